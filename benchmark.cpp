@@ -0,0 +1,551 @@
+#include "arena.h"
+#include "ingestion_service.h"
+#include "json_batch_parser.h"
+#include "jsonl_writer.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Phase 32: One benchmark binary whose JSONL output releases can be
+// compared with, replacing load_test's averages.
+//
+//   metricstream_bench micro [--iterations=N] [--batch=N] [--series=N]
+//   metricstream_bench load  [--host=A] [--port=N] [--rate=N] [--duration=S]
+//                            [--warmup=S] [--connections=N] [--batch=N]
+//                            [--series=N] [--arrival=constant|poisson]
+//   either: [--seed=N] [--json=FILE] [--baseline=FILE] [--tolerance=F]
+//
+// The load generator is open loop: each connection sends on its own
+// schedule (fixed or exponential gaps) whether or not the server kept up,
+// and latency is measured from when a request was due, not when it was
+// sent, so a stall shows up in every request it delayed instead of being
+// hidden by the client waiting (coordinated omission). Service time, from
+// the actual send, is reported alongside.
+//
+// --json appends one line per benchmark; --baseline compares against such
+// a file and exits 2 if throughput fell or p99 rose by more than
+// --tolerance (default 0.10).
+
+using namespace metricstream;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Options {
+    std::string mode;
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    double rate = 1000;          // Requests per second, all connections together
+    double duration_s = 10;
+    double warmup_s = 1;
+    size_t connections = 4;
+    size_t batch = 100;          // Metrics per request
+    size_t series = 1000;        // Distinct series the metrics spread over
+    bool poisson = false;
+    size_t iterations = 20000;   // Micro-benchmark operations
+    uint64_t seed = 42;
+    std::string json_path;
+    std::string baseline_path;
+    double tolerance = 0.10;
+};
+
+struct Result {
+    std::string name;
+    uint64_t ops = 0;
+    uint64_t items_per_op = 1;   // Metrics per op, for items_per_sec
+    uint64_t errors = 0;
+    double seconds = 0;
+    HdrHistogram latency_ns;     // Per op
+    std::vector<std::pair<std::string, std::string>> params;   // Raw JSON values
+
+    double ops_per_sec() const { return seconds > 0 ? static_cast<double>(ops) / seconds : 0; }
+};
+
+// ============================================================================
+// Workload
+// ============================================================================
+
+// Series i is cpu|mem|disk|net.usage{host=host-<i/4>,region=<...>}
+class MetricGenerator {
+public:
+    MetricGenerator(size_t series, uint64_t seed) : series_(std::max<size_t>(series, 1)), rng_(seed) {}
+
+    std::string body(size_t batch) {
+        static const char* NAMES[] = {"cpu.usage", "mem.usage", "disk.usage", "net.usage"};
+        static const char* REGIONS[] = {"us-east", "us-west", "eu-west", "ap-south"};
+        std::uniform_int_distribution<size_t> pick(0, series_ - 1);
+        std::uniform_real_distribution<double> value(0.0, 100.0);
+        std::string out = "{\"metrics\":[";
+        for (size_t i = 0; i < batch; ++i) {
+            size_t s = pick(rng_);
+            if (i > 0) out += ',';
+            out += "{\"name\":\"";
+            out += NAMES[s % 4];
+            out += "\",\"value\":";
+            out += std::to_string(value(rng_));
+            out += ",\"type\":\"gauge\",\"tags\":{\"host\":\"host-";
+            out += std::to_string(s / 4);
+            out += "\",\"region\":\"";
+            out += REGIONS[(s / 4) % 4];
+            out += "\"}}";
+        }
+        out += "]}";
+        return out;
+    }
+
+private:
+    size_t series_;
+    std::mt19937_64 rng_;
+};
+
+std::string post_request(const std::string& body, const std::string& client) {
+    std::string request = "POST /metrics HTTP/1.1\r\nHost: bench\r\nContent-Type: application/json\r\n";
+    request += "Authorization: " + client + "\r\n";
+    request += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+    request += body;
+    return request;
+}
+
+// ============================================================================
+// Micro-benchmarks
+// ============================================================================
+
+// Times chunks of `chunk` calls, recording the mean per call: the clock
+// costs about as much as the cheaper operations themselves
+template <typename Op>
+Result run_micro(const std::string& name, size_t iterations, size_t chunk, Op&& op) {
+    Result result;
+    result.name = name;
+    chunk = std::max<size_t>(chunk, 1);
+    for (size_t i = 0; i < std::min<size_t>(iterations / 10, 1000); ++i) {
+        op(i);   // Warm caches and allocators
+    }
+    auto start = Clock::now();
+    for (size_t done = 0; done < iterations;) {
+        size_t n = std::min(chunk, iterations - done);
+        auto chunk_start = Clock::now();
+        for (size_t i = 0; i < n; ++i) {
+            if (!op(done + i)) result.errors++;
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - chunk_start);
+        result.latency_ns.record(static_cast<uint64_t>(elapsed.count()) / n, n);
+        done += n;
+    }
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    result.ops = iterations;
+    return result;
+}
+
+std::vector<Result> run_micro_benchmarks(const Options& options) {
+    std::vector<Result> results;
+    MetricGenerator generator(options.series, options.seed);
+    std::vector<std::string> bodies;
+    for (size_t i = 0; i < 64; ++i) {
+        bodies.push_back(generator.body(options.batch));
+    }
+    std::string batch_param = std::to_string(options.batch);
+    std::string series_param = std::to_string(options.series);
+
+    // POST /metrics stage 1 and 2
+    {
+        JsonBatchParser parser;
+        MetricBatch batch;
+        Arena arena;
+        Result result = run_micro("json_parse", options.iterations, 1, [&](size_t i) {
+            batch.clear();
+            arena.reset();
+            return parser.parse(bodies[i % bodies.size()], batch, arena);
+        });
+        result.items_per_op = options.batch;
+        result.params = {{"batch", batch_param}, {"series", series_param},
+                         {"kernel", "\"" + std::string(json_kernel_name(parser.kernel())) + "\""}};
+        results.push_back(std::move(result));
+    }
+
+    // One decision per request, spread over as many clients as series
+    {
+        RateLimiter limiter(1000000000);
+        std::vector<std::string> clients;
+        for (size_t i = 0; i < std::min<size_t>(options.series, RateLimiter::DEFAULT_MAX_CLIENTS); ++i) {
+            clients.push_back("client-" + std::to_string(i));
+        }
+        Result result = run_micro("rate_limiter_allow", options.iterations * 50, 256, [&](size_t i) {
+            return limiter.allow_request(clients[i % clients.size()]);
+        });
+        result.params = {{"clients", std::to_string(clients.size())}};
+        results.push_back(std::move(result));
+    }
+
+    // Submission cost from outside the pool, as the event loop pays it
+    {
+        std::atomic<uint64_t> executed{0};
+        size_t ops = options.iterations * 10;
+        Result result;
+        {
+            ThreadPool pool(4, 65536);
+            result = run_micro("thread_pool_enqueue", ops, 64, [&](size_t) {
+                while (!pool.enqueue([&executed] { executed.fetch_add(1, std::memory_order_relaxed); })) {
+                    std::this_thread::yield();   // Full: wait for the workers rather than drop
+                }
+                return true;
+            });
+        }
+        result.params = {{"workers", "4"}};
+        if (executed.load() < ops) result.errors = ops - executed.load();
+        results.push_back(std::move(result));
+    }
+
+    // The storage writer's group commit, one batch per commit, no fsync
+    {
+        JsonBatchParser parser;
+        std::vector<MetricBatch> batches(8);
+        std::vector<std::unique_ptr<Arena>> arenas;
+        for (size_t i = 0; i < batches.size(); ++i) {
+            arenas.push_back(std::make_unique<Arena>());
+            parser.parse(bodies[i], batches[i], *arenas.back());
+        }
+        std::string path = "/tmp/metricstream_bench_" + std::to_string(getpid()) + ".jsonl";
+        FsyncPolicy no_sync;
+        no_sync.mode = FsyncPolicy::Mode::NEVER;
+        Result result;
+        {
+            JsonlWriter writer(path, no_sync);
+            result = run_micro("jsonl_write", options.iterations, 1, [&](size_t i) {
+                writer.append(batches[i % batches.size()]);
+                return writer.commit();
+            });
+        }
+        std::remove(path.c_str());
+        result.items_per_op = options.batch;
+        result.params = {{"batch", batch_param}};
+        results.push_back(std::move(result));
+    }
+    return results;
+}
+
+// ============================================================================
+// Open-loop HTTP load
+// ============================================================================
+
+int connect_to(const Options& options) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(options.port));
+    inet_pton(AF_INET, options.host.c_str(), &addr.sin_addr);
+    timeval timeout{5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Status code of one response, 0 if the connection failed
+int exchange(int fd, const std::string& request, std::string& inbox) {
+    size_t sent = 0;
+    while (sent < request.size()) {
+        ssize_t n = send(fd, request.data() + sent, request.size() - sent, 0);
+        if (n <= 0) return 0;
+        sent += static_cast<size_t>(n);
+    }
+    char chunk[4096];
+    while (true) {
+        size_t header_end = inbox.find("\r\n\r\n");
+        if (header_end != std::string::npos) {
+            size_t length = 0;
+            size_t field = inbox.find("Content-Length:");
+            if (field != std::string::npos && field < header_end) {
+                length = std::strtoul(inbox.c_str() + field + 15, nullptr, 10);
+            }
+            if (inbox.size() >= header_end + 4 + length) {
+                int status = inbox.size() > 12 ? std::atoi(inbox.c_str() + 9) : 0;
+                inbox.erase(0, header_end + 4 + length);
+                return status;
+            }
+        }
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) return 0;
+        inbox.append(chunk, static_cast<size_t>(n));
+    }
+}
+
+struct ConnectionStats {
+    HdrHistogram response_ns;   // From when the request was due
+    HdrHistogram service_ns;    // From when it was sent
+    uint64_t ok = 0;
+    uint64_t errors = 0;
+    std::map<int, uint64_t> statuses;
+};
+
+void load_connection(const Options& options, size_t index, Clock::time_point start,
+                     ConnectionStats& stats) {
+    // Bodies are generated up front so the schedule is not paced by JSON building
+    MetricGenerator generator(options.series, options.seed + index);
+    std::vector<std::string> requests;
+    for (size_t i = 0; i < 32; ++i) {
+        requests.push_back(post_request(generator.body(options.batch), "bench-" + std::to_string(index)));
+    }
+
+    double per_connection = options.rate / static_cast<double>(options.connections);
+    std::mt19937_64 rng(options.seed * 7919 + index);
+    std::exponential_distribution<double> poisson_gap(per_connection);
+    auto next_gap = [&] {
+        double seconds = options.poisson ? poisson_gap(rng) : 1.0 / per_connection;
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+    };
+
+    auto measure_from = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.warmup_s));
+    auto end = measure_from + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.duration_s));
+    // Stagger the connections' first sends across one gap
+    auto due = start + next_gap() * static_cast<long>(index) / static_cast<long>(options.connections);
+
+    int fd = -1;
+    std::string inbox;
+    for (size_t sequence = 0; due < end; ++sequence, due += next_gap()) {
+        std::this_thread::sleep_until(due);
+        if (fd < 0) {
+            fd = connect_to(options);
+            inbox.clear();
+        }
+        auto sent = Clock::now();
+        int status = fd >= 0 ? exchange(fd, requests[sequence % requests.size()], inbox) : 0;
+        auto done = Clock::now();
+        if (status == 0 && fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+        if (due < measure_from) {
+            continue;
+        }
+        stats.statuses[status]++;
+        if (status == 200) {
+            stats.ok++;
+            stats.response_ns.record(static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(done - due).count()));
+            stats.service_ns.record(static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(done - sent).count()));
+        } else {
+            stats.errors++;
+        }
+    }
+    if (fd >= 0) close(fd);
+}
+
+std::vector<Result> run_load(const Options& options) {
+    std::vector<ConnectionStats> stats(options.connections);
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    for (size_t i = 0; i < options.connections; ++i) {
+        threads.emplace_back(load_connection, std::cref(options), i, start, std::ref(stats[i]));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    Result response;
+    response.name = "http_ingest";
+    Result service;
+    service.name = "http_ingest_service_time";
+    std::map<int, uint64_t> statuses;
+    for (const ConnectionStats& connection : stats) {
+        response.latency_ns.merge(connection.response_ns);
+        service.latency_ns.merge(connection.service_ns);
+        response.ops += connection.ok;
+        response.errors += connection.errors;
+        for (const auto& [status, count] : connection.statuses) statuses[status] += count;
+    }
+    response.seconds = options.duration_s;
+    response.items_per_op = options.batch;
+    std::string status_json = "{";
+    for (const auto& [status, count] : statuses) {
+        if (status_json.size() > 1) status_json += ',';
+        status_json += "\"" + std::to_string(status) + "\":" + std::to_string(count);
+    }
+    status_json += "}";
+    std::ostringstream rate;
+    rate << options.rate;
+    response.params = {{"rate", rate.str()},
+                       {"arrival", options.poisson ? "\"poisson\"" : "\"constant\""},
+                       {"connections", std::to_string(options.connections)},
+                       {"batch", std::to_string(options.batch)},
+                       {"series", std::to_string(options.series)},
+                       {"statuses", status_json}};
+    service.ops = response.ops;
+    service.errors = response.errors;
+    service.seconds = response.seconds;
+    service.items_per_op = response.items_per_op;
+    service.params = response.params;
+    return {std::move(response), std::move(service)};
+}
+
+// ============================================================================
+// Output and baselines
+// ============================================================================
+
+std::string to_json(const Result& result) {
+    const HdrHistogram& h = result.latency_ns;
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    out << "{\"benchmark\":\"" << result.name << "\",\"ops\":" << result.ops
+        << ",\"errors\":" << result.errors << ",\"seconds\":" << std::setprecision(3) << result.seconds
+        << std::setprecision(1) << ",\"ops_per_sec\":" << result.ops_per_sec()
+        << ",\"items_per_sec\":" << result.ops_per_sec() * static_cast<double>(result.items_per_op)
+        << ",\"latency_ns\":{\"min\":" << h.min() << ",\"mean\":" << h.mean()
+        << ",\"p50\":" << h.percentile(0.5) << ",\"p90\":" << h.percentile(0.9)
+        << ",\"p99\":" << h.percentile(0.99) << ",\"p999\":" << h.percentile(0.999)
+        << ",\"max\":" << h.max() << "},\"params\":{";
+    for (size_t i = 0; i < result.params.size(); ++i) {
+        out << (i ? "," : "") << "\"" << result.params[i].first << "\":" << result.params[i].second;
+    }
+    out << "}}";
+    return out.str();
+}
+
+std::string format_ns(uint64_t ns) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(ns < 10000 ? 0 : 1);
+    if (ns < 10000) out << ns << "ns";
+    else if (ns < 10000000) out << ns / 1e3 << "us";
+    else out << ns / 1e6 << "ms";
+    return out.str();
+}
+
+void print_table(const std::vector<Result>& results) {
+    std::cout << std::left << std::setw(26) << "benchmark" << std::right << std::setw(14) << "ops/s"
+              << std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(10) << "p99.9"
+              << std::setw(10) << "max" << std::setw(9) << "errors" << "\n";
+    for (const Result& result : results) {
+        const HdrHistogram& h = result.latency_ns;
+        std::cout << std::left << std::setw(26) << result.name << std::right << std::setw(14)
+                  << std::fixed << std::setprecision(0) << result.ops_per_sec()
+                  << std::setw(10) << format_ns(h.percentile(0.5)) << std::setw(10) << format_ns(h.percentile(0.99))
+                  << std::setw(10) << format_ns(h.percentile(0.999)) << std::setw(10) << format_ns(h.max())
+                  << std::setw(9) << result.errors << "\n";
+    }
+}
+
+double json_number(const std::string& line, const std::string& field) {
+    size_t at = line.find("\"" + field + "\":");
+    return at == std::string::npos ? -1 : std::strtod(line.c_str() + at + field.size() + 3, nullptr);
+}
+
+// Exit status: 0 within tolerance, 2 on any regression
+int compare_to_baseline(const std::vector<Result>& results, const Options& options) {
+    std::ifstream in(options.baseline_path);
+    if (!in) {
+        std::cerr << "Cannot read baseline " << options.baseline_path << std::endl;
+        return 1;
+    }
+    // Last line per benchmark wins, so a baseline file can be appended to
+    std::map<std::string, std::string> baseline;
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t at = line.find("\"benchmark\":\"");
+        if (at == std::string::npos) continue;
+        size_t begin = at + 13;
+        baseline[line.substr(begin, line.find('"', begin) - begin)] = line;
+    }
+
+    int status = 0;
+    for (const Result& result : results) {
+        auto it = baseline.find(result.name);
+        if (it == baseline.end()) continue;
+        double base_rate = json_number(it->second, "ops_per_sec");
+        double base_p99 = json_number(it->second, "p99");
+        double rate = result.ops_per_sec();
+        double p99 = static_cast<double>(result.latency_ns.percentile(0.99));
+        bool slower = base_rate > 0 && rate < base_rate * (1 - options.tolerance);
+        bool tail = base_p99 > 0 && p99 > base_p99 * (1 + options.tolerance);
+        std::cout << (slower || tail ? "REGRESSION " : "ok         ") << result.name
+                  << std::fixed << std::setprecision(1) << ": ops/s " << rate << " vs " << base_rate
+                  << ", p99 " << format_ns(static_cast<uint64_t>(p99)) << " vs "
+                  << format_ns(static_cast<uint64_t>(base_p99)) << "\n";
+        if (slower || tail) status = 2;
+    }
+    return status;
+}
+
+bool parse_args(int argc, char* argv[], Options& options) {
+    if (argc < 2) return false;
+    options.mode = argv[1];
+    if (options.mode != "micro" && options.mode != "load") return false;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos) return false;
+        std::string key = arg.substr(2, eq - 2);
+        std::string value = arg.substr(eq + 1);
+        try {
+            if (key == "host") options.host = value;
+            else if (key == "port") options.port = std::stoi(value);
+            else if (key == "rate") options.rate = std::stod(value);
+            else if (key == "duration") options.duration_s = std::stod(value);
+            else if (key == "warmup") options.warmup_s = std::stod(value);
+            else if (key == "connections") options.connections = std::stoul(value);
+            else if (key == "batch") options.batch = std::stoul(value);
+            else if (key == "series") options.series = std::stoul(value);
+            else if (key == "iterations") options.iterations = std::stoul(value);
+            else if (key == "seed") options.seed = std::stoull(value);
+            else if (key == "json") options.json_path = value;
+            else if (key == "baseline") options.baseline_path = value;
+            else if (key == "tolerance") options.tolerance = std::stod(value);
+            else if (key == "arrival" && (value == "constant" || value == "poisson")) options.poisson = value == "poisson";
+            else return false;
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+    return options.rate > 0 && options.connections > 0 && options.batch > 0 && options.iterations > 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parse_args(argc, argv, options)) {
+        std::cerr << "Usage: metricstream_bench micro|load [--option=value ...] (see benchmark.cpp)" << std::endl;
+        return 1;
+    }
+
+    std::vector<Result> results = options.mode == "micro" ? run_micro_benchmarks(options) : run_load(options);
+    print_table(results);
+
+    if (!options.json_path.empty()) {
+        std::ofstream out(options.json_path, std::ios::app);
+        for (const Result& result : results) {
+            out << to_json(result) << "\n";
+        }
+        if (!out) {
+            std::cerr << "Cannot write " << options.json_path << std::endl;
+            return 1;
+        }
+    }
+    if (!options.baseline_path.empty()) {
+        return compare_to_baseline(results, options);
+    }
+    return 0;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <string_view>
+#include <utility>
+
+namespace metricstream {
+
+// Phase 29: What a route is worth under overload. CRITICAL (health, stats)
+// is never shed; SHEDDABLE (ingest, which clients retry) goes first; NORMAL
+// (queries) only once overload persists.
+enum class RequestPriority : uint8_t {
+    CRITICAL = 0,
+    NORMAL = 1,
+    SHEDDABLE = 2
+};
+
+constexpr size_t REQUEST_PRIORITY_COUNT = 3;
+
+std::string_view request_priority_name(RequestPriority priority);
+
+// Phase 29: CoDel-style admission control. The signal is sojourn time, how
+// long a request waited for a worker, not queue length: a queue that drains
+// quickly is fine however long it is, one whose *minimum* wait over a whole
+// interval stays above target is a standing queue that only grows latency.
+// Each interval in which that holds (or the pressure probe reports a slow
+// downstream, e.g. storage lag) raises the overload level; a good interval
+// resets it.
+//
+// While overloaded, new SHEDDABLE requests are refused as soon as their
+// headers arrive, before the body is read, and after normal_shed_intervals
+// bad intervals in a row NORMAL ones too. Requests that already queued are
+// dropped at the worker if they waited longer than target (interval when
+// not overloaded), as in Facebook's CoDel for RPC queues, so a burst costs
+// 503s with Retry-After instead of multi-second queues.
+//
+// Thread-safe: event loops call admit(), workers call admit_dequeued().
+class AdmissionController {
+public:
+    struct Options {
+        bool enabled = true;
+        std::chrono::microseconds target{10000};    // Tolerated standing queue delay
+        std::chrono::milliseconds interval{100};    // Window the minimum sojourn is taken over
+        uint32_t normal_shed_intervals = 5;         // Bad windows in a row before NORMAL is shed
+        std::chrono::seconds retry_after{1};        // Hint sent with every 503
+    };
+
+    // Polled once per interval; true means downstream cannot keep up
+    using PressureProbe = std::function<bool()>;
+
+    AdmissionController();
+    explicit AdmissionController(Options options);
+
+    // Must be called before requests arrive
+    void set_options(Options options) { options_ = options; }
+    void set_pressure_probe(PressureProbe probe) { probe_ = std::move(probe); }
+    const Options& options() const { return options_; }
+
+    // Front door, once the request's headers are in. queue_depth lets an
+    // interval with no dequeues at all (every worker stuck) count as bad.
+    bool admit(RequestPriority priority, size_t queue_depth);
+
+    // On the worker, before the handler runs
+    bool admit_dequeued(RequestPriority priority, std::chrono::nanoseconds sojourn);
+
+    uint32_t overload_level() const { return level_.load(std::memory_order_relaxed); }
+    uint64_t shed(RequestPriority priority) const {
+        return shed_[static_cast<size_t>(priority)].load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr int64_t NO_SAMPLE = std::numeric_limits<int64_t>::max();
+
+    Options options_;
+    PressureProbe probe_;
+    std::atomic<int64_t> window_end_ns_{0};
+    std::atomic<int64_t> window_min_ns_{NO_SAMPLE};
+    std::atomic<uint32_t> level_{0};
+    std::array<std::atomic<uint64_t>, REQUEST_PRIORITY_COUNT> shed_{};
+
+    void maybe_roll(int64_t now_ns, size_t queue_depth);
+    bool refuse(RequestPriority priority);
+};
+
+} // namespace metricstream
@@ -0,0 +1,158 @@
+#pragma once
+
+#include "metric.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace metricstream {
+
+struct AlertRule {
+    enum class Aggregation { AVG, SUM, MIN, MAX, COUNT };
+    enum class Condition { ABOVE, BELOW };
+
+    std::string name;                                        // Shown in notifications
+    std::string metric_name;
+    std::vector<std::pair<std::string, std::string>> tags;   // All must match
+    Aggregation aggregation = Aggregation::AVG;
+    Condition condition = Condition::ABOVE;
+    double threshold = 0;
+    std::chrono::milliseconds window{10000};
+    size_t buckets = 10;    // Window resolution: window / buckets per bucket
+
+    // "metric{k=v,...}:agg:op:threshold:window_seconds", e.g.
+    // "cpu_usage{host=web1}:avg:>:80:10"; tags are optional
+    static bool parse(std::string_view spec, AlertRule& rule);
+};
+
+struct WindowStats {
+    uint64_t count = 0;
+    double sum = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+};
+
+// Phase 19: Sliding window as a ring of time buckets, each holding count,
+// sum, min and max. Adding a point touches one bucket; reading the window
+// merges a fixed number of buckets, so neither grows with the number of
+// points in the window. Time is the points' own timestamps; advance() moves
+// the window forward when no points arrive.
+class SlidingWindowAggregate {
+public:
+    SlidingWindowAggregate(int64_t window_ms, size_t buckets);
+
+    void add(int64_t timestamp_ms, double value);   // Older than the window: ignored
+    void advance(int64_t now_ms);
+    WindowStats stats() const;
+
+private:
+    struct Bucket {
+        int64_t epoch = std::numeric_limits<int64_t>::min();
+        WindowStats stats;
+    };
+
+    std::vector<Bucket> ring_;
+    int64_t bucket_ms_;
+    int64_t head_epoch_ = std::numeric_limits<int64_t>::min();
+
+    int64_t epoch_of(int64_t timestamp_ms) const;
+};
+
+struct AlertEvent {
+    enum class Kind { FIRING, RESOLVED };
+
+    Kind kind;
+    const AlertRule* rule;
+    double value;          // Aggregate at the transition
+    uint64_t samples;      // Points in the window
+    int64_t timestamp_ms;  // Window head when it happened
+};
+
+struct AlertStatus {
+    const AlertRule* rule;
+    bool firing;
+    double value;
+    uint64_t samples;
+};
+
+// Phase 19: Alert rules evaluated on the ingestion path. Each accepted
+// batch updates the windows of the rules its metrics match (looked up by
+// metric name) and re-evaluates those rules at once, so a threshold crossing
+// is reported while the request that caused it is still being handled
+// rather than on the next polling tick. A background tick (start()) only
+// advances idle windows so rules resolve when data stops.
+//
+// Thread-safe: rules are guarded individually; the notifier runs outside
+// every lock and may be called from any handler thread.
+class AlertEngine {
+public:
+    using Notifier = std::function<void(const AlertEvent&)>;
+
+    // Default notifier logs to std::cerr
+    explicit AlertEngine(Notifier notifier = {});
+    ~AlertEngine();
+
+    AlertEngine(const AlertEngine&) = delete;
+    AlertEngine& operator=(const AlertEngine&) = delete;
+
+    void add_rule(AlertRule rule);
+    size_t rule_count() const;
+
+    // Feed a validated batch
+    void observe(const MetricBatch& batch);
+
+    // Move every window to now_ms and re-evaluate
+    void advance(int64_t now_ms);
+
+    // Background advance() with the wall clock
+    void start(std::chrono::milliseconds tick = std::chrono::seconds(1));
+    void stop();
+
+    std::vector<AlertStatus> status() const;
+
+    uint64_t notifications() const { return notifications_.load(std::memory_order_relaxed); }
+
+private:
+    struct RuleState {
+        explicit RuleState(AlertRule r);
+
+        AlertRule rule;
+        std::mutex mutex;
+        SlidingWindowAggregate window;   // Guarded by mutex
+        bool firing = false;
+        double value = 0;
+        uint64_t samples = 0;
+    };
+
+    Notifier notifier_;
+    mutable std::shared_mutex rules_mutex_;
+    std::vector<std::unique_ptr<RuleState>> rules_;
+    std::unordered_map<std::string, std::vector<size_t>> by_metric_;
+    std::atomic<bool> has_rules_{false};
+    std::atomic<uint64_t> notifications_{0};
+
+    std::thread ticker_;
+    std::mutex ticker_mutex_;
+    std::condition_variable ticker_cv_;
+    bool ticking_ = false;
+
+    // Re-evaluate under the rule's lock; returns true with *event filled in
+    // on a state change
+    static bool evaluate(RuleState& state, int64_t now_ms, AlertEvent* event);
+    void notify(const AlertEvent& event);
+};
+
+} // namespace metricstream
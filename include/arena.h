@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace metricstream {
+
+// Phase 23: Bump allocator for request-scoped scratch (decoded strings,
+// tag lists). allocate() moves a pointer; nothing is freed individually,
+// and reset() rewinds in O(1). When a request outgrew the current block,
+// the next reset() replaces the chain with one block big enough for it,
+// so a warmed-up arena serves every request from one block.
+//
+// Not thread-safe: one arena per worker thread, reset per request.
+class Arena {
+public:
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+    explicit Arena(size_t block_size = DEFAULT_BLOCK_SIZE);
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t bytes, size_t align = alignof(std::max_align_t)) {
+        uintptr_t p = (reinterpret_cast<uintptr_t>(cursor_) + align - 1) & ~(uintptr_t(align) - 1);
+        if (p + bytes > reinterpret_cast<uintptr_t>(end_)) {
+            return allocate_slow(bytes, align);
+        }
+        cursor_ = reinterpret_cast<char*>(p + bytes);
+        return reinterpret_cast<void*>(p);
+    }
+
+    char* allocate_chars(size_t n) { return static_cast<char*>(allocate(n, 1)); }
+
+    std::string_view copy(std::string_view s);
+
+    // Invalidates everything allocated so far
+    void reset();
+
+    size_t bytes_used() const;   // Since the last reset
+    size_t capacity() const;     // Sum of block sizes
+    size_t block_count() const { return blocks_.size(); }
+
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks_;
+    char* cursor_ = nullptr;
+    char* end_ = nullptr;
+    size_t block_size_;
+    size_t used_before_current_ = 0;   // Bytes used in earlier blocks
+
+    void* allocate_slow(size_t bytes, size_t align);
+    void add_block(size_t min_size);
+};
+
+// std::allocator-compatible handle, so containers can live in an arena.
+// deallocate() is a no-op; memory comes back at Arena::reset().
+template <typename T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator(Arena& arena) : arena_(&arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena()) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T*, size_t) {}
+
+    Arena* arena() const { return arena_; }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return arena_ == other.arena(); }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return arena_ != other.arena(); }
+
+private:
+    Arena* arena_;
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+} // namespace metricstream
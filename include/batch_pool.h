@@ -0,0 +1,51 @@
+#pragma once
+
+#include "metric.h"
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace metricstream {
+
+class BatchPool;
+
+// Returns the batch to its pool instead of freeing it
+struct BatchRecycler {
+    BatchPool* pool = nullptr;
+    void operator()(MetricBatch* batch) const;
+};
+
+using PooledBatch = std::unique_ptr<MetricBatch, BatchRecycler>;
+
+// Phase 15: Free list of MetricBatch objects. A batch travels handler ->
+// write queue -> writer by move and comes back here when the writer drops
+// it, so steady-state ingestion reuses vectors that are already sized.
+// The pool must outlive every batch it hands out.
+class BatchPool {
+public:
+    static constexpr size_t DEFAULT_MAX_POOLED = 256;
+    static constexpr size_t INITIAL_METRIC_CAPACITY = 64;
+
+    explicit BatchPool(size_t max_pooled = DEFAULT_MAX_POOLED);
+    ~BatchPool();
+
+    BatchPool(const BatchPool&) = delete;
+    BatchPool& operator=(const BatchPool&) = delete;
+
+    // Cleared batch, recycled when one is available
+    PooledBatch acquire();
+
+    size_t pooled() const;
+
+private:
+    friend struct BatchRecycler;
+
+    void recycle(MetricBatch* batch);
+
+    size_t max_pooled_;
+    mutable std::mutex mutex_;
+    std::vector<MetricBatch*> free_;
+};
+
+} // namespace metricstream
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "metric.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace metricstream {
+
+// Phase 25: Binary ingest protocol, for agents that would rather not print
+// and re-parse JSON. Both a POST /metrics body with Content-Type
+// application/x-metricstream and a raw TCP stream are sequences of frames:
+//
+//   frame   := u32 length | u8 type | body[length - 1]      (little-endian)
+//   HELLO   := client_id bytes                  (TCP only; rate-limit key)
+//   SERIES  := u32 first_ref | u32 count | count * series
+//   series  := u8 type | u16 len name | u16 tag_count | tag_count * (u16 len key | u16 len value)
+//   SAMPLES := u32 count | count * (u32 series_ref | i64 timestamp_ns | f64 value)
+//   ACK     := u8 status | u32 frames | u32 metrics  (server to client, TCP only)
+//   USAGE   := u32 count | count * (u16 len client_id | u32 requests)
+//              (cluster peers only: requests each client was admitted for)
+//
+// SERIES frames build a dictionary that lives as long as the stream (one
+// request body, or one TCP connection), so steady-state traffic is 20-byte
+// samples that decode with three loads and an array lookup into interned
+// series ids. Refs are dense; a SERIES frame may redefine existing refs or
+// append at the end. A timestamp of 0 means "when the server received it".
+constexpr std::string_view BINARY_CONTENT_TYPE = "application/x-metricstream";
+
+enum class FrameType : uint8_t {
+    HELLO = 1,
+    SERIES = 2,
+    SAMPLES = 3,
+    ACK = 4,
+    USAGE = 5
+};
+
+enum class AckStatus : uint8_t {
+    OK = 0,
+    INVALID = 1,        // Connection is closed after this ack
+    RATE_LIMITED = 2,
+    OVERLOADED = 3,     // Storage backpressure, or no worker free (closes)
+    UNAVAILABLE = 4,    // WAL failure
+    REJECTED = 5        // Samples failed validation (e.g. NaN, over 1000)
+};
+
+struct BinaryAck {
+    AckStatus status = AckStatus::OK;
+    uint32_t frames = 0;    // Frames this ack covers, in stream order
+    uint32_t metrics = 0;   // Samples accepted
+};
+
+constexpr size_t FRAME_HEADER_BYTES = 5;
+constexpr size_t SAMPLE_BYTES = 20;
+constexpr size_t MAX_FRAME_BYTES = 16 * 1024 * 1024;
+constexpr size_t MAX_STREAM_SERIES = 1 << 20;
+constexpr size_t MAX_BATCH_SAMPLES = 1000;   // Same limit as a JSON batch
+
+// Length of the longest prefix of `data` made of whole frames, stopping
+// before the SAMPLES frame that would take the total past max_samples
+// (a first frame is always included). 0 if no frame is complete yet.
+// Sets *error and returns 0 on a frame that can never be valid.
+size_t complete_frames(std::string_view data, size_t max_samples, size_t* frame_count,
+                       const char** error);
+
+// Offset of the first HELLO frame in `data` (whole frames, as above) and
+// its size including the header; data.size() and 0 if there is none
+size_t find_hello(std::string_view data, size_t* hello_bytes);
+
+// Phase 31: One client's admitted requests, as a USAGE frame carries them
+struct ClientUsage {
+    std::string client_id;
+    uint32_t requests = 0;
+};
+
+void encode_hello(std::string& out, std::string_view client_id);
+void encode_usage(std::string& out, const ClientUsage* usage, size_t count);
+void encode_ack(std::string& out, const BinaryAck& ack);
+// Decodes one ACK frame from the front of data; false if incomplete or not an ACK
+bool decode_ack(std::string_view data, BinaryAck& ack, size_t& consumed);
+
+// Client side: assigns refs and batches samples into frames
+class BinaryEncoder {
+public:
+    // The series' ref, queued for the next SERIES frame the first time it is seen
+    uint32_t series_ref(std::string_view name, MetricType type, const TagRefs& tags = {});
+    void add_sample(uint32_t ref, double value, int64_t timestamp_ns = 0);
+
+    // Appends a SERIES frame for new series (if any), then a SAMPLES frame
+    void flush(std::string& out);
+
+    // Forget every ref, e.g. after reconnecting to the server
+    void reset();
+
+    size_t pending_samples() const { return sample_count_; }
+
+private:
+    std::unordered_map<std::string, uint32_t> refs_;   // name\0key\0value... -> ref
+    std::string series_;
+    uint32_t series_first_ = 0;
+    uint32_t series_count_ = 0;
+    std::string samples_;
+    uint32_t sample_count_ = 0;
+};
+
+// Server side: one per stream, holding its dictionary of interned ids
+class BinaryDecoder {
+public:
+    // Decodes whole frames (see complete_frames) and appends their samples
+    // to batch. False with *error on malformed input; samples decoded before
+    // the error are left in batch.
+    bool decode(std::string_view frames, MetricBatch& batch, const char** error);
+
+    void reset();
+
+    std::string_view client_id() const { return client_id_; }
+    size_t series_count() const { return series_.size(); }
+
+    // USAGE entries decoded so far; whoever acts on them clears them
+    std::vector<ClientUsage>& usage() { return usage_; }
+
+private:
+    struct SeriesRef {
+        uint32_t id;
+        MetricType type;
+    };
+
+    std::vector<SeriesRef> series_;
+    std::string client_id_;
+    TagRefs tag_scratch_;
+    std::vector<ClientUsage> usage_;
+
+    bool decode_series(std::string_view body, const char** error);
+    bool decode_usage(std::string_view body, const char** error);
+    bool decode_samples(std::string_view body, MetricBatch& batch, const char** error);
+};
+
+} // namespace metricstream
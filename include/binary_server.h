@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include "binary_protocol.h"
+#include "event_loop.h"
+#include "thread_pool.h"
+
+namespace metricstream {
+
+// Phase 25: Raw TCP listener for the binary ingest protocol. Same shape as
+// HttpServer: event loops own the sockets and a pool runs the handler. The
+// complete frames buffered on a connection (up to MAX_BATCH_SAMPLES samples)
+// go to one handler call and are answered with one ACK, so a client can
+// keep several frames in flight and match acks by frame count.
+class BinaryServer {
+public:
+    // Runs on a pool thread. `frames` holds whole frames; `decoder` is the
+    // connection's dictionary and `remote_address` the client's IP. The
+    // server fills in ack.frames.
+    using FrameHandler = std::function<BinaryAck(BinaryDecoder& decoder, std::string_view frames,
+                                                 std::string_view remote_address)>;
+
+    BinaryServer(int port, FrameHandler handler, size_t thread_pool_size = 4, size_t event_loops = 1);
+    ~BinaryServer();
+
+    void start();
+    void stop();
+
+    // Must be called before start()
+    void set_idle_timeout(std::chrono::milliseconds timeout) { idle_timeout_ = timeout; }
+
+    size_t active_connections() const;
+    size_t queue_depth() const { return thread_pool_->queue_size(); }
+
+private:
+    int port_;
+    size_t event_loop_count_;
+    FrameHandler handler_;
+    std::atomic<bool> running_{false};
+    std::chrono::milliseconds idle_timeout_{std::chrono::seconds(300)};
+    std::unique_ptr<ThreadPool> thread_pool_;
+
+    std::vector<int> listen_fds_;
+    std::vector<std::unique_ptr<EventLoop>> event_loops_;
+
+    void on_connection_data(const ConnectionPtr& conn);
+    void send_ack(const ConnectionPtr& conn, const BinaryAck& ack, bool close_after_write);
+};
+
+} // namespace metricstream
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "metric.h"
+#include "series_registry.h"
+#include "sharded_map.h"
+#include "sketch.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace metricstream {
+
+// Phase 35: Per-client cardinality guardrails. An agent that puts a unique
+// tag value on every point creates a series per point, and each one costs
+// memory in the registry, the storage indexes and the rollup tables.
+//
+// Every client (Authorization header, binary HELLO id, or for a binary
+// stream that has not sent HELLO yet, its address) gets a budget of
+// series it may create per window. The request parses with a
+// ScopedSeriesBudget, so an over-budget client's new series are refused
+// before they are ever interned. Alongside, a HyperLogLog per client and
+// window estimates how many distinct series it sends, which can be capped
+// too and is exported in stats. Per client that is two fixed-size sketches
+// and a few counters; each metric costs one sketch add.
+class CardinalityLimiter {
+public:
+    enum class Action {
+        REJECT,      // Drop metrics of refused series
+        AGGREGATE    // Strip their tags, folding them into one series per name
+    };
+
+    struct Options {
+        size_t max_new_series = 10000;    // Created per client per window; 0 for no limit
+        size_t max_active_series = 0;     // Estimated distinct per client per window; 0 for no limit
+        std::chrono::milliseconds window{60000};
+        Action action = Action::REJECT;
+        size_t max_clients = 65536;
+    };
+
+    struct Client {
+        std::atomic<int64_t> window_start_ns{0};
+        std::atomic<uint32_t> window{0};      // Selects the current sketch
+        HyperLogLog sketches[2];              // This window's and the previous one's
+        std::atomic<uint64_t> created{0};     // In this window
+        std::atomic<bool> limited{false};     // This window hit a limit
+        std::atomic<uint64_t> created_total{0};
+        std::atomic<uint64_t> refused_total{0};
+    };
+
+    struct ClientStats {
+        std::string client_id;
+        double series_estimate;           // This window
+        double previous_estimate;         // The last full window
+        uint64_t created;                 // This window
+        uint64_t created_total;
+        uint64_t refused_total;
+    };
+
+    CardinalityLimiter();
+    explicit CardinalityLimiter(Options options);
+
+    CardinalityLimiter(const CardinalityLimiter&) = delete;
+    CardinalityLimiter& operator=(const CardinalityLimiter&) = delete;
+
+    // Keeps the client's state alive while held, even if it is evicted to
+    // make room for others (and its counts start over on the next sighting)
+    using ClientRef = ShardedMap<Client>::Ref;
+    ClientRef client(std::string_view client_id) { return clients_.get_or_insert(client_id); }
+
+    // New series the client may still create in its current window (which
+    // this starts, once the last one is over); 0 once a limit is reached
+    size_t budget(Client& client, std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+    // After the parse: charge what the budget scope created and refused,
+    // and add the batch's series from `first` on (what the parse appended)
+    // to the current sketch. With REJECT, also removes the refused metrics
+    // among them from the batch.
+    void record(Client& client, const ScopedSeriesBudget& scope, MetricBatch& batch, size_t first = 0);
+
+    const Options& options() const { return options_; }
+    bool limits_enabled() const { return options_.max_new_series > 0 || options_.max_active_series > 0; }
+    uint64_t series_refused() const { return refused_.load(std::memory_order_relaxed); }
+    uint64_t clients_limited() const { return clients_limited_.load(std::memory_order_relaxed); }
+    size_t tracked_clients() const { return clients_.size(); }
+    uint64_t evicted_clients() const { return clients_.evictions(); }
+
+    // Up to `limit` clients, highest current estimate first
+    std::vector<ClientStats> top_clients(size_t limit) const;
+
+private:
+    Options options_;
+    ShardedMap<Client> clients_;
+    std::atomic<uint64_t> refused_{0};
+    std::atomic<uint64_t> clients_limited_{0};   // Windows in which a client hit a limit
+};
+
+} // namespace metricstream
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "common.h"
+#include "series_registry.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace metricstream {
+
+// Phase 34: Checkpoints of in-memory state, so a restart maps the newest
+// one and replays only the WAL after it instead of rebuilding everything.
+//
+// series.dict is append-only, so each checkpoint writes only the series
+// registered since the previous one:
+//   header   "MSDICT01", u64 generation
+//   records  u32 length, canonical series key; the n-th is series id n + 1
+//
+// state-<sequence>.ckpt holds everything else, written whole to a
+// temporary file and renamed into place:
+//   header   "MSCKPT01", u32 version, u32 sections, u64 sequence,
+//            u64 dictionary generation, u64 series count, u64 dictionary bytes
+//   table    per section: u32 id, u32 crc32c, u64 offset, u64 length
+//   u32 crc32c of the header and table, then the sections, 8-byte aligned
+//
+// A state file names the dictionary prefix it was written against, so a
+// dictionary rewritten since (new generation), or cut short, rejects it and
+// the next older one is tried. Sections are opaque to the store; loading
+// one is a view into the mapped file.
+constexpr std::string_view CHECKPOINT_STATE_MAGIC = "MSCKPT01";
+constexpr std::string_view DICTIONARY_MAGIC = "MSDICT01";
+constexpr uint32_t CHECKPOINT_VERSION = 1;
+
+enum class CheckpointSection : uint32_t {
+    WAL = 1,           // Where the state below stands in the write-ahead log
+    RATE_LIMITS = 2,
+    ROLLUPS = 3        // One per rollup worker
+};
+
+class CheckpointStore {
+public:
+    struct Options {
+        std::string directory = "checkpoints";
+        size_t keep = 2;   // State files kept; older ones are deleted
+    };
+
+    using Sections = std::vector<std::pair<CheckpointSection, std::string>>;
+
+    explicit CheckpointStore(Options options);
+    ~CheckpointStore();
+
+    CheckpointStore(const CheckpointStore&) = delete;
+    CheckpointStore& operator=(const CheckpointStore&) = delete;
+
+    // Map the newest intact checkpoint and register its series. False if
+    // there is none; the next write() then starts a new dictionary.
+    bool load(SeriesRegistry& registry);
+    bool loaded() const { return state_.is_open(); }
+
+    // Of the loaded checkpoint, in the order written; empty if absent
+    std::vector<std::string_view> sections(CheckpointSection id) const;
+    std::string_view section(CheckpointSection id) const;
+
+    // Saved series id -> registry id. The identity unless the registry
+    // already held series when load() ran.
+    const std::vector<uint32_t>& series_ids() const { return series_ids_; }
+
+    // Unmap the loaded checkpoint once its sections are restored
+    void release();
+
+    // Append the registry's new series to the dictionary and sync it, then
+    // write the sections as the next checkpoint. Sections may only name
+    // series registered before the call.
+    bool write(const SeriesRegistry& registry, const Sections& sections);
+
+    uint64_t sequence() const { return sequence_; }
+    uint64_t checkpoints_written() const { return checkpoints_written_.load(std::memory_order_relaxed); }
+    // State file plus dictionary growth
+    uint64_t last_bytes() const { return last_bytes_.load(std::memory_order_relaxed); }
+    size_t dictionary_series() const { return dictionary_count_; }
+
+private:
+    struct SectionEntry {
+        uint32_t id;
+        std::string_view data;
+    };
+
+    Options options_;
+    std::string dictionary_path_;
+    int dictionary_fd_ = -1;
+    uint64_t generation_ = 0;
+    uint64_t dictionary_bytes_ = 0;   // Records past the header up to here are valid
+    size_t dictionary_count_ = 1;     // Series written, counting the overflow series
+    bool rewrite_dictionary_ = true;
+
+    MappedFile state_;
+    std::vector<SectionEntry> sections_;
+    std::vector<uint32_t> series_ids_;
+    uint64_t sequence_ = 0;
+    std::atomic<uint64_t> checkpoints_written_{0};
+    std::atomic<uint64_t> last_bytes_{0};
+
+    bool try_load(const std::string& path, SeriesRegistry& registry);
+    bool append_dictionary(const SeriesRegistry& registry, size_t count, uint64_t& bytes);
+    void delete_old_states();
+};
+
+// state-<sequence>.ckpt files in a directory, oldest first
+std::vector<std::string> list_checkpoint_files(const std::string& directory);
+
+} // namespace metricstream
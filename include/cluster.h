@@ -0,0 +1,129 @@
+#pragma once
+
+#include "binary_protocol.h"
+#include "metric.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace metricstream {
+
+// Phase 31: Cluster mode. Every node is started with the same list of
+// binary-protocol endpoints in the same order and owns the series that
+// hash to it on a consistent-hash ring, so a series's points all land on
+// one node and its queries and rollups are complete there. A node that
+// receives metrics it does not own forwards them to the owner over a
+// persistent binary connection and answers its client once the owner has
+// acked them (the owner acks after its own WAL sync).
+struct ClusterNode {
+    std::string host;
+    int port = 0;
+};
+
+// "host:port"
+bool parse_cluster_node(std::string_view spec, ClusterNode& out);
+
+// HELLO client id prefix of forwarded streams; the owner stores them as is
+constexpr std::string_view CLUSTER_CLIENT_PREFIX = "cluster:";
+
+// Forwarded streams skip the rate and cardinality limits, which their entry
+// node already applied. A HELLO of "cluster:N" is only taken at its word
+// from an address node N's host resolves to (hosts are resolved once, at
+// construction); from anywhere else it is an ordinary client id.
+class ClusterPeers {
+public:
+    ClusterPeers(const std::vector<ClusterNode>& nodes, size_t self);
+
+    bool trusted(std::string_view client_id, std::string_view remote_address) const;
+
+private:
+    size_t self_;
+    std::vector<std::vector<std::string>> addresses_;   // IPv4 dotted quads per node
+};
+
+// Stable across processes and platforms: FNV-1a over the series' canonical
+// key, then a 64-bit finalizer
+uint64_t series_hash(std::string_view canonical);
+
+// Each node is placed at virtual_nodes points on a 64-bit ring; a key is
+// owned by the first point at or after its hash. Adding a node moves only
+// the keys that now fall before one of its points, ~1/(n+1) of them.
+class HashRing {
+public:
+    static constexpr size_t DEFAULT_VIRTUAL_NODES = 128;
+
+    explicit HashRing(size_t nodes, size_t virtual_nodes = DEFAULT_VIRTUAL_NODES);
+
+    size_t owner(uint64_t hash) const;
+    size_t owner_of(const SeriesKey& series) const { return owner(series_hash(series.canonical)); }
+    size_t node_count() const { return nodes_; }
+
+private:
+    struct Point {
+        uint64_t hash;
+        uint32_t node;
+    };
+
+    size_t nodes_;
+    std::vector<Point> points_;   // Sorted by hash
+};
+
+// One sender thread and connection per peer. Concurrent send()s to the
+// same peer join one group, which goes out as one run of frames and is
+// acked as a whole, the same group commit the WAL does for fsyncs.
+class ClusterForwarder {
+public:
+    struct Options {
+        std::chrono::milliseconds connect_timeout{1000};
+        std::chrono::milliseconds ack_timeout{5000};
+        size_t max_pending_metrics = 100000;   // Per peer; send() fails beyond
+    };
+
+    class Group;
+    using Ticket = std::shared_ptr<Group>;
+
+    ClusterForwarder(std::vector<ClusterNode> nodes, size_t self);
+    ClusterForwarder(std::vector<ClusterNode> nodes, size_t self, Options options);
+    ~ClusterForwarder();
+
+    ClusterForwarder(const ClusterForwarder&) = delete;
+    ClusterForwarder& operator=(const ClusterForwarder&) = delete;
+
+    // Queue metrics for node; null if its queue is full
+    Ticket send(size_t node, const Metric* metrics, size_t count);
+
+    // Phase 31: Queue rate-limit usage for every peer, sent with the next
+    // group. Best effort: nobody waits for it, and a failed send loses it.
+    void share_usage(const std::vector<ClientUsage>& usage);
+
+    // Block until the group holding the ticket's metrics was acked. False if
+    // the peer refused it or could not be reached within the timeouts.
+    bool wait(const Ticket& ticket);
+
+    size_t node_count() const { return peers_.size(); }
+    uint64_t metrics_forwarded() const { return forwarded_.load(std::memory_order_relaxed); }
+    uint64_t forward_errors() const { return errors_.load(std::memory_order_relaxed); }
+
+private:
+    struct Peer;
+
+    Options options_;
+    std::string client_id_;
+    std::vector<std::unique_ptr<Peer>> peers_;   // Null for this node
+    std::atomic<uint64_t> forwarded_{0};
+    std::atomic<uint64_t> errors_{0};
+
+    void sender_loop(Peer& peer);
+    bool deliver(Peer& peer, const Group& group);
+    bool connect_peer(Peer& peer);
+};
+
+} // namespace metricstream
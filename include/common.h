@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace metricstream {
+
+// Read-only mapping of a whole file. Empty or missing files fail to open.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    bool is_open() const { return data_ != nullptr; }
+    std::string_view data() const { return {data_, size_}; }
+    size_t size() const { return size_; }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// JSON text helpers shared by the writers and HTTP responses
+void append_uint(std::string& out, uint64_t value);
+void append_json_string(std::string& out, std::string_view value);
+// Integers as plain digits, otherwise the shortest round-trip form; NaN and
+// infinities become null
+void append_json_number(std::string& out, double value);
+
+// 64-bit finalizer from MurmurHash3: spreads dense ids (series ids, node
+// numbers) over all the bits, for sketches and the hash ring
+inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// Phase 30: Pin the calling thread to one CPU (taken modulo the CPU count).
+// Linux only; elsewhere, and if the kernel refuses, returns false.
+bool pin_current_thread(size_t cpu);
+
+// CRC-32C (Castagnoli), as used by storage records. Pass the previous
+// result as `crc` to checksum data in pieces.
+uint32_t crc32c(const void* data, size_t length, uint32_t crc = 0);
+
+// Little-endian encoder for on-disk records
+class ByteWriter {
+public:
+    explicit ByteWriter(std::string& out) : out_(out) {}
+
+    void put_u8(uint8_t v) { out_.push_back(static_cast<char>(v)); }
+    void put_u16(uint16_t v) { put_le(v, 2); }
+    void put_u32(uint32_t v) { put_le(v, 4); }
+    void put_u64(uint64_t v) { put_le(v, 8); }
+    void put_i64(int64_t v) { put_le(static_cast<uint64_t>(v), 8); }
+    void put_f64(double v) {
+        uint64_t bits;
+        std::memcpy(&bits, &v, sizeof(bits));
+        put_u64(bits);
+    }
+    // u16 length prefix; longer strings are truncated
+    void put_string(std::string_view s) {
+        size_t n = s.size() > 0xFFFF ? 0xFFFF : s.size();
+        put_u16(static_cast<uint16_t>(n));
+        out_.append(s.data(), n);
+    }
+    void put_bytes(const void* data, size_t n) { out_.append(static_cast<const char*>(data), n); }
+
+    size_t size() const { return out_.size(); }
+
+    // Overwrite a u32 written earlier (e.g. a length placeholder)
+    void patch_u32(size_t offset, uint32_t v) {
+        for (int i = 0; i < 4; ++i) {
+            out_[offset + i] = static_cast<char>((v >> (8 * i)) & 0xFF);
+        }
+    }
+
+private:
+    std::string& out_;
+
+    void put_le(uint64_t v, int bytes) {
+        for (int i = 0; i < bytes; ++i) {
+            out_.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+        }
+    }
+};
+
+// Bounds-checked little-endian decoder. Reads past the end yield zeros and
+// clear ok(), so callers can decode a whole record and check once.
+class ByteReader {
+public:
+    explicit ByteReader(std::string_view data) : data_(data) {}
+
+    uint8_t get_u8() { return static_cast<uint8_t>(get_le(1)); }
+    uint16_t get_u16() { return static_cast<uint16_t>(get_le(2)); }
+    uint32_t get_u32() { return static_cast<uint32_t>(get_le(4)); }
+    uint64_t get_u64() { return get_le(8); }
+    int64_t get_i64() { return static_cast<int64_t>(get_le(8)); }
+    double get_f64() {
+        uint64_t bits = get_u64();
+        double v;
+        std::memcpy(&v, &bits, sizeof(v));
+        return v;
+    }
+    std::string_view get_string() {
+        size_t n = get_u16();
+        return get_bytes(n);
+    }
+    std::string_view get_bytes(size_t n) {
+        if (!ok_ || data_.size() - pos_ < n) {
+            ok_ = false;
+            return {};
+        }
+        std::string_view out = data_.substr(pos_, n);
+        pos_ += n;
+        return out;
+    }
+
+    bool ok() const { return ok_; }
+    size_t position() const { return pos_; }
+    size_t remaining() const { return data_.size() - pos_; }
+
+private:
+    std::string_view data_;
+    size_t pos_ = 0;
+    bool ok_ = true;
+
+    uint64_t get_le(size_t bytes) {
+        if (!ok_ || data_.size() - pos_ < bytes) {
+            ok_ = false;
+            return 0;
+        }
+        uint64_t v = 0;
+        for (size_t i = 0; i < bytes; ++i) {
+            v |= static_cast<uint64_t>(static_cast<uint8_t>(data_[pos_ + i])) << (8 * i);
+        }
+        pos_ += bytes;
+        return v;
+    }
+};
+
+} // namespace metricstream
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct iovec;
+
+namespace metricstream {
+
+class EventLoop;
+
+// Phase 10: One outgoing message as scatter-gather pieces. Static fragments
+// (status lines, canned responses) are referenced rather than copied, small
+// dynamic pieces live in an inline buffer, and large ones (bodies) are moved
+// in. The loop writes queued messages with one vectored send per wakeup.
+class OutboundMessage {
+public:
+    static constexpr size_t MAX_SEGMENTS = 8;
+    static constexpr size_t INLINE_CAPACITY = 192;
+
+    OutboundMessage() = default;
+    explicit OutboundMessage(std::string bytes) { add_owned(std::move(bytes)); }
+
+    // bytes must have static storage duration (or outlive the write)
+    void add_static(std::string_view bytes);
+    // Copied into the message; spills to an owned segment if the inline
+    // buffer is full. Messages with more than MAX_SEGMENTS pieces still work
+    // but are flattened into a single buffer.
+    void add_inline(std::string_view bytes);
+    void add_owned(std::string bytes);
+
+    size_t size() const { return total_size_; }
+    bool empty() const { return total_size_ == 0; }
+
+    // Describe the bytes after the first `skip` as iovecs; returns the count
+    size_t fill_iovec(struct iovec* iov, size_t max_iov, size_t skip) const;
+
+private:
+    enum class Kind : uint8_t { STATIC, INLINE, OWNED };
+
+    struct Segment {
+        Kind kind;
+        const char* data;     // STATIC only
+        uint32_t offset;      // INLINE: offset into inline_; OWNED: owned_ index
+        uint32_t size;
+    };
+
+    Segment segments_[MAX_SEGMENTS];
+    size_t segment_count_ = 0;
+    size_t total_size_ = 0;
+
+    // Pointers into these are resolved at write time so the message can move
+    char inline_[INLINE_CAPACITY];
+    size_t inline_used_ = 0;
+    std::vector<std::string> owned_;
+
+    bool push_segment(Kind kind, const char* data, uint32_t offset, size_t size);
+    const char* segment_data(const Segment& seg) const;
+    void flatten();
+    void append_flattened(std::string_view bytes);
+};
+
+// Protocol state a server attaches to a connection (e.g. its request parser)
+struct ConnectionContext {
+    virtual ~ConnectionContext() = default;
+};
+
+// Phase 8: Per-socket state owned by an EventLoop.
+// Only the owning loop thread touches the buffers; worker threads hand their
+// responses back through EventLoop::send().
+struct Connection {
+    int fd = -1;
+    EventLoop* loop = nullptr;
+    std::string remote_address;  // Client's IPv4 address, dotted quad
+
+    std::string in;              // Bytes read but not yet consumed by the parser
+    std::deque<OutboundMessage> out;  // Messages queued for the socket
+    size_t out_offset = 0;       // How much of out.front() has been written
+    size_t out_bytes = 0;        // Queued and not yet written, across `out`
+
+    bool in_flight = false;      // A request is being handled by a worker;
+                                 // `in` is frozen (no reads) until it completes
+    bool read_paused = false;    // Readable data left in the socket while in flight
+    bool processing = false;     // Inside EventLoop::process() for this connection
+    bool resume_pending = false; // A response arrived during it: feed the parser again
+    bool resume_read = false;    // ... and read the socket first
+    bool output_full = false;    // Past the loop's output limit: no reads or
+                                 // parsing until the peer drains it
+    bool write_armed = false;    // Poller is watching for writability
+    bool close_after_write = false;
+    bool peer_closed = false;    // read() returned 0
+    bool closed = false;
+
+    // Phase 8: Keep-alive connections idle past the loop's timeout are closed
+    std::chrono::steady_clock::time_point last_active;
+
+    std::unique_ptr<ConnectionContext> context;
+};
+
+using ConnectionPtr = std::shared_ptr<Connection>;
+
+// Phase 8: Non-blocking reactor.
+// Each loop owns a listening socket (SO_REUSEPORT on Linux, so the kernel
+// spreads accepts across loops) or shares one with its siblings, and drives
+// all socket I/O for the connections it accepted. Backend is edge-triggered
+// epoll on Linux and poll() elsewhere.
+class EventLoop {
+public:
+    // Called on the loop thread whenever new bytes were appended to conn->in
+    using DataCallback = std::function<void(const ConnectionPtr&)>;
+
+    EventLoop(int listen_fd, DataCallback on_data);
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    bool start();
+    void stop();
+
+    // Close keep-alive connections with no traffic for this long (0 = never).
+    // Must be called before start().
+    void set_idle_timeout(std::chrono::milliseconds timeout) { idle_timeout_ = timeout; }
+
+    // Stop reading once this many unconsumed bytes are buffered; the data
+    // callback is expected to reject oversized requests. Call before start().
+    void set_max_input_bytes(size_t bytes) { max_input_bytes_ = bytes; }
+
+    // Stop reading and parsing a connection while this many response bytes
+    // wait for the peer, so a client that pipelines without reading cannot
+    // grow its queue without bound. Call before start().
+    void set_max_output_bytes(size_t bytes) { max_output_bytes_ = bytes; }
+
+    // Phase 30: Run the loop thread on this CPU (-1 = wherever the
+    // scheduler likes). Call before start().
+    void set_cpu(int cpu) { cpu_ = cpu; }
+
+    // Thread-safe: queue a message for conn and wake the loop to flush it.
+    // This completes the in-flight request; any further pipelined bytes
+    // already buffered are handed to the data callback again.
+    // If close_after_write is set the connection is closed once drained.
+    void send(const ConnectionPtr& conn, OutboundMessage message, bool close_after_write);
+
+    // Loop thread only: write without completing the in-flight request
+    // (e.g. "100 Continue").
+    void write(const ConnectionPtr& conn, OutboundMessage message);
+
+    // Thread-safe: run fn on the loop thread.
+    void post(std::function<void()> fn);
+
+    size_t connection_count() const { return connection_count_.load(std::memory_order_relaxed); }
+
+    // Opens a non-blocking listening socket on port. When reuse_port is set
+    // the socket can share the port with other loops' listeners.
+    static int open_listener(int port, bool reuse_port);
+
+    // One listener per loop where the platform spreads accepts over
+    // SO_REUSEPORT sockets, else one for every loop to share. Empty if the
+    // port is in use, including by another server's reuseport group.
+    static std::vector<int> open_listeners(int port, size_t event_loops);
+
+    // True when this platform distributes accepts across SO_REUSEPORT sockets
+    static bool supports_reuse_port();
+
+private:
+    class Poller;
+
+    int listen_fd_;
+    DataCallback on_data_;
+    std::unique_ptr<Poller> poller_;
+    std::thread thread_;
+    std::atomic<bool> running_{false};
+    std::chrono::milliseconds idle_timeout_{0};
+    size_t max_input_bytes_ = 64 * 1024 * 1024;
+    size_t max_output_bytes_ = 4 * 1024 * 1024;
+    int cpu_ = -1;
+    std::chrono::steady_clock::time_point last_idle_sweep_;
+
+    // Listener unwatched after running out of descriptors, until resume_at
+    bool accept_paused_ = false;
+    std::chrono::steady_clock::time_point accept_resume_at_;
+    std::chrono::steady_clock::time_point last_accept_error_log_;
+    size_t accept_errors_suppressed_ = 0;
+
+    // Wakeup channel for cross-thread posts (eventfd on Linux, pipe elsewhere)
+    int wake_read_fd_ = -1;
+    int wake_write_fd_ = -1;
+    std::mutex pending_mutex_;
+    std::vector<std::function<void()>> pending_;
+
+    // Loop-thread only
+    std::unordered_map<int, ConnectionPtr> connections_;
+    std::atomic<size_t> connection_count_{0};
+
+    void run();
+    void wake();
+    void drain_wakeups();
+    void run_pending();
+
+    void accept_connections();
+    void resume_accepting();
+    void log_accept_error(int error);
+    void handle_readable(const ConnectionPtr& conn);
+    void process(const ConnectionPtr& conn, bool read);
+    void handle_writable(const ConnectionPtr& conn);
+    void flush_output(const ConnectionPtr& conn);
+    void close_connection(const ConnectionPtr& conn);
+    void close_if_finished(const ConnectionPtr& conn);
+    void close_idle_connections();
+};
+
+} // namespace metricstream
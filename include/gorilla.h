@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace metricstream {
+
+// MSB-first bit stream into a byte string
+class BitWriter {
+public:
+    void write_bit(bool bit) { write_bits(bit ? 1 : 0, 1); }
+    void write_bits(uint64_t value, int bits);   // Low `bits` bits of value, 1..64
+
+    const std::string& bytes() const { return bytes_; }
+    size_t bit_count() const { return bytes_.size() * 8 - free_bits_; }
+    void clear() {
+        bytes_.clear();
+        free_bits_ = 0;
+    }
+
+private:
+    std::string bytes_;
+    int free_bits_ = 0;   // Unused low bits of the last byte
+};
+
+// Reads what BitWriter wrote. Reading past the end yields zeros and clears ok().
+class BitReader {
+public:
+    explicit BitReader(std::string_view bytes) : bytes_(bytes) {}
+
+    bool read_bit() { return read_bits(1) != 0; }
+    uint64_t read_bits(int bits);
+
+    bool ok() const { return ok_; }
+
+private:
+    std::string_view bytes_;
+    size_t position_ = 0;   // In bits
+    bool ok_ = true;
+};
+
+// Phase 17: Gorilla time-series compression (Pelkonen et al., VLDB 2015).
+// Timestamps are stored as delta-of-delta with variable-width buckets, so a
+// steady scrape interval costs one bit per point; values are XORed with
+// their predecessor and only the meaningful bits are kept, so a repeated
+// value costs one bit and a slowly moving gauge a few.
+class GorillaEncoder {
+public:
+    void append(int64_t timestamp_ms, double value);
+
+    uint32_t count() const { return count_; }
+    const std::string& bytes() const { return bits_.bytes(); }
+    size_t bit_count() const { return bits_.bit_count(); }
+    void clear();
+
+private:
+    BitWriter bits_;
+    uint32_t count_ = 0;
+    int64_t prev_timestamp_ = 0;
+    int64_t prev_delta_ = 0;
+    uint64_t prev_value_ = 0;
+    int prev_leading_ = -1;     // -1: no XOR window yet
+    int prev_trailing_ = 0;
+
+    void append_timestamp(int64_t timestamp_ms);
+    void append_value(uint64_t bits);
+};
+
+// Decodes `count` points from a GorillaEncoder's bytes
+class GorillaDecoder {
+public:
+    GorillaDecoder(std::string_view bytes, uint32_t count) : bits_(bytes), remaining_(count) {}
+
+    // False when all points are read or the stream is corrupt (then !ok())
+    bool next(int64_t& timestamp_ms, double& value);
+
+    bool ok() const { return bits_.ok() && !corrupt_; }
+
+private:
+    BitReader bits_;
+    uint32_t remaining_;
+    bool corrupt_ = false;
+    bool first_ = true;
+    int64_t prev_timestamp_ = 0;
+    int64_t prev_delta_ = 0;
+    uint64_t prev_value_ = 0;
+    int prev_leading_ = 0;
+    int prev_trailing_ = 0;
+};
+
+} // namespace metricstream
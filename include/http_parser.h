@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace metricstream {
+
+struct HttpHeader {
+    std::string_view name;
+    std::string_view value;
+};
+
+// Phase 9: Zero-copy request. Every view points into the connection's read
+// buffer and stays valid until the response for this request has been sent.
+struct HttpRequest {
+    std::string_view method;
+    std::string_view path;      // Target without the query string
+    std::string_view query;     // Text after '?', empty if none
+    std::string_view version;
+    std::string_view body;
+    std::vector<HttpHeader> headers;
+
+    // Case-insensitive lookup; empty view if the header is absent
+    std::string_view header(std::string_view name) const;
+    bool has_header(std::string_view name) const;
+};
+
+// Phase 9: Incremental HTTP/1.1 request parser (one per connection).
+// parse() may be called repeatedly as bytes arrive; it resumes where it
+// stopped instead of rescanning. Bodies are framed by Content-Length or
+// chunked Transfer-Encoding; chunked bodies are de-chunked in place so the
+// body is always one contiguous view.
+class HttpRequestParser {
+public:
+    enum class Status {
+        NEED_MORE,   // Request incomplete, call parse() again after the next read
+        COMPLETE,    // request() is ready
+        ERROR        // Malformed or over limits, see error_status()
+    };
+
+    static constexpr size_t DEFAULT_MAX_HEADER_BYTES = 64 * 1024;
+    static constexpr size_t DEFAULT_MAX_BODY_BYTES = 16 * 1024 * 1024;
+
+    explicit HttpRequestParser(size_t max_body_bytes = DEFAULT_MAX_BODY_BYTES,
+                               size_t max_header_bytes = DEFAULT_MAX_HEADER_BYTES);
+
+    // buffer holds everything read from the socket that has not been consumed.
+    // It may be modified in place (chunked decoding) and must not be changed
+    // by the caller between COMPLETE and reset().
+    Status parse(std::string& buffer);
+
+    // Valid after parse() returned COMPLETE
+    const HttpRequest& request() const { return request_; }
+
+    // Number of leading buffer bytes that belong to the completed request
+    size_t consumed() const { return read_pos_; }
+
+    // HTTP status to answer with after ERROR (400, 413, 431, 501, 505)
+    int error_status() const { return error_status_; }
+
+    // True once headers are in, the client sent "Expect: 100-continue" and the
+    // body has not arrived yet. Cleared by acknowledge_continue().
+    bool expects_continue() const { return expect_continue_ && !continue_sent_; }
+    void acknowledge_continue() { continue_sent_ = true; }
+
+    // True once the request line and headers have been parsed
+    bool headers_complete() const { return state_ > State::HEADERS; }
+
+    // Phase 29: Method and path (no query) once headers_complete(), before
+    // the body is in; `buffer` is the one passed to parse()
+    std::string_view method(const std::string& buffer) const {
+        return std::string_view(buffer.data() + method_.offset, method_.length);
+    }
+    std::string_view path(const std::string& buffer) const {
+        std::string_view target(buffer.data() + target_.offset, target_.length);
+        return target.substr(0, target.find('?'));
+    }
+
+    // Prepare for the next request; the caller erases consumed() bytes first
+    void reset();
+
+    static bool iequals(std::string_view a, std::string_view b);
+
+private:
+    enum class State {
+        REQUEST_LINE,
+        HEADERS,
+        BODY_LENGTH,
+        CHUNK_SIZE,
+        CHUNK_DATA,
+        CHUNK_DATA_END,
+        TRAILERS,
+        COMPLETE,
+        ERROR
+    };
+
+    // Offsets rather than views while incomplete: the buffer may reallocate
+    struct Span {
+        uint32_t offset = 0;
+        uint32_t length = 0;
+    };
+
+    size_t max_body_bytes_;
+    size_t max_header_bytes_;
+
+    State state_ = State::REQUEST_LINE;
+    size_t read_pos_ = 0;        // Next unparsed byte
+    size_t scan_pos_ = 0;        // Where the next line search resumes
+    int error_status_ = 0;
+
+    Span method_, target_, version_;
+    std::vector<std::pair<Span, Span>> header_spans_;
+
+    bool chunked_ = false;
+    bool expect_continue_ = false;
+    bool continue_sent_ = false;
+    size_t content_length_ = 0;
+    size_t body_start_ = 0;
+    size_t body_length_ = 0;     // Decoded body bytes so far
+    size_t chunk_remaining_ = 0;
+
+    HttpRequest request_;
+
+    // Finds the next line starting at read_pos_; returns false if incomplete
+    bool next_line(const std::string& buffer, size_t& line_end, size_t& next);
+    Status fail(int status);
+    bool parse_request_line(const std::string& buffer, size_t line_end);
+    bool parse_header_line(const std::string& buffer, size_t line_end);
+    Status finish_headers(const std::string& buffer);
+    Status complete(const std::string& buffer);
+};
+
+} // namespace metricstream
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "event_loop.h"
+
+namespace metricstream {
+
+class CannedResponse;
+
+// Phase 10: Handlers fill this in; serialize_response() turns it into
+// scatter-gather pieces without an intermediate string
+struct HttpResponse {
+    int status_code = 200;
+    std::string body;
+    std::string_view content_type;   // Must refer to static storage
+    std::unordered_map<std::string, std::string> headers;  // Uncommon extra headers
+
+    // When set, the canned bytes are sent as-is and the fields above ignored
+    const CannedResponse* canned = nullptr;
+
+    void set_json_content() {
+        content_type = "application/json";
+    }
+};
+
+// Phase 10: A complete response rendered once at startup for hot paths
+// (rate limiting, health checks, overload). Both Connection variants are
+// kept so sending one is a single static iovec.
+class CannedResponse {
+public:
+    CannedResponse(int status_code, std::string_view content_type, std::string_view body,
+                   std::unordered_map<std::string, std::string> headers = {});
+
+    std::string_view bytes(bool keep_alive) const {
+        return keep_alive ? keep_alive_bytes_ : close_bytes_;
+    }
+
+    int status_code() const { return status_code_; }
+
+private:
+    int status_code_;
+    std::string keep_alive_bytes_;
+    std::string close_bytes_;
+};
+
+// Full status line including CRLF, e.g. "HTTP/1.1 200 OK\r\n"; empty for
+// codes without a precomputed line
+std::string_view status_line(int status_code);
+
+// The body is moved into the message; everything else is static or inline.
+// A canned response must outlive the write.
+OutboundMessage serialize_response(HttpResponse&& response, bool keep_alive);
+
+} // namespace metricstream
@@ -1,55 +1,94 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <chrono>
 #include <functional>
 #include <memory>
 #include <thread>
 #include <atomic>
-#include <unordered_map>
+#include <vector>
+#include "admission.h"
 #include "thread_pool.h"
+#include "event_loop.h"
+#include "http_parser.h"
+#include "http_response.h"
+#include "trace.h"
 
 namespace metricstream {
 
-struct HttpRequest {
-    std::string method;
-    std::string path;
-    std::string body;
-    std::unordered_map<std::string, std::string> headers;
-};
-
-struct HttpResponse {
-    int status_code = 200;
-    std::string body;
-    std::unordered_map<std::string, std::string> headers;
-    
-    void set_json_content() {
-        headers["Content-Type"] = "application/json";
-    }
-};
-
 using HttpHandler = std::function<HttpResponse(const HttpRequest&)>;
 
 class HttpServer {
 public:
-    HttpServer(int port, size_t thread_pool_size = 16);
+    // event_loops = 0 means one loop per hardware thread
+    HttpServer(int port, size_t thread_pool_size = 16, size_t event_loops = 0);
     ~HttpServer();
 
-    void add_handler(const std::string& path, const std::string& method, HttpHandler handler);
+    // Phase 29: on_event_loop handlers skip the worker queue and run on the
+    // loop thread, so they must be O(1) and never block
+    void add_handler(const std::string& path, const std::string& method, HttpHandler handler,
+                     RequestPriority priority = RequestPriority::NORMAL, bool on_event_loop = false);
     void start();
     void stop();
 
+    // Phase 8: Idle keep-alive connections are closed after this long.
+    // Must be called before start().
+    void set_idle_timeout(std::chrono::milliseconds timeout) { idle_timeout_ = timeout; }
+
+    // Phase 9: Requests with larger bodies are answered with 413.
+    // Must be called before start().
+    void set_max_body_size(size_t bytes) { max_body_size_ = bytes; }
+
+    // Phase 30: Pin event loop i to CPU i. Must be called before start().
+    void set_pin_event_loops(bool pin) { pin_event_loops_ = pin; }
+
+    // Phase 29: Overload shedding; configure before start()
+    AdmissionController& admission() { return admission_; }
+    const AdmissionController& admission() const { return admission_; }
+
+    // Open connections across all event loops (for monitoring)
+    size_t active_connections() const;
+    // Requests waiting for a worker
+    size_t queue_depth() const { return thread_pool_->queue_size(); }
+
+    // HTTP/1.1 persists unless "Connection: close"; HTTP/1.0 needs keep-alive
+    static bool wants_keep_alive(const HttpRequest& request);
+
 private:
     int port_;
+    size_t event_loop_count_;
     std::atomic<bool> running_;
-    std::unique_ptr<std::thread> server_thread_;
+    std::chrono::milliseconds idle_timeout_{std::chrono::seconds(60)};
+    size_t max_body_size_ = HttpRequestParser::DEFAULT_MAX_BODY_BYTES;
+    bool pin_event_loops_ = false;
     std::unique_ptr<ThreadPool> thread_pool_;  // Phase 6: Thread pool
 
-    void run_server();
+    // Phase 8: Event loops own socket I/O; the pool only runs handlers
+    std::vector<int> listen_fds_;
+    std::vector<std::unique_ptr<EventLoop>> event_loops_;
+
+    AdmissionController admission_;
+    std::unique_ptr<CannedResponse> shed_response_;   // 503 with Retry-After, built in start()
+
+    struct Route {
+        std::string path;
+        std::string method;
+        HttpHandler handler;
+        RequestPriority priority;
+        bool on_event_loop;
+    };
+
+    void on_connection_data(const ConnectionPtr& conn);
+    const Route* find_route(std::string_view method, std::string_view path) const;
+    RequestPriority priority_of(std::string_view method, std::string_view path) const;
+    void shed_request(const ConnectionPtr& conn);
+    void dispatch_request(const ConnectionPtr& conn, const HttpRequest& request, RequestTrace* trace);
+    void respond(const ConnectionPtr& conn, const HttpRequest& request, RequestTrace* trace);
     HttpResponse handle_request(const HttpRequest& request);
-    HttpRequest parse_request(const std::string& raw_request);
-    std::string format_response(const HttpResponse& response);
 
-    std::unordered_map<std::string, std::unordered_map<std::string, HttpHandler>> handlers_;
+    // Linear scan over a handful of routes beats hashing a path per request
+    std::vector<Route> routes_;
 };
 
 } // namespace metricstream
\ No newline at end of file
@@ -1,7 +1,23 @@
 #pragma once
 
 #include "metric.h"
+#include "alerting.h"
+#include "arena.h"
 #include "http_server.h"
+#include "json_batch_parser.h"
+#include "batch_pool.h"
+#include "binary_server.h"
+#include "cardinality.h"
+#include "checkpoint.h"
+#include "cluster.h"
+#include "partitioned_log.h"
+#include "query_executor.h"
+#include "rollup.h"
+#include "storage_sink.h"
+#include "wal.h"
+#include "sharded_map.h"
+#include "stats.h"
+#include "trace.h"
 #include <memory>
 #include <atomic>
 #include <unordered_map>
@@ -10,14 +26,17 @@
 #include <mutex>
 #include <array>
 #include <atomic>
-#include <fstream>
-#include <queue>
 #include <condition_variable>
 #include <functional>
 #include <thread>
+#include <string_view>
+#include <vector>
 
 namespace metricstream {
 
+class DecisionExporter;
+class QueryEngine;
+
 class MetricValidator {
 public:
     struct ValidationResult {
@@ -38,90 +57,441 @@ struct MetricEvent {
         : timestamp(ts), allowed(allow) {}
 };
 
+// Phase 14: Multi-producer ring of rate-limit decisions with one reader (the
+// exporter). Writers claim an index with fetch_add; each slot carries a
+// seqlock sequence so the reader can tell a finished event from one that is
+// still being written or was overwritten after the ring wrapped.
+//
+// A client only gets a ring while decisions are being exported, and it is
+// sized for one export interval of a typical client (2 KB); a client that
+// laps it between drains shows up as dropped events.
 struct ClientMetrics {
-    static constexpr size_t BUFFER_SIZE = 1000;
-    std::array<MetricEvent, BUFFER_SIZE> ring_buffer;
+    static constexpr size_t BUFFER_SIZE = 128;  // Power of two
+
+    struct Slot {
+        std::atomic<uint64_t> sequence{0};   // 2*index+1 while writing, 2*index+2 when done
+        std::atomic<int64_t> event{0};       // Timestamp in ns << 1 | allowed
+    };
+
+    std::array<Slot, BUFFER_SIZE> ring_buffer;
     std::atomic<size_t> write_index{0};
-    std::atomic<size_t> read_index{0};
+    std::atomic<size_t> read_index{0};     // Reader only
+
+    void record(const MetricEvent& event);
+
+    // Reader side: visits finished events after read_index and advances it.
+    // Returns how many events were lost to wrap-around.
+    template <typename F>
+    uint64_t drain(F&& visit);
+};
+
+// Per-client totals for one drain of the decision rings
+struct ClientDecisionCounts {
+    std::string client_id;
+    uint64_t allowed = 0;
+    uint64_t denied = 0;
+    uint64_t dropped = 0;   // Events overwritten before they were read
+};
+
+// Legacy sliding window (RateLimiter::Mode::SLIDING_WINDOW only)
+struct SlidingWindow {
+    std::mutex mutex;
+    std::deque<std::chrono::time_point<std::chrono::steady_clock>> timestamps;
+};
+
+// Phase 12: Everything the limiter keeps per client, in one map entry. Only
+// the GCRA word is inline; the rest is allocated the first time the client
+// needs it, so with GCRA and no exporter a client costs 24 bytes here.
+struct ClientState {
+    // GCRA: theoretical arrival time in steady_clock nanoseconds
+    std::atomic<int64_t> tat_ns{0};
+
+    std::atomic<SlidingWindow*> window{nullptr};
+    std::atomic<ClientMetrics*> metrics{nullptr};   // While decisions are exported
+    std::atomic<uint32_t> unshared{0};              // Admitted since peers last heard
+
+    ClientState() = default;
+    ClientState(const ClientState&) = delete;
+    ClientState& operator=(const ClientState&) = delete;
+    ~ClientState() {
+        delete window.load(std::memory_order_relaxed);
+        delete metrics.load(std::memory_order_relaxed);
+    }
+
+    // The object `part` points to, created by whichever caller gets there first
+    template <typename T>
+    static T& get_or_create(std::atomic<T*>& part) {
+        T* current = part.load(std::memory_order_acquire);
+        if (current == nullptr) {
+            T* created = new T();
+            if (part.compare_exchange_strong(current, created, std::memory_order_acq_rel,
+                                             std::memory_order_acquire)) {
+                return *created;
+            }
+            delete created;
+        }
+        return *current;
+    }
 };
 
 class RateLimiter {
 public:
-    RateLimiter(size_t max_requests_per_second);
-    bool allow_request(const std::string& client_id);
-    void flush_metrics();
-    
+    enum class Mode {
+        GCRA,            // O(1) state, one CAS per decision (default)
+        SLIDING_WINDOW   // Exact timestamp log, up to max_requests entries per client
+    };
+
+    static constexpr size_t DEFAULT_MAX_CLIENTS = 65536;
+
+    RateLimiter(size_t max_requests_per_second, Mode mode = Mode::GCRA,
+                size_t max_clients = DEFAULT_MAX_CLIENTS);
+    // `now` is for tests; callers leave it to the steady clock
+    bool allow_request(std::string_view client_id,
+                       std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+    // Phase 14: Decisions are only recorded while an exporter wants them
+    // (DecisionExporter turns this on), so clients get no ring otherwise.
+    void set_decision_log(bool enabled) { decision_log_.store(enabled, std::memory_order_relaxed); }
+
+    // Phase 31: While on, admitted requests are counted for take_usage(),
+    // which the service gossips to its peers; apply_usage() charges what a
+    // peer admitted as if it had been admitted here.
+    void set_usage_sharing(bool enabled) { usage_sharing_.store(enabled, std::memory_order_relaxed); }
+    // Appends each client with requests admitted since the last call
+    void take_usage(std::vector<ClientUsage>& out);
+    void apply_usage(std::string_view client_id, uint32_t requests,
+                     std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+    uint64_t peer_requests() const { return peer_requests_.load(std::memory_order_relaxed); }
+
+    // Drain every client's decision ring into per-client counts.
+    // Appends one entry per client with new events; single caller at a time.
+    void drain_decisions(std::vector<ClientDecisionCounts>& out);
+
+    Mode mode() const { return mode_; }
+    size_t tracked_clients() const { return clients_.size(); }
+    uint64_t evicted_clients() const { return clients_.evictions(); }
+
+    // Phase 34: GCRA state for a checkpoint, as each client's debt (how far
+    // its TAT is ahead of now) so it survives the steady clock restarting.
+    // Clients without debt are as good as new and are left out. load()
+    // returns how many clients it restored, 0 on corrupt data.
+    void save(std::string& out,
+              std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) const;
+    size_t load(std::string_view data,
+                std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
 private:
     size_t max_requests_;
+    Mode mode_;
+    std::atomic<bool> decision_log_{false};
+    std::atomic<bool> usage_sharing_{false};
+    std::atomic<uint64_t> peer_requests_{0};
+
+    // GCRA parameters: one request per emission interval, with bursts of up
+    // to max_requests_ requests (the same allowance as a 1 s window)
+    int64_t emission_interval_ns_;
+    int64_t burst_tolerance_ns_;
+
+    // Phase 12: Lock-free lookup replaces the mutex pool and the two
+    // unsynchronized unordered_maps. Past max_clients the least recently
+    // seen client is forgotten, which costs it nothing but its debt.
+    ShardedMap<ClientState> clients_;
+
+    bool allow_gcra(ClientState& state, std::chrono::steady_clock::time_point now);
+    bool allow_sliding_window(ClientState& state, std::chrono::steady_clock::time_point now);
+};
+
+template <typename F>
+uint64_t ClientMetrics::drain(F&& visit) {
+    size_t read_idx = read_index.load(std::memory_order_relaxed);
+    size_t write_idx = write_index.load(std::memory_order_acquire);
+
+    // The writers lapped us: everything older than one ring is gone
+    uint64_t dropped = 0;
+    if (write_idx - read_idx > BUFFER_SIZE) {
+        dropped = write_idx - read_idx - BUFFER_SIZE;
+        read_idx = write_idx - BUFFER_SIZE;
+    }
+
+    for (; read_idx < write_idx; ++read_idx) {
+        const Slot& slot = ring_buffer[read_idx & (BUFFER_SIZE - 1)];
+        uint64_t expected = 2 * static_cast<uint64_t>(read_idx) + 2;
+
+        uint64_t before = slot.sequence.load(std::memory_order_acquire);
+        if (before < expected) {
+            break;  // Claimed but not finished yet: resume here next drain
+        }
+        int64_t event = slot.event.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t after = slot.sequence.load(std::memory_order_relaxed);
+
+        if (before != expected || after != expected) {
+            dropped++;  // Overwritten by a later lap while we were behind
+            continue;
+        }
+        visit(event >> 1, (event & 1) != 0);
+    }
+
+    read_index.store(read_idx, std::memory_order_relaxed);
+    return dropped;
+}
+
+// Phase 17: Which StorageSink the writer thread feeds
+enum class StorageFormat {
+    JSONL,      // metrics.jsonl, human-readable (default, for debugging)
+    SEGMENTS    // Binary columnar segments, see segment.h
+};
+
+struct IngestionConfig {
+    int port = 8080;
+    size_t rate_limit = 10000;
+    FsyncPolicy fsync_policy;
+    StorageFormat storage_format = StorageFormat::JSONL;
+    std::string jsonl_path = "metrics.jsonl";
+    std::string segment_dir = "segments";
+    std::vector<AlertRule> alert_rules;   // Phase 19: evaluated as batches arrive
+    
+    // Phase 20: Batches a partition holds for its slowest consumer before
+    // POST /metrics answers 503; clients hash across the partitions
+    size_t log_partitions = 8;
+    size_t partition_capacity = 256;
     
-    // Hash-based per-client mutex pool (Phase 4 optimization)
-    static constexpr size_t MUTEX_POOL_SIZE = 10007;  // Prime number for better distribution
-    std::array<std::mutex, MUTEX_POOL_SIZE> client_mutex_pool_;
+    // Phase 21: POST /metrics answers once the batch is in the WAL and synced
+    bool wal_enabled = true;
+    std::string wal_dir = "wal";
+    std::chrono::microseconds wal_group_commit_delay{2000};
     
-    // Rate limiting data structures
-    std::unordered_map<std::string, std::deque<std::chrono::time_point<std::chrono::steady_clock>>> client_requests_;
+    // Phase 24: Stage 1 kernel for POST /metrics; AUTO picks the best one
+    // the CPU supports
+    JsonKernel json_kernel = JsonKernel::AUTO;
     
-    // Metrics collection data structures  
-    std::unordered_map<std::string, ClientMetrics> client_metrics_;
+    // Phase 25: Raw TCP listener for the binary protocol (0 = off); POST
+    // /metrics accepts it as application/x-metricstream either way
+    int binary_port = 0;
     
-    // Helper method to get client-specific mutex
-    std::mutex& get_client_mutex(const std::string& client_id);
+    // Phase 27: 10 s / 1 m / 5 m rollups of every accepted point, built by
+    // their own log consumer and served by GET /rollups. A bucket is written
+    // once the clock is rollup_lateness past its end.
+    bool rollups_enabled = false;
+    std::string rollup_dir = "rollups";
+    std::chrono::milliseconds rollup_lateness{5000};
+    // Workers split the log's partitions; each keeps its own buckets and
+    // sketches, merged when closed buckets are written
+    size_t rollup_workers = 2;
     
-    void send_to_monitoring(const std::string& client_id, 
-                           const std::chrono::time_point<std::chrono::steady_clock>& timestamp, 
-                           bool allowed);
+    // Phase 28: GET /query?agg=1 fans buckets of the range out over this
+    // many threads (0 = one per core)
+    size_t query_threads = 0;
+    
+    // Phase 29: Shed ingest (then queries) once requests queue for longer
+    // than admission.target or the storage writer falls half a log behind
+    AdmissionController::Options admission;
+    
+    // Phase 30: Shared-nothing storage. Each shard is a writer thread with
+    // its own sink that owns every storage_shards-th log partition: segment
+    // files side by side in segment_dir, or metrics-<n>.jsonl next to
+    // jsonl_path (shard 0 keeps the name). pin_threads puts event loop n
+    // and shard n's writer on CPU n. Capped at one shard per partition and
+    // at MAX_STORAGE_SHARDS, as segment file names are claimed by retrying.
+    static constexpr size_t MAX_STORAGE_SHARDS = 16;
+    size_t storage_shards = 1;
+    bool pin_threads = false;
+    
+    // Phase 31: Binary endpoints of every node, the same list in the same
+    // order on each, and this node's index in it. With two or more, metrics
+    // are forwarded to the node owning their series. binary_port defaults
+    // to this node's entry.
+    //
+    // rate_limit is cluster-wide: every cluster_usage_interval each node
+    // sends its peers the requests it admitted per client, and they charge
+    // them as their own. A client spreading its connections over the nodes
+    // can overshoot by at most what the others admit in one interval. The
+    // cardinality budget stays per entry node.
+    std::vector<ClusterNode> cluster_nodes;
+    size_t cluster_self = 0;
+    std::chrono::milliseconds cluster_usage_interval{50};
+    
+    // Phase 33: Per-request stage timestamps, served by GET /debug/traces;
+    // requests over tracing.slow_threshold are kept in a sampled slow log
+    Tracer::Options tracing;
+    
+    // Phase 34: Every checkpoint_interval, and on shutdown, the series
+    // dictionary, rate-limit debts and open rollup buckets are saved to
+    // checkpoint_dir. Startup maps the newest checkpoint before anything is
+    // interned and replays only the WAL after it; rollups resume from the
+    // WAL where their checkpoint left off, and open buckets survive a clean
+    // restart instead of being written out partial.
+    bool checkpoints_enabled = true;
+    std::string checkpoint_dir = "checkpoints";
+    std::chrono::milliseconds checkpoint_interval{60000};
+    
+    // Phase 35: Per-client caps on the series a client creates (and,
+    // optionally, the distinct series it sends) per window. Refused series'
+    // metrics are dropped or lose their tags; estimates are served by GET
+    // /debug/cardinality.
+    CardinalityLimiter::Options cardinality;
 };
 
 class IngestionService {
 public:
-    IngestionService(int port, size_t rate_limit = 10000);
+    explicit IngestionService(const IngestionConfig& config);
+    IngestionService(int port, size_t rate_limit = 10000, FsyncPolicy fsync_policy = {});
     ~IngestionService();
     
     void start();
     void stop();
     
     // Metrics for monitoring
-    size_t get_total_metrics_received() const { return metrics_received_; }
-    size_t get_total_batches_processed() const { return batches_processed_; }
-    size_t get_validation_errors() const { return validation_errors_; }
-    size_t get_rate_limited_requests() const { return rate_limited_; }
+    size_t get_total_metrics_received() const { return metrics_received_.value(); }
+    size_t get_total_batches_processed() const { return batches_processed_.value(); }
+    size_t get_validation_errors() const { return validation_errors_.value(); }
+    size_t get_rate_limited_requests() const { return rate_limited_.value(); }
+    // Phase 31: Requests peers admitted and this node charged to their clients
+    size_t get_peer_rate_limit_usage() const { return rate_limiter_->peer_requests(); }
     
 private:
     std::unique_ptr<HttpServer> server_;
+    std::unique_ptr<BinaryServer> binary_server_;
     std::unique_ptr<MetricValidator> validator_;
+    JsonBatchParser json_parser_;
     std::unique_ptr<RateLimiter> rate_limiter_;
+    std::unique_ptr<CardinalityLimiter> cardinality_;     // Phase 35
+    std::unique_ptr<DecisionExporter> decision_exporter_;  // Phase 14: rate_limits.jsonl
+    std::unique_ptr<AlertEngine> alert_engine_;            // Phase 19: streaming alerts
+    
+    // Phase 31: Null unless clustered; the forwarder outlives the servers
+    // whose handlers wait on it
+    std::unique_ptr<HashRing> ring_;
+    std::unique_ptr<ClusterForwarder> forwarder_;
+    std::unique_ptr<ClusterPeers> peers_;
+    size_t cluster_self_ = 0;
+    std::chrono::milliseconds usage_interval_{50};
+    std::thread usage_thread_;
+    std::mutex usage_mutex_;
+    std::condition_variable usage_cv_;
+    bool usage_stopping_ = false;
     
-    std::atomic<size_t> metrics_received_;
-    std::atomic<size_t> batches_processed_;
-    std::atomic<size_t> validation_errors_;
-    std::atomic<size_t> rate_limited_;
+    // Phase 26: Sharded per thread, summed when read
+    ShardedCounter metrics_received_;
+    ShardedCounter batches_processed_;
+    ShardedCounter validation_errors_;
+    ShardedCounter rate_limited_;
+    ShardedCounter storage_backpressure_;   // Batches refused: partition full
+    
+    // Phase 26: Per-stage request latency, exported by GET /metrics/stats
+    LatencyHistogram rate_limit_latency_;
+    LatencyHistogram parse_latency_;
+    LatencyHistogram validate_latency_;
+    LatencyHistogram enqueue_latency_;      // WAL append plus log append
+    LatencyHistogram wal_sync_latency_;     // Waiting for the group commit
+    LatencyHistogram request_latency_;      // Handler entry to response
     
     // File storage for MVP
-    std::ofstream metrics_file_;
-    std::mutex file_mutex_;
+    // Phase 16: Group commit to metrics.jsonl; only the writer thread uses it
+    // Phase 17: Behind StorageSink, so binary segments can replace it
+    // Phase 30: One sink per storage shard, used by that shard's writer only
+    std::vector<std::unique_ptr<StorageSink>> storage_;
+    
+    // Phase 21: Accepted batches are durable here before they are acked;
+    // the writer checkpoints it after flushing the sink
+    static constexpr std::chrono::milliseconds WAL_CHECKPOINT_INTERVAL{10000};
+    std::unique_ptr<WriteAheadLog> wal_;
+    // Phase 30: applied_through() as of each shard's last flush; the log
+    // is checkpointed at the lowest
+    std::unique_ptr<std::atomic<uint64_t>[]> shard_flushed_through_;
+    bool pin_threads_ = false;
+    
+    // Phase 18: GET /query over the segment directory (SEGMENTS only);
+    // the index is refreshed at most once per QUERY_REFRESH_INTERVAL
+    static constexpr std::chrono::milliseconds QUERY_REFRESH_INTERVAL{1000};
+    std::unique_ptr<QueryEngine> query_engine_;
+    std::unique_ptr<QueryExecutor> query_executor_;   // Phase 28: agg=1, cached per bucket
+    std::mutex query_refresh_mutex_;
+    std::chrono::steady_clock::time_point last_query_refresh_{};
+    
+    // Phase 27: One aggregator per rollup worker thread, each checking for
+    // closed buckets at least once per interval; the writer is shared
+    static constexpr std::chrono::milliseconds ROLLUP_CLOSE_INTERVAL{1000};
+    std::string rollup_dir_;
+    std::vector<std::unique_ptr<RollupAggregator>> rollup_aggregators_;
+    std::unique_ptr<RollupWriter> rollup_writer_;
+    
+    // Phase 34: Null unless checkpoints are enabled. The rollup stage is a
+    // WAL consumer of its own, so a checkpoint knows which logged batches
+    // its buckets hold; replay feeds rollups the rest. Workers park at
+    // rollup_pause_ while the checkpoint thread saves their aggregators.
+    std::unique_ptr<CheckpointStore> checkpoints_;
+    std::chrono::milliseconds checkpoint_interval_{60000};
+    size_t rollup_wal_consumer_ = 0;
+    bool rollups_restored_ = false;
+    uint64_t rollup_restored_through_ = 0;          // Checkpoint's last lsn...
+    std::vector<uint64_t> rollup_restored_missing_; // ...and those it lacked
+    std::thread checkpoint_thread_;
+    std::mutex checkpoint_mutex_;
+    std::condition_variable checkpoint_cv_;
+    bool checkpoint_stopping_ = false;
+    std::atomic<bool> rollup_pause_{false};
+    size_t rollups_paused_ = 0;
+    std::vector<std::string> rollup_images_;
+    std::atomic<uint64_t> checkpoint_duration_us_{0};
+    uint64_t restore_duration_us_ = 0;
     
     // Asynchronous batch writer infrastructure
-    std::queue<MetricBatch> write_queue_;
-    std::mutex queue_mutex_;
-    std::condition_variable queue_cv_;
-    std::thread writer_thread_;
-    std::atomic<bool> writer_running_{true};
+    // Phase 15: Batches move through a bounded queue and return to the pool
+    // Phase 20: The queue is a partitioned log; storage and alerting each
+    // read it through their own cursor on their own thread, and a batch
+    // returns to the pool once both have seen it
+    static constexpr size_t MAX_POLL_PER_PARTITION = 64;
+    static constexpr std::chrono::milliseconds CONSUMER_IDLE_WAIT{1000};
+    BatchPool batch_pool_;
+    std::unique_ptr<PartitionedLog> log_;   // Declared after the pool it returns batches to
+    size_t storage_cursor_ = 0;
+    size_t alert_cursor_ = 0;
+    size_t rollup_cursor_ = 0;
+    std::vector<std::thread> writer_threads_;   // One per storage shard
+    std::thread alert_thread_;
+    std::vector<std::thread> rollup_threads_;
     
     // HTTP handlers
     HttpResponse handle_metrics_post(const HttpRequest& request);
     HttpResponse handle_health_check(const HttpRequest& request);
     HttpResponse handle_metrics_get(const HttpRequest& request);
+    HttpResponse handle_stats_get(const HttpRequest& request);
+    HttpResponse handle_query(const HttpRequest& request);
+    HttpResponse handle_alerts_get(const HttpRequest& request);
+    HttpResponse handle_rollups_get(const HttpRequest& request);
+    HttpResponse handle_traces_get(const HttpRequest& request);
+    HttpResponse handle_cardinality_get(const HttpRequest& request);
+    
+    // Phase 25: Where every protocol's parsed batch goes
+    // Phase 31: forward is false for batches a peer forwarded, which this
+    // node owns by construction
+    enum class IngestResult { OK, INVALID, BACKPRESSURE, WAL_UNAVAILABLE, PEER_UNAVAILABLE };
+    IngestResult submit_batch(PooledBatch& batch, std::string_view client_id, std::string& error,
+                              bool forward = true);
+    bool forward_foreign(MetricBatch& batch, std::vector<ClusterForwarder::Ticket>& tickets);
+    BinaryAck handle_binary_frames(BinaryDecoder& decoder, std::string_view frames,
+                                   std::string_view remote_address);
+    bool decode_binary_part(BinaryDecoder& decoder, std::string_view frames, MetricBatch& batch,
+                            std::string_view remote_address, size_t& refused, const char** error);
     
     // Helper methods
-    MetricBatch parse_json_metrics_optimized(const std::string& json_body);
     MetricBatch parse_json_metrics(const std::string& json_body);
     Metric parse_single_metric(const std::string& metric_json);
     std::string extract_string_field(const std::string& json, const std::string& field);
     double extract_numeric_field(const std::string& json, const std::string& field);
     Tags extract_tags(const std::string& json);
-    void store_metrics_to_file(const MetricBatch& batch);
-    void queue_metrics_for_async_write(const MetricBatch& batch);
-    void async_writer_loop();
+    bool queue_metrics_for_async_write(PooledBatch& batch);
+    void async_writer_loop(size_t shard);
+    void alert_consumer_loop();
+    void rollup_consumer_loop(size_t worker);
+    void replay_wal(const IngestionConfig& config);
+    void checkpoint_wal(size_t shard, bool drained = false);
+    void restore_checkpoint(const IngestionConfig& config);
+    bool write_checkpoint(bool final);
+    void checkpoint_loop();
+    void pause_for_checkpoint(size_t worker);
+    void usage_loop();
     std::string create_error_response(const std::string& message);
     std::string create_success_response(size_t metrics_count);
 };
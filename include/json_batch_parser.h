@@ -0,0 +1,64 @@
+#pragma once
+
+#include "arena.h"
+#include "metric.h"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace metricstream {
+
+// Phase 24: Two-stage JSON parser for POST /metrics bodies, after simdjson.
+//
+// Stage 1 scans the body 64 bytes at a time and builds an index of every
+// unescaped quote and every structural character ({}[]:,) outside strings.
+// Escapes are resolved with carry-less bit tricks (odd-length backslash
+// runs) and the in-string mask is a prefix XOR of the quote bits, so the
+// vector kernels never branch per byte.
+//
+// Stage 2 walks the index: keys are sliced straight out of the body and
+// dispatched on length and first byte, numbers go through a Clinger fast
+// path with a from_chars fallback, and strings with escapes (including
+// \uXXXX and surrogate pairs) are decoded into the request arena.
+//
+// The kernel is picked once at runtime from what the CPU supports; the
+// scalar kernel produces the same index and is the fallback everywhere.
+enum class JsonKernel : uint8_t {
+    AUTO,    // Best kernel this CPU supports
+    SCALAR,
+    SSE2,
+    AVX2,
+    NEON
+};
+
+const char* json_kernel_name(JsonKernel kernel);
+bool json_kernel_supported(JsonKernel kernel);
+JsonKernel best_json_kernel();
+
+// Stage 1 on its own: writes structural positions to `out`, which must have
+// room for json.size() entries, and returns how many were written
+size_t find_json_structurals(std::string_view json, JsonKernel kernel, uint32_t* out);
+
+// Strict JSON number grammar; false if `text` is not exactly one number
+bool parse_json_number(std::string_view text, double& value);
+
+class JsonBatchParser {
+public:
+    // Unsupported kernels fall back to the best supported one
+    explicit JsonBatchParser(JsonKernel kernel = JsonKernel::AUTO);
+
+    // Parses {"metrics": [{"name": ..., "value": ..., "type": ..., "tags": {...}}]}
+    // into `batch`. Unknown fields are skipped; metrics without a name are
+    // dropped. Strings and the structural index live in `arena`. Returns
+    // false with a static message in `error` on malformed input, in which
+    // case `batch` may hold the metrics parsed before the error.
+    bool parse(std::string_view body, MetricBatch& batch, Arena& arena,
+               const char** error = nullptr) const;
+
+    JsonKernel kernel() const { return kernel_; }
+
+private:
+    JsonKernel kernel_;
+};
+
+} // namespace metricstream
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "metric.h"
+#include "storage_sink.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <string>
+
+namespace metricstream {
+
+// Phase 16: Group-commit writer for metrics.jsonl. Batches are formatted
+// straight into one preallocated buffer by a hand-rolled formatter and the
+// whole group goes to the file with a single write(); fsync follows the
+// configured policy. Single-threaded: owned by the async writer thread.
+//
+// Phase 17: One StorageSink among several; kept as the human-readable
+// debug format next to the binary segments.
+class JsonlWriter : public StorageSink {
+public:
+    static constexpr size_t DEFAULT_BUFFER_BYTES = 4 * 1024 * 1024;
+
+    explicit JsonlWriter(const std::string& path, FsyncPolicy policy = {},
+                         size_t buffer_bytes = DEFAULT_BUFFER_BYTES);
+    ~JsonlWriter() override;   // Commits and syncs whatever is left
+
+    JsonlWriter(const JsonlWriter&) = delete;
+    JsonlWriter& operator=(const JsonlWriter&) = delete;
+
+    bool is_open() const override { return file_.is_open(); }
+
+    // Format into the buffer; commits early if the buffer fills up
+    void append(const MetricBatch& batch) override;
+
+    // Write the buffer with one write() and apply the fsync policy
+    bool commit() override;
+
+    // fsync now if anything written is not yet durable
+    void sync() { file_.sync(); }
+
+    std::chrono::milliseconds sync_if_due() override { return file_.sync_if_due(); }
+    bool wants_timed_sync() const override { return file_.wants_timed_sync(); }
+
+    bool flush() override;
+
+    size_t buffered_bytes() const { return buffer_.size(); }
+    uint64_t bytes_written() const { return file_.bytes_written(); }
+    uint64_t fsync_count() const { return file_.fsync_count(); }
+    uint64_t write_errors() const { return file_.write_errors(); }
+
+    // Format one metric as a JSON line (exposed for tests)
+    void format_metric(const Metric& metric);
+
+private:
+    AppendFile file_;
+    size_t buffer_limit_;
+    std::string buffer_;
+
+    // "YYYY-MM-DDTHH:MM:SS" for cached_second_, rebuilt once per second
+    std::time_t cached_second_ = -1;
+    char timestamp_prefix_[20];
+
+    void append_timestamp(Timestamp ts);
+};
+
+} // namespace metricstream
@@ -1,8 +1,12 @@
 #pragma once
 
+#include "series_registry.h"
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <chrono>
+#include <cstdint>
+#include <utility>
 #include <vector>
 
 namespace metricstream {
@@ -17,23 +21,39 @@ enum class MetricType {
     SUMMARY
 };
 
+// Phase 22: 24 bytes per point. Name and tags live once in the
+// SeriesRegistry and the metric refers to them by id.
 struct Metric {
-    std::string name;
-    double value;
+    uint32_t series_id;
     MetricType type;
-    Tags tags;
+    double value;
     Timestamp timestamp;
     
-    // Constructor
-    Metric(const std::string& name, double value, MetricType type, 
+    Metric(uint32_t series_id, double value, MetricType type,
+           Timestamp ts = std::chrono::system_clock::now())
+        : series_id(series_id), type(type), value(value), timestamp(ts) {}
+    
+    // Interns name and tags in the global registry
+    Metric(std::string_view name, double value, MetricType type,
            const Tags& tags = {}, Timestamp ts = std::chrono::system_clock::now())
-        : name(name), value(value), type(type), tags(tags), timestamp(ts) {}
+        : Metric(intern(name, tags), value, type, ts) {}
+    
+    const SeriesKey& series() const { return SeriesRegistry::global().key(series_id); }
+    const std::string& name() const { return series().name; }
+    const TagList& tags() const { return series().tags; }
+    
+private:
+    static uint32_t intern(std::string_view name, const Tags& tags) {
+        TagRefs refs(tags.begin(), tags.end());
+        return SeriesRegistry::global().intern(name, refs);
+    }
 };
 
 struct MetricBatch {
     std::vector<Metric> metrics;
     std::string source_id;
     Timestamp received_at;
+    uint64_t wal_lsn = 0;   // Phase 21: position in the write-ahead log, 0 if not logged
     
     MetricBatch() : received_at(std::chrono::system_clock::now()) {}
     
@@ -43,6 +63,14 @@ struct MetricBatch {
     
     size_t size() const { return metrics.size(); }
     bool empty() const { return metrics.empty(); }
+
+    // Ready for reuse: drops contents but keeps the vector's capacity
+    void clear() {
+        metrics.clear();
+        source_id.clear();
+        wal_lsn = 0;
+        received_at = std::chrono::system_clock::now();
+    }
 };
 
 } // namespace metricstream
\ No newline at end of file
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "ingestion_service.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace metricstream {
+
+// Phase 14: Background stage that drains the rate limiter's decision rings
+// on an interval, aggregates them per client and emits one JSON line per
+// active client ({"ts":...,"client":...,"allowed":...,"denied":...,
+// "dropped":...}). Each flush is formatted into a reused buffer and written
+// with a single write() to a file or socket.
+class DecisionExporter {
+public:
+    // Takes ownership of fd
+    DecisionExporter(RateLimiter& limiter, int fd,
+                     std::chrono::milliseconds interval = std::chrono::seconds(1));
+    ~DecisionExporter();
+
+    DecisionExporter(const DecisionExporter&) = delete;
+    DecisionExporter& operator=(const DecisionExporter&) = delete;
+
+    void start();
+    void stop();    // Flushes once more before returning
+
+    // Drain and write now; returns the number of client lines written
+    size_t flush();
+
+    uint64_t dropped_events() const { return dropped_events_.load(); }
+    uint64_t write_errors() const { return write_errors_.load(); }
+
+    // Opens (creating if needed) a file for appending; -1 on failure
+    static int open_file(const std::string& path);
+
+private:
+    RateLimiter& limiter_;
+    int fd_;
+    std::chrono::milliseconds interval_;
+
+    std::vector<ClientDecisionCounts> counts_;  // Reused between flushes
+    std::string buffer_;
+    std::mutex flush_mutex_;                    // flush() may race the thread
+
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool running_ = false;
+
+    std::atomic<uint64_t> dropped_events_{0};
+    std::atomic<uint64_t> write_errors_{0};
+
+    void run();
+    bool write_all(const std::string& data);
+};
+
+} // namespace metricstream
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "batch_pool.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace metricstream {
+
+// Phase 20: In-process partitioned log between ingestion and its consumers
+// (storage, alerting). Producers hash a key to a partition and append a
+// batch at the next offset of that partition; offsets only grow. Every
+// registered cursor reads every entry of every partition in offset order,
+// each at its own pace, so stages consume in parallel instead of sharing
+// one queue. An entry goes back to the batch pool once the last cursor has
+// read it; a partition is full when its slowest cursor is `capacity`
+// entries behind, and appends then fail (backpressure).
+//
+// Appends are lock-free (a CAS on the partition head). Each partition of a
+// cursor must be read by one thread at a time; readers that find nothing
+// can wait(). A consumer may split a cursor's partitions across threads
+// (thread k of n reads partitions k, k + n, ...) and pass the same split
+// to readable() and wait().
+class PartitionedLog {
+public:
+    static constexpr size_t MAX_CURSORS = 8;
+
+    // capacity per partition is rounded up to a power of two
+    PartitionedLog(size_t partitions, size_t capacity);
+    ~PartitionedLog();
+
+    PartitionedLog(const PartitionedLog&) = delete;
+    PartitionedLog& operator=(const PartitionedLog&) = delete;
+
+    // Register a consumer before the first append; returns its id
+    size_t add_cursor(std::string name);
+
+    size_t partition_for(std::string_view key) const;
+
+    // Moves the batch in on success; leaves it with the caller when the
+    // partition is full or the log is closed
+    bool append(size_t partition, PooledBatch& batch, uint64_t* offset = nullptr);
+
+    // Visit up to max_entries readable entries of one partition in order,
+    // as fn(const MetricBatch&, uint64_t offset), and advance the cursor.
+    // Returns the number visited.
+    template <typename F>
+    size_t poll(size_t cursor, size_t partition, size_t max_entries, F&& fn);
+
+    // poll() across every partition
+    template <typename F>
+    size_t poll_all(size_t cursor, size_t max_per_partition, F&& fn);
+
+    // Block until the cursor has something to read, the log is closed or
+    // the timeout passes. Returns whether anything is readable.
+    bool wait(size_t cursor, std::chrono::milliseconds timeout,
+              size_t first_partition = 0, size_t stride = 1);
+
+    // Refuse further appends and wake every waiter; entries already in the
+    // log stay readable
+    void close();
+    bool closed() const { return closed_.load(std::memory_order_acquire); }
+
+    bool readable(size_t cursor, size_t first_partition = 0, size_t stride = 1) const;
+
+    size_t partition_count() const { return partitions_.size(); }
+    size_t capacity() const { return mask_ + 1; }
+    size_t cursor_count() const { return cursor_count_; }
+    const std::string& cursor_name(size_t cursor) const { return waiters_[cursor]->name; }
+
+    uint64_t end_offset(size_t partition) const;
+    uint64_t cursor_offset(size_t cursor, size_t partition) const;
+    uint64_t lag(size_t cursor) const;   // Entries not yet read, all partitions
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> sequence{0};   // offset + 1 once published
+        std::atomic<uint32_t> readers{0};    // Cursors yet to read it
+        PooledBatch batch;
+    };
+
+    struct Partition {
+        explicit Partition(size_t capacity) : slots(new Slot[capacity]) {}
+
+        std::unique_ptr<Slot[]> slots;
+        alignas(64) std::atomic<uint64_t> head{0};                  // Next offset to claim
+        alignas(64) std::atomic<uint64_t> cursors[MAX_CURSORS] = {};  // Next offset to read
+    };
+
+    struct Waiter {
+        std::string name;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::atomic<int> sleepers{0};
+    };
+
+    std::vector<std::unique_ptr<Partition>> partitions_;
+    std::vector<std::unique_ptr<Waiter>> waiters_;
+    size_t mask_;
+    size_t cursor_count_ = 0;
+    std::atomic<bool> closed_{false};
+
+    uint64_t slowest_cursor(const Partition& partition) const;
+    void wake_readers();
+};
+
+template <typename F>
+size_t PartitionedLog::poll(size_t cursor, size_t partition, size_t max_entries, F&& fn) {
+    Partition& p = *partitions_[partition];
+    uint64_t offset = p.cursors[cursor].load(std::memory_order_relaxed);
+    size_t visited = 0;
+    while (visited < max_entries) {
+        Slot& slot = p.slots[offset & mask_];
+        if (slot.sequence.load(std::memory_order_acquire) != offset + 1) {
+            break;   // Not published yet
+        }
+        fn(static_cast<const MetricBatch&>(*slot.batch), offset);
+        // The last reader returns the batch to the pool before its cursor
+        // moves on, so a producer that sees every cursor past the slot can
+        // reuse it
+        if (slot.readers.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            slot.batch.reset();
+        }
+        offset++;
+        p.cursors[cursor].store(offset, std::memory_order_release);
+        visited++;
+    }
+    return visited;
+}
+
+template <typename F>
+size_t PartitionedLog::poll_all(size_t cursor, size_t max_per_partition, F&& fn) {
+    size_t visited = 0;
+    for (size_t i = 0; i < partitions_.size(); ++i) {
+        visited += poll(cursor, i, max_per_partition, fn);
+    }
+    return visited;
+}
+
+} // namespace metricstream
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+namespace metricstream {
+
+// Phase 13: Hot-path instrumentation. Probes compile to nothing unless the
+// build sets METRICSTREAM_PROFILING (cmake -DMETRICSTREAM_PROFILING=ON).
+// When enabled, each probe reads the cycle counter twice and bumps a bucket
+// in a histogram owned by the calling thread, so there is no shared write
+// and no I/O on the measured path; Profiler::report() merges all threads'
+// histograms from a monitoring thread.
+#ifdef METRICSTREAM_PROFILING
+constexpr bool PROFILING_ENABLED = true;
+#else
+constexpr bool PROFILING_ENABLED = false;
+#endif
+
+enum class Probe : uint8_t {
+    RATE_LIMIT_DECISION,     // RateLimiter::allow_request
+    RATE_LIMIT_LOCK_WAIT,    // Sliding window: waiting for the client mutex
+    RATE_LIMIT_CLEANUP,      // Sliding window: expiring old timestamps
+    JSON_PARSE,              // JsonBatchParser::parse
+    REQUEST_HANDLER,         // HttpServer::handle_request
+    COUNT
+};
+
+// Cycle counter: TSC on x86, the virtual counter on ARM64, else steady_clock
+inline uint64_t read_cycle_counter() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t value;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+    return value;
+#else
+    return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+// log2 buckets: bucket i counts samples in [2^i, 2^(i+1)) cycles
+struct ProbeHistogram {
+    static constexpr size_t BUCKETS = 40;
+
+    std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> total_cycles{0};
+    std::atomic<uint64_t> max_cycles{0};
+};
+
+struct ThreadProfile {
+    std::array<ProbeHistogram, static_cast<size_t>(Probe::COUNT)> probes;
+};
+
+class Profiler {
+public:
+    // The calling thread's histograms, registered on first use
+    static ThreadProfile& local() {
+        thread_local ThreadProfile* profile = register_thread();
+        return *profile;
+    }
+
+    static void record(Probe probe, uint64_t cycles) {
+        ProbeHistogram& h = local().probes[static_cast<size_t>(probe)];
+        size_t bucket = cycles == 0 ? 0 : 63 - static_cast<size_t>(__builtin_clzll(cycles));
+        if (bucket >= ProbeHistogram::BUCKETS) bucket = ProbeHistogram::BUCKETS - 1;
+
+        // Single writer per histogram: plain load/store instead of locked RMWs
+        auto bump = [](std::atomic<uint64_t>& v, uint64_t by) {
+            v.store(v.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+        };
+        bump(h.buckets[bucket], 1);
+        bump(h.count, 1);
+        bump(h.total_cycles, cycles);
+        if (cycles > h.max_cycles.load(std::memory_order_relaxed)) {
+            h.max_cycles.store(cycles, std::memory_order_relaxed);
+        }
+    }
+
+    // Merge every thread's histograms and print count/mean/p50/p99/max per
+    // probe. Call from a monitoring thread, never from a measured path.
+    static void report(std::ostream& out);
+
+    static const char* probe_name(Probe probe);
+
+private:
+    static ThreadProfile* register_thread();
+};
+
+// RAII probe; an empty object when profiling is compiled out
+template <bool Enabled>
+class BasicScopedProbe {
+public:
+    explicit BasicScopedProbe(Probe probe) : probe_(probe), start_(read_cycle_counter()) {}
+    ~BasicScopedProbe() { Profiler::record(probe_, read_cycle_counter() - start_); }
+
+    BasicScopedProbe(const BasicScopedProbe&) = delete;
+    BasicScopedProbe& operator=(const BasicScopedProbe&) = delete;
+
+private:
+    Probe probe_;
+    uint64_t start_;
+};
+
+template <>
+class BasicScopedProbe<false> {
+public:
+    explicit BasicScopedProbe(Probe) {}
+};
+
+// Usage: ScopedProbe probe(Probe::JSON_PARSE);
+using ScopedProbe = BasicScopedProbe<PROFILING_ENABLED>;
+
+} // namespace metricstream
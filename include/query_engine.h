@@ -0,0 +1,182 @@
+#pragma once
+
+#include "segment.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace metricstream {
+
+// Read-only view of consecutive points
+struct PointSpan {
+    const DataPoint* data = nullptr;
+    size_t size = 0;
+
+    const DataPoint* begin() const { return data; }
+    const DataPoint* end() const { return data + size; }
+    bool empty() const { return size == 0; }
+    const DataPoint& operator[](size_t i) const { return data[i]; }
+};
+
+struct SeriesQuery {
+    std::string name;                                        // Empty matches every name
+    std::vector<std::pair<std::string, std::string>> tags;   // All must match
+    int64_t start_ms = std::numeric_limits<int64_t>::min();
+    int64_t end_ms = std::numeric_limits<int64_t>::max();    // Inclusive
+};
+
+struct QueryAggregate {
+    uint64_t count = 0;
+    double sum = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+
+    double avg() const { return count ? sum / static_cast<double>(count) : 0.0; }
+    void add(double value) {
+        count++;
+        sum += value;
+        if (value < min) min = value;
+        if (value > max) max = value;
+    }
+    void merge(const QueryAggregate& other) {
+        count += other.count;
+        sum += other.sum;
+        if (other.min < min) min = other.min;
+        if (other.max > max) max = other.max;
+    }
+};
+
+// Phase 28: count/sum/min/max over a decoded block in four independent
+// lanes, so the adds and compares pipeline (and vectorize) instead of
+// waiting on one accumulator
+void aggregate_points(PointSpan points, QueryAggregate& agg);
+
+// Points of each matching series. The spans point into the result's own
+// buffer; the SeriesInfo pointers live as long as the engine.
+class QueryResult {
+public:
+    struct Series {
+        const SeriesInfo* info;
+        PointSpan points;
+    };
+
+    const std::vector<Series>& series() const { return series_; }
+    size_t point_count() const { return points_.size(); }
+
+private:
+    friend class QueryEngine;
+    std::vector<DataPoint> points_;
+    std::vector<Series> series_;
+};
+
+// Phase 18: Queries over a segment directory. Segments are memory-mapped
+// once and indexed in memory: an inverted index from metric name and from
+// each tag pair to series, and per series the time range of every block.
+// A range query intersects posting lists, then decodes only the blocks
+// that overlap the range, so its cost follows the data returned rather
+// than the history stored.
+//
+// Only blocks already written are visible; points still in a writer's open
+// blocks show up within SegmentWriter::Options::max_block_age.
+//
+// Thread-safe: queries share a reader lock, refresh() takes it exclusively.
+class QueryEngine {
+public:
+    using Visitor = std::function<void(const SeriesInfo&, PointSpan)>;
+
+    explicit QueryEngine(std::string directory);
+
+    // Map new segment files and pick up what unsealed ones have gained.
+    // Returns the number of blocks added to the index.
+    size_t refresh();
+
+    // Copy the points of every matching series in the range into one buffer
+    QueryResult query(const SeriesQuery& query) const;
+
+    // Zero-copy form: visit each overlapping block's in-range points, in
+    // block order per series. Returns the number of points visited.
+    size_t scan(const SeriesQuery& query, const Visitor& visit) const;
+
+    // One aggregate per matching series that has points in the range
+    std::vector<std::pair<const SeriesInfo*, QueryAggregate>>
+    aggregate(const SeriesQuery& query) const;
+
+    // Series matching name and tags, ignoring time
+    std::vector<const SeriesInfo*> match(const SeriesQuery& query) const;
+
+    // Earliest and latest timestamp of any indexed block; (max, min) if empty
+    std::pair<int64_t, int64_t> time_bounds() const;
+
+    // Bumped by every refresh() that indexes new blocks
+    uint64_t generation() const { return generation_.load(std::memory_order_acquire); }
+    // Earliest timestamp in blocks indexed after `generation`: results over
+    // ranges ending before it are unchanged. max() if nothing was added,
+    // min() if that generation is too old to tell.
+    int64_t earliest_change_since(uint64_t generation) const;
+
+    size_t segment_count() const;
+    size_t series_count() const;
+    size_t block_count() const;
+    uint64_t blocks_decoded() const { return blocks_decoded_.load(std::memory_order_relaxed); }
+
+private:
+    struct BlockRef {
+        uint32_t segment;
+        uint32_t block;      // Index into the segment's reader.blocks()
+        int64_t min_timestamp_ms;
+        int64_t max_timestamp_ms;
+    };
+
+    struct IndexedSeries {
+        SeriesInfo info;                 // id is the engine-wide id
+        std::vector<BlockRef> blocks;    // Sorted by min_timestamp_ms
+    };
+
+    struct Segment {
+        std::string path;
+        SegmentReader reader;
+        int64_t min_timestamp_ms = std::numeric_limits<int64_t>::max();
+        int64_t max_timestamp_ms = std::numeric_limits<int64_t>::min();
+        std::vector<uint32_t> series;    // Engine ids with blocks here
+    };
+
+    std::string directory_;
+    mutable std::shared_mutex mutex_;
+
+    std::vector<std::unique_ptr<Segment>> segments_;
+    std::unordered_map<std::string, uint32_t> segment_by_path_;
+
+    std::deque<IndexedSeries> series_;   // Deque: SeriesInfo addresses stay put
+    std::unordered_map<std::string, uint32_t> series_by_key_;
+    std::unordered_map<std::string, std::vector<uint32_t>> by_name_;   // Sorted ids
+    std::unordered_map<std::string, std::vector<uint32_t>> by_tag_;    // "key\0value"
+    size_t block_count_ = 0;
+    mutable std::atomic<uint64_t> blocks_decoded_{0};
+
+    // Recent refreshes as (generation, earliest new timestamp), oldest first
+    static constexpr size_t MAX_CHANGES = 64;
+    std::atomic<uint64_t> generation_{0};
+    std::deque<std::pair<uint64_t, int64_t>> changes_;
+
+    // Indexes blocks from first_new on as new; returns their earliest timestamp
+    int64_t index_segment(uint32_t segment_index, size_t first_new);
+    void unindex_segment(uint32_t segment_index);
+    uint32_t intern_series(const SeriesInfo& info);
+    std::vector<uint32_t> matching_ids(const SeriesQuery& query) const;
+
+    // Calls visit(points) for each overlapping block of one series
+    template <typename F>
+    size_t scan_series(const IndexedSeries& series, const SeriesQuery& query,
+                       std::vector<DataPoint>& scratch, F&& visit) const;
+};
+
+} // namespace metricstream
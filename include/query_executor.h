@@ -0,0 +1,91 @@
+#pragma once
+
+#include "query_engine.h"
+#include "thread_pool.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace metricstream {
+
+// Phase 28: Parallel aggregation over a QueryEngine. The range is cut into
+// buckets aligned to the step (or to bucket_ms without one), the buckets
+// are spread over a work-stealing pool, and the per-bucket aggregates are
+// merged per series. Buckets are also the cache unit: one that lies wholly
+// inside the range and ended settle_ms before now can no longer change, so
+// it is kept under (query, width, start) and a dashboard refreshing the
+// same panel only computes the buckets that are still open.
+//
+// Client timestamps are not in time order, and peers forward late batches
+// after an outage. When the engine indexes blocks older than what is
+// cached, every cached bucket from their earliest point on is dropped.
+class QueryExecutor {
+public:
+    struct Options {
+        size_t threads = 0;                   // 0: one per core
+        int64_t bucket_ms = 60000;            // Chunk and cache width when no step is given
+        int64_t settle_ms = 30000;            // Newer buckets may still have open blocks
+        size_t max_cached_buckets = 100000;   // Oldest entries go first
+    };
+
+    struct Series {
+        const SeriesInfo* info;
+        QueryAggregate total;
+        std::vector<std::pair<int64_t, QueryAggregate>> steps;   // Bucket start; only with a step
+    };
+
+    // Past this many buckets per query the width grows to keep it bounded
+    static constexpr size_t MAX_BUCKETS = 10000;
+
+    explicit QueryExecutor(const QueryEngine& engine);
+    QueryExecutor(const QueryEngine& engine, Options options);
+
+    QueryExecutor(const QueryExecutor&) = delete;
+    QueryExecutor& operator=(const QueryExecutor&) = delete;
+
+    // Series with points in the range, in engine order. step_ms > 0 also
+    // fills each series' steps with the non-empty step buckets.
+    std::vector<Series> aggregate(const SeriesQuery& query, int64_t step_ms = 0);
+
+    void clear_cache();
+
+    uint64_t buckets_computed() const { return buckets_computed_.load(std::memory_order_relaxed); }
+    uint64_t cache_hits() const { return cache_hits_.load(std::memory_order_relaxed); }
+    size_t cached_buckets() const;
+
+private:
+    using BucketResult = std::vector<std::pair<const SeriesInfo*, QueryAggregate>>;
+
+    struct CachedBucket {
+        BucketResult result;
+        int64_t end_ms;      // Inclusive
+    };
+
+    const QueryEngine& engine_;
+    Options options_;
+    std::unique_ptr<ThreadPool> pool_;
+
+    mutable std::mutex cache_mutex_;   // Guards the members down to cached_generation_
+    std::unordered_map<std::string, CachedBucket> cache_;
+    std::deque<std::string> cache_order_;   // May name entries already invalidated
+    int64_t newest_cached_end_ms_;
+    uint64_t cached_generation_;            // Engine generation the cache reflects
+
+    std::atomic<uint64_t> buckets_computed_{0};
+    std::atomic<uint64_t> cache_hits_{0};
+
+    // Drops buckets the engine's newly indexed blocks may have changed;
+    // returns the generation the cache now reflects
+    uint64_t sync_with_engine();
+    bool cache_lookup(const std::string& key, BucketResult& out);
+    void cache_store(std::string key, int64_t end_ms, const BucketResult& result, uint64_t generation);
+};
+
+} // namespace metricstream
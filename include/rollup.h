@@ -0,0 +1,228 @@
+#pragma once
+
+#include "metric.h"
+#include "query_engine.h"
+#include "sketch.h"
+#include "storage_sink.h"
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace metricstream {
+
+// Phase 27: Pre-aggregated series. Every accepted point is folded into a
+// 10 s, a 1 m and a 5 m bucket of its series (count, sum, min, max, last,
+// plus a QuantileSketch for HISTOGRAM and SUMMARY), and closed buckets are
+// written to one compact stream per resolution. A dashboard over a day
+// reads 288 5 m rollups per series instead of every raw point, and counters
+// get rate() from consecutive `last` values without touching raw data.
+struct RollupResolution {
+    std::string_view name;
+    int64_t ms;
+};
+
+constexpr size_t ROLLUP_RESOLUTION_COUNT = 3;
+constexpr std::array<RollupResolution, ROLLUP_RESOLUTION_COUNT> ROLLUP_RESOLUTIONS = {{
+    {"10s", 10000},
+    {"1m", 60000},
+    {"5m", 300000},
+}};
+
+// Index into ROLLUP_RESOLUTIONS, or ROLLUP_RESOLUTION_COUNT if unknown
+size_t rollup_resolution_index(std::string_view name);
+
+inline bool is_sketched(MetricType type) {
+    return type == MetricType::HISTOGRAM || type == MetricType::SUMMARY;
+}
+
+// One bucket of one series. Buckets are mergeable, so the same bucket may
+// be written more than once (late points reopen it) and readers add up
+// every record with the same start.
+struct RollupPoint {
+    int64_t start_ms = 0;
+    uint64_t count = 0;
+    double sum = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    double last = 0;
+    int64_t last_ms = std::numeric_limits<int64_t>::min();   // Timestamp of `last`
+    QuantileSketch sketch;                                    // Empty unless sketched
+
+    void add(int64_t timestamp_ms, double value, bool sketched);
+    void merge(const RollupPoint& other);
+    double avg() const { return count ? sum / static_cast<double>(count) : 0.0; }
+};
+
+// Per-second increase between consecutive buckets' `last`, treating a drop
+// as a counter reset. Points are (bucket start, rate); needs sorted input.
+std::vector<DataPoint> counter_rates(const std::vector<RollupPoint>& points);
+
+// Folds batches into open buckets and hands out the ones that have closed.
+// Time is the points' own timestamps; a bucket closes once the clock passed
+// to close() is `lateness` beyond its end. Single-threaded: each rollup
+// worker owns one and accumulates without locks; the writer merges what
+// several workers emit for the same bucket.
+class RollupAggregator {
+public:
+    using Emit = std::function<void(size_t resolution, uint32_t series_id, MetricType type,
+                                    const RollupPoint& point)>;
+
+    explicit RollupAggregator(std::chrono::milliseconds lateness = std::chrono::seconds(5))
+        : lateness_ms_(lateness.count()) {}
+
+    void add(const MetricBatch& batch);
+
+    // Emit and drop buckets that ended at least `lateness` before now_ms.
+    // Returns the number emitted.
+    size_t close(int64_t now_ms, const Emit& emit);
+    size_t close_all(const Emit& emit);
+
+    size_t open_buckets() const { return open_buckets_; }
+    uint64_t points_added() const { return points_added_; }
+
+    // Phase 34: Open buckets, for a checkpoint. load() merges saved buckets
+    // into these, mapping saved series ids through `ids` (saved id ->
+    // registry id); false, with nothing loaded, if the data is corrupt.
+    void save(std::string& out) const;
+    bool load(std::string_view data, const std::vector<uint32_t>& ids);
+
+private:
+    struct SeriesState {
+        MetricType type = MetricType::GAUGE;
+        std::array<std::vector<RollupPoint>, ROLLUP_RESOLUTION_COUNT> open;   // Usually one each
+        bool listed = false;
+    };
+
+    int64_t lateness_ms_;
+    std::vector<SeriesState> series_;   // By registry id
+    std::vector<uint32_t> active_;      // Series with open buckets
+    size_t open_buckets_ = 0;
+    uint64_t points_added_ = 0;
+    int64_t next_close_ms_ = std::numeric_limits<int64_t>::max();   // Earliest bucket deadline
+
+    size_t close_before(int64_t cutoff_ms, const Emit& emit);
+    RollupPoint& open_bucket(uint32_t series_id, MetricType type, size_t resolution, int64_t start);
+};
+
+// Writes rollup-<resolution>-<sequence>.rlp files into a directory: one
+// open file per resolution, rolled over once it passes max_file_bytes and
+// on every restart. Layout, all integers little-endian:
+//
+//   header   "MSRLP001", u32 version, u32 resolution ms
+//   records  u8 type, u32 payload length, payload, u32 crc32c(type, payload)
+//     SERIES  u32 id, u8 metric type, str name, u16 n, n x (str key, str value)
+//     ROLLUP  u32 series id, i64 start ms, u64 count, f64 sum, f64 min, f64 max,
+//             f64 last, i64 last ms, sketch bytes (rest of the payload, if any)
+//
+// Series ids are local to the file, as in segments. A file cut short by a
+// crash is read up to the first record that fails its checksum.
+constexpr std::string_view ROLLUP_MAGIC = "MSRLP001";
+constexpr uint32_t ROLLUP_VERSION = 1;
+constexpr size_t ROLLUP_HEADER_SIZE = 16;
+
+enum class RollupRecord : uint8_t {
+    SERIES = 1,
+    ROLLUP = 2
+};
+
+class RollupWriter {
+public:
+    struct Options {
+        std::string directory = "rollups";
+        size_t max_file_bytes = 64 * 1024 * 1024;
+        FsyncPolicy fsync;
+    };
+
+    explicit RollupWriter(Options options);
+    ~RollupWriter();   // Commits and syncs
+
+    RollupWriter(const RollupWriter&) = delete;
+    RollupWriter& operator=(const RollupWriter&) = delete;
+
+    bool is_open() const { return usable_; }
+
+    // Stage one closed bucket of a registry series. Several aggregators may
+    // append concurrently; buckets with the same series, resolution and
+    // start staged before the next commit() are merged into one record.
+    void append(size_t resolution, uint32_t series_id, MetricType type, const RollupPoint& point);
+
+    // Encode what is staged and write it, one write() per stream
+    bool commit();
+
+    // commit() and fsync regardless of the policy
+    bool flush();
+
+    uint64_t rollups_written() const;
+    uint64_t write_errors() const;
+
+private:
+    struct Stream {
+        explicit Stream(FsyncPolicy policy) : file(policy) {}
+
+        AppendFile file;
+        std::string path;
+        std::string pending;
+        uint64_t written = 0;             // Bytes in the current file
+        std::vector<uint32_t> file_ids;   // Registry id -> id in this file
+        uint32_t next_id = 0;
+    };
+
+    struct StagedKey {
+        uint32_t series_id;
+        uint32_t resolution;
+        int64_t start_ms;
+
+        bool operator==(const StagedKey& other) const {
+            return series_id == other.series_id && resolution == other.resolution &&
+                   start_ms == other.start_ms;
+        }
+    };
+    struct StagedKeyHash {
+        size_t operator()(const StagedKey& key) const {
+            uint64_t h = (static_cast<uint64_t>(key.series_id) << 2 | key.resolution) * 0x9E3779B97F4A7C15ULL;
+            return static_cast<size_t>(h ^ static_cast<uint64_t>(key.start_ms));
+        }
+    };
+    struct Staged {
+        MetricType type;
+        RollupPoint point;
+    };
+
+    Options options_;
+    bool usable_ = true;
+    mutable std::mutex mutex_;   // Guards everything below
+    uint64_t sequence_ = 1;
+    std::array<std::unique_ptr<Stream>, ROLLUP_RESOLUTION_COUNT> streams_;
+    std::unordered_map<StagedKey, Staged, StagedKeyHash> staged_;
+    uint64_t rollups_written_ = 0;
+    uint64_t open_errors_ = 0;
+
+    bool ensure_file(size_t resolution);
+    uint32_t file_series(Stream& stream, uint32_t series_id, MetricType type);
+    void encode(size_t resolution, uint32_t series_id, MetricType type, const RollupPoint& point);
+    bool commit_locked();
+};
+
+// Rollups of every matching series in the range, bucket starts within
+// [query.start_ms, query.end_ms], merged across files and sorted by start
+struct RollupSeries {
+    SeriesInfo info;
+    std::vector<RollupPoint> points;
+};
+
+std::vector<RollupSeries> query_rollups(const std::string& directory, size_t resolution,
+                                        const SeriesQuery& query);
+
+// Rollup files of one resolution in a directory, oldest first
+std::vector<std::string> list_rollup_files(const std::string& directory, size_t resolution);
+
+} // namespace metricstream
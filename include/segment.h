@@ -0,0 +1,212 @@
+#pragma once
+
+#include "common.h"
+#include "gorilla.h"
+#include "metric.h"
+#include "storage_sink.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace metricstream {
+
+// Phase 17: Binary columnar segments. Points are grouped per series (metric
+// name + sorted tags) into Gorilla-compressed blocks; a sealed segment ends
+// with an index of every series and block so readers can seek straight to
+// the blocks they need. Layout, all integers little-endian:
+//
+//   header   "MSSEG001", u32 version, u32 reserved
+//   records  u8 type, u32 payload length, payload, u32 crc32c(type, payload)
+//     SERIES   u32 id, u8 metric type, str name, u16 n, n x (str key, str value)
+//     BLOCK    u32 series id, u32 count, i64 min ts, i64 max ts, Gorilla bytes
+//     INDEX    u32 n, n x (u32 series id, u64 SERIES offset),
+//              u32 m, m x (u32 series id, u32 count, i64 min ts, i64 max ts,
+//                          u64 BLOCK offset)
+//   trailer  u64 INDEX offset, "MSSEGIDX"   (sealed segments only)
+//
+// Strings are a u16 length and the bytes; timestamps are epoch milliseconds.
+// A segment cut short by a crash has no trailer; readers recover it by
+// scanning records up to the first one that fails its checksum.
+constexpr std::string_view SEGMENT_MAGIC = "MSSEG001";
+constexpr std::string_view SEGMENT_TRAILER_MAGIC = "MSSEGIDX";
+constexpr uint32_t SEGMENT_VERSION = 1;
+constexpr size_t SEGMENT_HEADER_SIZE = 16;
+constexpr size_t SEGMENT_TRAILER_SIZE = 16;
+constexpr size_t SEGMENT_RECORD_OVERHEAD = 9;
+
+enum class SegmentRecord : uint8_t {
+    SERIES = 1,
+    BLOCK = 2,
+    INDEX = 3
+};
+
+struct SeriesInfo {
+    uint32_t id = 0;
+    MetricType type = MetricType::GAUGE;
+    std::string name;
+    std::vector<std::pair<std::string, std::string>> tags;   // Sorted by key
+};
+
+struct BlockInfo {
+    uint32_t series_id = 0;
+    uint32_t count = 0;
+    int64_t min_timestamp_ms = 0;
+    int64_t max_timestamp_ms = 0;
+    uint64_t offset = 0;    // Of the BLOCK record in its segment
+};
+
+struct DataPoint {
+    int64_t timestamp_ms;
+    double value;
+};
+
+// Writes segment-<sequence>.seg files into a directory, rolling over to a
+// new file once the current one passes max_segment_bytes. Single-threaded:
+// owned by the async writer thread.
+class SegmentWriter : public StorageSink {
+public:
+    struct Options {
+        std::string directory = "segments";
+        size_t max_segment_bytes = 64 * 1024 * 1024;
+        uint32_t block_points = 1024;                    // Seal a block at this many points
+        std::chrono::milliseconds max_block_age{10000};  // ...or at a commit once this old
+        FsyncPolicy fsync;
+    };
+
+    explicit SegmentWriter(Options options);
+    ~SegmentWriter() override;   // Seals open blocks and the current segment
+
+    SegmentWriter(const SegmentWriter&) = delete;
+    SegmentWriter& operator=(const SegmentWriter&) = delete;
+
+    bool is_open() const override { return usable_; }
+
+    // Encode points into their series' open blocks
+    void append(const MetricBatch& batch) override;
+
+    // Seal blocks past max_block_age, write all finished records with one
+    // write() and roll the segment if it is full
+    bool commit() override;
+
+    // Besides the fsync policy, wakes the writer when an open block is due
+    // to be sealed, so idle series still reach the disk
+    std::chrono::milliseconds sync_if_due() override;
+    bool wants_timed_sync() const override {
+        return file_.wants_timed_sync() || !open_blocks_.empty();
+    }
+
+    // Seals every open block (the segment itself stays open)
+    bool flush() override;
+
+    // Seal every open block, write the index and close the current segment;
+    // the next append starts a new file
+    bool roll();
+
+    const std::string& current_path() const { return path_; }
+    size_t series_count() const { return series_.size(); }
+    uint64_t points_written() const { return points_written_; }
+    uint64_t blocks_written() const { return blocks_written_; }
+    uint64_t segments_sealed() const { return segments_sealed_; }
+    uint64_t bytes_written() const { return file_.bytes_written(); }
+    uint64_t write_errors() const { return file_.write_errors() + open_errors_; }
+
+private:
+    struct Series {
+        SeriesInfo info;
+        GorillaEncoder block;
+        int64_t min_timestamp_ms = 0;
+        int64_t max_timestamp_ms = 0;
+        std::chrono::steady_clock::time_point opened{};
+        bool in_segment = false;   // SERIES record written to the current file
+        bool listed = false;       // In open_blocks_
+    };
+
+    Options options_;
+    AppendFile file_;
+    std::string path_;
+    bool usable_ = true;
+    uint64_t next_sequence_ = 1;
+
+    // Current segment: bytes already written, records still buffered, and
+    // the offsets its index will list
+    uint64_t segment_written_ = 0;
+    std::string pending_;
+    std::vector<std::pair<uint32_t, uint64_t>> series_offsets_;
+    std::vector<BlockInfo> blocks_;
+
+    // Series dictionary: registry id -> id (index into series_)
+    static constexpr uint32_t NO_SERIES = UINT32_MAX;
+    std::vector<uint32_t> series_ids_;
+    std::vector<Series> series_;
+    std::vector<uint32_t> open_blocks_;   // Series with points not yet sealed
+    std::chrono::steady_clock::time_point oldest_open_{};
+
+    uint64_t points_written_ = 0;
+    uint64_t blocks_written_ = 0;
+    uint64_t segments_sealed_ = 0;
+    uint64_t open_errors_ = 0;
+
+    bool ensure_segment();
+    uint32_t series_for(const Metric& metric);
+    void write_series_record(Series& series);
+    void seal_block(Series& series);
+    size_t begin_record(SegmentRecord type);
+    void end_record(size_t start);
+    bool flush_pending();
+};
+
+// Reads one segment file, sealed or recovered. The file is memory-mapped;
+// blocks are decoded straight from the mapping.
+class SegmentReader {
+public:
+    // False (with error() set) if the file cannot be read or is not a segment
+    bool open(const std::string& path);
+
+    // Unsealed segments only: remap and pick up records appended since the
+    // last open/refresh (or the index, once sealed). Returns whether the
+    // series or blocks changed.
+    bool refresh();
+
+    // Whether the index trailer was present; otherwise the series and
+    // blocks came from a record scan
+    bool sealed() const { return sealed_; }
+
+    const std::vector<SeriesInfo>& series() const { return series_; }
+    const std::vector<BlockInfo>& blocks() const { return blocks_; }
+    const SeriesInfo* find_series(uint32_t id) const;
+
+    // Decode a block, appending its points to out
+    bool read_block(const BlockInfo& block, std::vector<DataPoint>& out) const;
+
+    const std::string& error() const { return error_; }
+
+private:
+    std::string path_;
+    MappedFile file_;
+    std::string_view data_;
+    bool sealed_ = false;
+    uint64_t scan_offset_ = 0;   // First record not yet scanned (unsealed only)
+    std::vector<SeriesInfo> series_;
+    std::vector<BlockInfo> blocks_;
+    std::unordered_map<uint32_t, size_t> series_by_id_;
+    std::string error_;
+
+    bool read_record(uint64_t offset, SegmentRecord& type, std::string_view& payload,
+                     uint64_t* next = nullptr) const;
+    bool map_and_check();
+    bool try_load_index();
+    bool load_index(uint64_t index_offset);
+    bool scan_records();
+    bool add_series(std::string_view payload);
+    bool add_block(std::string_view payload, uint64_t offset);
+};
+
+// Segment files in a directory, oldest first
+std::vector<std::string> list_segment_files(const std::string& directory);
+
+} // namespace metricstream
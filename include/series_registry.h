@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace metricstream {
+
+// Tags of one series, sorted by key, keys unique
+using TagList = std::vector<std::pair<std::string, std::string>>;
+
+// Unsorted (key, value) views handed to intern(); later duplicates win
+using TagRef = std::pair<std::string_view, std::string_view>;
+using TagRefs = std::vector<TagRef>;
+
+struct SeriesKey {
+    std::string name;
+    TagList tags;
+    std::string canonical;   // name, then each key and value, NUL-separated
+
+    // Value of a tag, nullptr if the series does not have it
+    const std::string* tag(std::string_view key) const;
+};
+
+// Phase 35: Caps how many series intern() may create on this thread while
+// in scope, so one client's tag explosion cannot fill the registry. Past the
+// cap, a series that does not exist yet is refused: it maps to OVERFLOW_ID,
+// or with strip_tags to the series of its name alone, which is created if
+// need be. Scopes nest; the innermost applies.
+class ScopedSeriesBudget {
+public:
+    ScopedSeriesBudget(size_t allowed, bool strip_tags);
+    ~ScopedSeriesBudget();
+
+    ScopedSeriesBudget(const ScopedSeriesBudget&) = delete;
+    ScopedSeriesBudget& operator=(const ScopedSeriesBudget&) = delete;
+
+    size_t created() const { return created_; }
+    size_t refused() const { return refused_; }
+
+private:
+    friend class SeriesRegistry;
+
+    ScopedSeriesBudget* previous_;
+    size_t allowed_;
+    bool strip_tags_;
+    size_t created_ = 0;
+    size_t refused_ = 0;
+};
+
+// Phase 22: Process-wide intern table for series (metric name plus tag
+// set). Agents resend the same few thousand series, so a metric carries a
+// 32-bit id instead of owning its name and a map of tags: the strings are
+// stored once, here. Ids are dense, never reused, and their keys never
+// move, so key(id) is a lock-free array lookup valid for the process
+// lifetime. Interning an existing series takes a shared lock on one of
+// SHARDS shards and does not allocate.
+class SeriesRegistry {
+public:
+    static constexpr size_t SHARDS = 64;
+    static constexpr size_t CHUNK_SIZE = 4096;
+    static constexpr size_t MAX_CHUNKS = 4096;   // 16M series
+    static constexpr uint32_t OVERFLOW_ID = 0;   // Shared by series past the limit
+
+    SeriesRegistry();
+    ~SeriesRegistry();
+
+    SeriesRegistry(const SeriesRegistry&) = delete;
+    SeriesRegistry& operator=(const SeriesRegistry&) = delete;
+
+    static SeriesRegistry& global();
+
+    uint32_t intern(std::string_view name, const TagRef* tags, size_t count);
+    uint32_t intern(std::string_view name, const TagRefs& tags) {
+        return intern(name, tags.data(), tags.size());
+    }
+    uint32_t intern(std::string_view name, const TagList& tags);
+
+    // id must come from intern()
+    const SeriesKey& key(uint32_t id) const {
+        return chunks_[id / CHUNK_SIZE].load(std::memory_order_acquire)[id % CHUNK_SIZE];
+    }
+
+    size_t size() const { return next_id_.load(std::memory_order_acquire); }
+
+    // Phase 34: Bulk-load series saved by a checkpoint, canonicals[i]
+    // becoming id i + 1, on several threads. Only into a registry holding
+    // nothing but the overflow series; false otherwise, or if a string is
+    // not canonical, and the registry is left as it was.
+    bool restore(const std::vector<std::string_view>& canonicals);
+
+    // Phase 34: Name and tags (views into canonical) of a canonical string
+    static bool split_canonical(std::string_view canonical, std::string_view& name, TagRefs& tags);
+
+private:
+    struct Shard {
+        std::shared_mutex mutex;
+        std::unordered_map<std::string_view, uint32_t> ids;   // Views into SeriesKey::canonical
+    };
+
+    std::unique_ptr<Shard[]> shards_;
+    std::unique_ptr<std::atomic<SeriesKey*>[]> chunks_;
+    std::mutex alloc_mutex_;   // Assigning ids and allocating chunks
+    std::atomic<uint32_t> next_id_{0};
+
+    uint32_t intern_sorted(std::string_view name, const TagRefs& sorted);
+    static size_t shard_for(std::string_view canonical);
+    SeriesKey* slot(uint32_t id);
+};
+
+} // namespace metricstream
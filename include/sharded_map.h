@@ -0,0 +1,427 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace metricstream {
+
+// Epoch-based reclamation for lock-free readers. A reader pins the current
+// epoch while it uses shared memory; a writer that unlinks something stamps
+// it with an epoch and frees it once every pinned reader is past that
+// stamp. Pins nest, and pinning costs one store and a fence on a cache line
+// the thread owns. Thread records are reused after their thread exits.
+class Epoch {
+public:
+    class Guard {
+    public:
+        Guard() { pin(); }
+        ~Guard() { unpin(); }
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    };
+
+    // For holders that outlive a scope (see ShardedMap::Ref); Guard otherwise
+    static void pin() {
+        Record& r = local();
+        if (r.depth++ == 0) {
+            // Pairs with oldest_pinned(): either the writer sees this pin, or
+            // this reader's loads see the writer's unlink
+            r.pinned.store(counter_.load(std::memory_order_acquire), std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    static void unpin() {
+        Record& r = local();
+        if (--r.depth == 0) {
+            r.pinned.store(0, std::memory_order_release);
+        }
+    }
+
+    // Stamps something just unlinked: free it once oldest_pinned() > stamp
+    static uint64_t retire_stamp() {
+        return counter_.fetch_add(1, std::memory_order_seq_cst);
+    }
+
+    // Lowest epoch any reader is pinned at, or the maximum when none is
+    static uint64_t oldest_pinned() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t oldest = std::numeric_limits<uint64_t>::max();
+        for (Record* r = records_.load(std::memory_order_acquire); r != nullptr; r = r->next) {
+            uint64_t pinned = r->pinned.load(std::memory_order_seq_cst);
+            if (pinned != 0 && pinned < oldest) {
+                oldest = pinned;
+            }
+        }
+        return oldest;
+    }
+
+private:
+    struct alignas(64) Record {
+        std::atomic<uint64_t> pinned{0};    // 0 while the thread holds nothing
+        std::atomic<bool> in_use{true};
+        Record* next = nullptr;             // Records are never freed
+        size_t depth = 0;                   // Owner thread only
+    };
+
+    // Claims a record for this thread, and gives it back when the thread exits
+    struct Owner {
+        Record* record;
+
+        Owner() {
+            for (Record* r = records_.load(std::memory_order_acquire); r != nullptr; r = r->next) {
+                bool free = false;
+                if (r->in_use.compare_exchange_strong(free, true, std::memory_order_acquire)) {
+                    record = r;
+                    return;
+                }
+            }
+            record = new Record();
+            Record* head = records_.load(std::memory_order_relaxed);
+            do {
+                record->next = head;
+            } while (!records_.compare_exchange_weak(head, record, std::memory_order_release,
+                                                     std::memory_order_relaxed));
+        }
+
+        ~Owner() { record->in_use.store(false, std::memory_order_release); }
+    };
+
+    static Record& local() {
+        thread_local Owner owner;
+        return *owner.record;
+    }
+
+    static inline std::atomic<uint64_t> counter_{1};
+    static inline std::atomic<Record*> records_{nullptr};
+};
+
+// Phase 12: Concurrent string-keyed map for per-client state. Shards are
+// open-addressing tables sized up front, so lookups are lock-free (acquire
+// loads and a key compare) and only the first sighting of a key takes its
+// shard's mutex.
+//
+// Memory is bounded: once a shard holds its share of `capacity` keys, a new
+// key evicts the shard's least recently used one, picked by a CLOCK sweep
+// (a hit sets the entry's referenced bit; the sweep clears set bits and
+// takes the first entry found clear). Lookups hand out a Ref that pins the
+// epoch, so an evicted entry is only freed once no Ref can reach it.
+template <typename V>
+class ShardedMap {
+    struct Entry;
+
+public:
+    static constexpr size_t DEFAULT_SHARDS = 64;
+
+    // A value plus the pin that keeps it alive; empty when nothing was found
+    class Ref {
+    public:
+        Ref() = default;
+        Ref(Ref&& other) noexcept
+            : value_(std::exchange(other.value_, nullptr)), pinned_(std::exchange(other.pinned_, false)) {}
+        Ref& operator=(Ref&& other) noexcept {
+            if (this != &other) {
+                release();
+                value_ = std::exchange(other.value_, nullptr);
+                pinned_ = std::exchange(other.pinned_, false);
+            }
+            return *this;
+        }
+        Ref(const Ref&) = delete;
+        Ref& operator=(const Ref&) = delete;
+        ~Ref() { release(); }
+
+        explicit operator bool() const { return value_ != nullptr; }
+        V& operator*() const { return *value_; }
+        V* operator->() const { return value_; }
+
+    private:
+        friend class ShardedMap;
+
+        static Ref pinned() {
+            Ref ref;
+            Epoch::pin();
+            ref.pinned_ = true;
+            return ref;
+        }
+
+        void release() {
+            if (pinned_) {
+                Epoch::unpin();
+                pinned_ = false;
+            }
+            value_ = nullptr;
+        }
+
+        V* value_ = nullptr;
+        bool pinned_ = false;
+    };
+
+    explicit ShardedMap(size_t capacity, size_t shard_count = DEFAULT_SHARDS) {
+        size_t shards = 1;
+        while (shards < shard_count) shards <<= 1;
+        shard_mask_ = shards - 1;
+
+        size_t per_shard = (capacity + shards - 1) / shards;
+        if (per_shard == 0) per_shard = 1;
+        // Keep tables at most half full so probe sequences stay short
+        size_t slots = 2;
+        while (slots < per_shard * 2) slots <<= 1;
+
+        shards_.reserve(shards);
+        for (size_t i = 0; i < shards; ++i) {
+            shards_.push_back(std::make_unique<Shard>(slots, per_shard));
+        }
+    }
+
+    ShardedMap(const ShardedMap&) = delete;
+    ShardedMap& operator=(const ShardedMap&) = delete;
+
+    // Lock-free; empty if key is not in the map
+    Ref find(std::string_view key) const {
+        Ref ref = Ref::pinned();
+        size_t hash = hash_key(key);
+        if (Entry* entry = lookup(shard_for(hash), hash, key)) {
+            ref.value_ = &entry->value;
+            return ref;
+        }
+        return Ref();
+    }
+
+    // Existing entry, or a new one (evicting another when the shard is full)
+    Ref get_or_insert(std::string_view key) {
+        Ref ref = Ref::pinned();
+        size_t hash = hash_key(key);
+        Shard& shard = shard_for(hash);
+        if (Entry* entry = lookup(shard, hash, key)) {
+            ref.value_ = &entry->value;
+            return ref;
+        }
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        // Re-probe under the lock: another thread may have inserted it
+        if (Entry* entry = lookup(shard, hash, key)) {
+            ref.value_ = &entry->value;
+            return ref;
+        }
+
+        reclaim(shard);
+        if (shard.used >= shard.max_entries) {
+            evict_one(shard);
+        }
+        if (shard.tombstones > shard.max_entries / 2) {
+            rebuild(shard);
+        }
+
+        Entry* entry = new Entry(hash, key);
+        Table& table = *shard.table.load(std::memory_order_relaxed);
+        size_t i = slot_index(hash, table.mask);
+        while (true) {
+            Entry* current = table.slots[i].load(std::memory_order_relaxed);
+            if (current == nullptr || current == tombstone()) {
+                if (current == tombstone()) shard.tombstones--;
+                break;
+            }
+            i = (i + 1) & table.mask;
+        }
+        table.slots[i].store(entry, std::memory_order_release);
+        shard.used++;
+        size_.fetch_add(1, std::memory_order_relaxed);
+        ref.value_ = &entry->value;
+        return ref;
+    }
+
+    // Visits every entry without locking; entries inserted or evicted
+    // concurrently may or may not be seen
+    template <typename F>
+    void for_each(F&& fn) const {
+        Epoch::Guard guard;
+        for (const auto& shard : shards_) {
+            const Table& table = *shard->table.load(std::memory_order_acquire);
+            for (size_t i = 0; i <= table.mask; ++i) {
+                Entry* entry = table.slots[i].load(std::memory_order_acquire);
+                if (entry != nullptr && entry != tombstone()) {
+                    fn(entry->key, entry->value);
+                }
+            }
+        }
+    }
+
+    size_t size() const { return size_.load(std::memory_order_relaxed); }
+    uint64_t evictions() const { return evictions_.load(std::memory_order_relaxed); }
+
+private:
+    struct Entry {
+        Entry(size_t h, std::string_view k) : hash(h), key(k), value() {}
+
+        size_t hash;
+        std::string key;
+        // CLOCK bit: hit since the last sweep. Clear at first, so a flood of
+        // one-off keys evicts each other before any key seen twice.
+        std::atomic<bool> referenced{false};
+        V value;
+    };
+
+    // Replaced wholesale when tombstones pile up, so readers never see a
+    // table being reorganised
+    struct Table {
+        explicit Table(size_t slot_count)
+            : slots(new std::atomic<Entry*>[slot_count]), mask(slot_count - 1) {
+            for (size_t i = 0; i < slot_count; ++i) {
+                slots[i].store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+        std::unique_ptr<std::atomic<Entry*>[]> slots;
+        size_t mask;
+    };
+
+    // Unlinked, waiting for readers that may still hold it to unpin
+    struct Retired {
+        uint64_t stamp;
+        Entry* entry;
+        Table* table;
+    };
+
+    struct Shard {
+        Shard(size_t slot_count, size_t max) : table(new Table(slot_count)), max_entries(max) {}
+
+        ~Shard() {
+            Table* current = table.load(std::memory_order_relaxed);
+            for (size_t i = 0; i <= current->mask; ++i) {
+                Entry* entry = current->slots[i].load(std::memory_order_relaxed);
+                if (entry != tombstone()) delete entry;
+            }
+            delete current;
+            for (const Retired& r : retired) {
+                delete r.entry;
+                delete r.table;
+            }
+        }
+
+        std::atomic<Table*> table;
+        size_t max_entries;
+        size_t used = 0;                    // Guarded by mutex, as is everything below
+        size_t tombstones = 0;
+        size_t hand = 0;                    // CLOCK position
+        std::vector<Retired> retired;
+        mutable std::mutex mutex;
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    size_t shard_mask_ = 0;
+    std::atomic<size_t> size_{0};
+    std::atomic<uint64_t> evictions_{0};
+
+    // Marks an evicted entry's slot so probes for keys past it continue
+    static Entry* tombstone() {
+        return reinterpret_cast<Entry*>(alignof(Entry));
+    }
+
+    // Caller holds an epoch pin (or the shard mutex)
+    static Entry* lookup(const Shard& shard, size_t hash, std::string_view key) {
+        const Table& table = *shard.table.load(std::memory_order_acquire);
+        size_t mask = table.mask;
+        for (size_t i = slot_index(hash, mask), probes = 0; probes <= mask; i = (i + 1) & mask, ++probes) {
+            Entry* entry = table.slots[i].load(std::memory_order_acquire);
+            if (entry == nullptr) {
+                return nullptr;
+            }
+            if (entry != tombstone() && entry->hash == hash && entry->key == key) {
+                // Load first: a hot entry's cache line is not written on every hit
+                if (!entry->referenced.load(std::memory_order_relaxed)) {
+                    entry->referenced.store(true, std::memory_order_relaxed);
+                }
+                return entry;
+            }
+        }
+        return nullptr;
+    }
+
+    void evict_one(Shard& shard) {
+        Table& table = *shard.table.load(std::memory_order_relaxed);
+        // Two laps: the first may only clear referenced bits
+        for (size_t step = 0; step <= 2 * table.mask + 1; ++step) {
+            size_t i = shard.hand;
+            shard.hand = (shard.hand + 1) & table.mask;
+            Entry* entry = table.slots[i].load(std::memory_order_relaxed);
+            if (entry == nullptr || entry == tombstone()) {
+                continue;
+            }
+            if (entry->referenced.exchange(false, std::memory_order_relaxed)) {
+                continue;
+            }
+            table.slots[i].store(tombstone(), std::memory_order_release);
+            shard.retired.push_back({Epoch::retire_stamp(), entry, nullptr});
+            shard.used--;
+            shard.tombstones++;
+            size_.fetch_sub(1, std::memory_order_relaxed);
+            evictions_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    // Same size, live entries only; the old table goes once readers leave it
+    void rebuild(Shard& shard) {
+        Table* old = shard.table.load(std::memory_order_relaxed);
+        Table* fresh = new Table(old->mask + 1);
+        for (size_t i = 0; i <= old->mask; ++i) {
+            Entry* entry = old->slots[i].load(std::memory_order_relaxed);
+            if (entry == nullptr || entry == tombstone()) {
+                continue;
+            }
+            size_t j = slot_index(entry->hash, fresh->mask);
+            while (fresh->slots[j].load(std::memory_order_relaxed) != nullptr) {
+                j = (j + 1) & fresh->mask;
+            }
+            fresh->slots[j].store(entry, std::memory_order_relaxed);
+        }
+        shard.table.store(fresh, std::memory_order_release);
+        shard.retired.push_back({Epoch::retire_stamp(), nullptr, old});
+        shard.tombstones = 0;
+    }
+
+    static void reclaim(Shard& shard) {
+        if (shard.retired.empty()) {
+            return;
+        }
+        uint64_t oldest = Epoch::oldest_pinned();
+        size_t kept = 0;
+        for (const Retired& r : shard.retired) {
+            if (r.stamp < oldest) {
+                delete r.entry;
+                delete r.table;
+            } else {
+                shard.retired[kept++] = r;
+            }
+        }
+        shard.retired.resize(kept);
+    }
+
+    static size_t hash_key(std::string_view key) {
+        return std::hash<std::string_view>{}(key);
+    }
+
+    // High bits pick the shard, low bits the slot, so the two stay independent
+    const Shard& shard_for(size_t hash) const {
+        return *shards_[(hash >> (sizeof(size_t) * 8 - 16)) & shard_mask_];
+    }
+    Shard& shard_for(size_t hash) {
+        return *shards_[(hash >> (sizeof(size_t) * 8 - 16)) & shard_mask_];
+    }
+
+    static size_t slot_index(size_t hash, size_t mask) {
+        return hash & mask;
+    }
+};
+
+} // namespace metricstream
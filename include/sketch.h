@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace metricstream {
+
+// Phase 27: Mergeable quantile sketch (DDSketch). A value v > 0 is counted
+// in bin ceil(log_gamma(v)), gamma = (1 + a) / (1 - a), so any quantile it
+// reports is within relative error a of a value that was added. Bins are
+// plain counts, which makes merging two sketches (two rollup buckets, two
+// threads) an exact element-wise sum. Negative values mirror positive ones;
+// magnitudes under MIN_INDEXABLE count as zero, and NaN and infinities are
+// ignored.
+//
+// Bounded: past MAX_BINS bins per sign the lowest bins are folded together,
+// trading accuracy on the smallest values only. With a = 1% that happens
+// beyond a ~1e18 spread, so in practice never.
+class QuantileSketch {
+public:
+    static constexpr double RELATIVE_ACCURACY = 0.01;
+    static constexpr double MIN_INDEXABLE = 1e-9;
+    static constexpr size_t MAX_BINS = 2048;
+
+    void add(double value, uint64_t n = 1);
+    void merge(const QuantileSketch& other);
+    void clear();
+
+    // Value at rank q * (count - 1), q in [0, 1]; NaN when empty
+    double quantile(double q) const;
+
+    uint64_t count() const { return count_; }
+    bool empty() const { return count_ == 0; }
+    double sum() const { return sum_; }
+    double min() const { return min_; }
+    double max() const { return max_; }
+    size_t bin_count() const { return positive_.bins.size() + negative_.bins.size(); }
+
+    // Compact form for storage: varint bin indexes and counts
+    void serialize(std::string& out) const;
+    // Replaces this sketch; false (and empty) on malformed input
+    bool deserialize(std::string_view data);
+
+private:
+    struct Store {
+        int32_t offset = 0;            // Index of bins[0]
+        std::vector<uint64_t> bins;
+
+        void add(int32_t index, uint64_t n);
+        void merge(const Store& other);
+    };
+
+    Store positive_;
+    Store negative_;                   // Indexed by magnitude
+    uint64_t zero_count_ = 0;
+    uint64_t count_ = 0;
+    double sum_ = 0;
+    double min_ = std::numeric_limits<double>::infinity();
+    double max_ = -std::numeric_limits<double>::infinity();
+
+    static int32_t index_of(double magnitude);
+    static double value_of(int32_t index);
+};
+
+// Phase 35: HyperLogLog distinct counter in fixed memory: 2^PRECISION
+// registers of one byte, each the highest rank (leading zeros + 1) seen
+// among hashes routed to it, for a standard error of 1.04 / sqrt(1024),
+// about 3%. add() is one relaxed load, plus a CAS only when it raises a
+// register, and is safe from any number of threads. The harmonic sum the
+// estimate needs is kept up to date as registers rise, so estimate() is
+// O(1) too. Hashes must already be well mixed.
+class HyperLogLog {
+public:
+    static constexpr unsigned PRECISION = 10;
+    static constexpr size_t REGISTERS = size_t{1} << PRECISION;
+
+    HyperLogLog();
+
+    // True if the hash raised a register, so it was certainly not added before
+    bool add(uint64_t hash);
+    double estimate() const;
+    // Not atomic against concurrent add()s, which may survive it
+    void clear();
+
+private:
+    // Ranks are capped so that REGISTERS terms of 2^(MAX_RANK - rank) fit
+    // in 64 bits; a higher rank would take ~2^60 distinct hashes
+    static constexpr unsigned MAX_RANK = 63 - PRECISION;
+
+    std::array<std::atomic<uint8_t>, REGISTERS> registers_;
+    std::atomic<uint64_t> inverse_sum_;    // Sum of 2^(MAX_RANK - register)
+    std::atomic<uint32_t> zero_registers_;
+};
+
+} // namespace metricstream
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace metricstream {
+
+// Phase 26: Service counters that do not bounce a cache line between
+// workers. Each counter is STAT_CELLS cache-line-sized cells; a thread
+// always bumps the cell it was assigned the first time it recorded
+// anything (round-robin), and readers sum every cell. A read taken while
+// writers run is a slightly stale sum, never a torn one.
+constexpr size_t STAT_CELLS = 64;
+
+size_t next_stat_cell();
+
+inline size_t stat_cell_index() {
+    thread_local size_t index = next_stat_cell();
+    return index;
+}
+
+class ShardedCounter {
+public:
+    void add(uint64_t n = 1) {
+        cells_[stat_cell_index()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const {
+        uint64_t total = 0;
+        for (const Cell& cell : cells_) {
+            total += cell.value.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+private:
+    struct alignas(64) Cell {
+        std::atomic<uint64_t> value{0};
+    };
+    std::array<Cell, STAT_CELLS> cells_;
+};
+
+// Phase 26: Latency distribution in log2 microsecond buckets (<= 1us,
+// <= 2us, ... <= 2^24us ~ 16.8s, then +Inf), sharded like ShardedCounter.
+// Unlike the Phase 13 probes this is always on: one clock read per edge.
+class LatencyHistogram {
+public:
+    static constexpr size_t BUCKETS = 26;
+
+    struct Snapshot {
+        std::array<uint64_t, BUCKETS> buckets{};   // Not cumulative
+        uint64_t count = 0;
+        uint64_t sum_ns = 0;
+    };
+
+    void observe(std::chrono::nanoseconds elapsed) {
+        uint64_t ns = elapsed.count() > 0 ? static_cast<uint64_t>(elapsed.count()) : 0;
+        uint64_t us = (ns + 999) / 1000;
+        size_t bucket = us <= 1 ? 0 : 64 - static_cast<size_t>(__builtin_clzll(us - 1));
+        if (bucket >= BUCKETS) bucket = BUCKETS - 1;
+
+        Cell& cell = cells_[stat_cell_index()];
+        cell.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        cell.sum_ns.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    Snapshot snapshot() const;
+
+    // Upper bound of bucket i in seconds; infinity for the last
+    static double bucket_bound_seconds(size_t i);
+
+private:
+    struct alignas(64) Cell {
+        std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+        std::atomic<uint64_t> sum_ns{0};
+    };
+    std::array<Cell, STAT_CELLS> cells_;
+};
+
+// Phase 32: High dynamic range histogram for benchmarks: exact below 256,
+// then 128 linear sub-buckets per power of two, so any recorded value is
+// reported within 1/128 (< 0.8%) of itself from 1 ns to hours. Not
+// thread-safe; give each thread its own and merge() them.
+class HdrHistogram {
+public:
+    static constexpr unsigned SUB_BUCKET_BITS = 7;
+    static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BUCKET_BITS;
+    static constexpr size_t COUNTS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    HdrHistogram();
+
+    void record(uint64_t value, uint64_t times = 1) {
+        counts_[index_of(value)] += times;
+        count_ += times;
+        sum_ += static_cast<double>(value) * static_cast<double>(times);
+        if (value < min_) min_ = value;
+        if (value > max_) max_ = value;
+    }
+
+    void merge(const HdrHistogram& other);
+    void reset();
+
+    uint64_t count() const { return count_; }
+    uint64_t min() const { return count_ == 0 ? 0 : min_; }
+    uint64_t max() const { return max_; }
+    double mean() const { return count_ == 0 ? 0.0 : sum_ / static_cast<double>(count_); }
+
+    // Smallest recorded value v such that a fraction q of the samples are
+    // <= v, reported as the top of v's sub-bucket (capped at max())
+    uint64_t percentile(double q) const;
+
+    static size_t index_of(uint64_t value) {
+        unsigned msb = 63 - static_cast<unsigned>(__builtin_clzll(value | 1));
+        unsigned shift = msb > SUB_BUCKET_BITS ? msb - SUB_BUCKET_BITS : 0;
+        return (size_t(shift) << SUB_BUCKET_BITS) + static_cast<size_t>(value >> shift);
+    }
+    // Largest value that maps to index
+    static uint64_t highest_equivalent(size_t index);
+
+private:
+    std::vector<uint64_t> counts_;
+    uint64_t count_ = 0;
+    double sum_ = 0;
+    uint64_t min_ = UINT64_MAX;
+    uint64_t max_ = 0;
+};
+
+// Records the time from construction to destruction
+class ScopedLatency {
+public:
+    explicit ScopedLatency(LatencyHistogram& histogram)
+        : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+    ~ScopedLatency() { histogram_.observe(std::chrono::steady_clock::now() - start_); }
+
+    ScopedLatency(const ScopedLatency&) = delete;
+    ScopedLatency& operator=(const ScopedLatency&) = delete;
+
+private:
+    LatencyHistogram& histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Phase 26: Prometheus text exposition (format 0.0.4). Write each family's
+// header once, then its samples; `labels` is the text between the braces,
+// e.g. stage="parse".
+class PrometheusWriter {
+public:
+    static constexpr std::string_view CONTENT_TYPE = "text/plain; version=0.0.4";
+
+    explicit PrometheusWriter(std::string& out) : out_(out) {}
+
+    void family(std::string_view name, std::string_view type, std::string_view help);
+    void sample(std::string_view name, double value, std::string_view labels = {});
+    void histogram(std::string_view name, const LatencyHistogram::Snapshot& snapshot,
+                   std::string_view labels = {});
+
+    // family() plus one unlabeled sample
+    void counter(std::string_view name, std::string_view help, uint64_t value);
+    void gauge(std::string_view name, std::string_view help, double value);
+
+private:
+    std::string& out_;
+
+    void append_name(std::string_view name, std::string_view suffix, std::string_view labels,
+                     std::string_view extra_label = {});
+};
+
+} // namespace metricstream
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "metric.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace metricstream {
+
+// When a sink makes committed data durable
+struct FsyncPolicy {
+    enum class Mode {
+        NEVER,          // Leave it to the page cache
+        EVERY_COMMIT,   // fsync after each group commit
+        INTERVAL,       // At most one fsync per interval while data is dirty
+        BYTES           // Once `bytes` have been written since the last fsync
+    };
+
+    Mode mode = Mode::INTERVAL;
+    std::chrono::milliseconds interval{1000};
+    size_t bytes = 8 * 1024 * 1024;
+};
+
+// Phase 17: Where the async writer thread puts accepted batches. append()
+// buffers, commit() ends a group commit; sinks are single-threaded.
+class StorageSink {
+public:
+    virtual ~StorageSink() = default;
+
+    virtual bool is_open() const = 0;
+    virtual void append(const MetricBatch& batch) = 0;
+    virtual bool commit() = 0;
+
+    // INTERVAL fsync hooks, see AppendFile
+    virtual std::chrono::milliseconds sync_if_due() = 0;
+    virtual bool wants_timed_sync() const = 0;
+
+    // Phase 21: Commit and fsync everything appended so far, including what
+    // a sink keeps across commits (open segment blocks), regardless of the
+    // policy. The WAL can drop records once this returns true.
+    virtual bool flush() = 0;
+};
+
+// Append-only file descriptor plus the FsyncPolicy bookkeeping the sinks share
+class AppendFile {
+public:
+    explicit AppendFile(FsyncPolicy policy = {}) : policy_(policy) {}
+    ~AppendFile() { close(); }
+
+    AppendFile(const AppendFile&) = delete;
+    AppendFile& operator=(const AppendFile&) = delete;
+
+    // O_APPEND; `exclusive` fails if the file already exists
+    bool open(const std::string& path, bool exclusive = false);
+
+    // Syncs first unless the policy is NEVER
+    void close();
+
+    bool is_open() const { return fd_ >= 0; }
+
+    // Write everything (looping on short writes), then apply the policy
+    bool write(std::string_view data);
+
+    // fsync now if anything written is not yet durable
+    void sync();
+
+    // INTERVAL mode: fsync if dirty data has waited a full interval.
+    // Returns how long the caller may sleep before calling again.
+    std::chrono::milliseconds sync_if_due();
+
+    // INTERVAL mode with written-but-unsynced data: the owner should wake
+    // up within sync_if_due()'s delay even if nothing new arrives
+    bool wants_timed_sync() const {
+        return policy_.mode == FsyncPolicy::Mode::INTERVAL && unsynced_bytes_ > 0;
+    }
+
+    const FsyncPolicy& policy() const { return policy_; }
+    uint64_t bytes_written() const { return bytes_written_; }
+    uint64_t fsync_count() const { return fsync_count_; }
+    uint64_t write_errors() const { return write_errors_; }
+
+private:
+    int fd_ = -1;
+    FsyncPolicy policy_;
+
+    size_t unsynced_bytes_ = 0;
+    std::chrono::steady_clock::time_point first_unsynced_{};
+    uint64_t bytes_written_ = 0;
+    uint64_t fsync_count_ = 0;
+    uint64_t write_errors_ = 0;
+};
+
+} // namespace metricstream
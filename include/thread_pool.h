@@ -1,17 +1,207 @@
 #pragma once
 
 #include <vector>
-#include <queue>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
-#include <functional>
 #include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 namespace metricstream {
 
+// Phase 11: Move-only type-erased callable. Captures up to INLINE_SIZE bytes
+// (e.g. a shared_ptr plus a couple of pointers) are stored in place, so
+// handing a request to the pool does not allocate.
+class Task {
+public:
+    static constexpr size_t INLINE_SIZE = 48;
+
+    Task() = default;
+
+    template <typename F,
+              typename Fn = std::decay_t<F>,
+              typename = std::enable_if_t<!std::is_same<Fn, Task>::value>>
+    Task(F&& fn) {
+        if constexpr (sizeof(Fn) <= INLINE_SIZE &&
+                      alignof(Fn) <= alignof(std::max_align_t) &&
+                      std::is_nothrow_move_constructible<Fn>::value) {
+            new (storage_) Fn(std::forward<F>(fn));
+            ops_ = &inline_ops<Fn>;
+        } else {
+            *reinterpret_cast<Fn**>(static_cast<void*>(storage_)) = new Fn(std::forward<F>(fn));
+            ops_ = &heap_ops<Fn>;
+        }
+    }
+
+    Task(Task&& other) noexcept : ops_(other.ops_) {
+        if (ops_) {
+            ops_->move(other.storage_, storage_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            ops_ = other.ops_;
+            if (ops_) {
+                ops_->move(other.storage_, storage_);
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() { reset(); }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+    void operator()() { ops_->invoke(storage_); }
+
+    void reset() {
+        if (ops_) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    struct Ops {
+        void (*invoke)(void*);
+        void (*move)(void* from, void* to);   // Leaves `from` destroyed
+        void (*destroy)(void*);
+    };
+
+    template <typename Fn>
+    static constexpr Ops inline_ops = {
+        [](void* s) { (*std::launder(reinterpret_cast<Fn*>(s)))(); },
+        [](void* from, void* to) {
+            Fn* f = std::launder(reinterpret_cast<Fn*>(from));
+            new (to) Fn(std::move(*f));
+            f->~Fn();
+        },
+        [](void* s) { std::launder(reinterpret_cast<Fn*>(s))->~Fn(); }
+    };
+
+    template <typename Fn>
+    static constexpr Ops heap_ops = {
+        [](void* s) { (**reinterpret_cast<Fn**>(s))(); },
+        [](void* from, void* to) { *reinterpret_cast<Fn**>(to) = *reinterpret_cast<Fn**>(from); },
+        [](void* s) { delete *reinterpret_cast<Fn**>(s); }
+    };
+
+    alignas(std::max_align_t) unsigned char storage_[INLINE_SIZE];
+    const Ops* ops_ = nullptr;
+};
+
+// Phase 11: Bounded multi-producer multi-consumer ring (Vyukov). Each cell
+// carries a sequence number, so producers and consumers only contend on the
+// cell they claim. T must be trivially copyable.
+template <typename T>
+class BoundedMpmcQueue {
+public:
+    // capacity is rounded up to a power of two
+    explicit BoundedMpmcQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        mask_ = size - 1;
+        cells_ = std::make_unique<Cell[]>(size);
+        for (size_t i = 0; i < size; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool try_push(T value) {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells_[pos & mask_];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // Full
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(T& value) {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells_[pos & mask_];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = cell.value;
+                    cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // Empty
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+};
+
+// Phase 11: Chase-Lev work-stealing deque of task handles. The owning worker
+// pushes and pops at the bottom without contention; idle workers steal from
+// the top. Fixed capacity: the pool never holds more tasks than that.
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(size_t capacity);
+
+    // Owner thread only. Returns false if full.
+    bool push(uint32_t value);
+    bool pop(uint32_t& value);
+
+    // Any thread
+    bool steal(uint32_t& value);
+
+private:
+    std::unique_ptr<std::atomic<uint32_t>[]> buffer_;
+    int64_t mask_ = 0;
+    alignas(64) std::atomic<int64_t> top_{0};
+    alignas(64) std::atomic<int64_t> bottom_{0};
+};
+
 // Phase 6: Thread Pool for eliminating thread creation overhead
 // Replaces thread-per-request model with fixed worker pool
+//
+// Phase 11: Work-stealing scheduler. Tasks live in a fixed slot array whose
+// free list bounds the pool (enqueue() fails when no slot is free). External
+// threads hand slots to workers' inboxes round-robin; tasks enqueued from a
+// worker go on its own deque. Each queue holds one worker's share of the
+// slots, and a full one spills into the other inboxes. Idle workers steal,
+// spin briefly, then park.
 class ThreadPool {
 public:
     // Constructor: Create pool with specified number of workers
@@ -23,7 +213,7 @@ public:
 
     // Enqueue a task for execution
     // Returns true if enqueued, false if queue is full (backpressure)
-    bool enqueue(std::function<void()> task);
+    bool enqueue(Task task);
 
     // Get current queue depth (for monitoring)
     size_t queue_size() const;
@@ -32,22 +222,43 @@ public:
     size_t worker_count() const { return workers_.size(); }
 
 private:
+    struct alignas(64) TaskSlot {
+        Task task;
+    };
+
+    struct Worker {
+        explicit Worker(size_t capacity) : deque(capacity), inbox(capacity) {}
+
+        WorkStealingDeque deque;           // Owner pushes/pops, others steal
+        BoundedMpmcQueue<uint32_t> inbox;  // Submissions from outside the pool
+    };
+
     // Worker threads
     std::vector<std::thread> workers_;
+    std::vector<std::unique_ptr<Worker>> queues_;
 
-    // Task queue
-    std::queue<std::function<void()>> tasks_;
+    // Task storage and its free list
+    std::unique_ptr<TaskSlot[]> slots_;
+    BoundedMpmcQueue<uint32_t> free_slots_;
     size_t max_queue_size_;
 
-    // Synchronization
-    mutable std::mutex queue_mutex_;
+    alignas(64) std::atomic<size_t> next_worker_{0};  // Round-robin for external enqueues
+    alignas(64) std::atomic<int64_t> queued_{0};      // Tasks waiting to run
+
+    // Parking
+    std::mutex park_mutex_;
     std::condition_variable condition_;
+    std::atomic<size_t> sleepers_{0};
 
     // Shutdown flag
     std::atomic<bool> stop_;
 
     // Worker function - runs in each thread
-    void worker_loop();
+    void worker_loop(size_t index);
+    bool find_task(size_t index, uint32_t& slot);
+    void run_slot(uint32_t slot);
+    void release_slot(uint32_t slot);
+    void park();
 };
 
 } // namespace metricstream
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace metricstream {
+
+// Phase 33: Boundaries a request crosses, in pipeline order. Ingest-only
+// stages are simply not reached by other routes. Disk writes happen on
+// the storage writer after the response, so the request's durable write
+// is WAL_SYNCED.
+enum class TraceStage : uint8_t {
+    RECEIVED,       // Event loop saw the request's first bytes
+    HEADERS,        // Headers parsed, admission decided
+    BODY,           // Body read; queued for a worker
+    DEQUEUED,       // Worker picked it up
+    RATE_LIMITED,   // Rate limiter decided
+    PARSED,         // JSON or binary batch decoded
+    VALIDATED,
+    WAL_APPENDED,
+    ENQUEUED,       // In the partitioned log
+    WAL_SYNCED,     // Group commit covered it
+    RESPONDED       // Response handed back to the event loop
+};
+
+constexpr size_t TRACE_STAGE_COUNT = 11;
+
+std::string_view trace_stage_name(TraceStage stage);
+
+inline int64_t trace_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Phase 33: Fixed size, so recording one never allocates
+struct RequestTrace {
+    static constexpr size_t METHOD_BYTES = 8;
+    static constexpr size_t PATH_BYTES = 48;
+
+    uint64_t id = 0;
+    std::array<int64_t, TRACE_STAGE_COUNT> at_ns{};   // steady clock; 0 = not reached
+    char method[METHOD_BYTES] = {};
+    char path[PATH_BYTES] = {};                       // Truncated, NUL-terminated
+    uint16_t status = 0;
+    uint32_t metrics = 0;
+
+    void mark(TraceStage stage) { at_ns[static_cast<size_t>(stage)] = trace_now_ns(); }
+    bool reached(TraceStage stage) const { return at_ns[static_cast<size_t>(stage)] != 0; }
+    void set_route(std::string_view method, std::string_view path);
+    // RECEIVED to the last stage reached
+    int64_t total_ns() const;
+};
+
+// Phase 33: The request the calling thread is working on, so handlers can
+// mark stages without it being passed down; null when none is traced
+RequestTrace* current_trace();
+
+inline void trace_mark(TraceStage stage) {
+    if (RequestTrace* trace = current_trace()) {
+        trace->mark(stage);
+    }
+}
+
+class ScopedTraceContext {
+public:
+    explicit ScopedTraceContext(RequestTrace* trace);
+    ~ScopedTraceContext();
+
+    ScopedTraceContext(const ScopedTraceContext&) = delete;
+    ScopedTraceContext& operator=(const ScopedTraceContext&) = delete;
+
+private:
+    RequestTrace* previous_;
+};
+
+// Phase 33: Keeps the last recent_per_thread finished traces of every
+// thread in a ring of its own, so finishing one costs an uncontended lock
+// and a copy. Requests slower than slow_threshold are also sampled, one in
+// slow_sample_every, into a shared slow log that survives the rings
+// wrapping. GET /debug/traces reads both.
+class Tracer {
+public:
+    struct Options {
+        bool enabled = true;
+        std::chrono::microseconds slow_threshold{50000};
+        uint32_t slow_sample_every = 1;
+        size_t recent_per_thread = 128;
+        size_t slow_capacity = 256;
+    };
+
+    Tracer();
+    explicit Tracer(Options options);
+    ~Tracer();
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    static Tracer& global();
+
+    // Must be called before requests arrive
+    void set_options(Options options) { options_ = options; }
+    const Options& options() const { return options_; }
+    bool enabled() const { return options_.enabled; }
+
+    uint64_t next_id() { return next_id_.fetch_add(1, std::memory_order_relaxed) + 1; }
+
+    void finish(const RequestTrace& trace);
+
+    // Newest first
+    std::vector<RequestTrace> recent(size_t limit) const;
+    std::vector<RequestTrace> slow(size_t limit) const;
+
+    uint64_t traces_finished() const { return finished_.load(std::memory_order_relaxed); }
+    uint64_t slow_requests() const { return slow_seen_.load(std::memory_order_relaxed); }
+
+private:
+    struct Ring {
+        mutable std::mutex mutex;
+        std::vector<RequestTrace> traces;
+        size_t next = 0;
+    };
+
+    Options options_;
+    uint64_t instance_;   // Tells this tracer's thread-local rings apart
+    std::atomic<uint64_t> next_id_{0};
+    std::atomic<uint64_t> finished_{0};
+    std::atomic<uint64_t> slow_seen_{0};
+
+    mutable std::mutex rings_mutex_;
+    std::vector<std::unique_ptr<Ring>> rings_;
+    Ring slow_;
+
+    Ring& thread_ring();
+    static void push(Ring& ring, const RequestTrace& trace, size_t capacity);
+    static void collect(const Ring& ring, std::vector<RequestTrace>& out);
+};
+
+// {"id":..,"method":..,"path":..,"status":..,"metrics":..,"total_us":..,
+//  "stages_us":{"headers":..,...}}, offsets from RECEIVED
+void append_trace_json(std::string& out, const RequestTrace& trace);
+
+} // namespace metricstream
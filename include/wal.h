@@ -0,0 +1,172 @@
+#pragma once
+
+#include "metric.h"
+#include "storage_sink.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace metricstream {
+
+// Phase 21: Write-ahead log. Every accepted batch is appended here before
+// POST /metrics answers, and the answer waits until its record is on disk.
+// Appends only copy into a shared buffer; one flusher thread writes the
+// buffer and fdatasyncs it, so concurrent requests share a single fsync
+// (group commit) instead of paying one each.
+//
+// wal/wal-<first lsn>.log holds framed records:
+//   u8 type | u32 payload length | payload | u32 crc32c(type + payload)
+// BATCH payloads carry the log sequence number (lsn) and the batch; CANCEL
+// payloads name the lsn of a batch that was logged but then refused.
+//
+// Once storage has made every batch up to some lsn durable, checkpoint()
+// records it in wal/checkpoint and deletes files that hold nothing newer.
+// open() replays what came after the last checkpoint, so batches stored
+// since then are stored again after a crash (at-least-once).
+//
+// Phase 34: Other consumers (rollups) track what they have applied through
+// their own watermark. Their state is checkpointed elsewhere, so retain_from()
+// keeps the files they would replay after a crash even once storage's
+// checkpoint has passed them.
+constexpr uint32_t WAL_RECORD_OVERHEAD = 9;
+
+enum WalRecord : uint8_t {
+    WAL_BATCH = 1,
+    WAL_CANCEL = 2
+};
+
+// Payload of a BATCH record
+void encode_wal_batch(std::string& out, uint64_t lsn, const MetricBatch& batch);
+bool decode_wal_batch(std::string_view payload, uint64_t& lsn, MetricBatch& batch);
+
+class WriteAheadLog {
+public:
+    struct Options {
+        std::string directory = "wal";
+        std::chrono::microseconds group_commit_delay{2000};   // Gather appends this long...
+        size_t group_commit_bytes = 1024 * 1024;              // ...unless this much is waiting
+        size_t max_file_bytes = 64 * 1024 * 1024;
+    };
+
+    struct ReplayStats {
+        uint64_t batches = 0;
+        uint64_t metrics = 0;
+        uint64_t cancelled = 0;
+        uint64_t corrupt_records = 0;   // Torn tails and CRC mismatches
+        uint64_t files = 0;
+    };
+
+    // batch.wal_lsn is the record's lsn
+    using ReplayVisitor = std::function<void(const MetricBatch&)>;
+
+    static constexpr size_t STORAGE_CONSUMER = 0;
+
+    explicit WriteAheadLog(Options options);
+    ~WriteAheadLog();   // Flushes what is buffered, then stops the flusher
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    // Visit every batch after the last checkpoint that was not cancelled, in
+    // lsn order, then start the flusher. Returns false if the directory or
+    // a new file cannot be opened; the log then refuses appends.
+    bool open(const ReplayVisitor& replay, ReplayStats* stats = nullptr);
+
+    // Phase 34: Also visit retained batches from lsn `from` on, at or below
+    // the checkpoint too; compare batch.wal_lsn with checkpoint_lsn()
+    bool open(const ReplayVisitor& replay, uint64_t from, ReplayStats* stats = nullptr);
+
+    // Phase 34: Another consumer of appended batches, with its own
+    // watermark. Call before the first append.
+    size_t add_consumer();
+
+    // Buffer a record; returns its lsn, or 0 if the log is not writable
+    uint64_t append(const MetricBatch& batch);
+
+    // The batch at lsn was refused after append(): replay must skip it
+    void cancel(uint64_t lsn);
+
+    // Block until the record at lsn is durable. False if the log failed.
+    bool wait_durable(uint64_t lsn);
+
+    // Storage has taken these batches; checkpoint() may pass them once the
+    // sink is flushed
+    void mark_applied(const uint64_t* lsns, size_t count) {
+        mark_applied(STORAGE_CONSUMER, lsns, count);
+    }
+    void mark_applied(size_t consumer, const uint64_t* lsns, size_t count);
+
+    // Every lsn up to this one is applied or cancelled
+    uint64_t applied_through() const { return applied_through(STORAGE_CONSUMER); }
+    uint64_t applied_through(size_t consumer) const;
+
+    // Phase 34: The highest lsn handed out so far and, of those, the ones a
+    // consumer has not applied yet, read together
+    void consumer_snapshot(size_t consumer, uint64_t& last_lsn, std::vector<uint64_t>& outstanding) const;
+
+    // Storage has made everything up to lsn durable
+    bool checkpoint(uint64_t lsn);
+    uint64_t checkpoint_lsn() const;
+
+    // Phase 34: Keep files holding lsn or later when checkpoints pass them
+    void retain_from(uint64_t lsn);
+
+    bool failed() const;
+    uint64_t durable_lsn() const;
+    uint64_t records_written() const;
+    uint64_t group_commits() const { return group_commits_.load(std::memory_order_relaxed); }
+    uint64_t bytes_written() const { return bytes_written_.load(std::memory_order_relaxed); }
+
+private:
+    struct LogFile {
+        std::string path;
+        uint64_t first_lsn;
+    };
+
+    Options options_;
+    std::string checkpoint_path_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable flush_cv_;     // Flusher: work or shutdown
+    std::condition_variable durable_cv_;   // Waiters: durable_lsn_ moved
+    std::string pending_;                  // Guarded by mutex_
+    uint64_t next_lsn_ = 1;
+    uint64_t pending_last_lsn_ = 0;        // Highest lsn in pending_
+    uint64_t durable_lsn_ = 0;
+    uint64_t records_written_ = 0;
+    bool open_ = false;
+    bool failed_ = false;
+    bool stopping_ = false;
+    std::vector<std::set<uint64_t>> outstanding_;   // Per consumer: appended, not yet applied or cancelled
+
+    // Owned by the flusher once it runs; files_ is shared with checkpoint()
+    AppendFile file_;
+    uint64_t file_first_lsn_ = 0;
+    std::string flushing_;
+    mutable std::mutex files_mutex_;
+    std::vector<LogFile> files_;
+    uint64_t checkpoint_lsn_ = 0;
+    uint64_t retain_from_ = UINT64_MAX;
+    std::atomic<uint64_t> group_commits_{0};
+    std::atomic<uint64_t> bytes_written_{0};
+
+    std::thread flusher_;
+
+    void frame(WalRecord type, size_t payload_start);
+    bool open_file(uint64_t first_lsn);
+    void flusher_loop();
+    bool read_checkpoint(uint64_t& lsn) const;
+    bool write_checkpoint(uint64_t lsn);   // Caller holds files_mutex_
+    void drop_files();                     // Caller holds files_mutex_
+};
+
+} // namespace metricstream
@@ -0,0 +1,94 @@
+#include "admission.h"
+
+namespace metricstream {
+
+namespace {
+
+int64_t steady_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+std::string_view request_priority_name(RequestPriority priority) {
+    switch (priority) {
+        case RequestPriority::CRITICAL: return "critical";
+        case RequestPriority::NORMAL: return "normal";
+        case RequestPriority::SHEDDABLE: return "sheddable";
+    }
+    return "unknown";
+}
+
+AdmissionController::AdmissionController() : AdmissionController(Options()) {}
+
+AdmissionController::AdmissionController(Options options) : options_(options) {}
+
+bool AdmissionController::admit(RequestPriority priority, size_t queue_depth) {
+    if (!options_.enabled || priority == RequestPriority::CRITICAL) {
+        return true;
+    }
+    maybe_roll(steady_now_ns(), queue_depth);
+
+    uint32_t level = level_.load(std::memory_order_relaxed);
+    bool shed = priority == RequestPriority::SHEDDABLE ? level > 0
+                                                     : level >= options_.normal_shed_intervals;
+    return shed ? refuse(priority) : true;
+}
+
+bool AdmissionController::admit_dequeued(RequestPriority priority, std::chrono::nanoseconds sojourn) {
+    if (!options_.enabled) {
+        return true;
+    }
+    int64_t wait_ns = sojourn.count();
+    int64_t seen = window_min_ns_.load(std::memory_order_relaxed);
+    while (wait_ns < seen &&
+           !window_min_ns_.compare_exchange_weak(seen, wait_ns, std::memory_order_relaxed)) {
+    }
+    maybe_roll(steady_now_ns(), 0);
+
+    if (priority == RequestPriority::CRITICAL) {
+        return true;
+    }
+    // Overloaded: anything that waited past target is already too late
+    bool overloaded = level_.load(std::memory_order_relaxed) > 0;
+    auto timeout = overloaded && priority == RequestPriority::SHEDDABLE
+                       ? std::chrono::nanoseconds(options_.target)
+                       : std::chrono::nanoseconds(options_.interval);
+    return sojourn > timeout ? refuse(priority) : true;
+}
+
+void AdmissionController::maybe_roll(int64_t now_ns, size_t queue_depth) {
+    int64_t end = window_end_ns_.load(std::memory_order_acquire);
+    if (now_ns < end) {
+        return;
+    }
+    int64_t interval_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(options_.interval).count();
+    if (!window_end_ns_.compare_exchange_strong(end, now_ns + interval_ns, std::memory_order_acq_rel)) {
+        return;   // Another thread closed this window
+    }
+    if (end == 0) {
+        return;   // First call opens the first window
+    }
+
+    int64_t min_ns = window_min_ns_.exchange(NO_SAMPLE, std::memory_order_relaxed);
+    int64_t target_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(options_.target).count();
+    // No dequeues at all while requests wait means the workers are stuck
+    bool standing_queue = min_ns == NO_SAMPLE ? queue_depth > 0 : min_ns > target_ns;
+    bool bad = standing_queue || (probe_ && probe_());
+    if (bad) {
+        uint32_t level = level_.load(std::memory_order_relaxed);
+        if (level < std::numeric_limits<uint32_t>::max()) {
+            level_.store(level + 1, std::memory_order_relaxed);
+        }
+    } else {
+        level_.store(0, std::memory_order_relaxed);
+    }
+}
+
+bool AdmissionController::refuse(RequestPriority priority) {
+    shed_[static_cast<size_t>(priority)].fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+} // namespace metricstream
@@ -0,0 +1,363 @@
+#include "alerting.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+namespace metricstream {
+
+namespace {
+
+const char* aggregation_name(AlertRule::Aggregation aggregation) {
+    switch (aggregation) {
+        case AlertRule::Aggregation::AVG:   return "avg";
+        case AlertRule::Aggregation::SUM:   return "sum";
+        case AlertRule::Aggregation::MIN:   return "min";
+        case AlertRule::Aggregation::MAX:   return "max";
+        case AlertRule::Aggregation::COUNT: return "count";
+    }
+    return "avg";
+}
+
+bool parse_double(std::string_view text, double& out) {
+    std::string copy(text);
+    if (copy.empty()) return false;
+    char* end = nullptr;
+    out = std::strtod(copy.c_str(), &end);
+    return *end == '\0';
+}
+
+void log_alert(const AlertEvent& event) {
+    const AlertRule& rule = *event.rule;
+    std::cerr << "[Alert] " << (event.kind == AlertEvent::Kind::FIRING ? "FIRING " : "RESOLVED ")
+              << rule.name << ": " << aggregation_name(rule.aggregation) << "("
+              << rule.metric_name << ", " << rule.window.count() << "ms) = " << event.value
+              << (rule.condition == AlertRule::Condition::ABOVE ? " > " : " < ")
+              << rule.threshold << " (" << event.samples << " samples)" << std::endl;
+}
+
+int64_t wall_clock_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+// ============================================================================
+// AlertRule
+// ============================================================================
+
+bool AlertRule::parse(std::string_view spec, AlertRule& rule) {
+    AlertRule parsed;
+    parsed.name = std::string(spec);
+
+    size_t colon = spec.find(':');
+    size_t brace = spec.find('{');
+    std::string_view rest;
+    if (brace != std::string_view::npos && brace < colon) {
+        size_t close = spec.find('}', brace);
+        if (close == std::string_view::npos || close + 1 >= spec.size() || spec[close + 1] != ':') {
+            return false;
+        }
+        parsed.metric_name = std::string(spec.substr(0, brace));
+        std::string_view tags = spec.substr(brace + 1, close - brace - 1);
+        while (!tags.empty()) {
+            size_t comma = tags.find(',');
+            std::string_view tag = tags.substr(0, comma);
+            size_t eq = tag.find('=');
+            if (eq == std::string_view::npos || eq == 0) return false;
+            parsed.tags.emplace_back(std::string(tag.substr(0, eq)), std::string(tag.substr(eq + 1)));
+            tags = comma == std::string_view::npos ? std::string_view{} : tags.substr(comma + 1);
+        }
+        rest = spec.substr(close + 2);
+    } else {
+        if (colon == std::string_view::npos) return false;
+        parsed.metric_name = std::string(spec.substr(0, colon));
+        rest = spec.substr(colon + 1);
+    }
+    if (parsed.metric_name.empty()) return false;
+
+    std::string_view fields[4];
+    for (int i = 0; i < 4; ++i) {
+        size_t next = rest.find(':');
+        if ((next == std::string_view::npos) != (i == 3)) return false;
+        fields[i] = rest.substr(0, next);
+        rest = next == std::string_view::npos ? std::string_view{} : rest.substr(next + 1);
+    }
+
+    if (fields[0] == "avg") parsed.aggregation = Aggregation::AVG;
+    else if (fields[0] == "sum") parsed.aggregation = Aggregation::SUM;
+    else if (fields[0] == "min") parsed.aggregation = Aggregation::MIN;
+    else if (fields[0] == "max") parsed.aggregation = Aggregation::MAX;
+    else if (fields[0] == "count") parsed.aggregation = Aggregation::COUNT;
+    else return false;
+
+    if (fields[1] == ">") parsed.condition = Condition::ABOVE;
+    else if (fields[1] == "<") parsed.condition = Condition::BELOW;
+    else return false;
+
+    double window_seconds;
+    if (!parse_double(fields[2], parsed.threshold) ||
+        !parse_double(fields[3], window_seconds) || window_seconds <= 0) {
+        return false;
+    }
+    parsed.window = std::chrono::milliseconds(static_cast<int64_t>(window_seconds * 1000));
+    if (parsed.window.count() <= 0) return false;
+
+    rule = std::move(parsed);
+    return true;
+}
+
+// ============================================================================
+// SlidingWindowAggregate
+// ============================================================================
+
+SlidingWindowAggregate::SlidingWindowAggregate(int64_t window_ms, size_t buckets) {
+    if (buckets == 0) buckets = 1;
+    if (window_ms < static_cast<int64_t>(buckets)) window_ms = static_cast<int64_t>(buckets);
+    ring_.resize(buckets);
+    bucket_ms_ = (window_ms + static_cast<int64_t>(buckets) - 1) / static_cast<int64_t>(buckets);
+}
+
+int64_t SlidingWindowAggregate::epoch_of(int64_t timestamp_ms) const {
+    // Floor division so negative timestamps bucket consistently
+    int64_t epoch = timestamp_ms / bucket_ms_;
+    if (timestamp_ms % bucket_ms_ < 0) epoch--;
+    return epoch;
+}
+
+void SlidingWindowAggregate::add(int64_t timestamp_ms, double value) {
+    int64_t epoch = epoch_of(timestamp_ms);
+    int64_t size = static_cast<int64_t>(ring_.size());
+    if (head_epoch_ == std::numeric_limits<int64_t>::min() || epoch > head_epoch_) {
+        head_epoch_ = epoch;
+    } else if (epoch <= head_epoch_ - size) {
+        return;   // Fell out of the window already
+    }
+
+    Bucket& bucket = ring_[static_cast<size_t>(((epoch % size) + size) % size)];
+    if (bucket.epoch != epoch) {
+        bucket.epoch = epoch;
+        bucket.stats = WindowStats{};
+    }
+    WindowStats& stats = bucket.stats;
+    stats.count++;
+    stats.sum += value;
+    stats.min = std::min(stats.min, value);
+    stats.max = std::max(stats.max, value);
+}
+
+void SlidingWindowAggregate::advance(int64_t now_ms) {
+    int64_t epoch = epoch_of(now_ms);
+    if (head_epoch_ == std::numeric_limits<int64_t>::min() || epoch > head_epoch_) {
+        head_epoch_ = epoch;
+    }
+}
+
+WindowStats SlidingWindowAggregate::stats() const {
+    WindowStats out;
+    if (head_epoch_ == std::numeric_limits<int64_t>::min()) {
+        return out;
+    }
+    int64_t oldest = head_epoch_ - static_cast<int64_t>(ring_.size());
+    for (const Bucket& bucket : ring_) {
+        if (bucket.epoch > oldest && bucket.epoch <= head_epoch_) {
+            out.count += bucket.stats.count;
+            out.sum += bucket.stats.sum;
+            out.min = std::min(out.min, bucket.stats.min);
+            out.max = std::max(out.max, bucket.stats.max);
+        }
+    }
+    return out;
+}
+
+// ============================================================================
+// AlertEngine
+// ============================================================================
+
+AlertEngine::RuleState::RuleState(AlertRule r)
+    : rule(std::move(r)), window(rule.window.count(), rule.buckets) {}
+
+AlertEngine::AlertEngine(Notifier notifier)
+    : notifier_(notifier ? std::move(notifier) : Notifier(log_alert)) {}
+
+AlertEngine::~AlertEngine() {
+    stop();
+}
+
+void AlertEngine::add_rule(AlertRule rule) {
+    std::unique_lock<std::shared_mutex> lock(rules_mutex_);
+    size_t index = rules_.size();
+    by_metric_[rule.metric_name].push_back(index);
+    rules_.push_back(std::make_unique<RuleState>(std::move(rule)));
+    has_rules_.store(true, std::memory_order_release);
+}
+
+size_t AlertEngine::rule_count() const {
+    std::shared_lock<std::shared_mutex> lock(rules_mutex_);
+    return rules_.size();
+}
+
+bool AlertEngine::evaluate(RuleState& state, int64_t now_ms, AlertEvent* event) {
+    WindowStats stats = state.window.stats();
+    bool count_rule = state.rule.aggregation == AlertRule::Aggregation::COUNT;
+
+    double value = 0;
+    switch (state.rule.aggregation) {
+        case AlertRule::Aggregation::AVG:
+            value = stats.count ? stats.sum / static_cast<double>(stats.count) : 0;
+            break;
+        case AlertRule::Aggregation::SUM:   value = stats.sum; break;
+        case AlertRule::Aggregation::MIN:   value = stats.count ? stats.min : 0; break;
+        case AlertRule::Aggregation::MAX:   value = stats.count ? stats.max : 0; break;
+        case AlertRule::Aggregation::COUNT: value = static_cast<double>(stats.count); break;
+    }
+    state.value = value;
+    state.samples = stats.count;
+
+    // An empty window only means something to count rules ("fewer than N")
+    bool crossed = false;
+    if (stats.count > 0 || count_rule) {
+        crossed = state.rule.condition == AlertRule::Condition::ABOVE
+            ? value > state.rule.threshold : value < state.rule.threshold;
+    }
+    if (crossed == state.firing) {
+        return false;
+    }
+    state.firing = crossed;
+    *event = AlertEvent{crossed ? AlertEvent::Kind::FIRING : AlertEvent::Kind::RESOLVED,
+                        &state.rule, value, stats.count, now_ms};
+    return true;
+}
+
+void AlertEngine::observe(const MetricBatch& batch) {
+    if (!has_rules_.load(std::memory_order_acquire)) {
+        return;
+    }
+
+    std::vector<AlertEvent> events;
+    {
+        std::shared_lock<std::shared_mutex> lock(rules_mutex_);
+
+        // Group the batch's matches by rule so each rule's lock is taken once
+        std::vector<std::pair<size_t, const Metric*>> matches;
+        for (const Metric& metric : batch.metrics) {
+            const SeriesKey& series = metric.series();
+            auto it = by_metric_.find(series.name);
+            if (it == by_metric_.end()) {
+                continue;
+            }
+            for (size_t index : it->second) {
+                bool match = true;
+                for (const auto& [key, value] : rules_[index]->rule.tags) {
+                    const std::string* tag = series.tag(key);
+                    if (tag == nullptr || *tag != value) {
+                        match = false;
+                        break;
+                    }
+                }
+                if (match) {
+                    matches.emplace_back(index, &metric);
+                }
+            }
+        }
+        if (matches.empty()) {
+            return;
+        }
+        std::stable_sort(matches.begin(), matches.end(),
+                         [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        for (size_t i = 0; i < matches.size();) {
+            RuleState& state = *rules_[matches[i].first];
+            int64_t latest = std::numeric_limits<int64_t>::min();
+            std::lock_guard<std::mutex> rule_lock(state.mutex);
+            for (; i < matches.size() && rules_[matches[i].first].get() == &state; ++i) {
+                int64_t ts = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    matches[i].second->timestamp.time_since_epoch()).count();
+                state.window.add(ts, matches[i].second->value);
+                latest = std::max(latest, ts);
+            }
+            AlertEvent event;
+            if (evaluate(state, latest, &event)) {
+                events.push_back(event);
+            }
+        }
+    }
+
+    for (const AlertEvent& event : events) {
+        notify(event);
+    }
+}
+
+void AlertEngine::advance(int64_t now_ms) {
+    std::vector<AlertEvent> events;
+    {
+        std::shared_lock<std::shared_mutex> lock(rules_mutex_);
+        for (auto& state : rules_) {
+            std::lock_guard<std::mutex> rule_lock(state->mutex);
+            state->window.advance(now_ms);
+            AlertEvent event;
+            if (evaluate(*state, now_ms, &event)) {
+                events.push_back(event);
+            }
+        }
+    }
+    for (const AlertEvent& event : events) {
+        notify(event);
+    }
+}
+
+void AlertEngine::notify(const AlertEvent& event) {
+    notifications_.fetch_add(1, std::memory_order_relaxed);
+    try {
+        notifier_(event);
+    } catch (const std::exception& e) {
+        std::cerr << "[Alert] Notifier threw exception: " << e.what() << std::endl;
+    }
+}
+
+std::vector<AlertStatus> AlertEngine::status() const {
+    std::shared_lock<std::shared_mutex> lock(rules_mutex_);
+    std::vector<AlertStatus> out;
+    out.reserve(rules_.size());
+    for (const auto& state : rules_) {
+        std::lock_guard<std::mutex> rule_lock(state->mutex);
+        out.push_back({&state->rule, state->firing, state->value, state->samples});
+    }
+    return out;
+}
+
+void AlertEngine::start(std::chrono::milliseconds tick) {
+    std::lock_guard<std::mutex> lock(ticker_mutex_);
+    if (ticking_) {
+        return;
+    }
+    ticking_ = true;
+    ticker_ = std::thread([this, tick] {
+        std::unique_lock<std::mutex> lock(ticker_mutex_);
+        while (ticking_) {
+            ticker_cv_.wait_for(lock, tick, [this] { return !ticking_; });
+            if (!ticking_) {
+                break;
+            }
+            lock.unlock();
+            advance(wall_clock_ms());
+            lock.lock();
+        }
+    });
+}
+
+void AlertEngine::stop() {
+    {
+        std::lock_guard<std::mutex> lock(ticker_mutex_);
+        if (!ticking_) {
+            return;
+        }
+        ticking_ = false;
+    }
+    ticker_cv_.notify_all();
+    if (ticker_.joinable()) {
+        ticker_.join();
+    }
+}
+
+} // namespace metricstream
@@ -0,0 +1,64 @@
+#include "arena.h"
+#include <cstring>
+
+namespace metricstream {
+
+Arena::Arena(size_t block_size) : block_size_(block_size == 0 ? DEFAULT_BLOCK_SIZE : block_size) {}
+
+void Arena::add_block(size_t min_size) {
+    size_t size = min_size > block_size_ ? min_size : block_size_;
+    if (!blocks_.empty()) {
+        used_before_current_ += static_cast<size_t>(cursor_ - blocks_.back().data.get());
+    }
+    blocks_.push_back({std::unique_ptr<char[]>(new char[size]), size});
+    cursor_ = blocks_.back().data.get();
+    end_ = cursor_ + size;
+}
+
+void* Arena::allocate_slow(size_t bytes, size_t align) {
+    // Room for the worst-case alignment padding at the start of a block
+    add_block(bytes + align);
+    return allocate(bytes, align);
+}
+
+std::string_view Arena::copy(std::string_view s) {
+    if (s.empty()) {
+        return {};
+    }
+    char* out = allocate_chars(s.size());
+    std::memcpy(out, s.data(), s.size());
+    return {out, s.size()};
+}
+
+void Arena::reset() {
+    if (blocks_.size() > 1) {
+        // Outgrew one block: next time, fit all of it in one
+        size_t total = capacity();
+        blocks_.clear();
+        used_before_current_ = 0;
+        block_size_ = total;
+        add_block(total);
+        return;
+    }
+    used_before_current_ = 0;
+    if (!blocks_.empty()) {
+        cursor_ = blocks_.front().data.get();
+    }
+}
+
+size_t Arena::bytes_used() const {
+    if (blocks_.empty()) {
+        return 0;
+    }
+    return used_before_current_ + static_cast<size_t>(cursor_ - blocks_.back().data.get());
+}
+
+size_t Arena::capacity() const {
+    size_t total = 0;
+    for (const Block& block : blocks_) {
+        total += block.size;
+    }
+    return total;
+}
+
+} // namespace metricstream
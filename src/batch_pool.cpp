@@ -0,0 +1,60 @@
+#include "batch_pool.h"
+
+namespace metricstream {
+
+void BatchRecycler::operator()(MetricBatch* batch) const {
+    if (pool != nullptr) {
+        pool->recycle(batch);
+    } else {
+        delete batch;
+    }
+}
+
+BatchPool::BatchPool(size_t max_pooled) : max_pooled_(max_pooled) {
+    free_.reserve(max_pooled_);
+}
+
+BatchPool::~BatchPool() {
+    for (MetricBatch* batch : free_) {
+        delete batch;
+    }
+}
+
+PooledBatch BatchPool::acquire() {
+    MetricBatch* batch = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!free_.empty()) {
+            batch = free_.back();
+            free_.pop_back();
+        }
+    }
+
+    if (batch == nullptr) {
+        batch = new MetricBatch();
+        batch->metrics.reserve(INITIAL_METRIC_CAPACITY);
+    } else {
+        batch->received_at = std::chrono::system_clock::now();
+    }
+    return PooledBatch(batch, BatchRecycler{this});
+}
+
+void BatchPool::recycle(MetricBatch* batch) {
+    // Clear outside the lock; element destructors may free memory
+    batch->clear();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.size() < max_pooled_) {
+            free_.push_back(batch);
+            return;
+        }
+    }
+    delete batch;
+}
+
+size_t BatchPool::pooled() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return free_.size();
+}
+
+} // namespace metricstream
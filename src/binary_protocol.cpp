@@ -0,0 +1,360 @@
+#include "binary_protocol.h"
+#include "common.h"
+#include <algorithm>
+#include <cstring>
+
+namespace metricstream {
+
+namespace {
+
+constexpr size_t SERIES_HEADER_BYTES = 8;      // first_ref, count
+constexpr size_t MIN_SERIES_ENTRY_BYTES = 5;   // type, empty name, no tags
+constexpr size_t ACK_BODY_BYTES = 9;
+
+// Samples are decoded with plain loads: every supported target is
+// little-endian, and big-endian hosts swap
+inline uint32_t load_u32(const char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+inline uint64_t load_u64(const char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+Timestamp from_epoch_ns(int64_t ns) {
+    return Timestamp(std::chrono::duration_cast<Timestamp::duration>(std::chrono::nanoseconds(ns)));
+}
+
+void put_frame_header(ByteWriter& w, FrameType type, size_t body_bytes) {
+    w.put_u32(static_cast<uint32_t>(body_bytes + 1));
+    w.put_u8(static_cast<uint8_t>(type));
+}
+
+} // namespace
+
+// ============================================================================
+// Framing
+// ============================================================================
+
+size_t complete_frames(std::string_view data, size_t max_samples, size_t* frame_count,
+                       const char** error) {
+    size_t pos = 0;
+    size_t frames = 0;
+    size_t samples = 0;
+    while (data.size() - pos >= FRAME_HEADER_BYTES) {
+        uint32_t length = load_u32(data.data() + pos);
+        uint8_t type = static_cast<uint8_t>(data[pos + 4]);
+        if (length == 0 || length > MAX_FRAME_BYTES) {
+            if (error) *error = "Invalid frame length";
+            return 0;
+        }
+        if (type < static_cast<uint8_t>(FrameType::HELLO) || type > static_cast<uint8_t>(FrameType::USAGE) ||
+            type == static_cast<uint8_t>(FrameType::ACK)) {
+            if (error) *error = "Unknown frame type";
+            return 0;
+        }
+        size_t frame_bytes = sizeof(uint32_t) + length;
+        if (data.size() - pos < frame_bytes) {
+            break;
+        }
+        if (type == static_cast<uint8_t>(FrameType::SAMPLES) && length > sizeof(uint32_t)) {
+            size_t count = load_u32(data.data() + pos + FRAME_HEADER_BYTES);
+            if (frames > 0 && samples + count > max_samples) {
+                break;
+            }
+            samples += count;
+        }
+        pos += frame_bytes;
+        frames++;
+    }
+    if (frame_count) *frame_count = frames;
+    return pos;
+}
+
+size_t find_hello(std::string_view data, size_t* hello_bytes) {
+    size_t pos = 0;
+    while (data.size() - pos >= FRAME_HEADER_BYTES) {
+        size_t frame_bytes = sizeof(uint32_t) + load_u32(data.data() + pos);
+        if (data.size() - pos < frame_bytes) {
+            break;
+        }
+        if (static_cast<uint8_t>(data[pos + 4]) == static_cast<uint8_t>(FrameType::HELLO)) {
+            *hello_bytes = frame_bytes;
+            return pos;
+        }
+        pos += frame_bytes;
+    }
+    *hello_bytes = 0;
+    return data.size();
+}
+
+void encode_hello(std::string& out, std::string_view client_id) {
+    ByteWriter w(out);
+    put_frame_header(w, FrameType::HELLO, client_id.size());
+    w.put_bytes(client_id.data(), client_id.size());
+}
+
+void encode_usage(std::string& out, const ClientUsage* usage, size_t count) {
+    size_t body_bytes = sizeof(uint32_t);
+    for (size_t i = 0; i < count; ++i) {
+        body_bytes += sizeof(uint16_t) + std::min<size_t>(usage[i].client_id.size(), 0xFFFF) + sizeof(uint32_t);
+    }
+    ByteWriter w(out);
+    put_frame_header(w, FrameType::USAGE, body_bytes);
+    w.put_u32(static_cast<uint32_t>(count));
+    for (size_t i = 0; i < count; ++i) {
+        w.put_string(usage[i].client_id);
+        w.put_u32(usage[i].requests);
+    }
+}
+
+void encode_ack(std::string& out, const BinaryAck& ack) {
+    ByteWriter w(out);
+    put_frame_header(w, FrameType::ACK, ACK_BODY_BYTES);
+    w.put_u8(static_cast<uint8_t>(ack.status));
+    w.put_u32(ack.frames);
+    w.put_u32(ack.metrics);
+}
+
+bool decode_ack(std::string_view data, BinaryAck& ack, size_t& consumed) {
+    ByteReader r(data);
+    uint32_t length = r.get_u32();
+    uint8_t type = r.get_u8();
+    uint8_t status = r.get_u8();
+    ack.frames = r.get_u32();
+    ack.metrics = r.get_u32();
+    if (!r.ok() || length != ACK_BODY_BYTES + 1 || type != static_cast<uint8_t>(FrameType::ACK) ||
+        status > static_cast<uint8_t>(AckStatus::REJECTED)) {
+        return false;
+    }
+    ack.status = static_cast<AckStatus>(status);
+    consumed = r.position();
+    return true;
+}
+
+// ============================================================================
+// BinaryEncoder
+// ============================================================================
+
+uint32_t BinaryEncoder::series_ref(std::string_view name, MetricType type, const TagRefs& tags) {
+    std::string key(1, static_cast<char>(type));
+    key.append(name);
+    for (const auto& [k, v] : tags) {
+        key.push_back('\0');
+        key.append(k);
+        key.push_back('\0');
+        key.append(v);
+    }
+
+    auto it = refs_.find(key);
+    if (it != refs_.end()) {
+        return it->second;
+    }
+
+    uint32_t ref = static_cast<uint32_t>(refs_.size());
+    refs_.emplace(std::move(key), ref);
+    if (series_count_ == 0) {
+        series_first_ = ref;
+    }
+    series_count_++;
+
+    ByteWriter w(series_);
+    w.put_u8(static_cast<uint8_t>(type));
+    w.put_string(name);
+    w.put_u16(static_cast<uint16_t>(tags.size()));
+    for (const auto& [k, v] : tags) {
+        w.put_string(k);
+        w.put_string(v);
+    }
+    return ref;
+}
+
+void BinaryEncoder::add_sample(uint32_t ref, double value, int64_t timestamp_ns) {
+    ByteWriter w(samples_);
+    w.put_u32(ref);
+    w.put_i64(timestamp_ns);
+    w.put_f64(value);
+    sample_count_++;
+}
+
+void BinaryEncoder::flush(std::string& out) {
+    ByteWriter w(out);
+    if (series_count_ > 0) {
+        put_frame_header(w, FrameType::SERIES, SERIES_HEADER_BYTES + series_.size());
+        w.put_u32(series_first_);
+        w.put_u32(series_count_);
+        w.put_bytes(series_.data(), series_.size());
+        series_.clear();
+        series_count_ = 0;
+    }
+    if (sample_count_ > 0) {
+        put_frame_header(w, FrameType::SAMPLES, sizeof(uint32_t) + samples_.size());
+        w.put_u32(sample_count_);
+        w.put_bytes(samples_.data(), samples_.size());
+        samples_.clear();
+        sample_count_ = 0;
+    }
+}
+
+void BinaryEncoder::reset() {
+    refs_.clear();
+    series_.clear();
+    series_count_ = 0;
+    samples_.clear();
+    sample_count_ = 0;
+}
+
+// ============================================================================
+// BinaryDecoder
+// ============================================================================
+
+bool BinaryDecoder::decode(std::string_view frames, MetricBatch& batch, const char** error) {
+    size_t pos = 0;
+    while (pos < frames.size()) {
+        if (frames.size() - pos < FRAME_HEADER_BYTES) {
+            if (error) *error = "Truncated frame";
+            return false;
+        }
+        uint32_t length = load_u32(frames.data() + pos);
+        if (length == 0 || frames.size() - pos - sizeof(uint32_t) < length) {
+            if (error) *error = "Truncated frame";
+            return false;
+        }
+        auto type = static_cast<FrameType>(frames[pos + 4]);
+        std::string_view body = frames.substr(pos + FRAME_HEADER_BYTES, length - 1);
+        pos += sizeof(uint32_t) + length;
+
+        bool ok;
+        switch (type) {
+            case FrameType::HELLO:
+                client_id_.assign(body);
+                ok = true;
+                break;
+            case FrameType::SERIES:
+                ok = decode_series(body, error);
+                break;
+            case FrameType::SAMPLES:
+                ok = decode_samples(body, batch, error);
+                break;
+            case FrameType::USAGE:
+                ok = decode_usage(body, error);
+                break;
+            default:
+                if (error) *error = "Unknown frame type";
+                ok = false;
+                break;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool BinaryDecoder::decode_series(std::string_view body, const char** error) {
+    ByteReader r(body);
+    uint32_t first = r.get_u32();
+    uint32_t count = r.get_u32();
+    if (!r.ok() || first > series_.size() || count > MAX_STREAM_SERIES - first ||
+        count > r.remaining() / MIN_SERIES_ENTRY_BYTES) {
+        if (error) *error = "Invalid SERIES frame";
+        return false;
+    }
+
+    SeriesRegistry& registry = SeriesRegistry::global();
+    for (uint32_t i = 0; i < count; ++i) {
+        uint8_t type = r.get_u8();
+        std::string_view name = r.get_string();
+        uint16_t tag_count = r.get_u16();
+        tag_scratch_.clear();
+        for (uint16_t t = 0; t < tag_count && r.ok(); ++t) {
+            std::string_view key = r.get_string();
+            tag_scratch_.emplace_back(key, r.get_string());
+        }
+        if (!r.ok() || type > static_cast<uint8_t>(MetricType::SUMMARY)) {
+            if (error) *error = "Invalid SERIES frame";
+            return false;
+        }
+
+        SeriesRef ref{registry.intern(name, tag_scratch_), static_cast<MetricType>(type)};
+        if (first + i < series_.size()) {
+            series_[first + i] = ref;
+        } else {
+            series_.push_back(ref);
+        }
+    }
+    if (r.remaining() != 0) {
+        if (error) *error = "Invalid SERIES frame";
+        return false;
+    }
+    return true;
+}
+
+bool BinaryDecoder::decode_samples(std::string_view body, MetricBatch& batch, const char** error) {
+    if (body.size() < sizeof(uint32_t)) {
+        if (error) *error = "Invalid SAMPLES frame";
+        return false;
+    }
+    size_t count = load_u32(body.data());
+    if ((body.size() - sizeof(uint32_t)) / SAMPLE_BYTES != count ||
+        (body.size() - sizeof(uint32_t)) % SAMPLE_BYTES != 0) {
+        if (error) *error = "Invalid SAMPLES frame";
+        return false;
+    }
+
+    batch.metrics.reserve(batch.metrics.size() + count);
+    const char* p = body.data() + sizeof(uint32_t);
+    for (size_t i = 0; i < count; ++i, p += SAMPLE_BYTES) {
+        uint32_t ref = load_u32(p);
+        int64_t timestamp_ns = static_cast<int64_t>(load_u64(p + 4));
+        uint64_t bits = load_u64(p + 12);
+        if (ref >= series_.size()) {
+            if (error) *error = "Unknown series ref";
+            return false;
+        }
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        const SeriesRef& series = series_[ref];
+        batch.metrics.emplace_back(series.id, value, series.type,
+                                   timestamp_ns == 0 ? batch.received_at : from_epoch_ns(timestamp_ns));
+    }
+    return true;
+}
+
+bool BinaryDecoder::decode_usage(std::string_view body, const char** error) {
+    ByteReader r(body);
+    uint32_t count = r.get_u32();
+    // Each entry takes at least 6 bytes, which bounds a corrupt count
+    if (!r.ok() || count > r.remaining() / 6) {
+        if (error) *error = "Invalid USAGE frame";
+        return false;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        std::string_view client_id = r.get_string();
+        uint32_t requests = r.get_u32();
+        if (!r.ok()) {
+            if (error) *error = "Invalid USAGE frame";
+            return false;
+        }
+        usage_.push_back(ClientUsage{std::string(client_id), requests});
+    }
+    return true;
+}
+
+void BinaryDecoder::reset() {
+    series_.clear();
+    client_id_.clear();
+    usage_.clear();
+}
+
+} // namespace metricstream
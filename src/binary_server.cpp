@@ -0,0 +1,136 @@
+#include "binary_server.h"
+#include <unistd.h>
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+namespace metricstream {
+
+namespace {
+
+// The connection's dictionary, and how much of `in` the last dispatch used
+struct BinaryConnectionState : ConnectionContext {
+    BinaryDecoder decoder;
+    size_t consumed = 0;
+};
+
+} // namespace
+
+BinaryServer::BinaryServer(int port, FrameHandler handler, size_t thread_pool_size, size_t event_loops)
+    : port_(port), event_loop_count_(std::max<size_t>(1, event_loops)), handler_(std::move(handler)),
+      thread_pool_(std::make_unique<ThreadPool>(thread_pool_size)) {}
+
+BinaryServer::~BinaryServer() {
+    stop();
+    // Drain workers before the loops they post acks to go away
+    thread_pool_.reset();
+}
+
+void BinaryServer::start() {
+    if (running_.load()) {
+        return;
+    }
+
+    listen_fds_ = EventLoop::open_listeners(port_, event_loop_count_);
+    if (listen_fds_.empty()) {
+        return;
+    }
+
+    for (size_t i = 0; i < event_loop_count_; ++i) {
+        int listen_fd = listen_fds_[i % listen_fds_.size()];
+        auto loop = std::make_unique<EventLoop>(listen_fd,
+            [this](const ConnectionPtr& conn) { on_connection_data(conn); });
+        loop->set_idle_timeout(idle_timeout_);
+        loop->set_max_input_bytes(2 * MAX_FRAME_BYTES);
+        if (!loop->start()) {
+            break;
+        }
+        event_loops_.push_back(std::move(loop));
+    }
+
+    running_ = true;
+    std::cout << "Binary ingest listening on port " << port_
+              << " (" << event_loops_.size() << " event loops)" << std::endl;
+}
+
+void BinaryServer::stop() {
+    if (!running_.load()) {
+        return;
+    }
+
+    running_ = false;
+    for (auto& loop : event_loops_) {
+        loop->stop();
+    }
+    for (int fd : listen_fds_) {
+        close(fd);
+    }
+    listen_fds_.clear();
+    std::cout << "Binary ingest stopped" << std::endl;
+}
+
+size_t BinaryServer::active_connections() const {
+    size_t total = 0;
+    for (const auto& loop : event_loops_) {
+        total += loop->connection_count();
+    }
+    return total;
+}
+
+void BinaryServer::send_ack(const ConnectionPtr& conn, const BinaryAck& ack, bool close_after_write) {
+    std::string bytes;
+    encode_ack(bytes, ack);
+    OutboundMessage message;
+    message.add_inline(bytes);
+    conn->loop->send(conn, std::move(message), close_after_write);
+}
+
+// Runs on the connection's event loop thread after every read and after
+// each ack, so a connection's frames are decoded in order
+void BinaryServer::on_connection_data(const ConnectionPtr& conn) {
+    if (conn->in_flight) {
+        return;
+    }
+
+    if (!conn->context) {
+        conn->context = std::make_unique<BinaryConnectionState>();
+    }
+    auto* state = static_cast<BinaryConnectionState*>(conn->context.get());
+
+    // The previous frames have been acked: drop their bytes
+    if (state->consumed > 0) {
+        conn->in.erase(0, state->consumed);
+        state->consumed = 0;
+    }
+
+    const char* error = nullptr;
+    size_t frames = 0;
+    size_t bytes = complete_frames(conn->in, MAX_BATCH_SAMPLES, &frames, &error);
+    if (error) {
+        // Framing is lost, so the connection ends
+        conn->in_flight = true;
+        send_ack(conn, BinaryAck{AckStatus::INVALID, 0, 0}, true);
+        return;
+    }
+    if (bytes == 0) {
+        return;
+    }
+
+    // `in` is frozen while in flight, so the worker reads it in place
+    conn->in_flight = true;
+    state->consumed = bytes;
+    uint32_t frame_count = static_cast<uint32_t>(frames);
+    bool enqueued = thread_pool_->enqueue([this, conn, state, bytes, frame_count]() {
+        BinaryAck ack = handler_(state->decoder, std::string_view(conn->in).substr(0, bytes),
+                                 conn->remote_address);
+        ack.frames = frame_count;
+        send_ack(conn, ack, ack.status == AckStatus::INVALID || !running_.load());
+    });
+
+    // Dropping frames could lose dictionary entries, so the client reconnects
+    if (!enqueued) {
+        send_ack(conn, BinaryAck{AckStatus::OVERLOADED, frame_count, 0}, true);
+    }
+}
+
+} // namespace metricstream
@@ -0,0 +1,94 @@
+#include "cardinality.h"
+#include "common.h"
+#include <algorithm>
+#include <limits>
+
+namespace metricstream {
+
+CardinalityLimiter::CardinalityLimiter() : CardinalityLimiter(Options()) {}
+
+CardinalityLimiter::CardinalityLimiter(Options options)
+    : options_(options), clients_(options.max_clients) {}
+
+size_t CardinalityLimiter::budget(Client& client, std::chrono::steady_clock::time_point now) {
+    int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+    int64_t window_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(options_.window).count();
+    int64_t start = client.window_start_ns.load(std::memory_order_relaxed);
+    if (now_ns - start >= window_ns &&
+        client.window_start_ns.compare_exchange_strong(start, now_ns, std::memory_order_relaxed)) {
+        // The sketch two windows old becomes the current one. Requests still
+        // adding to the old current one count towards the previous window.
+        uint32_t next = client.window.load(std::memory_order_relaxed) + 1;
+        client.sketches[next % 2].clear();
+        client.created.store(0, std::memory_order_relaxed);
+        client.limited.store(false, std::memory_order_relaxed);
+        client.window.store(next, std::memory_order_release);
+    }
+
+    // Concurrent requests of one client share what is left, so together
+    // they may overshoot by a request's worth each
+    size_t left = std::numeric_limits<size_t>::max();
+    if (options_.max_new_series > 0) {
+        uint64_t created = client.created.load(std::memory_order_relaxed);
+        left = created >= options_.max_new_series ? 0 : options_.max_new_series - static_cast<size_t>(created);
+    }
+    if (options_.max_active_series > 0 &&
+        client.sketches[client.window.load(std::memory_order_acquire) % 2].estimate() >=
+            static_cast<double>(options_.max_active_series)) {
+        left = 0;
+    }
+    if (left == 0 && !client.limited.exchange(true, std::memory_order_relaxed)) {
+        clients_limited_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return left;
+}
+
+void CardinalityLimiter::record(Client& client, const ScopedSeriesBudget& scope, MetricBatch& batch, size_t first) {
+    if (size_t created = scope.created()) {
+        client.created.fetch_add(created, std::memory_order_relaxed);
+        client.created_total.fetch_add(created, std::memory_order_relaxed);
+    }
+    if (size_t refused = scope.refused()) {
+        client.refused_total.fetch_add(refused, std::memory_order_relaxed);
+        refused_.fetch_add(refused, std::memory_order_relaxed);
+    }
+    // A binary stream's refused series stay mapped for later batches, so
+    // this is not only about the series refused just now
+    if (options_.action == Action::REJECT && client.refused_total.load(std::memory_order_relaxed) > 0) {
+        auto& metrics = batch.metrics;
+        metrics.erase(std::remove_if(metrics.begin() + static_cast<std::ptrdiff_t>(first), metrics.end(),
+                                     [](const Metric& m) { return m.series_id == SeriesRegistry::OVERFLOW_ID; }),
+                      metrics.end());
+    }
+
+    HyperLogLog& sketch = client.sketches[client.window.load(std::memory_order_acquire) % 2];
+    for (size_t i = first; i < batch.metrics.size(); ++i) {
+        // Series ids are dense; the sketch needs their bits spread
+        sketch.add(mix64(batch.metrics[i].series_id));
+    }
+}
+
+std::vector<CardinalityLimiter::ClientStats> CardinalityLimiter::top_clients(size_t limit) const {
+    std::vector<ClientStats> out;
+    clients_.for_each([&out](const std::string& client_id, const Client& client) {
+        uint32_t window = client.window.load(std::memory_order_acquire);
+        ClientStats stats;
+        stats.client_id = client_id;
+        stats.series_estimate = client.sketches[window % 2].estimate();
+        stats.previous_estimate = client.sketches[(window + 1) % 2].estimate();
+        stats.created = client.created.load(std::memory_order_relaxed);
+        stats.created_total = client.created_total.load(std::memory_order_relaxed);
+        stats.refused_total = client.refused_total.load(std::memory_order_relaxed);
+        out.push_back(std::move(stats));
+    });
+    auto by_estimate = [](const ClientStats& a, const ClientStats& b) { return a.series_estimate > b.series_estimate; };
+    if (out.size() > limit) {
+        std::partial_sort(out.begin(), out.begin() + static_cast<std::ptrdiff_t>(limit), out.end(), by_estimate);
+        out.resize(limit);
+    } else {
+        std::sort(out.begin(), out.end(), by_estimate);
+    }
+    return out;
+}
+
+} // namespace metricstream
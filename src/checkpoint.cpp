@@ -0,0 +1,335 @@
+#include "checkpoint.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+namespace metricstream {
+
+namespace {
+
+constexpr std::string_view STATE_PREFIX = "state-";
+constexpr std::string_view STATE_SUFFIX = ".ckpt";
+constexpr size_t STATE_HEADER_SIZE = 48;
+constexpr size_t SECTION_ENTRY_SIZE = 24;
+constexpr size_t DICTIONARY_HEADER_SIZE = 16;
+constexpr size_t ALIGNMENT = 8;
+
+size_t aligned(size_t offset) {
+    return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+uint64_t state_sequence(std::string_view path) {
+    size_t dash = path.rfind('-');
+    if (dash == std::string_view::npos || path.size() < dash + 1 + STATE_SUFFIX.size()) {
+        return 0;
+    }
+    uint64_t sequence = 0;
+    for (size_t i = dash + 1; i < path.size() - STATE_SUFFIX.size(); ++i) {
+        if (path[i] < '0' || path[i] > '9') return 0;
+        sequence = sequence * 10 + static_cast<uint64_t>(path[i] - '0');
+    }
+    return sequence;
+}
+
+bool write_all(int fd, std::string_view data) {
+    size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t n = ::write(fd, data.data() + offset, data.size() - offset);
+        if (n > 0) {
+            offset += static_cast<size_t>(n);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+std::vector<std::string> list_checkpoint_files(const std::string& directory) {
+    std::vector<std::string> names;
+    if (DIR* dir = opendir(directory.c_str())) {
+        while (dirent* entry = readdir(dir)) {
+            std::string_view name = entry->d_name;
+            if (name.size() > STATE_PREFIX.size() + STATE_SUFFIX.size() &&
+                name.substr(0, STATE_PREFIX.size()) == STATE_PREFIX &&
+                name.substr(name.size() - STATE_SUFFIX.size()) == STATE_SUFFIX) {
+                names.emplace_back(name);
+            }
+        }
+        closedir(dir);
+    }
+    // Sequences are zero-padded, so name order is creation order
+    std::sort(names.begin(), names.end());
+    for (auto& name : names) {
+        name = directory + "/" + name;
+    }
+    return names;
+}
+
+CheckpointStore::CheckpointStore(Options options)
+    : options_(std::move(options)), dictionary_path_(options_.directory + "/series.dict") {
+    if (mkdir(options_.directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "Warning: Could not create checkpoint directory " << options_.directory << std::endl;
+    }
+    auto existing = list_checkpoint_files(options_.directory);
+    if (!existing.empty()) {
+        sequence_ = state_sequence(existing.back());
+    }
+}
+
+CheckpointStore::~CheckpointStore() {
+    if (dictionary_fd_ >= 0) {
+        ::close(dictionary_fd_);
+    }
+}
+
+bool CheckpointStore::load(SeriesRegistry& registry) {
+    auto files = list_checkpoint_files(options_.directory);
+    for (auto it = files.rbegin(); it != files.rend(); ++it) {
+        if (try_load(*it, registry)) {
+            return true;
+        }
+        std::cerr << "Warning: Ignoring unusable checkpoint " << *it << std::endl;
+        release();
+    }
+    rewrite_dictionary_ = true;
+    return false;
+}
+
+bool CheckpointStore::try_load(const std::string& path, SeriesRegistry& registry) {
+    if (!state_.open(path)) {
+        return false;
+    }
+    std::string_view data = state_.data();
+    ByteReader in(data);
+    std::string_view magic = in.get_bytes(CHECKPOINT_STATE_MAGIC.size());
+    uint32_t version = in.get_u32();
+    uint32_t count = in.get_u32();
+    uint64_t sequence = in.get_u64();
+    uint64_t generation = in.get_u64();
+    uint64_t series_count = in.get_u64();
+    uint64_t dictionary_bytes = in.get_u64();
+    if (!in.ok() || magic != CHECKPOINT_STATE_MAGIC || version != CHECKPOINT_VERSION ||
+        count > in.remaining() / SECTION_ENTRY_SIZE || series_count == 0) {
+        return false;
+    }
+    sections_.clear();
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t id = in.get_u32();
+        uint32_t crc = in.get_u32();
+        uint64_t offset = in.get_u64();
+        uint64_t length = in.get_u64();
+        if (offset > data.size() || length > data.size() - offset) {
+            return false;
+        }
+        std::string_view section = data.substr(offset, length);
+        if (crc32c(section.data(), section.size()) != crc) {
+            return false;
+        }
+        sections_.push_back({id, section});
+    }
+    size_t table_end = in.position();
+    if (in.get_u32() != crc32c(data.data(), table_end) || !in.ok()) {
+        return false;
+    }
+
+    // The dictionary prefix this state was written against
+    MappedFile dictionary;
+    if (!dictionary.open(dictionary_path_)) {
+        return false;
+    }
+    ByteReader dict(dictionary.data());
+    if (dict.get_bytes(DICTIONARY_MAGIC.size()) != DICTIONARY_MAGIC || dict.get_u64() != generation ||
+        !dict.ok() || dictionary_bytes > dict.remaining()) {
+        return false;
+    }
+    ByteReader records(dictionary.data().substr(DICTIONARY_HEADER_SIZE, dictionary_bytes));
+    std::vector<std::string_view> canonicals;
+    canonicals.reserve(series_count - 1);
+    while (records.remaining() > 0 && records.ok()) {
+        canonicals.push_back(records.get_bytes(records.get_u32()));
+    }
+    if (!records.ok() || canonicals.size() != series_count - 1) {
+        return false;
+    }
+
+    series_ids_.assign(series_count, SeriesRegistry::OVERFLOW_ID);
+    if (registry.restore(canonicals)) {
+        for (uint32_t id = 1; id < series_count; ++id) {
+            series_ids_[id] = id;
+        }
+        rewrite_dictionary_ = false;
+    } else {
+        // Shared with series registered already: ids differ from the
+        // dictionary's, so the next write() starts a new one
+        TagRefs tags;
+        std::string_view name;
+        for (size_t i = 0; i < canonicals.size(); ++i) {
+            if (SeriesRegistry::split_canonical(canonicals[i], name, tags)) {
+                series_ids_[i + 1] = registry.intern(name, tags);
+            }
+        }
+        rewrite_dictionary_ = true;
+    }
+    generation_ = generation;
+    dictionary_bytes_ = dictionary_bytes;
+    dictionary_count_ = series_count;
+    sequence_ = std::max(sequence_, sequence);
+    return true;
+}
+
+std::vector<std::string_view> CheckpointStore::sections(CheckpointSection id) const {
+    std::vector<std::string_view> out;
+    for (const SectionEntry& entry : sections_) {
+        if (entry.id == static_cast<uint32_t>(id)) {
+            out.push_back(entry.data);
+        }
+    }
+    return out;
+}
+
+std::string_view CheckpointStore::section(CheckpointSection id) const {
+    for (const SectionEntry& entry : sections_) {
+        if (entry.id == static_cast<uint32_t>(id)) {
+            return entry.data;
+        }
+    }
+    return {};
+}
+
+void CheckpointStore::release() {
+    sections_.clear();
+    state_.close();
+}
+
+bool CheckpointStore::append_dictionary(const SeriesRegistry& registry, size_t count, uint64_t& bytes) {
+    if (rewrite_dictionary_) {
+        if (dictionary_fd_ >= 0) {
+            ::close(dictionary_fd_);
+        }
+        dictionary_fd_ = ::open(dictionary_path_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (dictionary_fd_ < 0) {
+            return false;
+        }
+        uint64_t now = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+        generation_ = std::max(now, generation_ + 1);
+        std::string header;
+        ByteWriter w(header);
+        w.put_bytes(DICTIONARY_MAGIC.data(), DICTIONARY_MAGIC.size());
+        w.put_u64(generation_);
+        if (!write_all(dictionary_fd_, header)) {
+            return false;
+        }
+        dictionary_bytes_ = 0;
+        dictionary_count_ = 1;
+        bytes += header.size();
+        rewrite_dictionary_ = false;
+    } else if (dictionary_fd_ < 0) {
+        // Drop whatever a crash left past the last checkpoint's prefix
+        dictionary_fd_ = ::open(dictionary_path_.c_str(), O_RDWR);
+        if (dictionary_fd_ < 0 ||
+            ::ftruncate(dictionary_fd_, static_cast<off_t>(DICTIONARY_HEADER_SIZE + dictionary_bytes_)) != 0 ||
+            ::lseek(dictionary_fd_, 0, SEEK_END) < 0) {
+            return false;
+        }
+    }
+
+    std::string records;
+    ByteWriter w(records);
+    for (size_t id = dictionary_count_; id < count; ++id) {
+        const std::string& canonical = registry.key(static_cast<uint32_t>(id)).canonical;
+        w.put_u32(static_cast<uint32_t>(canonical.size()));
+        w.put_bytes(canonical.data(), canonical.size());
+    }
+    if (!write_all(dictionary_fd_, records) || ::fsync(dictionary_fd_) != 0) {
+        return false;
+    }
+    dictionary_bytes_ += records.size();
+    dictionary_count_ = count;
+    bytes += records.size();
+    return true;
+}
+
+bool CheckpointStore::write(const SeriesRegistry& registry, const Sections& sections) {
+    uint64_t bytes = 0;
+    size_t series_count = registry.size();
+    if (!append_dictionary(registry, series_count, bytes)) {
+        std::cerr << "Warning: Could not write series dictionary " << dictionary_path_ << std::endl;
+        if (dictionary_fd_ >= 0) {
+            ::close(dictionary_fd_);
+            dictionary_fd_ = -1;
+        }
+        rewrite_dictionary_ = true;
+        return false;
+    }
+
+    std::string header;
+    ByteWriter w(header);
+    w.put_bytes(CHECKPOINT_STATE_MAGIC.data(), CHECKPOINT_STATE_MAGIC.size());
+    w.put_u32(CHECKPOINT_VERSION);
+    w.put_u32(static_cast<uint32_t>(sections.size()));
+    w.put_u64(sequence_ + 1);
+    w.put_u64(generation_);
+    w.put_u64(series_count);
+    w.put_u64(dictionary_bytes_);
+    size_t offset = aligned(STATE_HEADER_SIZE + sections.size() * SECTION_ENTRY_SIZE + 4);
+    for (const auto& [id, data] : sections) {
+        w.put_u32(static_cast<uint32_t>(id));
+        w.put_u32(crc32c(data.data(), data.size()));
+        w.put_u64(offset);
+        w.put_u64(data.size());
+        offset = aligned(offset + data.size());
+    }
+    w.put_u32(crc32c(header.data(), header.size()));
+
+    char name[48];
+    std::snprintf(name, sizeof(name), "state-%020llu.ckpt", static_cast<unsigned long long>(sequence_ + 1));
+    std::string path = options_.directory + "/" + name;
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Warning: Could not write checkpoint " << tmp << std::endl;
+        return false;
+    }
+    static const char PADDING[ALIGNMENT] = {};
+    bool ok = write_all(fd, header) &&
+              write_all(fd, std::string_view(PADDING, aligned(header.size()) - header.size()));
+    for (size_t i = 0; i < sections.size() && ok; ++i) {
+        const std::string& data = sections[i].second;
+        ok = write_all(fd, data) &&
+             write_all(fd, std::string_view(PADDING, aligned(data.size()) - data.size()));
+    }
+    ok = ok && ::fsync(fd) == 0;
+    ::close(fd);
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::cerr << "Warning: Could not write checkpoint " << path << std::endl;
+        ::unlink(tmp.c_str());
+        return false;
+    }
+
+    sequence_++;
+    checkpoints_written_.fetch_add(1, std::memory_order_relaxed);
+    last_bytes_.store(bytes + offset, std::memory_order_relaxed);
+    delete_old_states();
+    return true;
+}
+
+void CheckpointStore::delete_old_states() {
+    auto files = list_checkpoint_files(options_.directory);
+    size_t keep = std::max<size_t>(options_.keep, 1);
+    for (size_t i = 0; i + keep < files.size(); ++i) {
+        ::unlink(files[i].c_str());
+    }
+}
+
+} // namespace metricstream
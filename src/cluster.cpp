@@ -0,0 +1,417 @@
+#include "cluster.h"
+#include "common.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <iostream>
+#include <limits>
+
+namespace metricstream {
+
+namespace {
+
+#ifdef MSG_NOSIGNAL
+constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+constexpr int SEND_FLAGS = 0;
+#endif
+
+void set_timeout(int fd, int option, std::chrono::milliseconds timeout) {
+    timeval tv{};
+    tv.tv_sec = static_cast<decltype(tv.tv_sec)>(timeout.count() / 1000);
+    tv.tv_usec = static_cast<decltype(tv.tv_usec)>((timeout.count() % 1000) * 1000);
+    setsockopt(fd, SOL_SOCKET, option, &tv, sizeof(tv));
+}
+
+} // namespace
+
+bool parse_cluster_node(std::string_view spec, ClusterNode& out) {
+    size_t colon = spec.rfind(':');
+    if (colon == std::string_view::npos || colon == 0 || colon + 1 == spec.size()) {
+        return false;
+    }
+    int port = 0;
+    for (char c : spec.substr(colon + 1)) {
+        if (c < '0' || c > '9') return false;
+        port = port * 10 + (c - '0');
+        if (port > 65535) return false;
+    }
+    if (port == 0) {
+        return false;
+    }
+    out.host.assign(spec.substr(0, colon));
+    out.port = port;
+    return true;
+}
+
+ClusterPeers::ClusterPeers(const std::vector<ClusterNode>& nodes, size_t self)
+    : self_(self), addresses_(nodes.size()) {
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (i == self) continue;
+        addrinfo hints{};
+        hints.ai_family = AF_INET;   // Listeners are IPv4
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* resolved = nullptr;
+        if (getaddrinfo(nodes[i].host.c_str(), nullptr, &hints, &resolved) != 0) {
+            std::cerr << "[CLUSTER] Cannot resolve " << nodes[i].host
+                      << "; its forwarded streams will be limited as clients" << std::endl;
+            continue;
+        }
+        for (addrinfo* ai = resolved; ai != nullptr; ai = ai->ai_next) {
+            char address[INET_ADDRSTRLEN];
+            auto* in = reinterpret_cast<sockaddr_in*>(ai->ai_addr);
+            if (inet_ntop(AF_INET, &in->sin_addr, address, sizeof(address))) {
+                addresses_[i].emplace_back(address);
+            }
+        }
+        freeaddrinfo(resolved);
+    }
+}
+
+bool ClusterPeers::trusted(std::string_view client_id, std::string_view remote_address) const {
+    if (client_id.substr(0, CLUSTER_CLIENT_PREFIX.size()) != CLUSTER_CLIENT_PREFIX) {
+        return false;
+    }
+    std::string_view digits = client_id.substr(CLUSTER_CLIENT_PREFIX.size());
+    if (digits.empty() || digits.size() > 6) {
+        return false;
+    }
+    size_t node = 0;
+    for (char c : digits) {
+        if (c < '0' || c > '9') return false;
+        node = node * 10 + static_cast<size_t>(c - '0');
+    }
+    if (node >= addresses_.size() || node == self_) {
+        return false;
+    }
+    const auto& known = addresses_[node];
+    return std::find(known.begin(), known.end(), remote_address) != known.end();
+}
+
+uint64_t series_hash(std::string_view canonical) {
+    uint64_t h = 0xCBF29CE484222325ULL;
+    for (char c : canonical) {
+        h ^= static_cast<uint8_t>(c);
+        h *= 0x100000001B3ULL;
+    }
+    return mix64(h);
+}
+
+// ============================================================================
+// HashRing
+// ============================================================================
+
+HashRing::HashRing(size_t nodes, size_t virtual_nodes) : nodes_(std::max<size_t>(nodes, 1)) {
+    virtual_nodes = std::max<size_t>(virtual_nodes, 1);
+    points_.reserve(nodes_ * virtual_nodes);
+    for (size_t node = 0; node < nodes_; ++node) {
+        for (size_t v = 0; v < virtual_nodes; ++v) {
+            uint64_t point = mix64((static_cast<uint64_t>(node) << 32 | v) + 0x9E3779B97F4A7C15ULL);
+            points_.push_back(Point{point, static_cast<uint32_t>(node)});
+        }
+    }
+    std::sort(points_.begin(), points_.end(), [](const Point& a, const Point& b) {
+        return a.hash < b.hash || (a.hash == b.hash && a.node < b.node);
+    });
+}
+
+size_t HashRing::owner(uint64_t hash) const {
+    auto it = std::lower_bound(points_.begin(), points_.end(), hash,
+                               [](const Point& point, uint64_t h) { return point.hash < h; });
+    return it == points_.end() ? points_.front().node : it->node;
+}
+
+// ============================================================================
+// ClusterForwarder
+// ============================================================================
+
+class ClusterForwarder::Group {
+public:
+    explicit Group(Peer* peer) : peer(peer) {}
+
+    Peer* peer;
+    std::vector<Metric> metrics;
+    std::string usage;   // Encoded USAGE frames
+    bool done = false;
+    bool ok = false;
+};
+
+struct ClusterForwarder::Peer {
+    ClusterNode node;
+    std::mutex mutex;                 // Guards open, stopping and the groups' results
+    std::condition_variable wake;     // Sender: work or shutdown
+    std::condition_variable acked;    // Waiters: a group finished
+    std::shared_ptr<Group> open;      // Collecting metrics for the next send
+    bool stopping = false;
+    std::thread thread;
+
+    // Sender thread only
+    int fd = -1;
+    BinaryEncoder encoder;
+    std::string wire;
+    std::string inbox;
+    std::chrono::steady_clock::time_point retry_at{};
+};
+
+ClusterForwarder::ClusterForwarder(std::vector<ClusterNode> nodes, size_t self)
+    : ClusterForwarder(std::move(nodes), self, Options()) {}
+
+ClusterForwarder::ClusterForwarder(std::vector<ClusterNode> nodes, size_t self, Options options)
+    : options_(options), client_id_(std::string(CLUSTER_CLIENT_PREFIX) + std::to_string(self)) {
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (i == self) {
+            peers_.emplace_back();
+            continue;
+        }
+        auto peer = std::make_unique<Peer>();
+        peer->node = std::move(nodes[i]);
+        peers_.push_back(std::move(peer));
+    }
+    for (auto& peer : peers_) {
+        if (peer) {
+            peer->thread = std::thread(&ClusterForwarder::sender_loop, this, std::ref(*peer));
+        }
+    }
+}
+
+ClusterForwarder::~ClusterForwarder() {
+    for (auto& peer : peers_) {
+        if (!peer) continue;
+        {
+            std::lock_guard<std::mutex> lock(peer->mutex);
+            peer->stopping = true;
+        }
+        peer->wake.notify_all();
+        peer->thread.join();
+        if (peer->fd >= 0) {
+            close(peer->fd);
+        }
+    }
+}
+
+ClusterForwarder::Ticket ClusterForwarder::send(size_t node, const Metric* metrics, size_t count) {
+    if (node >= peers_.size() || !peers_[node]) {
+        return nullptr;
+    }
+    Peer& peer = *peers_[node];
+    std::lock_guard<std::mutex> lock(peer.mutex);
+    if (peer.stopping) {
+        return nullptr;
+    }
+    if (!peer.open) {
+        peer.open = std::make_shared<Group>(&peer);
+    }
+    if (peer.open->metrics.size() + count > options_.max_pending_metrics) {
+        errors_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    peer.open->metrics.insert(peer.open->metrics.end(), metrics, metrics + count);
+    peer.wake.notify_one();
+    return peer.open;
+}
+
+void ClusterForwarder::share_usage(const std::vector<ClientUsage>& usage) {
+    if (usage.empty()) {
+        return;
+    }
+    // Split so no frame nears MAX_FRAME_BYTES, however long the client ids
+    constexpr size_t FRAME_BUDGET = 1024 * 1024;
+    std::string frames;
+    size_t first = 0;
+    size_t bytes = 0;
+    for (size_t i = 0; i < usage.size(); ++i) {
+        bytes += usage[i].client_id.size() + 6;
+        if (bytes > FRAME_BUDGET || i + 1 == usage.size()) {
+            encode_usage(frames, usage.data() + first, i + 1 - first);
+            first = i + 1;
+            bytes = 0;
+        }
+    }
+    for (auto& peer : peers_) {
+        if (!peer) continue;
+        std::lock_guard<std::mutex> lock(peer->mutex);
+        if (peer->stopping) continue;
+        if (!peer->open) {
+            peer->open = std::make_shared<Group>(peer.get());
+        }
+        peer->open->usage.append(frames);
+        peer->wake.notify_one();
+    }
+}
+
+bool ClusterForwarder::wait(const Ticket& ticket) {
+    if (!ticket) {
+        return false;
+    }
+    Peer& peer = *ticket->peer;
+    std::unique_lock<std::mutex> lock(peer.mutex);
+    peer.acked.wait(lock, [&] { return ticket->done; });
+    return ticket->ok;
+}
+
+void ClusterForwarder::sender_loop(Peer& peer) {
+    while (true) {
+        std::shared_ptr<Group> group;
+        {
+            std::unique_lock<std::mutex> lock(peer.mutex);
+            auto pending = [&] {
+                return peer.open && (!peer.open->metrics.empty() || !peer.open->usage.empty());
+            };
+            peer.wake.wait(lock, [&] { return peer.stopping || pending(); });
+            if (!pending()) {
+                return;   // Stopping with nothing left
+            }
+            group = std::move(peer.open);
+        }
+
+        bool ok = deliver(peer, *group);
+        if (ok) {
+            forwarded_.fetch_add(group->metrics.size(), std::memory_order_relaxed);
+        } else {
+            errors_.fetch_add(1, std::memory_order_relaxed);
+        }
+        {
+            std::lock_guard<std::mutex> lock(peer.mutex);
+            group->done = true;
+            group->ok = ok;
+        }
+        peer.acked.notify_all();
+    }
+}
+
+bool ClusterForwarder::connect_peer(Peer& peer) {
+    auto now = std::chrono::steady_clock::now();
+    if (now < peer.retry_at) {
+        return false;   // Fail fast while the peer is known to be down
+    }
+    peer.retry_at = now + options_.connect_timeout;
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    std::string port = std::to_string(peer.node.port);
+    if (getaddrinfo(peer.node.host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+        return false;
+    }
+
+    int fd = -1;
+    for (addrinfo* ai = addresses; ai != nullptr && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        // Non-blocking connect, so an unreachable host costs connect_timeout
+        int flags = fcntl(fd, F_GETFL, 0);
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+        int rc = connect(fd, ai->ai_addr, ai->ai_addrlen);
+        if (rc != 0 && errno == EINPROGRESS) {
+            pollfd pfd{fd, POLLOUT, 0};
+            int error = 0;
+            socklen_t length = sizeof(error);
+            if (poll(&pfd, 1, static_cast<int>(options_.connect_timeout.count())) == 1 &&
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0) {
+                rc = 0;
+            }
+        }
+        if (rc != 0) {
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        fcntl(fd, F_SETFL, flags);
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0) {
+        return false;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    set_timeout(fd, SO_RCVTIMEO, options_.ack_timeout);
+    set_timeout(fd, SO_SNDTIMEO, options_.ack_timeout);
+
+    peer.fd = fd;
+    peer.retry_at = {};
+    peer.encoder.reset();
+    peer.inbox.clear();
+    return true;
+}
+
+bool ClusterForwarder::deliver(Peer& peer, const Group& group) {
+    bool fresh = peer.fd < 0;
+    if (fresh && !connect_peer(peer)) {
+        return false;
+    }
+
+    // The peer's dictionary starts empty on a new connection
+    peer.wire.clear();
+    if (fresh) {
+        encode_hello(peer.wire, client_id_);
+    }
+    const SeriesRegistry& registry = SeriesRegistry::global();
+    TagRefs tags;
+    for (const Metric& metric : group.metrics) {
+        const SeriesKey& key = registry.key(metric.series_id);
+        tags.assign(key.tags.begin(), key.tags.end());
+        uint32_t ref = peer.encoder.series_ref(key.name, metric.type, tags);
+        int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            metric.timestamp.time_since_epoch()).count();
+        peer.encoder.add_sample(ref, metric.value, ns);
+        if (peer.encoder.pending_samples() == MAX_BATCH_SAMPLES) {
+            peer.encoder.flush(peer.wire);
+        }
+    }
+    if (peer.encoder.pending_samples() > 0) {
+        peer.encoder.flush(peer.wire);
+    }
+    peer.wire.append(group.usage);
+
+    size_t frames = 0;
+    const char* error = nullptr;
+    complete_frames(peer.wire, std::numeric_limits<size_t>::max(), &frames, &error);
+
+    auto fail = [&peer] {
+        close(peer.fd);
+        peer.fd = -1;
+        return false;
+    };
+
+    size_t sent = 0;
+    while (sent < peer.wire.size()) {
+        ssize_t n = ::send(peer.fd, peer.wire.data() + sent, peer.wire.size() - sent, SEND_FLAGS);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return fail();
+        sent += static_cast<size_t>(n);
+    }
+
+    // Every frame is covered by some ack; any refusal fails the group
+    bool ok = true;
+    size_t acked = 0;
+    char chunk[256];
+    while (acked < frames) {
+        BinaryAck ack;
+        size_t consumed = 0;
+        if (decode_ack(peer.inbox, ack, consumed)) {
+            peer.inbox.erase(0, consumed);
+            acked += ack.frames;
+            ok = ok && ack.status == AckStatus::OK;
+            continue;
+        }
+        ssize_t n = recv(peer.fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return fail();
+        peer.inbox.append(chunk, static_cast<size_t>(n));
+    }
+    return ok;
+}
+
+} // namespace metricstream
@@ -1,8 +1,177 @@
-// Common utilities - placeholder for now
-#include <string>
+// Common utilities shared by storage and networking code
+#include "common.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include <array>
+#include <cmath>
+#include <cstdio>
+
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+// Floating-point to_chars is missing from some standard libraries
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+#define METRICSTREAM_HAS_FP_TO_CHARS 1
+#endif
 
 namespace metricstream {
 
-// Utility functions will be added here as needed
+namespace {
+
+// Reflected CRC-32C polynomial
+constexpr uint32_t CRC32C_POLY = 0x82F63B78u;
+
+std::array<uint32_t, 256> make_crc_table() {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+const std::array<uint32_t, 256> CRC_TABLE = make_crc_table();
+
+} // namespace
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : data_(other.data_), size_(other.size_) {
+    other.data_ = nullptr;
+    other.size_ = 0;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        close();
+        data_ = other.data_;
+        size_ = other.size_;
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+    return *this;
+}
+
+bool MappedFile::open(const std::string& path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+    void* addr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);   // The mapping keeps the file referenced
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    data_ = static_cast<const char*>(addr);
+    size_ = static_cast<size_t>(st.st_size);
+    return true;
+}
+
+void MappedFile::close() {
+    if (data_) {
+        munmap(const_cast<char*>(data_), size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+}
+
+void append_uint(std::string& out, uint64_t value) {
+    char digits[20];
+    size_t n = 0;
+    do {
+        digits[n++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (n > 0) {
+        out.push_back(digits[--n]);
+    }
+}
+
+void append_json_string(std::string& out, std::string_view value) {
+    static const char HEX[] = "0123456789abcdef";
+    out.push_back('"');
+    for (char c : value) {
+        unsigned char u = static_cast<unsigned char>(c);
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+            out.push_back(c);
+        } else if (u < 0x20) {
+            out.append("\\u00");
+            out.push_back(HEX[u >> 4]);
+            out.push_back(HEX[u & 0xF]);
+        } else {
+            out.push_back(c);
+        }
+    }
+    out.push_back('"');
+}
+
+void append_json_number(std::string& out, double value) {
+    if (!std::isfinite(value)) {
+        out.append("null");   // JSON has no NaN/Inf
+        return;
+    }
+    double integral;
+    if (std::modf(value, &integral) == 0.0 && std::fabs(value) < 1e15) {
+        // Common case for counters: plain integer digits
+        if (value < 0) {
+            out.push_back('-');
+            append_uint(out, static_cast<uint64_t>(-value));
+        } else {
+            append_uint(out, static_cast<uint64_t>(value));
+        }
+        return;
+    }
+
+    char digits[32];
+#ifdef METRICSTREAM_HAS_FP_TO_CHARS
+    // Shortest representation that round-trips
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, static_cast<size_t>(result.ptr - digits));
+#else
+    int n = std::snprintf(digits, sizeof(digits), "%.17g", value);
+    out.append(digits, static_cast<size_t>(n));
+#endif
+}
+
+bool pin_current_thread(size_t cpu) {
+#if defined(__linux__)
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus <= 0) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(static_cast<int>(cpu % static_cast<size_t>(cpus)), &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    // macOS only has affinity hints between threads, not cores
+    (void)cpu;
+    return false;
+#endif
+}
+
+uint32_t crc32c(const void* data, size_t length, uint32_t crc) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < length; ++i) {
+        crc = CRC_TABLE[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
 
-} // namespace metricstream
\ No newline at end of file
+} // namespace metricstream
@@ -0,0 +1,822 @@
+#include "event_loop.h"
+#include "common.h"
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#else
+#include <poll.h>
+#endif
+
+namespace metricstream {
+
+namespace {
+
+constexpr size_t READ_CHUNK_SIZE = 64 * 1024;
+constexpr int MAX_ACCEPTS_PER_WAKEUP = 64;
+constexpr int POLL_TIMEOUT_MS = 1000;
+// Out of descriptors: how long the listener stays unwatched before retrying
+constexpr int ACCEPT_BACKOFF_MS = 100;
+constexpr size_t MAX_IOV_PER_SEND = 64;
+
+bool set_non_blocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+} // namespace
+
+// ============================================================================
+// OutboundMessage
+// ============================================================================
+
+bool OutboundMessage::push_segment(Kind kind, const char* data, uint32_t offset, size_t size) {
+    if (segment_count_ == MAX_SEGMENTS) {
+        return false;
+    }
+    segments_[segment_count_++] = Segment{kind, data, offset, static_cast<uint32_t>(size)};
+    total_size_ += size;
+    return true;
+}
+
+void OutboundMessage::flatten() {
+    std::string bytes;
+    bytes.reserve(total_size_);
+    for (size_t i = 0; i < segment_count_; ++i) {
+        const Segment& seg = segments_[i];
+        bytes.append(segment_data(seg), seg.size);
+    }
+    owned_.clear();
+    owned_.push_back(std::move(bytes));
+    inline_used_ = 0;
+    segments_[0] = Segment{Kind::OWNED, nullptr, 0, static_cast<uint32_t>(total_size_)};
+    segment_count_ = 1;
+}
+
+void OutboundMessage::append_flattened(std::string_view bytes) {
+    // Rare: a message with more pieces than segments becomes one buffer
+    flatten();
+    owned_.back().append(bytes.data(), bytes.size());
+    segments_[0].size += static_cast<uint32_t>(bytes.size());
+    total_size_ += bytes.size();
+}
+
+void OutboundMessage::add_static(std::string_view bytes) {
+    if (bytes.empty()) {
+        return;
+    }
+    if (!push_segment(Kind::STATIC, bytes.data(), 0, bytes.size())) {
+        append_flattened(bytes);
+    }
+}
+
+void OutboundMessage::add_inline(std::string_view bytes) {
+    if (bytes.empty()) {
+        return;
+    }
+    if (INLINE_CAPACITY - inline_used_ < bytes.size()) {
+        add_owned(std::string(bytes));
+        return;
+    }
+    // Extend the previous segment when it ends where this one would start
+    Segment* last = segment_count_ > 0 ? &segments_[segment_count_ - 1] : nullptr;
+    bool contiguous = last && last->kind == Kind::INLINE && last->offset + last->size == inline_used_;
+    if (!contiguous && !push_segment(Kind::INLINE, nullptr, static_cast<uint32_t>(inline_used_), 0)) {
+        append_flattened(bytes);
+        return;
+    }
+    std::memcpy(inline_ + inline_used_, bytes.data(), bytes.size());
+    inline_used_ += bytes.size();
+    segments_[segment_count_ - 1].size += static_cast<uint32_t>(bytes.size());
+    total_size_ += bytes.size();
+}
+
+void OutboundMessage::add_owned(std::string bytes) {
+    if (bytes.empty()) {
+        return;
+    }
+    if (segment_count_ == MAX_SEGMENTS) {
+        append_flattened(bytes);
+        return;
+    }
+    size_t size = bytes.size();
+    owned_.push_back(std::move(bytes));
+    push_segment(Kind::OWNED, nullptr, static_cast<uint32_t>(owned_.size() - 1), size);
+}
+
+const char* OutboundMessage::segment_data(const Segment& seg) const {
+    switch (seg.kind) {
+        case Kind::STATIC: return seg.data;
+        case Kind::INLINE: return inline_ + seg.offset;
+        case Kind::OWNED:  return owned_[seg.offset].data();
+    }
+    return nullptr;
+}
+
+size_t OutboundMessage::fill_iovec(struct iovec* iov, size_t max_iov, size_t skip) const {
+    size_t count = 0;
+    for (size_t i = 0; i < segment_count_ && count < max_iov; ++i) {
+        const Segment& seg = segments_[i];
+        if (skip >= seg.size) {
+            skip -= seg.size;
+            continue;
+        }
+        iov[count].iov_base = const_cast<char*>(segment_data(seg) + skip);
+        iov[count].iov_len = seg.size - skip;
+        skip = 0;
+        count++;
+    }
+    return count;
+}
+
+// ============================================================================
+// Poller: readiness backend (edge-triggered epoll on Linux, poll() elsewhere)
+// ============================================================================
+
+struct PollEvent {
+    int fd;
+    bool readable;
+    bool writable;
+    bool error;
+};
+
+#if defined(__linux__)
+
+class EventLoop::Poller {
+public:
+    Poller() : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)) {}
+    ~Poller() { if (epoll_fd_ >= 0) close(epoll_fd_); }
+
+    bool valid() const { return epoll_fd_ >= 0; }
+
+    // Sockets are edge-triggered: callers must drain reads/writes to EAGAIN
+    bool add(int fd, bool edge_triggered, bool want_write) {
+        return control(EPOLL_CTL_ADD, fd, edge_triggered, want_write);
+    }
+
+    bool modify(int fd, bool want_write) {
+        return control(EPOLL_CTL_MOD, fd, true, want_write);
+    }
+
+    void remove(int fd) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    int wait(std::vector<PollEvent>& out, int timeout_ms) {
+        epoll_event events[256];
+        int n = epoll_wait(epoll_fd_, events, 256, timeout_ms);
+        out.clear();
+        for (int i = 0; i < n; ++i) {
+            uint32_t e = events[i].events;
+            out.push_back(PollEvent{
+                events[i].data.fd,
+                (e & (EPOLLIN | EPOLLRDHUP)) != 0,
+                (e & EPOLLOUT) != 0,
+                (e & (EPOLLERR | EPOLLHUP)) != 0
+            });
+        }
+        return n;
+    }
+
+private:
+    int epoll_fd_;
+
+    bool control(int op, int fd, bool edge_triggered, bool want_write) {
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        if (edge_triggered) ev.events |= EPOLLET;
+        if (want_write) ev.events |= EPOLLOUT;
+        ev.data.fd = fd;
+        return epoll_ctl(epoll_fd_, op, fd, &ev) == 0;
+    }
+};
+
+#else
+
+class EventLoop::Poller {
+public:
+    bool valid() const { return true; }
+
+    // poll() is level-triggered; draining to EAGAIN is still correct
+    bool add(int fd, bool /* edge_triggered */, bool want_write) {
+        index_[fd] = fds_.size();
+        fds_.push_back(pollfd{fd, static_cast<short>(POLLIN | (want_write ? POLLOUT : 0)), 0});
+        return true;
+    }
+
+    bool modify(int fd, bool want_write) {
+        auto it = index_.find(fd);
+        if (it == index_.end()) return false;
+        fds_[it->second].events = static_cast<short>(POLLIN | (want_write ? POLLOUT : 0));
+        return true;
+    }
+
+    void remove(int fd) {
+        auto it = index_.find(fd);
+        if (it == index_.end()) return;
+        size_t idx = it->second;
+        index_.erase(it);
+        if (idx != fds_.size() - 1) {
+            fds_[idx] = fds_.back();
+            index_[fds_[idx].fd] = idx;
+        }
+        fds_.pop_back();
+    }
+
+    int wait(std::vector<PollEvent>& out, int timeout_ms) {
+        out.clear();
+        int n = poll(fds_.data(), fds_.size(), timeout_ms);
+        if (n <= 0) return n;
+        for (const auto& p : fds_) {
+            if (p.revents == 0) continue;
+            out.push_back(PollEvent{
+                p.fd,
+                (p.revents & POLLIN) != 0,
+                (p.revents & POLLOUT) != 0,
+                (p.revents & (POLLERR | POLLHUP | POLLNVAL)) != 0
+            });
+        }
+        return static_cast<int>(out.size());
+    }
+
+private:
+    std::vector<pollfd> fds_;
+    std::unordered_map<int, size_t> index_;
+};
+
+#endif
+
+// ============================================================================
+// EventLoop
+// ============================================================================
+
+EventLoop::EventLoop(int listen_fd, DataCallback on_data)
+    : listen_fd_(listen_fd), on_data_(std::move(on_data)), poller_(std::make_unique<Poller>()) {
+}
+
+EventLoop::~EventLoop() {
+    stop();
+    if (wake_read_fd_ >= 0) close(wake_read_fd_);
+    if (wake_write_fd_ >= 0 && wake_write_fd_ != wake_read_fd_) close(wake_write_fd_);
+}
+
+int EventLoop::open_listener(int port, bool reuse_port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        std::cerr << "Failed to create socket" << std::endl;
+        return -1;
+    }
+
+    // Allow socket reuse
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+#ifdef SO_REUSEPORT
+    if (reuse_port) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    }
+#else
+    (void)reuse_port;
+#endif
+
+    struct sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        std::cerr << "Bind failed on port " << port << std::endl;
+        close(fd);
+        return -1;
+    }
+
+    // Phase 7 lesson: a small backlog drops connection bursts
+    if (listen(fd, SOMAXCONN) < 0 || !set_non_blocking(fd)) {
+        std::cerr << "Listen failed" << std::endl;
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+std::vector<int> EventLoop::open_listeners(int port, size_t event_loops) {
+    std::vector<int> fds;
+    bool per_loop = supports_reuse_port() && event_loops > 1;
+    if (per_loop) {
+        // Any process could join an SO_REUSEPORT group and take a share of
+        // our connections, so claim the port alone first: a plain bind
+        // fails if anyone, reuseport group or not, already holds it
+        int probe = open_listener(port, false);
+        if (probe < 0) {
+            return fds;
+        }
+        close(probe);
+    }
+
+    size_t count = per_loop ? event_loops : 1;
+    for (size_t i = 0; i < count; ++i) {
+        int fd = open_listener(port, per_loop);
+        if (fd < 0) {
+            for (int open_fd : fds) {
+                close(open_fd);
+            }
+            fds.clear();
+            break;
+        }
+        fds.push_back(fd);
+    }
+    return fds;
+}
+
+bool EventLoop::supports_reuse_port() {
+#if defined(__linux__) && defined(SO_REUSEPORT)
+    return true;
+#else
+    // BSD/macOS accept SO_REUSEPORT but do not load-balance between sockets
+    return false;
+#endif
+}
+
+bool EventLoop::start() {
+    if (running_.load()) {
+        return true;
+    }
+    if (!poller_->valid()) {
+        std::cerr << "[EventLoop] Failed to create poller" << std::endl;
+        return false;
+    }
+
+#if defined(__linux__)
+    wake_read_fd_ = wake_write_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_read_fd_ < 0) {
+        std::cerr << "[EventLoop] Failed to create eventfd" << std::endl;
+        return false;
+    }
+#else
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0) {
+        std::cerr << "[EventLoop] Failed to create wakeup pipe" << std::endl;
+        return false;
+    }
+    wake_read_fd_ = pipe_fds[0];
+    wake_write_fd_ = pipe_fds[1];
+    set_non_blocking(wake_read_fd_);
+    set_non_blocking(wake_write_fd_);
+#endif
+
+    poller_->add(wake_read_fd_, false, false);
+    poller_->add(listen_fd_, false, false);
+
+    running_ = true;
+    thread_ = std::thread(&EventLoop::run, this);
+    return true;
+}
+
+void EventLoop::stop() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+    wake();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void EventLoop::send(const ConnectionPtr& conn, OutboundMessage message, bool close_after_write) {
+    auto deliver = [this, conn, close_after_write](OutboundMessage& data) {
+        if (conn->closed) {
+            return;
+        }
+        // A response completes the request that was in flight
+        conn->in_flight = false;
+        conn->close_after_write = conn->close_after_write || close_after_write;
+        write(conn, std::move(data));
+        // Past the output limit the drain in flush_output() picks up from here
+        if (conn->closed || conn->close_after_write || conn->output_full) {
+            return;
+        }
+
+        // Pipelining: the next request may already be buffered or still in
+        // the socket (reads were paused while the request was in flight)
+        if (conn->read_paused) {
+            conn->read_paused = false;
+            process(conn, true);
+        } else if (!conn->in.empty()) {
+            process(conn, false);
+        }
+    };
+
+    if (std::this_thread::get_id() == thread_.get_id()) {
+        deliver(message);
+        return;
+    }
+
+    post([deliver, data = std::move(message)]() mutable { deliver(data); });
+}
+
+void EventLoop::write(const ConnectionPtr& conn, OutboundMessage message) {
+    if (conn->closed || message.empty()) {
+        return;
+    }
+    conn->out_bytes += message.size();
+    conn->out.push_back(std::move(message));
+    flush_output(conn);
+}
+
+void EventLoop::post(std::function<void()> fn) {
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        pending_.push_back(std::move(fn));
+    }
+    wake();
+}
+
+void EventLoop::wake() {
+    if (wake_write_fd_ < 0) {
+        return;
+    }
+#if defined(__linux__)
+    uint64_t one = 1;
+    ssize_t ignored = ::write(wake_write_fd_, &one, sizeof(one));
+#else
+    char one = 1;
+    ssize_t ignored = ::write(wake_write_fd_, &one, sizeof(one));
+#endif
+    (void)ignored;
+}
+
+void EventLoop::drain_wakeups() {
+    char buf[64];
+    while (::read(wake_read_fd_, buf, sizeof(buf)) > 0) {
+    }
+}
+
+void EventLoop::run_pending() {
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        tasks.swap(pending_);
+    }
+    for (auto& task : tasks) {
+        task();
+    }
+}
+
+void EventLoop::run() {
+    if (cpu_ >= 0) {
+        pin_current_thread(static_cast<size_t>(cpu_));
+    }
+    std::vector<PollEvent> events;
+    events.reserve(256);
+
+    while (running_.load()) {
+        poller_->wait(events, accept_paused_ ? ACCEPT_BACKOFF_MS : POLL_TIMEOUT_MS);
+
+        for (const auto& ev : events) {
+            if (ev.fd == wake_read_fd_) {
+                drain_wakeups();
+                continue;
+            }
+            if (ev.fd == listen_fd_) {
+                accept_connections();
+                continue;
+            }
+
+            auto it = connections_.find(ev.fd);
+            if (it == connections_.end()) {
+                continue;
+            }
+            ConnectionPtr conn = it->second;
+
+            if (ev.readable) {
+                handle_readable(conn);
+            }
+            if (!conn->closed && ev.writable) {
+                handle_writable(conn);
+            }
+            if (!conn->closed && ev.error && !ev.readable) {
+                close_connection(conn);
+            }
+        }
+
+        run_pending();
+        close_idle_connections();
+        resume_accepting();
+    }
+
+    // Shutdown: drop every connection this loop owns
+    std::vector<ConnectionPtr> remaining;
+    remaining.reserve(connections_.size());
+    for (auto& entry : connections_) {
+        remaining.push_back(entry.second);
+    }
+    for (auto& conn : remaining) {
+        close_connection(conn);
+    }
+    if (!accept_paused_) {
+        poller_->remove(listen_fd_);
+    }
+    poller_->remove(wake_read_fd_);
+}
+
+void EventLoop::accept_connections() {
+    for (int i = 0; i < MAX_ACCEPTS_PER_WAKEUP; ++i) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+
+        int client_socket = accept(listen_fd_, (struct sockaddr*)&client_addr, &client_len);
+        if (client_socket < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK || !running_.load()) {
+                return;
+            }
+            int error = errno;
+            if (error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM) {
+                // The connection stays queued and the level-triggered listener
+                // would report it again at once: stop watching for a while
+                poller_->remove(listen_fd_);
+                accept_paused_ = true;
+                accept_resume_at_ = std::chrono::steady_clock::now() +
+                                    std::chrono::milliseconds(ACCEPT_BACKOFF_MS);
+            }
+            log_accept_error(error);
+            return;
+        }
+
+        set_non_blocking(client_socket);
+        int one = 1;
+        setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+        setsockopt(client_socket, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+        auto conn = std::make_shared<Connection>();
+        conn->fd = client_socket;
+        conn->loop = this;
+        conn->last_active = std::chrono::steady_clock::now();
+        char address[INET_ADDRSTRLEN];
+        if (inet_ntop(AF_INET, &client_addr.sin_addr, address, sizeof(address))) {
+            conn->remote_address = address;
+        }
+
+        if (!poller_->add(client_socket, true, false)) {
+            close(client_socket);
+            continue;
+        }
+        connections_[client_socket] = conn;
+        connection_count_.fetch_add(1, std::memory_order_relaxed);
+
+        // Edge-triggered: data may already be waiting
+        handle_readable(conn);
+    }
+}
+
+void EventLoop::resume_accepting() {
+    if (!accept_paused_ || std::chrono::steady_clock::now() < accept_resume_at_) {
+        return;
+    }
+    accept_paused_ = !poller_->add(listen_fd_, false, false);
+}
+
+void EventLoop::log_accept_error(int error) {
+    // At most one line per second, however often accept() keeps failing
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_accept_error_log_ < std::chrono::seconds(1)) {
+        accept_errors_suppressed_++;
+        return;
+    }
+    last_accept_error_log_ = now;
+    std::cerr << "Accept failed: " << std::strerror(error);
+    if (accept_errors_suppressed_ > 0) {
+        std::cerr << " (" << accept_errors_suppressed_ << " more since the last report)";
+        accept_errors_suppressed_ = 0;
+    }
+    std::cerr << std::endl;
+}
+
+void EventLoop::handle_readable(const ConnectionPtr& conn) {
+    // The worker holds views into conn->in, or the peer is not reading its
+    // responses: leave new bytes in the socket
+    if (conn->in_flight || conn->output_full) {
+        conn->read_paused = true;
+        return;
+    }
+    process(conn, true);
+}
+
+// Read (if asked) and hand the bytes to the data callback. A response sent
+// from inside the callback, e.g. one answered on this thread, does not
+// recurse: it marks the connection and this loop serves the next pipelined
+// request, so the stack stays flat however many are buffered.
+void EventLoop::process(const ConnectionPtr& conn, bool read) {
+    if (conn->processing) {
+        conn->resume_pending = true;
+        conn->resume_read = conn->resume_read || read;
+        return;
+    }
+    conn->processing = true;
+
+    char buffer[READ_CHUNK_SIZE];
+    while (true) {
+        if (conn->out_bytes >= max_output_bytes_) {
+            conn->output_full = true;
+            conn->read_paused = true;
+            break;
+        }
+
+        bool got_data = false;
+        bool drained = !read;
+
+        while (read && conn->in.size() < max_input_bytes_) {
+            ssize_t n = ::read(conn->fd, buffer, sizeof(buffer));
+            if (n > 0) {
+                conn->in.append(buffer, static_cast<size_t>(n));
+                got_data = true;
+                continue;
+            }
+            if (n == 0) {
+                conn->peer_closed = true;
+                drained = true;
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                drained = true;
+                break;
+            }
+            conn->processing = false;
+            close_connection(conn);
+            return;
+        }
+
+        // Edge-triggered: no new event will arrive for bytes we left behind
+        if (read) {
+            conn->read_paused = !drained;
+        }
+        if (got_data) {
+            conn->last_active = std::chrono::steady_clock::now();
+        }
+        conn->resume_pending = false;
+        conn->resume_read = false;
+        if (!conn->in.empty()) {
+            on_data_(conn);
+        }
+
+        if (conn->closed || conn->in_flight) {
+            break;
+        }
+        if (!conn->resume_pending) {
+            // Over the input limit without the callback making progress: drop it
+            if (conn->in.size() >= max_input_bytes_) {
+                conn->processing = false;
+                close_connection(conn);
+                return;
+            }
+            break;
+        }
+        // Answered inline: go on with what is buffered, or still in the socket
+        read = conn->resume_read || conn->read_paused;
+        if (read) {
+            conn->read_paused = false;
+        }
+    }
+
+    conn->processing = false;
+    close_if_finished(conn);
+}
+
+void EventLoop::close_if_finished(const ConnectionPtr& conn) {
+    // Client went away: keep the socket only while a response is owed
+    if (!conn->closed && conn->peer_closed && !conn->in_flight && conn->out.empty()) {
+        close_connection(conn);
+    }
+}
+
+void EventLoop::handle_writable(const ConnectionPtr& conn) {
+    if (!conn->out.empty()) {
+        flush_output(conn);
+    }
+
+    // The peer caught up: serve what it pipelined while we held back
+    if (!conn->closed && conn->output_full && conn->out_bytes < max_output_bytes_) {
+        conn->output_full = false;
+        conn->read_paused = false;
+        process(conn, true);
+    }
+}
+
+void EventLoop::flush_output(const ConnectionPtr& conn) {
+    struct iovec iov[MAX_IOV_PER_SEND];
+
+    while (!conn->out.empty()) {
+        // Gather as many queued messages as fit into one vectored send
+        size_t iov_count = 0;
+        size_t skip = conn->out_offset;
+        for (const auto& message : conn->out) {
+            if (iov_count == MAX_IOV_PER_SEND) break;
+            iov_count += message.fill_iovec(iov + iov_count, MAX_IOV_PER_SEND - iov_count, skip);
+            skip = 0;
+        }
+
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iov_count;
+#ifdef MSG_NOSIGNAL
+        ssize_t n = ::sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+#else
+        ssize_t n = ::sendmsg(conn->fd, &msg, 0);
+#endif
+        if (n > 0) {
+            size_t written = static_cast<size_t>(n);
+            while (written > 0 && !conn->out.empty()) {
+                size_t remaining = conn->out.front().size() - conn->out_offset;
+                if (written < remaining) {
+                    conn->out_offset += written;
+                    break;
+                }
+                written -= remaining;
+                conn->out_bytes -= conn->out.front().size();
+                conn->out.pop_front();
+                conn->out_offset = 0;
+            }
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // Socket buffer full: ask for EPOLLOUT and resume later
+            if (!conn->write_armed) {
+                conn->write_armed = poller_->modify(conn->fd, true);
+            }
+            return;
+        }
+        close_connection(conn);
+        return;
+    }
+
+    conn->out_offset = 0;
+    conn->last_active = std::chrono::steady_clock::now();
+    if (conn->write_armed) {
+        poller_->modify(conn->fd, false);
+        conn->write_armed = false;
+    }
+
+    if (conn->close_after_write || (conn->peer_closed && !conn->in_flight && conn->in.empty())) {
+        close_connection(conn);
+    }
+}
+
+void EventLoop::close_idle_connections() {
+    if (idle_timeout_.count() <= 0) {
+        return;
+    }
+
+    // Sweep at most once per second; the poll timeout bounds the delay
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_idle_sweep_ < std::chrono::seconds(1)) {
+        return;
+    }
+    last_idle_sweep_ = now;
+
+    std::vector<ConnectionPtr> idle;
+    for (const auto& entry : connections_) {
+        const ConnectionPtr& conn = entry.second;
+        // Never cut off a request that is being handled or a pending response
+        if (!conn->in_flight && conn->out.empty() && now - conn->last_active >= idle_timeout_) {
+            idle.push_back(conn);
+        }
+    }
+    for (const auto& conn : idle) {
+        close_connection(conn);
+    }
+}
+
+void EventLoop::close_connection(const ConnectionPtr& conn) {
+    if (conn->closed) {
+        return;
+    }
+    conn->closed = true;
+    poller_->remove(conn->fd);
+    connections_.erase(conn->fd);
+    close(conn->fd);
+    connection_count_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+} // namespace metricstream
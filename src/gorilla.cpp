@@ -0,0 +1,212 @@
+#include "gorilla.h"
+#include <algorithm>
+#include <cstring>
+
+namespace metricstream {
+
+namespace {
+
+// Delta-of-delta buckets: control bits, then a two's complement payload
+struct DodBucket {
+    uint64_t control;
+    int control_bits;
+    int value_bits;
+};
+
+constexpr DodBucket DOD_BUCKETS[] = {
+    {0b10, 2, 7},
+    {0b110, 3, 9},
+    {0b1110, 4, 12},
+};
+constexpr uint64_t DOD_FALLBACK_CONTROL = 0b1111;
+
+// Leading zero counts are stored in 5 bits
+constexpr int MAX_LEADING = 31;
+
+inline uint64_t double_bits(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline double bits_double(uint64_t bits) {
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+inline int64_t sign_extend(uint64_t value, int bits) {
+    uint64_t sign = uint64_t{1} << (bits - 1);
+    return static_cast<int64_t>((value ^ sign) - sign);
+}
+
+inline uint64_t low_mask(int bits) {
+    return bits >= 64 ? ~uint64_t{0} : (uint64_t{1} << bits) - 1;
+}
+
+} // namespace
+
+void BitWriter::write_bits(uint64_t value, int bits) {
+    while (bits > 0) {
+        if (free_bits_ == 0) {
+            bytes_.push_back('\0');
+            free_bits_ = 8;
+        }
+        int take = std::min(bits, free_bits_);
+        unsigned chunk = static_cast<unsigned>((value >> (bits - take)) & low_mask(take));
+        unsigned char& last = reinterpret_cast<unsigned char&>(bytes_.back());
+        last = static_cast<unsigned char>(last | (chunk << (free_bits_ - take)));
+        free_bits_ -= take;
+        bits -= take;
+    }
+}
+
+uint64_t BitReader::read_bits(int bits) {
+    uint64_t value = 0;
+    while (bits > 0) {
+        if (position_ >= bytes_.size() * 8) {
+            ok_ = false;
+            return 0;
+        }
+        unsigned byte = static_cast<unsigned char>(bytes_[position_ / 8]);
+        int available = 8 - static_cast<int>(position_ % 8);
+        int take = std::min(bits, available);
+        uint64_t chunk = (byte >> (available - take)) & low_mask(take);
+        value = (value << take) | chunk;
+        position_ += static_cast<size_t>(take);
+        bits -= take;
+    }
+    return value;
+}
+
+void GorillaEncoder::clear() {
+    bits_.clear();
+    count_ = 0;
+    prev_timestamp_ = 0;
+    prev_delta_ = 0;
+    prev_value_ = 0;
+    prev_leading_ = -1;
+    prev_trailing_ = 0;
+}
+
+void GorillaEncoder::append(int64_t timestamp_ms, double value) {
+    uint64_t bits = double_bits(value);
+    if (count_ == 0) {
+        // First point is stored raw
+        bits_.write_bits(static_cast<uint64_t>(timestamp_ms), 64);
+        bits_.write_bits(bits, 64);
+        prev_timestamp_ = timestamp_ms;
+        prev_value_ = bits;
+    } else {
+        append_timestamp(timestamp_ms);
+        append_value(bits);
+    }
+    count_++;
+}
+
+void GorillaEncoder::append_timestamp(int64_t timestamp_ms) {
+    // Unsigned arithmetic: out-of-order or far-apart points must not overflow
+    int64_t delta = static_cast<int64_t>(static_cast<uint64_t>(timestamp_ms) -
+                                         static_cast<uint64_t>(prev_timestamp_));
+    int64_t dod = static_cast<int64_t>(static_cast<uint64_t>(delta) -
+                                       static_cast<uint64_t>(prev_delta_));
+    prev_timestamp_ = timestamp_ms;
+    prev_delta_ = delta;
+
+    if (dod == 0) {
+        bits_.write_bit(false);
+        return;
+    }
+    for (const DodBucket& bucket : DOD_BUCKETS) {
+        int64_t limit = int64_t{1} << (bucket.value_bits - 1);
+        if (dod >= -limit && dod < limit) {
+            bits_.write_bits(bucket.control, bucket.control_bits);
+            bits_.write_bits(static_cast<uint64_t>(dod), bucket.value_bits);
+            return;
+        }
+    }
+    bits_.write_bits(DOD_FALLBACK_CONTROL, 4);
+    bits_.write_bits(static_cast<uint64_t>(dod), 64);
+}
+
+void GorillaEncoder::append_value(uint64_t bits) {
+    uint64_t x = bits ^ prev_value_;
+    prev_value_ = bits;
+    if (x == 0) {
+        bits_.write_bit(false);
+        return;
+    }
+    bits_.write_bit(true);
+
+    int leading = std::min(__builtin_clzll(x), MAX_LEADING);
+    int trailing = __builtin_ctzll(x);
+
+    if (prev_leading_ >= 0 && leading >= prev_leading_ && trailing >= prev_trailing_) {
+        // Fits the previous window: reuse its position
+        bits_.write_bit(false);
+        bits_.write_bits(x >> prev_trailing_, 64 - prev_leading_ - prev_trailing_);
+        return;
+    }
+
+    int meaningful = 64 - leading - trailing;
+    bits_.write_bit(true);
+    bits_.write_bits(static_cast<uint64_t>(leading), 5);
+    bits_.write_bits(static_cast<uint64_t>(meaningful & 63), 6);   // 64 wraps to 0
+    bits_.write_bits(x >> trailing, meaningful);
+    prev_leading_ = leading;
+    prev_trailing_ = trailing;
+}
+
+bool GorillaDecoder::next(int64_t& timestamp_ms, double& value) {
+    if (remaining_ == 0 || !ok()) {
+        return false;
+    }
+
+    if (first_) {
+        prev_timestamp_ = static_cast<int64_t>(bits_.read_bits(64));
+        prev_value_ = bits_.read_bits(64);
+        first_ = false;
+    } else {
+        int64_t dod = 0;
+        if (bits_.read_bit()) {
+            int value_bits = 64;
+            for (const DodBucket& bucket : DOD_BUCKETS) {
+                if (!bits_.read_bit()) {
+                    value_bits = bucket.value_bits;
+                    break;
+                }
+            }
+            dod = value_bits == 64 ? static_cast<int64_t>(bits_.read_bits(64))
+                                   : sign_extend(bits_.read_bits(value_bits), value_bits);
+        }
+        prev_delta_ = static_cast<int64_t>(static_cast<uint64_t>(prev_delta_) +
+                                           static_cast<uint64_t>(dod));
+        prev_timestamp_ = static_cast<int64_t>(static_cast<uint64_t>(prev_timestamp_) +
+                                               static_cast<uint64_t>(prev_delta_));
+
+        if (bits_.read_bit()) {
+            if (bits_.read_bit()) {
+                prev_leading_ = static_cast<int>(bits_.read_bits(5));
+                int meaningful = static_cast<int>(bits_.read_bits(6));
+                if (meaningful == 0) meaningful = 64;
+                prev_trailing_ = 64 - prev_leading_ - meaningful;
+                if (prev_trailing_ < 0) {
+                    corrupt_ = true;
+                    return false;
+                }
+            }
+            int meaningful = 64 - prev_leading_ - prev_trailing_;
+            prev_value_ ^= bits_.read_bits(meaningful) << prev_trailing_;
+        }
+    }
+
+    if (!bits_.ok()) {
+        return false;
+    }
+    timestamp_ms = prev_timestamp_;
+    value = bits_double(prev_value_);
+    remaining_--;
+    return true;
+}
+
+} // namespace metricstream
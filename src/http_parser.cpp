@@ -0,0 +1,329 @@
+#include "http_parser.h"
+#include <cstring>
+
+namespace metricstream {
+
+namespace {
+
+inline char ascii_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+inline bool is_ows(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// Does a comma-separated header value contain token (case-insensitive)?
+bool has_token(std::string_view value, std::string_view token) {
+    size_t pos = 0;
+    while (pos <= value.size()) {
+        size_t comma = value.find(',', pos);
+        if (comma == std::string_view::npos) comma = value.size();
+        std::string_view item = value.substr(pos, comma - pos);
+        while (!item.empty() && is_ows(item.front())) item.remove_prefix(1);
+        while (!item.empty() && is_ows(item.back())) item.remove_suffix(1);
+        if (HttpRequestParser::iequals(item, token)) return true;
+        pos = comma + 1;
+    }
+    return false;
+}
+
+} // namespace
+
+std::string_view HttpRequest::header(std::string_view name) const {
+    for (const auto& h : headers) {
+        if (HttpRequestParser::iequals(h.name, name)) {
+            return h.value;
+        }
+    }
+    return {};
+}
+
+bool HttpRequest::has_header(std::string_view name) const {
+    for (const auto& h : headers) {
+        if (HttpRequestParser::iequals(h.name, name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool HttpRequestParser::iequals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (ascii_lower(a[i]) != ascii_lower(b[i])) return false;
+    }
+    return true;
+}
+
+HttpRequestParser::HttpRequestParser(size_t max_body_bytes, size_t max_header_bytes)
+    : max_body_bytes_(max_body_bytes), max_header_bytes_(max_header_bytes) {
+    header_spans_.reserve(16);
+    request_.headers.reserve(16);
+}
+
+void HttpRequestParser::reset() {
+    state_ = State::REQUEST_LINE;
+    read_pos_ = 0;
+    scan_pos_ = 0;
+    error_status_ = 0;
+    method_ = target_ = version_ = Span{};
+    header_spans_.clear();
+    chunked_ = false;
+    expect_continue_ = false;
+    continue_sent_ = false;
+    content_length_ = 0;
+    body_start_ = 0;
+    body_length_ = 0;
+    chunk_remaining_ = 0;
+    request_.method = request_.path = request_.query = {};
+    request_.version = request_.body = {};
+    request_.headers.clear();  // Keeps capacity for the next request
+}
+
+HttpRequestParser::Status HttpRequestParser::fail(int status) {
+    state_ = State::ERROR;
+    error_status_ = status;
+    return Status::ERROR;
+}
+
+bool HttpRequestParser::next_line(const std::string& buffer, size_t& line_end, size_t& next) {
+    size_t from = scan_pos_ > read_pos_ ? scan_pos_ : read_pos_;
+    if (from >= buffer.size()) {
+        return false;
+    }
+
+    const void* hit = std::memchr(buffer.data() + from, '\n', buffer.size() - from);
+    if (hit == nullptr) {
+        // Remember how far we looked so the next call only scans new bytes
+        scan_pos_ = buffer.size();
+        return false;
+    }
+
+    size_t nl = static_cast<const char*>(hit) - buffer.data();
+    next = nl + 1;
+    line_end = (nl > read_pos_ && buffer[nl - 1] == '\r') ? nl - 1 : nl;
+    scan_pos_ = next;
+    return true;
+}
+
+bool HttpRequestParser::parse_request_line(const std::string& buffer, size_t line_end) {
+    std::string_view line(buffer.data() + read_pos_, line_end - read_pos_);
+
+    size_t sp1 = line.find(' ');
+    if (sp1 == std::string_view::npos || sp1 == 0) return false;
+    size_t sp2 = line.find(' ', sp1 + 1);
+    if (sp2 == std::string_view::npos || sp2 == sp1 + 1) return false;
+
+    uint32_t base = static_cast<uint32_t>(read_pos_);
+    method_ = Span{base, static_cast<uint32_t>(sp1)};
+    target_ = Span{static_cast<uint32_t>(base + sp1 + 1), static_cast<uint32_t>(sp2 - sp1 - 1)};
+    version_ = Span{static_cast<uint32_t>(base + sp2 + 1), static_cast<uint32_t>(line.size() - sp2 - 1)};
+    return true;
+}
+
+bool HttpRequestParser::parse_header_line(const std::string& buffer, size_t line_end) {
+    std::string_view line(buffer.data() + read_pos_, line_end - read_pos_);
+
+    // Obsolete line folding and whitespace before the colon are rejected
+    if (is_ows(line.front())) return false;
+    size_t colon = line.find(':');
+    if (colon == std::string_view::npos || colon == 0 || is_ows(line[colon - 1])) return false;
+
+    size_t value_start = colon + 1;
+    size_t value_end = line.size();
+    while (value_start < value_end && is_ows(line[value_start])) value_start++;
+    while (value_end > value_start && is_ows(line[value_end - 1])) value_end--;
+
+    uint32_t base = static_cast<uint32_t>(read_pos_);
+    header_spans_.emplace_back(
+        Span{base, static_cast<uint32_t>(colon)},
+        Span{static_cast<uint32_t>(base + value_start), static_cast<uint32_t>(value_end - value_start)});
+    return true;
+}
+
+HttpRequestParser::Status HttpRequestParser::finish_headers(const std::string& buffer) {
+    std::string_view version(buffer.data() + version_.offset, version_.length);
+    if (version.size() != 8 || version.compare(0, 7, "HTTP/1.") != 0) {
+        return fail(505);
+    }
+
+    bool has_length = false;
+    for (const auto& [name_span, value_span] : header_spans_) {
+        std::string_view name(buffer.data() + name_span.offset, name_span.length);
+        std::string_view value(buffer.data() + value_span.offset, value_span.length);
+
+        if (iequals(name, "Content-Length")) {
+            if (value.empty() || value.size() > 19) return fail(400);
+            size_t length = 0;
+            for (char c : value) {
+                if (c < '0' || c > '9') return fail(400);
+                length = length * 10 + static_cast<size_t>(c - '0');
+            }
+            if (has_length && length != content_length_) return fail(400);
+            has_length = true;
+            content_length_ = length;
+        } else if (iequals(name, "Transfer-Encoding")) {
+            if (!has_token(value, "chunked")) return fail(501);
+            chunked_ = true;
+        } else if (iequals(name, "Expect")) {
+            expect_continue_ = iequals(value, "100-continue");
+        }
+    }
+
+    // Both framings at once is a request-smuggling vector
+    if (chunked_ && has_length) return fail(400);
+
+    body_start_ = read_pos_;
+    if (chunked_) {
+        state_ = State::CHUNK_SIZE;
+        return Status::NEED_MORE;
+    }
+    if (content_length_ > max_body_bytes_) return fail(413);
+    if (content_length_ > 0) {
+        state_ = State::BODY_LENGTH;
+        return Status::NEED_MORE;
+    }
+
+    expect_continue_ = false;
+    return complete(buffer);
+}
+
+HttpRequestParser::Status HttpRequestParser::complete(const std::string& buffer) {
+    const char* base = buffer.data();
+    request_.method = std::string_view(base + method_.offset, method_.length);
+    request_.version = std::string_view(base + version_.offset, version_.length);
+
+    std::string_view target(base + target_.offset, target_.length);
+    size_t q = target.find('?');
+    request_.path = target.substr(0, q);
+    request_.query = q == std::string_view::npos ? std::string_view{} : target.substr(q + 1);
+
+    request_.headers.clear();
+    for (const auto& [name_span, value_span] : header_spans_) {
+        request_.headers.push_back(HttpHeader{
+            std::string_view(base + name_span.offset, name_span.length),
+            std::string_view(base + value_span.offset, value_span.length)});
+    }
+
+    request_.body = std::string_view(base + body_start_, body_length_);
+    state_ = State::COMPLETE;
+    return Status::COMPLETE;
+}
+
+HttpRequestParser::Status HttpRequestParser::parse(std::string& buffer) {
+    size_t line_end = 0;
+    size_t next = 0;
+
+    while (true) {
+        switch (state_) {
+            case State::REQUEST_LINE:
+                if (!next_line(buffer, line_end, next)) {
+                    return buffer.size() > max_header_bytes_ ? fail(431) : Status::NEED_MORE;
+                }
+                if (line_end == read_pos_) {
+                    // Stray CRLF between pipelined requests is allowed
+                    read_pos_ = next;
+                    break;
+                }
+                if (!parse_request_line(buffer, line_end)) return fail(400);
+                read_pos_ = next;
+                state_ = State::HEADERS;
+                break;
+
+            case State::HEADERS:
+                if (!next_line(buffer, line_end, next)) {
+                    return buffer.size() > max_header_bytes_ ? fail(431) : Status::NEED_MORE;
+                }
+                if (line_end == read_pos_) {
+                    read_pos_ = next;
+                    Status status = finish_headers(buffer);
+                    if (status != Status::NEED_MORE) return status;
+                    break;
+                }
+                if (!parse_header_line(buffer, line_end)) return fail(400);
+                read_pos_ = next;
+                if (read_pos_ > max_header_bytes_) return fail(431);
+                break;
+
+            case State::BODY_LENGTH:
+                if (buffer.size() - body_start_ < content_length_) {
+                    return Status::NEED_MORE;
+                }
+                body_length_ = content_length_;
+                read_pos_ = body_start_ + content_length_;
+                expect_continue_ = false;
+                return complete(buffer);
+
+            case State::CHUNK_SIZE: {
+                if (!next_line(buffer, line_end, next)) return Status::NEED_MORE;
+                size_t size = 0;
+                size_t digits = 0;
+                for (size_t i = read_pos_; i < line_end; ++i, ++digits) {
+                    char c = buffer[i];
+                    int v;
+                    if (c >= '0' && c <= '9') v = c - '0';
+                    else if (c >= 'a' && c <= 'f') v = c - 'a' + 10;
+                    else if (c >= 'A' && c <= 'F') v = c - 'A' + 10;
+                    else if (c == ';' || is_ows(c)) break;  // Chunk extensions are ignored
+                    else return fail(400);
+                    if (digits >= 15) return fail(413);
+                    size = size * 16 + static_cast<size_t>(v);
+                }
+                if (digits == 0) return fail(400);
+                read_pos_ = next;
+                if (size == 0) {
+                    state_ = State::TRAILERS;
+                    break;
+                }
+                if (body_length_ + size > max_body_bytes_) return fail(413);
+                chunk_remaining_ = size;
+                state_ = State::CHUNK_DATA;
+                break;
+            }
+
+            case State::CHUNK_DATA: {
+                size_t available = buffer.size() - read_pos_;
+                size_t n = available < chunk_remaining_ ? available : chunk_remaining_;
+                if (n > 0) {
+                    // De-chunk in place: slide data down behind what we already have
+                    std::memmove(&buffer[body_start_ + body_length_], &buffer[read_pos_], n);
+                    body_length_ += n;
+                    read_pos_ += n;
+                    chunk_remaining_ -= n;
+                }
+                if (chunk_remaining_ > 0) return Status::NEED_MORE;
+                state_ = State::CHUNK_DATA_END;
+                break;
+            }
+
+            case State::CHUNK_DATA_END:
+                if (!next_line(buffer, line_end, next)) return Status::NEED_MORE;
+                if (line_end != read_pos_) return fail(400);
+                read_pos_ = next;
+                state_ = State::CHUNK_SIZE;
+                break;
+
+            case State::TRAILERS: {
+                if (!next_line(buffer, line_end, next)) return Status::NEED_MORE;
+                // Trailer fields are skipped; an empty line ends the message
+                bool empty_line = line_end == read_pos_;
+                read_pos_ = next;
+                if (empty_line) {
+                    expect_continue_ = false;
+                    return complete(buffer);
+                }
+                if (read_pos_ - body_start_ > body_length_ + max_header_bytes_) return fail(431);
+                break;
+            }
+
+            case State::COMPLETE:
+                return Status::COMPLETE;
+
+            case State::ERROR:
+                return Status::ERROR;
+        }
+    }
+}
+
+} // namespace metricstream
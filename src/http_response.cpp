@@ -0,0 +1,122 @@
+#include "http_response.h"
+#include <sys/uio.h>
+#include <cstring>
+#include <utility>
+
+namespace metricstream {
+
+namespace {
+
+constexpr std::string_view CONTENT_TYPE_PREFIX = "Content-Type: ";
+constexpr std::string_view JSON_CONTENT_TYPE = "Content-Type: application/json\r\n";
+constexpr std::string_view CONNECTION_KEEP_ALIVE = "Connection: keep-alive\r\n\r\n";
+constexpr std::string_view CONNECTION_CLOSE = "Connection: close\r\n\r\n";
+
+// Formats "Content-Length: N\r\n" into out; returns the length
+size_t format_content_length(char* out, size_t length) {
+    constexpr std::string_view prefix = "Content-Length: ";
+    std::memcpy(out, prefix.data(), prefix.size());
+    size_t pos = prefix.size();
+
+    char digits[20];
+    size_t n = 0;
+    do {
+        digits[n++] = static_cast<char>('0' + length % 10);
+        length /= 10;
+    } while (length > 0);
+    while (n > 0) {
+        out[pos++] = digits[--n];
+    }
+    out[pos++] = '\r';
+    out[pos++] = '\n';
+    return pos;
+}
+
+// Appends the headers shared by built and canned responses, minus Connection
+void append_headers(OutboundMessage& message, const HttpResponse& response) {
+    std::string_view line = status_line(response.status_code);
+    if (!line.empty()) {
+        message.add_static(line);
+    } else {
+        std::string unknown = "HTTP/1.1 " + std::to_string(response.status_code) + " Unknown\r\n";
+        message.add_inline(unknown);
+    }
+
+    if (response.content_type == "application/json") {
+        message.add_static(JSON_CONTENT_TYPE);
+    } else if (!response.content_type.empty()) {
+        message.add_static(CONTENT_TYPE_PREFIX);
+        message.add_inline(response.content_type);
+        message.add_inline("\r\n");
+    }
+
+    char length_header[48];
+    message.add_inline(std::string_view(length_header,
+        format_content_length(length_header, response.body.size())));
+
+    for (const auto& header : response.headers) {
+        message.add_inline(header.first);
+        message.add_inline(": ");
+        message.add_inline(header.second);
+        message.add_inline("\r\n");
+    }
+}
+
+std::string flatten(const OutboundMessage& message) {
+    struct iovec iov[OutboundMessage::MAX_SEGMENTS];
+    size_t count = message.fill_iovec(iov, OutboundMessage::MAX_SEGMENTS, 0);
+    std::string bytes;
+    bytes.reserve(message.size());
+    for (size_t i = 0; i < count; ++i) {
+        bytes.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+    }
+    return bytes;
+}
+
+} // namespace
+
+std::string_view status_line(int status_code) {
+    switch (status_code) {
+        case 200: return "HTTP/1.1 200 OK\r\n";
+        case 400: return "HTTP/1.1 400 Bad Request\r\n";
+        case 404: return "HTTP/1.1 404 Not Found\r\n";
+        case 405: return "HTTP/1.1 405 Method Not Allowed\r\n";
+        case 413: return "HTTP/1.1 413 Payload Too Large\r\n";
+        case 429: return "HTTP/1.1 429 Too Many Requests\r\n";
+        case 431: return "HTTP/1.1 431 Request Header Fields Too Large\r\n";
+        case 500: return "HTTP/1.1 500 Internal Server Error\r\n";
+        case 501: return "HTTP/1.1 501 Not Implemented\r\n";
+        case 503: return "HTTP/1.1 503 Service Unavailable\r\n";
+        case 505: return "HTTP/1.1 505 HTTP Version Not Supported\r\n";
+        default:  return {};
+    }
+}
+
+CannedResponse::CannedResponse(int status_code, std::string_view content_type, std::string_view body,
+                               std::unordered_map<std::string, std::string> headers)
+    : status_code_(status_code) {
+    HttpResponse response;
+    response.status_code = status_code;
+    response.content_type = content_type;
+    response.body.assign(body.data(), body.size());
+    response.headers = std::move(headers);
+
+    // Startup only: render through the normal path and keep the bytes
+    keep_alive_bytes_ = flatten(serialize_response(HttpResponse(response), true));
+    close_bytes_ = flatten(serialize_response(std::move(response), false));
+}
+
+OutboundMessage serialize_response(HttpResponse&& response, bool keep_alive) {
+    OutboundMessage message;
+    if (response.canned != nullptr) {
+        message.add_static(response.canned->bytes(keep_alive));
+        return message;
+    }
+
+    append_headers(message, response);
+    message.add_static(keep_alive ? CONNECTION_KEEP_ALIVE : CONNECTION_CLOSE);
+    message.add_owned(std::move(response.body));
+    return message;
+}
+
+} // namespace metricstream
@@ -1,210 +1,325 @@
 #include "http_server.h"
-#include <sys/socket.h>
-#include <netinet/in.h>
+#include "profiling.h"
+#include "trace.h"
 #include <unistd.h>
+#include <algorithm>
+#include <chrono>
 #include <iostream>
-#include <sstream>
-#include <cstring>
+#include <string>
 
 namespace metricstream {
 
-HttpServer::HttpServer(int port, size_t thread_pool_size)
-    : port_(port), running_(false) {
+namespace {
+
+constexpr std::string_view CONTINUE_RESPONSE = "HTTP/1.1 100 Continue\r\n\r\n";
+
+OutboundMessage static_message(std::string_view bytes) {
+    OutboundMessage message;
+    message.add_static(bytes);
+    return message;
+}
+
+// Phase 9: Per-connection parser; owned by the Connection
+struct HttpConnectionState : ConnectionContext {
+    explicit HttpConnectionState(size_t max_body) : parser(max_body) {}
+
+    HttpRequestParser parser;
+    bool request_done = false;   // parser holds a served request to discard
+    bool admitted = false;       // Phase 29: passed admission, headers seen
+    bool traced = false;         // Phase 33: trace holds the current request
+    RequestTrace trace;
+};
+
+// Phase 33: Stamp the response and record the trace; `trace` is reused by
+// the connection's next request once this returns
+void finish_trace(RequestTrace& trace, int status) {
+    trace.status = static_cast<uint16_t>(status);
+    trace.mark(TraceStage::RESPONDED);
+    Tracer::global().finish(trace);
+}
+
+int status_of(const HttpResponse& response) {
+    return response.canned ? response.canned->status_code() : response.status_code;
+}
+
+} // namespace
+
+HttpServer::HttpServer(int port, size_t thread_pool_size, size_t event_loops)
+    : port_(port), event_loop_count_(event_loops), running_(false) {
     // Phase 6: Initialize thread pool
     thread_pool_ = std::make_unique<ThreadPool>(thread_pool_size);
+
+    if (event_loop_count_ == 0) {
+        event_loop_count_ = std::max(1u, std::thread::hardware_concurrency());
+    }
 }
 
 HttpServer::~HttpServer() {
     stop();
+    // Drain workers before the loops they post responses to go away
+    thread_pool_.reset();
 }
 
-void HttpServer::add_handler(const std::string& path, const std::string& method, HttpHandler handler) {
-    handlers_[path][method] = std::move(handler);
+void HttpServer::add_handler(const std::string& path, const std::string& method, HttpHandler handler,
+                             RequestPriority priority, bool on_event_loop) {
+    for (auto& route : routes_) {
+        if (route.path == path && route.method == method) {
+            route.handler = std::move(handler);
+            route.priority = priority;
+            route.on_event_loop = on_event_loop;
+            return;
+        }
+    }
+    routes_.push_back(Route{path, method, std::move(handler), priority, on_event_loop});
 }
 
 void HttpServer::start() {
     if (running_.load()) {
         return;
     }
-    
+
+    std::string retry_after = std::to_string(std::max<int64_t>(1, admission_.options().retry_after.count()));
+    shed_response_ = std::make_unique<CannedResponse>(503, "application/json",
+        "{\"error\":\"Server overloaded, try again later\"}",
+        std::unordered_map<std::string, std::string>{{"Retry-After", retry_after}});
+
+    // Phase 8: One listener per loop where the kernel balances SO_REUSEPORT
+    // sockets, otherwise every loop polls the same non-blocking listener
+    listen_fds_ = EventLoop::open_listeners(port_, event_loop_count_);
+    if (listen_fds_.empty()) {
+        return;
+    }
+
+    for (size_t i = 0; i < event_loop_count_; ++i) {
+        int listen_fd = listen_fds_[i % listen_fds_.size()];
+        auto loop = std::make_unique<EventLoop>(listen_fd,
+            [this](const ConnectionPtr& conn) { on_connection_data(conn); });
+        loop->set_idle_timeout(idle_timeout_);
+        loop->set_max_input_bytes(max_body_size_ + 2 * HttpRequestParser::DEFAULT_MAX_HEADER_BYTES);
+        if (pin_event_loops_) {
+            loop->set_cpu(static_cast<int>(i));
+        }
+        if (!loop->start()) {
+            break;
+        }
+        event_loops_.push_back(std::move(loop));
+    }
+
     running_ = true;
-    server_thread_ = std::make_unique<std::thread>(&HttpServer::run_server, this);
-    std::cout << "HTTP server started on port " << port_ << std::endl;
+    std::cout << "HTTP server started on port " << port_
+              << " (" << event_loops_.size() << " event loops)" << std::endl;
 }
 
 void HttpServer::stop() {
     if (!running_.load()) {
         return;
     }
-    
+
     running_ = false;
-    if (server_thread_ && server_thread_->joinable()) {
-        server_thread_->join();
+    for (auto& loop : event_loops_) {
+        loop->stop();
     }
+    for (int fd : listen_fds_) {
+        close(fd);
+    }
+    listen_fds_.clear();
     std::cout << "HTTP server stopped" << std::endl;
 }
 
-void HttpServer::run_server() {
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd == -1) {
-        std::cerr << "Failed to create socket" << std::endl;
-        return;
+size_t HttpServer::active_connections() const {
+    size_t total = 0;
+    for (const auto& loop : event_loops_) {
+        total += loop->connection_count();
     }
+    return total;
+}
 
-    // Allow socket reuse
-    int opt = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-
-    struct sockaddr_in address;
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(port_);
+bool HttpServer::wants_keep_alive(const HttpRequest& request) {
+    std::string_view connection = request.header("Connection");
+    if (HttpRequestParser::iequals(connection, "close")) return false;
+    if (HttpRequestParser::iequals(connection, "keep-alive")) return true;
+    return request.version != "HTTP/1.0";
+}
 
-    if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
-        std::cerr << "Bind failed on port " << port_ << std::endl;
-        close(server_fd);
+// Runs on the connection's event loop thread after every read and after
+// each response, so pipelined requests are served one at a time in order
+void HttpServer::on_connection_data(const ConnectionPtr& conn) {
+    if (conn->in_flight) {
         return;
     }
 
-    if (listen(server_fd, 10) < 0) {
-        std::cerr << "Listen failed" << std::endl;
-        close(server_fd);
-        return;
+    if (!conn->context) {
+        conn->context = std::make_unique<HttpConnectionState>(max_body_size_);
+    }
+    auto* state = static_cast<HttpConnectionState*>(conn->context.get());
+    HttpRequestParser& parser = state->parser;
+
+    // The previous request has been answered: drop its bytes
+    if (state->request_done) {
+        conn->in.erase(0, parser.consumed());
+        parser.reset();
+        state->request_done = false;
+        state->admitted = false;
     }
 
-    while (running_.load()) {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
-        
-        int client_socket = accept(server_fd, (struct sockaddr*)&client_addr, &client_len);
-        if (client_socket < 0) {
-            if (running_.load()) {
-                std::cerr << "Accept failed" << std::endl;
+    // Phase 33: A request starts with its first bytes
+    if (!state->traced && !conn->in.empty() && Tracer::global().enabled()) {
+        state->trace = RequestTrace();
+        state->trace.id = Tracer::global().next_id();
+        state->trace.mark(TraceStage::RECEIVED);
+        state->traced = true;
+    }
+    RequestTrace* trace = state->traced ? &state->trace : nullptr;
+
+    HttpRequestParser::Status status = parser.parse(conn->in);
+
+    // Phase 29: Decide as soon as the headers are in, so a shed upload is
+    // neither read nor answered with 100 Continue
+    if (status != HttpRequestParser::Status::ERROR && parser.headers_complete() && !state->admitted) {
+        RequestPriority priority = priority_of(parser.method(conn->in), parser.path(conn->in));
+        if (trace) {
+            trace->mark(TraceStage::HEADERS);
+            trace->set_route(parser.method(conn->in), parser.path(conn->in));
+        }
+        if (!admission_.admit(priority, thread_pool_->queue_size())) {
+            if (trace) {
+                finish_trace(*trace, shed_response_->status_code());
+                state->traced = false;
             }
-            continue;
+            shed_request(conn);
+            return;
         }
+        state->admitted = true;
+    }
 
-        // PHASE 6: Enqueue request to thread pool (eliminates thread creation overhead)
-        bool enqueued = thread_pool_->enqueue([this, client_socket]() {
-            // Read request
-            char buffer[4096] = {0};
-            ssize_t bytes_read = read(client_socket, buffer, sizeof(buffer) - 1);
+    switch (status) {
+        case HttpRequestParser::Status::NEED_MORE:
+            if (parser.expects_continue()) {
+                parser.acknowledge_continue();
+                conn->loop->write(conn, static_message(CONTINUE_RESPONSE));
+            }
+            return;
 
-            if (bytes_read > 0) {
-                std::string request_data(buffer, bytes_read);
-                HttpRequest request = parse_request(request_data);
-                HttpResponse response = handle_request(request);
+        case HttpRequestParser::Status::ERROR: {
+            // Framing is unknown after a parse error, so the connection ends
+            HttpResponse response;
+            response.status_code = parser.error_status();
+            response.set_json_content();
+            response.body = "{\"error\":\"Malformed request\"}";
+            if (trace) {
+                finish_trace(*trace, response.status_code);
+                state->traced = false;
+            }
+            conn->loop->send(conn, serialize_response(std::move(response), false), true);
+            return;
+        }
 
-                std::string response_str = format_response(response);
-                write(client_socket, response_str.c_str(), response_str.length());
+        case HttpRequestParser::Status::COMPLETE:
+            state->request_done = true;
+            state->traced = false;   // Owned by the dispatched request from here
+            conn->in_flight = true;
+            if (trace) {
+                trace->mark(TraceStage::BODY);
             }
+            dispatch_request(conn, parser.request(), trace);
+            return;
+    }
+}
 
-            close(client_socket);
-        });
-
-        // If queue is full (backpressure), reject request immediately
-        if (!enqueued) {
-            const char* overload_response =
-                "HTTP/1.1 503 Service Unavailable\r\n"
-                "Content-Type: application/json\r\n"
-                "Content-Length: 47\r\n"
-                "\r\n"
-                "{\"error\":\"Server overloaded, try again later\"}";
-            write(client_socket, overload_response, strlen(overload_response));
-            close(client_socket);
+const HttpServer::Route* HttpServer::find_route(std::string_view method, std::string_view path) const {
+    for (const auto& route : routes_) {
+        if (route.path == path && route.method == method) {
+            return &route;
         }
     }
+    return nullptr;
+}
+
+RequestPriority HttpServer::priority_of(std::string_view method, std::string_view path) const {
+    const Route* route = find_route(method, path);
+    return route ? route->priority : RequestPriority::NORMAL;
+}
+
+void HttpServer::shed_request(const ConnectionPtr& conn) {
+    // The body may still be unread, so the connection cannot be reused
+    conn->in_flight = true;
+    conn->loop->send(conn, static_message(shed_response_->bytes(false)), true);
+}
+
+void HttpServer::dispatch_request(const ConnectionPtr& conn, const HttpRequest& request, RequestTrace* trace) {
+    const Route* route = find_route(request.method, request.path);
+    RequestPriority priority = route ? route->priority : RequestPriority::NORMAL;
 
-    close(server_fd);
-}
-
-HttpRequest HttpServer::parse_request(const std::string& raw_request) {
-    HttpRequest request;
-    std::istringstream stream(raw_request);
-    std::string line;
-    
-    // Parse request line
-    if (std::getline(stream, line)) {
-        std::istringstream request_line(line);
-        request_line >> request.method >> request.path;
-    }
-    
-    // Parse headers
-    while (std::getline(stream, line) && line != "\r" && !line.empty()) {
-        size_t colon_pos = line.find(':');
-        if (colon_pos != std::string::npos) {
-            std::string key = line.substr(0, colon_pos);
-            std::string value = line.substr(colon_pos + 2); // Skip ": "
-            
-            // Remove trailing \r if present
-            if (!value.empty() && value.back() == '\r') {
-                value.pop_back();
+    // Phase 29: Health answers on the loop thread, so it stays up however
+    // deep the worker queue is
+    if (route && route->on_event_loop) {
+        respond(conn, request, trace);
+        return;
+    }
+
+    // PHASE 6: Enqueue request to thread pool (eliminates thread creation overhead)
+    // The request views stay valid: the loop does not touch conn->in while in flight
+    auto queued_at = std::chrono::steady_clock::now();
+    bool enqueued = thread_pool_->enqueue([this, conn, &request, priority, queued_at, trace]() {
+        if (trace) {
+            trace->mark(TraceStage::DEQUEUED);
+        }
+        // Phase 29: Past its deadline the client has likely given up; the
+        // 503 is cheaper than doing the work
+        if (!admission_.admit_dequeued(priority, std::chrono::steady_clock::now() - queued_at)) {
+            if (trace) {
+                finish_trace(*trace, shed_response_->status_code());
             }
-            
-            request.headers[key] = value;
+            conn->loop->send(conn, static_message(shed_response_->bytes(false)), true);
+            return;
         }
+        respond(conn, request, trace);
+    });
+
+    // If queue is full (backpressure), reject request immediately
+    if (!enqueued) {
+        if (trace) {
+            finish_trace(*trace, shed_response_->status_code());
+        }
+        conn->loop->send(conn, static_message(shed_response_->bytes(false)), true);
+    }
+}
+
+void HttpServer::respond(const ConnectionPtr& conn, const HttpRequest& request, RequestTrace* trace) {
+    HttpResponse response;
+    {
+        ScopedTraceContext context(trace);
+        response = handle_request(request);
+    }
+    if (trace) {
+        finish_trace(*trace, status_of(response));
     }
-    
-    // Parse body (if present)
-    std::ostringstream body_stream;
-    while (std::getline(stream, line)) {
-        body_stream << line << "\n";
-    }
-    request.body = body_stream.str();
-    
-    // Remove trailing newline if present
-    if (!request.body.empty() && request.body.back() == '\n') {
-        request.body.pop_back();
-    }
-    
-    return request;
-}
-
-std::string HttpServer::format_response(const HttpResponse& response) {
-    std::ostringstream stream;
-    
-    // Status line
-    stream << "HTTP/1.1 " << response.status_code << " ";
-    switch (response.status_code) {
-        case 200: stream << "OK"; break;
-        case 400: stream << "Bad Request"; break;
-        case 429: stream << "Too Many Requests"; break;
-        case 500: stream << "Internal Server Error"; break;
-        default: stream << "Unknown"; break;
-    }
-    stream << "\r\n";
-    
-    // Headers
-    stream << "Content-Length: " << response.body.length() << "\r\n";
-    for (const auto& header : response.headers) {
-        stream << header.first << ": " << header.second << "\r\n";
-    }
-    stream << "\r\n";
-    
-    // Body
-    stream << response.body;
-    
-    return stream.str();
+    bool keep_alive = running_.load() && wants_keep_alive(request);
+    conn->loop->send(conn, serialize_response(std::move(response), keep_alive), !keep_alive);
 }
 
 HttpResponse HttpServer::handle_request(const HttpRequest& request) {
-    auto path_it = handlers_.find(request.path);
-    if (path_it == handlers_.end()) {
-        HttpResponse response;
+    ScopedProbe probe(Probe::REQUEST_HANDLER);
+    bool path_found = false;
+    for (const auto& route : routes_) {
+        if (route.path != request.path) {
+            continue;
+        }
+        path_found = true;
+        if (route.method == request.method) {
+            return route.handler(request);
+        }
+    }
+
+    HttpResponse response;
+    if (!path_found) {
         response.status_code = 404;
         response.body = "Not Found";
-        return response;
-    }
-    
-    auto method_it = path_it->second.find(request.method);
-    if (method_it == path_it->second.end()) {
-        HttpResponse response;
+    } else {
         response.status_code = 405;
         response.body = "Method Not Allowed";
-        return response;
     }
-    
-    return method_it->second(request);
+    return response;
 }
 
 } // namespace metricstream
\ No newline at end of file
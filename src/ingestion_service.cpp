@@ -1,179 +1,272 @@
 #include "ingestion_service.h"
+#include "binary_protocol.h"
+#include "common.h"
+#include "jsonl_writer.h"
+#include "metrics_exporter.h"
+#include "profiling.h"
+#include "query_engine.h"
+#include "segment.h"
+#include "series_registry.h"
 #include <iostream>
 #include <thread>
 #include <cmath>
-#include <iomanip>
-#include <ctime>
 #include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
 #include <vector>
 
 namespace metricstream {
 
+namespace {
+
+// Phase 10: Hot-path responses rendered once, sent as a single static iovec
+const CannedResponse RATE_LIMITED_RESPONSE(429, "application/json",
+    R"({"error":"Rate limit exceeded"})");
+const CannedResponse HEALTHY_RESPONSE(200, "application/json",
+    R"({"status":"healthy","service":"ingestion"})");
+const CannedResponse STORAGE_BACKPRESSURE_RESPONSE(503, "application/json",
+    R"({"error":"Storage backlog, try again later"})");
+const CannedResponse WAL_UNAVAILABLE_RESPONSE(503, "application/json",
+    R"({"error":"Write-ahead log unavailable"})");
+const CannedResponse PEER_UNAVAILABLE_RESPONSE(503, "application/json",
+    R"({"error":"Cluster peer unavailable"})");
+// Phase 35: Retrying the same series cannot succeed before the window ends
+const CannedResponse SERIES_LIMIT_RESPONSE(400, "application/json",
+    R"({"error":"Series limit exceeded for this client"})");
+
+// Commit the sink every this many replayed batches so replay memory stays flat
+constexpr uint64_t REPLAY_COMMIT_BATCHES = 256;
+
+// Clients exported with their series estimate on /metrics/stats
+constexpr size_t TOP_CARDINALITY_CLIENTS = 10;
+
+} // namespace
+
 // TODO(human): Implement sliding window rate limiting algorithm
 // Consider using a token bucket or sliding window approach
 // Store client request counts with timestamps
 
 //
 
-RateLimiter::RateLimiter(size_t max_requests_per_second) 
-    : max_requests_(max_requests_per_second) {
-}
-
-// Hash-based per-client mutex selection (Phase 4 optimization)
-std::mutex& RateLimiter::get_client_mutex(const std::string& client_id) {
-    std::hash<std::string> hasher;
-    size_t hash_value = hasher(client_id);
-    size_t mutex_index = hash_value % MUTEX_POOL_SIZE;
-    return client_mutex_pool_[mutex_index];
+RateLimiter::RateLimiter(size_t max_requests_per_second, Mode mode, size_t max_clients)
+    : max_requests_(max_requests_per_second), mode_(mode), clients_(max_clients) {
+    constexpr int64_t NS_PER_SECOND = 1000000000;
+    emission_interval_ns_ = max_requests_ > 0 ? NS_PER_SECOND / static_cast<int64_t>(max_requests_) : 0;
+    if (emission_interval_ns_ == 0) {
+        emission_interval_ns_ = 1;
+    }
+    burst_tolerance_ns_ = NS_PER_SECOND - emission_interval_ns_;
 }
 
-bool RateLimiter::allow_request(const std::string& client_id) {
-    auto function_start = std::chrono::high_resolution_clock::now();
-    auto now = std::chrono::steady_clock::now();
-
-    // PHASE 5 OPTIMIZATION: Lock-free ring buffer for metrics collection
-    // Mutex only protects rate limiting state, not metrics (which use atomics)
-    bool decision;
+bool RateLimiter::allow_request(std::string_view client_id, std::chrono::steady_clock::time_point now) {
+    ScopedProbe probe(Probe::RATE_LIMIT_DECISION);
 
-    auto lock_start = std::chrono::high_resolution_clock::now();
-    {
-        std::mutex& client_lock = get_client_mutex(client_id);
-        std::lock_guard<std::mutex> lock(client_lock);
-        auto lock_acquired = std::chrono::high_resolution_clock::now();
-
-        // Rate limiting logic - under per-client lock
-        auto& client_queue = client_requests_[client_id];
-
-        // Remove old timestamps (older than 1 second)
-        auto cleanup_start = std::chrono::high_resolution_clock::now();
-        size_t removed_count = 0;
-        while (!client_queue.empty()) {
-            auto oldest_timestamp = client_queue.front();
-            auto time_diff = std::chrono::duration_cast<std::chrono::seconds>(now - oldest_timestamp);
-
-            if (time_diff.count() >= 1) {
-                client_queue.pop_front();
-                removed_count++;
-            } else {
-                break;
-            }
-        }
-        auto cleanup_end = std::chrono::high_resolution_clock::now();
+    if (max_requests_ == 0) {
+        return false;
+    }
 
-        auto decision_start = std::chrono::high_resolution_clock::now();
-        if(client_queue.size() < max_requests_){
-            client_queue.push_back(now);
-            decision = true;
-        } else {
-            decision = false;
-        }
-        auto decision_end = std::chrono::high_resolution_clock::now();
-
-        // Profile logging (every 1000 requests)
-        static std::atomic<int> profile_counter{0};
-        if (profile_counter.fetch_add(1) % 1000 == 0) {
-            auto wait_time = std::chrono::duration_cast<std::chrono::microseconds>(
-                lock_acquired - lock_start).count();
-            auto cleanup_time = std::chrono::duration_cast<std::chrono::microseconds>(
-                cleanup_end - cleanup_start).count();
-            auto decision_time = std::chrono::duration_cast<std::chrono::microseconds>(
-                decision_end - decision_start).count();
-            auto total_lock_time = std::chrono::duration_cast<std::chrono::microseconds>(
-                decision_end - lock_acquired).count();
-
-            std::cerr << "[PROFILE] Wait: " << wait_time << "μs | "
-                      << "Cleanup: " << cleanup_time << "μs (" << removed_count << " items) | "
-                      << "Decision: " << decision_time << "μs | "
-                      << "Total-in-lock: " << total_lock_time << "μs | "
-                      << "Queue-size: " << client_queue.size() << "\n";
-        }
-    } // Lock released here
+    // Phase 12: Lock-free lookup; the shard lock is only taken for new clients
+    ShardedMap<ClientState>::Ref state = clients_.get_or_insert(client_id);
+    bool decision = mode_ == Mode::GCRA ? allow_gcra(*state, now)
+                                        : allow_sliding_window(*state, now);
 
     // LOCK-FREE metrics collection using atomic ring buffer
-    // Single-writer (this thread) / single-reader (flush thread) pattern
-    auto& metrics = client_metrics_[client_id];
-    size_t write_idx = metrics.write_index.load(std::memory_order_relaxed);
+    if (decision_log_.load(std::memory_order_relaxed)) {
+        ClientState::get_or_create(state->metrics).record(MetricEvent{now, decision});
+    }
+    if (decision && usage_sharing_.load(std::memory_order_relaxed)) {
+        state->unshared.fetch_add(1, std::memory_order_relaxed);
+    }
 
-    // Write event to ring buffer
-    metrics.ring_buffer[write_idx % ClientMetrics::BUFFER_SIZE] = MetricEvent{now, decision};
+    return decision;
+}
 
-    // Publish write with release semantics - ensures buffer write visible before index update
-    metrics.write_index.store(write_idx + 1, std::memory_order_release);
+// Phase 12: Generic Cell Rate Algorithm. The theoretical arrival time (TAT)
+// advances by one emission interval per allowed request; a request is
+// allowed while TAT is no more than the burst tolerance ahead of now.
+bool RateLimiter::allow_gcra(ClientState& state, std::chrono::steady_clock::time_point now) {
+    int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        now.time_since_epoch()).count();
 
-    return decision;
+    int64_t tat = state.tat_ns.load(std::memory_order_relaxed);
+    while (true) {
+        int64_t start = tat > now_ns ? tat : now_ns;
+        if (start - now_ns > burst_tolerance_ns_) {
+            return false;
+        }
+        if (state.tat_ns.compare_exchange_weak(tat, start + emission_interval_ns_,
+                                               std::memory_order_relaxed)) {
+            return true;
+        }
+    }
 }
 
-void RateLimiter::flush_metrics() {
-    // PHASE 5 OPTIMIZATION: Lock-free metrics reading
-    // No longer need complex lock ordering since metrics use atomic ring buffer
-    // Only client_metrics_ map iteration needs protection (for concurrent insertions)
+void RateLimiter::save(std::string& out, std::chrono::steady_clock::time_point now) const {
+    int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        now.time_since_epoch()).count();
+    ByteWriter w(out);
+    size_t count_at = w.size();
+    w.put_u32(0);
+    uint32_t count = 0;
+    clients_.for_each([&](const std::string& client_id, ClientState& state) {
+        int64_t debt = state.tat_ns.load(std::memory_order_relaxed) - now_ns;
+        if (debt > 0) {
+            w.put_string(client_id);
+            w.put_i64(debt);
+            count++;
+        }
+    });
+    w.patch_u32(count_at, count);
+}
 
-    // Get snapshot of current clients
-    std::vector<std::string> client_ids;
-    {
-        static std::mutex client_list_mutex;
-        std::lock_guard<std::mutex> list_lock(client_list_mutex);
+size_t RateLimiter::load(std::string_view data, std::chrono::steady_clock::time_point now) {
+    ByteReader in(data);
+    uint32_t count = in.get_u32();
+    // Each client needs at least 10 bytes, which bounds a corrupt count
+    if (!in.ok() || count > in.remaining() / 10) {
+        return 0;
+    }
+    int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        now.time_since_epoch()).count();
+    size_t restored = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        std::string_view client_id = in.get_string();
+        int64_t debt = in.get_i64();
+        if (!in.ok()) {
+            break;
+        }
+        // Debts never exceed one second's allowance, whatever the limit
+        debt = std::clamp<int64_t>(debt, 0, burst_tolerance_ns_ + emission_interval_ns_);
+        clients_.get_or_insert(client_id)->tat_ns.store(now_ns + debt, std::memory_order_relaxed);
+        restored++;
+    }
+    return restored;
+}
 
-        client_ids.reserve(client_metrics_.size());
-        for (const auto& [client_id, _] : client_metrics_) {
-            client_ids.push_back(client_id);
+void RateLimiter::take_usage(std::vector<ClientUsage>& out) {
+    clients_.for_each([&out](const std::string& client_id, ClientState& state) {
+        if (state.unshared.load(std::memory_order_relaxed) == 0) {
+            return;   // Most clients are idle: skip the write
+        }
+        uint32_t requests = state.unshared.exchange(0, std::memory_order_relaxed);
+        if (requests > 0) {
+            out.push_back(ClientUsage{client_id, requests});
         }
+    });
+}
+
+// Phase 31: A peer's admissions take from the same allowance as ours. The
+// debt is capped at one second's allowance, as in load().
+void RateLimiter::apply_usage(std::string_view client_id, uint32_t requests,
+                              std::chrono::steady_clock::time_point now) {
+    if (requests == 0 || max_requests_ == 0) {
+        return;
     }
+    peer_requests_.fetch_add(requests, std::memory_order_relaxed);
+    ShardedMap<ClientState>::Ref state = clients_.get_or_insert(client_id);
 
-    // Process each client's metrics using lock-free reads
-    for (const auto& client_id : client_ids) {
-        auto it = client_metrics_.find(client_id);
-        if (it == client_metrics_.end()) {
-            continue;
+    if (mode_ == Mode::GCRA) {
+        int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            now.time_since_epoch()).count();
+        int64_t limit = now_ns + burst_tolerance_ns_ + emission_interval_ns_;
+        int64_t tat = state->tat_ns.load(std::memory_order_relaxed);
+        while (true) {
+            int64_t start = tat > now_ns ? tat : now_ns;
+            int64_t charged = start + static_cast<int64_t>(requests) * emission_interval_ns_;
+            if (state->tat_ns.compare_exchange_weak(tat, std::min(charged, limit),
+                                                    std::memory_order_relaxed)) {
+                return;
+            }
         }
+    }
 
-        auto& metrics = it->second;
+    SlidingWindow& window = ClientState::get_or_create(state->window);
+    std::lock_guard<std::mutex> lock(window.mutex);
+    for (uint32_t i = 0; i < requests && window.timestamps.size() < max_requests_; ++i) {
+        window.timestamps.push_back(now);
+    }
+}
 
-        // LOCK-FREE READ: Use acquire semantics to see all writes before write_index update
-        size_t read_idx = metrics.read_index.load(std::memory_order_acquire);
-        size_t write_idx = metrics.write_index.load(std::memory_order_acquire);
+bool RateLimiter::allow_sliding_window(ClientState& state, std::chrono::steady_clock::time_point now) {
+    // Phase 13: Probes are compiled out unless METRICSTREAM_PROFILING is set,
+    // and record into per-thread histograms (no I/O under the lock)
+    SlidingWindow& window = ClientState::get_or_create(state.window);
+    std::unique_lock<std::mutex> lock(window.mutex, std::defer_lock);
+    {
+        ScopedProbe probe(Probe::RATE_LIMIT_LOCK_WAIT);
+        lock.lock();
+    }
 
-        // Process all events between read and write indices
-        size_t events_processed = 0;
-        for (size_t i = read_idx; i < write_idx; ++i) {
-            const auto& event = metrics.ring_buffer[i % ClientMetrics::BUFFER_SIZE];
+    // Rate limiting logic - under per-client lock
+    auto& client_queue = window.timestamps;
 
-            // Send to monitoring (I/O operation outside any critical section)
-            send_to_monitoring(client_id, event.timestamp, event.allowed);
-            events_processed++;
+    // Remove old timestamps (older than 1 second)
+    {
+        ScopedProbe probe(Probe::RATE_LIMIT_CLEANUP);
+        while (!client_queue.empty() && now - client_queue.front() >= std::chrono::seconds(1)) {
+            client_queue.pop_front();
         }
+    }
 
-        // Update read index with release semantics to mark events as processed
-        if (events_processed > 0) {
-            metrics.read_index.store(write_idx, std::memory_order_release);
-        }
+    if (client_queue.size() < max_requests_) {
+        client_queue.push_back(now);
+        return true;
     }
+    return false;
 }
 
-void RateLimiter::send_to_monitoring(const std::string& client_id,
-                                   const std::chrono::time_point<std::chrono::steady_clock>& timestamp,
-                                   bool allowed) {
-    // Convert timestamp to milliseconds since epoch for monitoring
-    auto ms_since_epoch = std::chrono::duration_cast<std::chrono::milliseconds>(
-        timestamp.time_since_epoch()).count();
-    
-    // In production, this would send to your monitoring system (Prometheus, DataDog, etc.)
-    std::cout << "[METRICS] client=" << client_id 
-              << " timestamp=" << ms_since_epoch 
-              << " allowed=" << (allowed ? "true" : "false") << std::endl;
+void ClientMetrics::record(const MetricEvent& event) {
+    // Claim an index; several workers may record for the same client at once
+    size_t idx = write_index.fetch_add(1, std::memory_order_acq_rel);
+    Slot& slot = ring_buffer[idx & (BUFFER_SIZE - 1)];
+
+    // Seqlock write: odd while the fields are in flux, even when published
+    slot.sequence.store(2 * static_cast<uint64_t>(idx) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    int64_t timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        event.timestamp.time_since_epoch()).count();
+    slot.event.store(timestamp_ns * 2 + (event.allowed ? 1 : 0), std::memory_order_relaxed);
+    slot.sequence.store(2 * static_cast<uint64_t>(idx) + 2, std::memory_order_release);
+}
+
+void RateLimiter::drain_decisions(std::vector<ClientDecisionCounts>& out) {
+    // PHASE 5 OPTIMIZATION: Lock-free metrics reading
+    // Phase 12: The sharded map is safe to walk while clients are inserted
+    clients_.for_each([&out](const std::string& client_id, ClientState& state) {
+        ClientMetrics* metrics = state.metrics.load(std::memory_order_acquire);
+        if (metrics == nullptr) {
+            return;
+        }
+        ClientDecisionCounts counts;
+        counts.dropped = metrics->drain([&counts](int64_t, bool allowed) {
+            if (allowed) {
+                counts.allowed++;
+            } else {
+                counts.denied++;
+            }
+        });
+
+        if (counts.allowed + counts.denied + counts.dropped > 0) {
+            counts.client_id = client_id;
+            out.push_back(std::move(counts));
+        }
+    });
 }
 
 MetricValidator::ValidationResult MetricValidator::validate_metric(const Metric& metric) const {
     ValidationResult result;
     result.valid = true;
     
-    if (metric.name.empty()) {
+    const std::string& name = metric.name();
+    if (name.empty()) {
         result.valid = false;
         result.error_message = "Metric name cannot be empty";
         return result;
     }
     
-    if (metric.name.length() > 255) {
+    if (name.length() > 255) {
         result.valid = false;
         result.error_message = "Metric name too long (max 255 characters)";
         return result;
@@ -216,48 +309,321 @@ MetricValidator::ValidationResult MetricValidator::validate_batch(const MetricBa
     return result;
 }
 
-IngestionService::IngestionService(int port, size_t rate_limit)
-    : metrics_received_(0), batches_processed_(0), validation_errors_(0), rate_limited_(0) {
+namespace {
+
+IngestionConfig make_config(int port, size_t rate_limit, FsyncPolicy fsync_policy) {
+    IngestionConfig config;
+    config.port = port;
+    config.rate_limit = rate_limit;
+    config.fsync_policy = fsync_policy;
+    return config;
+}
+
+int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Query-string component: %XX escapes and '+' for space
+std::string url_decode(std::string_view text) {
+    std::string out;
+    out.reserve(text.size());
+    for (size_t i = 0; i < text.size(); ++i) {
+        char c = text[i];
+        if (c == '+') {
+            out.push_back(' ');
+        } else if (c == '%' && i + 2 < text.size() &&
+                   hex_digit(text[i + 1]) >= 0 && hex_digit(text[i + 2]) >= 0) {
+            out.push_back(static_cast<char>(hex_digit(text[i + 1]) * 16 + hex_digit(text[i + 2])));
+            i += 2;
+        } else {
+            out.push_back(c);
+        }
+    }
+    return out;
+}
+
+// Calls visit(key, value) for each decoded key=value pair of a query string
+template <typename F>
+void for_each_query_param(std::string_view params, F&& visit) {
+    while (!params.empty()) {
+        size_t amp = params.find('&');
+        std::string_view param = params.substr(0, amp);
+        params = amp == std::string_view::npos ? std::string_view{} : params.substr(amp + 1);
+        if (param.empty()) continue;
+        
+        size_t eq = param.find('=');
+        std::string key = url_decode(param.substr(0, eq));
+        std::string value = eq == std::string_view::npos ? std::string() : url_decode(param.substr(eq + 1));
+        if (!visit(key, value)) return;
+    }
+}
+
+bool parse_int64(const std::string& text, int64_t& out) {
+    if (text.empty()) return false;
+    char* end = nullptr;
+    errno = 0;
+    long long value = std::strtoll(text.c_str(), &end, 10);
+    if (errno != 0 || *end != '\0') return false;
+    out = value;
+    return true;
+}
+
+void append_tags_json(std::string& out, const SeriesInfo& series) {
+    out.append("\"tags\":{");
+    bool first = true;
+    for (const auto& [key, value] : series.tags) {
+        if (!first) out.push_back(',');
+        append_json_string(out, key);
+        out.push_back(':');
+        append_json_string(out, value);
+        first = false;
+    }
+    out.push_back('}');
+}
+
+// Phase 30: metrics.jsonl -> metrics-2.jsonl for shard 2; shard 0 keeps it
+std::string shard_jsonl_path(const std::string& path, size_t shard) {
+    if (shard == 0) {
+        return path;
+    }
+    size_t slash = path.rfind('/');
+    size_t dot = path.rfind('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash) || dot == slash + 1) {
+        return path + "-" + std::to_string(shard);
+    }
+    return path.substr(0, dot) + "-" + std::to_string(shard) + path.substr(dot);
+}
+
+} // namespace
+
+IngestionService::IngestionService(int port, size_t rate_limit, FsyncPolicy fsync_policy)
+    : IngestionService(make_config(port, rate_limit, fsync_policy)) {}
+
+IngestionService::IngestionService(const IngestionConfig& config)
+    : json_parser_(config.json_kernel) {
     
-    server_ = std::make_unique<HttpServer>(port);
+    server_ = std::make_unique<HttpServer>(config.port);
+    server_->set_pin_event_loops(config.pin_threads);
+    std::cerr << "[JSON] Parsing with the " << json_kernel_name(json_parser_.kernel())
+              << " kernel" << std::endl;
     validator_ = std::make_unique<MetricValidator>();
-    rate_limiter_ = std::make_unique<RateLimiter>(rate_limit);
+    // Phase 31: The rate limit is shared by gossip, the cardinality budget
+    // stays per node; see IngestionConfig::cluster_nodes
+    size_t cluster_size = config.cluster_nodes.size();
+    bool clustered = cluster_size > 1 && config.cluster_self < cluster_size;
+    rate_limiter_ = std::make_unique<RateLimiter>(config.rate_limit);
+    if (clustered) {
+        ring_ = std::make_unique<HashRing>(cluster_size);
+        forwarder_ = std::make_unique<ClusterForwarder>(config.cluster_nodes, config.cluster_self);
+        peers_ = std::make_unique<ClusterPeers>(config.cluster_nodes, config.cluster_self);
+        cluster_self_ = config.cluster_self;
+        usage_interval_ = config.cluster_usage_interval;
+        rate_limiter_->set_usage_sharing(true);
+        usage_thread_ = std::thread(&IngestionService::usage_loop, this);
+        std::cerr << "[CLUSTER] Node " << cluster_self_ << " of " << cluster_size << std::endl;
+    }
+    cardinality_ = std::make_unique<CardinalityLimiter>(config.cardinality);
+    decision_exporter_ = std::make_unique<DecisionExporter>(
+        *rate_limiter_, DecisionExporter::open_file("rate_limits.jsonl"));
+    alert_engine_ = std::make_unique<AlertEngine>();
+    for (const AlertRule& rule : config.alert_rules) {
+        alert_engine_->add_rule(rule);
+    }
     
-    // Open metrics file for storage
-    metrics_file_.open("metrics.jsonl", std::ios::app);
-    if (!metrics_file_.is_open()) {
-        std::cerr << "Warning: Could not open metrics.jsonl for writing" << std::endl;
+    // Open metrics storage, one sink per shard. Segment writers open their
+    // files exclusively, so shards sharing the directory never collide.
+    size_t shards = std::clamp<size_t>(config.storage_shards, 1,
+                                       std::min(std::max<size_t>(config.log_partitions, 1), IngestionConfig::MAX_STORAGE_SHARDS));
+    for (size_t shard = 0; shard < shards; ++shard) {
+        if (config.storage_format == StorageFormat::SEGMENTS) {
+            SegmentWriter::Options options;
+            options.directory = config.segment_dir;
+            options.fsync = config.fsync_policy;
+            storage_.push_back(std::make_unique<SegmentWriter>(options));
+        } else {
+            storage_.push_back(std::make_unique<JsonlWriter>(shard_jsonl_path(config.jsonl_path, shard),
+                                                             config.fsync_policy));
+        }
     }
+    shard_flushed_through_ = std::make_unique<std::atomic<uint64_t>[]>(shards);
+    pin_threads_ = config.pin_threads;
     
-    // Start async writer thread
-    writer_thread_ = std::thread(&IngestionService::async_writer_loop, this);
+    // Phase 34: Before replay, which may feed them
+    if (config.rollups_enabled) {
+        rollup_dir_ = config.rollup_dir;
+        size_t workers = std::clamp<size_t>(config.rollup_workers, 1, std::max<size_t>(config.log_partitions, 1));
+        for (size_t i = 0; i < workers; ++i) {
+            rollup_aggregators_.push_back(std::make_unique<RollupAggregator>(config.rollup_lateness));
+        }
+        RollupWriter::Options options;
+        options.directory = config.rollup_dir;
+        options.fsync = config.fsync_policy;
+        rollup_writer_ = std::make_unique<RollupWriter>(options);
+    }
+    
+    // Phase 34: The checkpoint registers its series before anything else
+    // interns one, so their ids are the ones it was saved with
+    auto restore_started = std::chrono::steady_clock::now();
+    if (config.checkpoints_enabled) {
+        restore_checkpoint(config);
+    }
+    if (config.wal_enabled) {
+        replay_wal(config);
+    }
+    restore_duration_us_ = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - restore_started).count());
+    if (checkpoints_) {
+        std::cerr << "[CHECKPOINT] Ready after " << restore_duration_us_ / 1000 << " ms of restore and replay"
+                  << std::endl;
+    }
+    
+    // Cursors are registered before the first append, so each sees every batch
+    log_ = std::make_unique<PartitionedLog>(config.log_partitions, config.partition_capacity);
+    storage_cursor_ = log_->add_cursor("storage");
+    if (!config.alert_rules.empty()) {
+        alert_cursor_ = log_->add_cursor("alerts");
+    }
+    if (config.rollups_enabled) {
+        rollup_cursor_ = log_->add_cursor("rollups");
+    }
+    
+    // Start the shard writers (and the alert consumer, if there are rules)
+    for (size_t shard = 0; shard < storage_.size(); ++shard) {
+        writer_threads_.emplace_back(&IngestionService::async_writer_loop, this, shard);
+    }
+    if (!config.alert_rules.empty()) {
+        alert_thread_ = std::thread(&IngestionService::alert_consumer_loop, this);
+    }
+    for (size_t i = 0; i < rollup_aggregators_.size(); ++i) {
+        rollup_threads_.emplace_back(&IngestionService::rollup_consumer_loop, this, i);
+    }
+    if (checkpoints_) {
+        checkpoint_thread_ = std::thread(&IngestionService::checkpoint_loop, this);
+    }
+    
+    // Phase 33: Stage timestamps of every HTTP request
+    Tracer::global().set_options(config.tracing);
+    
+    // Phase 29: Writer lag is the downstream half of the overload signal
+    server_->admission().set_options(config.admission);
+    server_->admission().set_pressure_probe([this] {
+        return log_->lag(storage_cursor_) > log_->partition_count() * log_->capacity() / 2;
+    });
     
     // Register HTTP endpoints
     server_->add_handler("/metrics", "POST", 
-        [this](const HttpRequest& req) { return handle_metrics_post(req); });
+        [this](const HttpRequest& req) { return handle_metrics_post(req); },
+        RequestPriority::SHEDDABLE);
     server_->add_handler("/health", "GET", 
-        [this](const HttpRequest& req) { return handle_health_check(req); });
+        [this](const HttpRequest& req) { return handle_health_check(req); },
+        RequestPriority::CRITICAL, true);
     server_->add_handler("/metrics", "GET", 
         [this](const HttpRequest& req) { return handle_metrics_get(req); });
+    server_->add_handler("/metrics/stats", "GET",
+        [this](const HttpRequest& req) { return handle_stats_get(req); },
+        RequestPriority::CRITICAL);
+    server_->add_handler("/alerts", "GET",
+        [this](const HttpRequest& req) { return handle_alerts_get(req); });
+    server_->add_handler("/debug/traces", "GET",
+        [this](const HttpRequest& req) { return handle_traces_get(req); });
+    server_->add_handler("/debug/cardinality", "GET",
+        [this](const HttpRequest& req) { return handle_cardinality_get(req); });
+    
+    if (rollup_writer_) {
+        server_->add_handler("/rollups", "GET",
+            [this](const HttpRequest& req) { return handle_rollups_get(req); });
+    }
+    
+    if (config.storage_format == StorageFormat::SEGMENTS) {
+        query_engine_ = std::make_unique<QueryEngine>(config.segment_dir);
+        QueryExecutor::Options executor_options;
+        executor_options.threads = config.query_threads;
+        query_executor_ = std::make_unique<QueryExecutor>(*query_engine_, executor_options);
+        server_->add_handler("/query", "GET",
+            [this](const HttpRequest& req) { return handle_query(req); });
+    }
+    
+    // Phase 31: Peers forward over the binary protocol
+    int binary_port = config.binary_port;
+    if (clustered && binary_port <= 0) {
+        binary_port = config.cluster_nodes[cluster_self_].port;
+    }
+    if (binary_port > 0) {
+        binary_server_ = std::make_unique<BinaryServer>(binary_port,
+            [this](BinaryDecoder& decoder, std::string_view frames, std::string_view remote_address) {
+                return handle_binary_frames(decoder, frames, remote_address);
+            });
+    }
 }
 
 IngestionService::~IngestionService() {
     stop();
+    // Finish in-flight handlers before the queue and pool they use go away
+    server_.reset();
+    binary_server_.reset();
+    if (usage_thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(usage_mutex_);
+            usage_stopping_ = true;
+        }
+        usage_cv_.notify_all();
+        usage_thread_.join();
+    }
+    forwarder_.reset();
+    
+    // Phase 34: While the rollup workers still run, as a checkpoint in
+    // progress waits for them
+    if (checkpoint_thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(checkpoint_mutex_);
+            checkpoint_stopping_ = true;
+        }
+        checkpoint_cv_.notify_all();
+        checkpoint_thread_.join();
+    }
     
-    // Shutdown async writer thread
-    writer_running_ = false;
-    queue_cv_.notify_all();
-    if (writer_thread_.joinable()) {
-        writer_thread_.join();
+    // Shutdown consumer threads (each drains what is still in the log)
+    log_->close();
+    for (auto& thread : writer_threads_) {
+        thread.join();
+    }
+    if (alert_thread_.joinable()) {
+        alert_thread_.join();
     }
+    for (auto& thread : rollup_threads_) {
+        thread.join();
+    }
+    log_.reset();
     
-    if (metrics_file_.is_open()) {
-        metrics_file_.close();
+    // Phase 34: Open buckets go into the final checkpoint; only if that
+    // fails are they written out partial
+    if (checkpoints_ && !write_checkpoint(/*final=*/true)) {
+        for (auto& aggregator : rollup_aggregators_) {
+            aggregator->close_all([this](size_t resolution, uint32_t series_id, MetricType type,
+                                         const RollupPoint& point) {
+                rollup_writer_->append(resolution, series_id, type, point);
+            });
+        }
     }
+    rollup_writer_.reset();
+    
+    // The writer checkpointed on exit; this only stops the flusher
+    wal_.reset();
+    
+    // Commits and syncs anything the writers left buffered
+    storage_.clear();
 }
 
 void IngestionService::start() {
     server_->start();
+    if (binary_server_) {
+        binary_server_->start();
+    }
+    decision_exporter_->start();
+    alert_engine_->start();
     std::cout << "Ingestion service started" << std::endl;
 }
 
@@ -265,49 +631,107 @@ void IngestionService::stop() {
     if (server_) {
         server_->stop();
     }
+    if (binary_server_) {
+        binary_server_->stop();
+    }
+    if (decision_exporter_) {
+        decision_exporter_->stop();
+    }
+    if (alert_engine_) {
+        alert_engine_->stop();
+    }
     std::cout << "Ingestion service stopped" << std::endl;
 }
 
 HttpResponse IngestionService::handle_metrics_post(const HttpRequest& request) {
+    ScopedLatency request_timer(request_latency_);
     HttpResponse response;
     response.set_json_content();
     
     // Extract client ID from headers or use IP as fallback
-    std::string client_id = "default";
-    auto auth_header = request.headers.find("Authorization");
-    if (auth_header != request.headers.end()) {
-        client_id = auth_header->second;
+    std::string_view client_id = request.header("Authorization");
+    if (client_id.empty()) {
+        client_id = "default";
     }
     
     // Check rate limiting
-    if (!rate_limiter_->allow_request(client_id)) {
-        rate_limited_++;
-        response.status_code = 429;
-        response.body = create_error_response("Rate limit exceeded");
+    bool allowed;
+    {
+        ScopedLatency timer(rate_limit_latency_);
+        allowed = rate_limiter_->allow_request(client_id);
+    }
+    trace_mark(TraceStage::RATE_LIMITED);
+    if (!allowed) {
+        rate_limited_.add();
+        response.canned = &RATE_LIMITED_RESPONSE;
         return response;
     }
     
     try {
-        MetricBatch batch = parse_json_metrics_optimized(request.body);
-        
-        auto validation_result = validator_->validate_batch(batch);
-        if (!validation_result.valid) {
-            validation_errors_++;
+        PooledBatch batch = batch_pool_.acquire();
+        const char* parse_error = nullptr;
+        bool parsed;
+        auto parse_start = std::chrono::steady_clock::now();
+        // Phase 35: Whatever the parse would intern past the client's budget is refused
+        CardinalityLimiter::ClientRef cardinality = cardinality_->client(client_id);
+        ScopedSeriesBudget series_budget(cardinality_->budget(*cardinality, parse_start),
+                                         cardinality_->options().action == CardinalityLimiter::Action::AGGREGATE);
+        if (HttpRequestParser::iequals(request.header("Content-Type"), BINARY_CONTENT_TYPE)) {
+            // Phase 25: A binary body is a self-contained frame stream
+            thread_local BinaryDecoder decoder;
+            decoder.reset();
+            parsed = decoder.decode(request.body, *batch, &parse_error);
+            if (parsed && !decoder.usage().empty()) {
+                parsed = false;   // Phase 31: Peers send these on their own streams
+                parse_error = "USAGE frames are only accepted from cluster peers";
+            }
+        } else {
+            // Phase 23: One arena per worker thread, rewound for each request
+            thread_local Arena arena;
+            arena.reset();
+            // Phase 24: Vectorized structural scan, then a walk over the index
+            parsed = json_parser_.parse(request.body, *batch, arena, &parse_error);
+        }
+        parse_latency_.observe(std::chrono::steady_clock::now() - parse_start);
+        trace_mark(TraceStage::PARSED);
+        if (RequestTrace* trace = current_trace()) {
+            trace->metrics = static_cast<uint32_t>(batch->size());
+        }
+        cardinality_->record(*cardinality, series_budget, *batch);
+        if (!parsed) {
+            validation_errors_.add();
             response.status_code = 400;
-            response.body = create_error_response(validation_result.error_message);
+            response.body = create_error_response(parse_error);
+            return response;
+        }
+        if (batch->empty() && series_budget.refused() > 0) {
+            response.canned = &SERIES_LIMIT_RESPONSE;
             return response;
         }
         
-        metrics_received_ += batch.size();
-        batches_processed_++;
-        
-        // Queue metrics for asynchronous writing (no blocking!)
-        queue_metrics_for_async_write(batch);
-        
-        response.body = create_success_response(batch.size());
+        size_t count = batch->size();
+        std::string error;
+        switch (submit_batch(batch, client_id, error)) {
+            case IngestResult::OK:
+                response.body = create_success_response(count);
+                break;
+            case IngestResult::INVALID:
+                response.status_code = 400;
+                response.body = create_error_response(error);
+                break;
+            case IngestResult::BACKPRESSURE:
+                response.canned = &STORAGE_BACKPRESSURE_RESPONSE;
+                break;
+            case IngestResult::WAL_UNAVAILABLE:
+                response.canned = &WAL_UNAVAILABLE_RESPONSE;
+                break;
+            case IngestResult::PEER_UNAVAILABLE:
+                response.canned = &PEER_UNAVAILABLE_RESPONSE;
+                break;
+        }
         
     } catch (const std::exception& e) {
-        validation_errors_++;
+        validation_errors_.add();
         response.status_code = 400;
         response.body = create_error_response("Invalid JSON: " + std::string(e.what()));
     }
@@ -315,10 +739,238 @@ HttpResponse IngestionService::handle_metrics_post(const HttpRequest& request) {
     return response;
 }
 
+// Validate, log and queue a parsed batch; shared by every ingest protocol
+IngestionService::IngestResult IngestionService::submit_batch(PooledBatch& batch, std::string_view client_id,
+                                                              std::string& error, bool forward) {
+    auto stage_start = std::chrono::steady_clock::now();
+    auto validation_result = validator_->validate_batch(*batch);
+    auto stage_end = std::chrono::steady_clock::now();
+    validate_latency_.observe(stage_end - stage_start);
+    trace_mark(TraceStage::VALIDATED);
+    if (!validation_result.valid) {
+        validation_errors_.add();
+        error = std::move(validation_result.error_message);
+        return IngestResult::INVALID;
+    }
+    
+    // Phase 31: Series owned elsewhere go to their nodes first, so the
+    // owners' WAL syncs overlap with ours
+    std::vector<ClusterForwarder::Ticket> tickets;
+    if (forward && forwarder_ && !forward_foreign(*batch, tickets)) {
+        return IngestResult::PEER_UNAVAILABLE;
+    }
+    auto wait_forwarded = [this, &tickets] {
+        bool ok = true;
+        for (const auto& ticket : tickets) {
+            ok = forwarder_->wait(ticket) && ok;
+        }
+        return ok ? IngestResult::OK : IngestResult::PEER_UNAVAILABLE;
+    };
+    if (batch->empty()) {
+        batches_processed_.add();
+        return wait_forwarded();
+    }
+    
+    // Phase 20: Alert windows see the batch from the log's alert cursor,
+    // off the request path and in parallel with storage
+    batch->source_id.assign(client_id);
+    
+    // Phase 21: Log first, so the lsn travels with the batch to storage
+    stage_start = stage_end;
+    uint64_t lsn = 0;
+    if (wal_) {
+        lsn = wal_->append(*batch);
+        if (lsn == 0) {
+            return IngestResult::WAL_UNAVAILABLE;
+        }
+        batch->wal_lsn = lsn;
+        trace_mark(TraceStage::WAL_APPENDED);
+    }
+    
+    // Queue metrics for asynchronous writing (no blocking!)
+    size_t count = batch->size();
+    if (!queue_metrics_for_async_write(batch)) {
+        if (lsn != 0) {
+            wal_->cancel(lsn);   // Replay must not resurrect a refused batch
+        }
+        storage_backpressure_.add();
+        return IngestResult::BACKPRESSURE;
+    }
+    stage_end = std::chrono::steady_clock::now();
+    enqueue_latency_.observe(stage_end - stage_start);
+    trace_mark(TraceStage::ENQUEUED);
+    
+    // Acknowledge only once the record is synced. Storage may already
+    // have the batch if this fails; the client retries either way.
+    if (lsn != 0) {
+        bool durable = wal_->wait_durable(lsn);
+        wal_sync_latency_.observe(std::chrono::steady_clock::now() - stage_end);
+        trace_mark(TraceStage::WAL_SYNCED);
+        if (!durable) {
+            return IngestResult::WAL_UNAVAILABLE;
+        }
+    }
+    
+    metrics_received_.add(count);
+    batches_processed_.add();
+    return tickets.empty() ? IngestResult::OK : wait_forwarded();
+}
+
+// Phase 31: Moves the metrics other nodes own out of the batch and queues
+// them for their owners. False if a peer's queue is full; the client
+// retries the whole batch, so peers that did take theirs may see it twice.
+bool IngestionService::forward_foreign(MetricBatch& batch, std::vector<ClusterForwarder::Ticket>& tickets) {
+    thread_local std::vector<std::vector<Metric>> foreign;
+    foreign.resize(ring_->node_count());
+    for (auto& metrics : foreign) {
+        metrics.clear();
+    }
+    
+    size_t kept = 0;
+    for (const Metric& metric : batch.metrics) {
+        size_t owner = ring_->owner_of(metric.series());
+        if (owner == cluster_self_) {
+            batch.metrics[kept++] = metric;
+        } else {
+            foreign[owner].push_back(metric);
+        }
+    }
+    batch.metrics.erase(batch.metrics.begin() + static_cast<std::ptrdiff_t>(kept), batch.metrics.end());
+    
+    for (size_t node = 0; node < foreign.size(); ++node) {
+        if (foreign[node].empty()) continue;
+        auto ticket = forwarder_->send(node, foreign[node].data(), foreign[node].size());
+        if (!ticket) {
+            return false;
+        }
+        tickets.push_back(std::move(ticket));
+    }
+    return true;
+}
+
+// Phase 25: One call per run of frames a TCP client has buffered
+BinaryAck IngestionService::handle_binary_frames(BinaryDecoder& decoder, std::string_view frames,
+                                                 std::string_view remote_address) {
+    ScopedLatency request_timer(request_latency_);
+    BinaryAck ack;
+    PooledBatch batch = batch_pool_.acquire();
+    const char* decode_error = nullptr;
+    bool decoded = true;
+    size_t refused = 0;
+    // Phase 35: A HELLO renames the client for the frames after it, even in
+    // the same read, so the run is decoded in parts split at each HELLO
+    while (decoded && !frames.empty()) {
+        size_t hello_bytes;
+        size_t hello_at = find_hello(frames, &hello_bytes);
+        decoded = decode_binary_part(decoder, frames.substr(0, hello_at), *batch, remote_address,
+                                     refused, &decode_error);
+        if (decoded && hello_bytes > 0) {
+            decoded = decoder.decode(frames.substr(hello_at, hello_bytes), *batch, &decode_error);
+        }
+        frames.remove_prefix(hello_at + hello_bytes);
+    }
+    if (!decoded) {
+        validation_errors_.add();
+        ack.status = AckStatus::INVALID;
+        return ack;
+    }
+    if (batch->empty()) {
+        if (refused > 0) {
+            ack.status = AckStatus::REJECTED;
+        }
+        return ack;   // Only HELLO or SERIES frames, or only refused series
+    }
+    
+    std::string_view client_id = decoder.client_id();
+    if (client_id.empty()) {
+        client_id = "binary";
+    }
+    // Phase 31: The entry node already charged a forwarded batch
+    bool from_peer = peers_ && peers_->trusted(client_id, remote_address);
+    bool allowed = true;
+    if (!from_peer) {
+        ScopedLatency timer(rate_limit_latency_);
+        allowed = rate_limiter_->allow_request(client_id);
+    }
+    if (!allowed) {
+        rate_limited_.add();
+        ack.status = AckStatus::RATE_LIMITED;
+        return ack;
+    }
+    
+    size_t count = batch->size();
+    std::string error;
+    switch (submit_batch(batch, client_id, error, !from_peer)) {
+        case IngestResult::OK:
+            ack.metrics = static_cast<uint32_t>(count);
+            break;
+        case IngestResult::INVALID:
+            // The frames decoded, so the stream is intact: reject just these
+            ack.status = AckStatus::REJECTED;
+            break;
+        case IngestResult::BACKPRESSURE:
+            ack.status = AckStatus::OVERLOADED;
+            break;
+        case IngestResult::WAL_UNAVAILABLE:
+        case IngestResult::PEER_UNAVAILABLE:
+            ack.status = AckStatus::UNAVAILABLE;
+            break;
+    }
+    return ack;
+}
+
+// Phase 35: Series are interned as SERIES frames decode, charged to the
+// client the stream's last HELLO named. Before any HELLO the stream's
+// address stands in for it. Peers' series were budgeted by the entry node.
+bool IngestionService::decode_binary_part(BinaryDecoder& decoder, std::string_view frames, MetricBatch& batch,
+                                          std::string_view remote_address, size_t& refused,
+                                          const char** error) {
+    if (frames.empty()) {
+        return true;
+    }
+    std::string_view client_id = decoder.client_id();
+    bool from_peer = !client_id.empty() && peers_ && peers_->trusted(client_id, remote_address);
+    CardinalityLimiter::ClientRef cardinality;
+    if (client_id.empty()) {
+        std::string anonymous = "binary:";
+        anonymous.append(remote_address);
+        cardinality = cardinality_->client(anonymous);
+    } else if (!from_peer) {
+        cardinality = cardinality_->client(client_id);
+    }
+    size_t first = batch.size();
+    ScopedSeriesBudget series_budget(cardinality ? cardinality_->budget(*cardinality)
+                                                 : std::numeric_limits<size_t>::max(),
+                                     cardinality_->options().action == CardinalityLimiter::Action::AGGREGATE);
+    bool decoded;
+    {
+        ScopedLatency timer(parse_latency_);
+        decoded = decoder.decode(frames, batch, error);
+    }
+    if (cardinality) {
+        cardinality_->record(*cardinality, series_budget, batch, first);
+    }
+    refused += series_budget.refused();
+
+    // Phase 31: Only a peer may spend a client's allowance on its behalf
+    std::vector<ClientUsage>& usage = decoder.usage();
+    if (!usage.empty()) {
+        if (!from_peer) {
+            if (error) *error = "USAGE frames are only accepted from cluster peers";
+            decoded = false;
+        } else {
+            for (const ClientUsage& entry : usage) {
+                rate_limiter_->apply_usage(entry.client_id, entry.requests);
+            }
+        }
+        usage.clear();
+    }
+    return decoded;
+}
+
 HttpResponse IngestionService::handle_health_check(const HttpRequest& request) {
     HttpResponse response;
-    response.set_json_content();
-    response.body = R"({"status":"healthy","service":"ingestion"})";
+    response.canned = &HEALTHY_RESPONSE;
     return response;
 }
 
@@ -327,198 +979,529 @@ HttpResponse IngestionService::handle_metrics_get(const HttpRequest& request) {
     response.set_json_content();
     
     // Return service statistics
-    response.body = "{"
-        "\"metrics_received\":" + std::to_string(metrics_received_) + ","
-        "\"batches_processed\":" + std::to_string(batches_processed_) + ","
-        "\"validation_errors\":" + std::to_string(validation_errors_) + ","
-        "\"rate_limited_requests\":" + std::to_string(rate_limited_) +
-        "}";
+    std::string& body = response.body;
+    body.append("{\"metrics_received\":");
+    append_uint(body, metrics_received_.value());
+    body.append(",\"batches_processed\":");
+    append_uint(body, batches_processed_.value());
+    body.append(",\"validation_errors\":");
+    append_uint(body, validation_errors_.value());
+    body.append(",\"rate_limited_requests\":");
+    append_uint(body, rate_limited_.value());
+    body.append(",\"storage_backpressure\":");
+    append_uint(body, storage_backpressure_.value());
+    body.append(",\"storage_lag\":");
+    append_uint(body, log_->lag(storage_cursor_));
+    if (wal_) {
+        body.append(",\"wal_records\":");
+        append_uint(body, wal_->records_written());
+        body.append(",\"wal_group_commits\":");
+        append_uint(body, wal_->group_commits());
+    }
+    body.push_back('}');
     
     return response;
 }
 
-MetricBatch IngestionService::parse_json_metrics_optimized(const std::string& json_body) {
-    MetricBatch batch;
+// Phase 26: Prometheus scrape target
+HttpResponse IngestionService::handle_stats_get(const HttpRequest& /*request*/) {
+    HttpResponse response;
+    response.content_type = PrometheusWriter::CONTENT_TYPE;
+    PrometheusWriter out(response.body);
     
-    enum class ParseState {
-        LOOKING_FOR_METRICS,
-        IN_METRICS_ARRAY,
-        IN_METRIC_OBJECT,
-        PARSING_FIELD_NAME,
-        PARSING_STRING_VALUE,
-        PARSING_NUMBER_VALUE,
-        IN_TAGS_OBJECT,
-        DONE
-    };
+    out.counter("metricstream_metrics_received_total", "Metrics accepted", metrics_received_.value());
+    out.counter("metricstream_batches_processed_total", "Batches accepted", batches_processed_.value());
+    out.counter("metricstream_validation_errors_total", "Batches rejected as malformed or invalid",
+                validation_errors_.value());
+    out.counter("metricstream_rate_limited_requests_total", "Requests refused by the rate limiter",
+                rate_limited_.value());
+    out.counter("metricstream_rate_limit_clients_evicted_total", "Idle clients the rate limiter forgot to make room",
+                rate_limiter_->evicted_clients());
+    out.counter("metricstream_storage_backpressure_total", "Batches refused because a log partition was full",
+                storage_backpressure_.value());
     
-    ParseState state = ParseState::LOOKING_FOR_METRICS;
-    size_t i = 0;
-    const size_t len = json_body.length();
-    
-    // Pre-allocated buffers to avoid string allocations
-    std::string current_field;
-    std::string current_value;
-    current_field.reserve(32);
-    current_value.reserve(128);
-    
-    // Current metric being parsed
-    std::string metric_name, metric_type = "gauge";
-    double metric_value = 0.0;
-    Tags metric_tags;
-    metric_name.reserve(64);
-    metric_type.reserve(16);
-    
-    auto skip_whitespace = [&]() {
-        while (i < len && std::isspace(json_body[i])) i++;
-    };
+    out.gauge("metricstream_http_connections", "Open HTTP connections",
+              static_cast<double>(server_->active_connections()));
+    out.gauge("metricstream_thread_pool_queue_depth", "HTTP requests waiting for a worker",
+              static_cast<double>(server_->queue_depth()));
+    const AdmissionController& admission = server_->admission();
+    out.gauge("metricstream_http_overload_level", "Consecutive overloaded admission intervals",
+              static_cast<double>(admission.overload_level()));
+    out.family("metricstream_http_shed_total", "counter", "Requests refused with 503 by admission control");
+    for (size_t i = 0; i < REQUEST_PRIORITY_COUNT; ++i) {
+        auto priority = static_cast<RequestPriority>(i);
+        std::string labels = "class=\"" + std::string(request_priority_name(priority)) + "\"";
+        out.sample("metricstream_http_shed_total", static_cast<double>(admission.shed(priority)), labels);
+    }
+    out.gauge("metricstream_storage_shards", "Storage writer shards", static_cast<double>(storage_.size()));
+    if (forwarder_) {
+        out.counter("metricstream_cluster_forwarded_total", "Metrics acked by the node owning their series",
+                    forwarder_->metrics_forwarded());
+        out.counter("metricstream_cluster_forward_errors_total", "Forwarded groups a peer refused or never acked",
+                    forwarder_->forward_errors());
+        out.counter("metricstream_cluster_peer_requests_total",
+                    "Requests peers admitted that this node charged to their clients' rate limits",
+                    rate_limiter_->peer_requests());
+    }
+    out.gauge("metricstream_write_queue_depth", "Logged batches the storage writer has not consumed",
+              static_cast<double>(log_->lag(storage_cursor_)));
+    if (alert_thread_.joinable()) {
+        out.gauge("metricstream_alert_queue_depth", "Logged batches the alert evaluator has not consumed",
+                  static_cast<double>(log_->lag(alert_cursor_)));
+    }
+    if (!rollup_threads_.empty()) {
+        out.gauge("metricstream_rollup_queue_depth", "Logged batches the rollup stage has not consumed",
+                  static_cast<double>(log_->lag(rollup_cursor_)));
+        out.counter("metricstream_rollups_written_total", "Rollup records written",
+                    rollup_writer_->rollups_written());
+    }
+    if (binary_server_) {
+        out.gauge("metricstream_binary_connections", "Open binary protocol connections",
+                  static_cast<double>(binary_server_->active_connections()));
+    }
+    out.gauge("metricstream_series", "Distinct series interned", static_cast<double>(SeriesRegistry::global().size()));
+    out.counter("metricstream_cardinality_refused_total", "New series refused by per-client cardinality limits",
+                cardinality_->series_refused());
+    out.counter("metricstream_cardinality_limited_total", "Client windows that reached a cardinality limit",
+                cardinality_->clients_limited());
+    out.counter("metricstream_cardinality_clients_evicted_total", "Idle clients the cardinality limiter forgot to make room",
+                cardinality_->evicted_clients());
+    // Labelled by client, so only the heaviest few
+    out.family("metricstream_client_series_estimate", "gauge",
+               "Estimated distinct series sent this window, for the top clients");
+    for (const auto& client : cardinality_->top_clients(TOP_CARDINALITY_CLIENTS)) {
+        std::string labels = "client=\"";
+        for (char c : client.client_id) {
+            if (c == '\\' || c == '"') labels.push_back('\\');
+            labels.push_back(c == '\n' ? ' ' : c);
+        }
+        labels.push_back('"');
+        out.sample("metricstream_client_series_estimate", client.series_estimate, labels);
+    }
+    if (wal_) {
+        out.counter("metricstream_wal_records_total", "Records appended to the WAL", wal_->records_written());
+        out.counter("metricstream_wal_group_commits_total", "WAL fsyncs", wal_->group_commits());
+    }
+    if (checkpoints_) {
+        out.counter("metricstream_checkpoints_total", "Checkpoints written", checkpoints_->checkpoints_written());
+        out.gauge("metricstream_checkpoint_bytes", "Bytes the last checkpoint wrote",
+                  static_cast<double>(checkpoints_->last_bytes()));
+        out.gauge("metricstream_checkpoint_seconds", "Time the last checkpoint took",
+                  static_cast<double>(checkpoint_duration_us_.load(std::memory_order_relaxed)) / 1e6);
+        out.gauge("metricstream_restore_seconds", "Startup time spent restoring the checkpoint and replaying the WAL",
+                  static_cast<double>(restore_duration_us_) / 1e6);
+    }
     
-    auto parse_string = [&](std::string& result) {
-        result.clear();
-        if (i >= len || json_body[i] != '"') return false;
-        i++; // skip opening quote
-        
-        while (i < len && json_body[i] != '"') {
-            if (json_body[i] == '\\' && i + 1 < len) {
-                i++; // skip escape char
-                if (json_body[i] == 'n') result += '\n';
-                else if (json_body[i] == 't') result += '\t';
-                else if (json_body[i] == 'r') result += '\r';
-                else result += json_body[i];
-            } else {
-                result += json_body[i];
+    out.family("metricstream_ingest_stage_seconds", "histogram", "Time spent per ingest stage");
+    out.histogram("metricstream_ingest_stage_seconds", rate_limit_latency_.snapshot(), "stage=\"rate_limit\"");
+    out.histogram("metricstream_ingest_stage_seconds", parse_latency_.snapshot(), "stage=\"parse\"");
+    out.histogram("metricstream_ingest_stage_seconds", validate_latency_.snapshot(), "stage=\"validate\"");
+    out.histogram("metricstream_ingest_stage_seconds", enqueue_latency_.snapshot(), "stage=\"enqueue\"");
+    out.histogram("metricstream_ingest_stage_seconds", wal_sync_latency_.snapshot(), "stage=\"wal_sync\"");
+    out.family("metricstream_request_seconds", "histogram", "POST /metrics and binary frame handling, end to end");
+    out.histogram("metricstream_request_seconds", request_latency_.snapshot());
+    
+    return response;
+}
+
+HttpResponse IngestionService::handle_alerts_get(const HttpRequest& /*request*/) {
+    HttpResponse response;
+    response.set_json_content();
+    
+    std::string& body = response.body;
+    body.append("{\"alerts\":[");
+    bool first = true;
+    for (const AlertStatus& status : alert_engine_->status()) {
+        if (!first) body.push_back(',');
+        body.append("{\"rule\":");
+        append_json_string(body, status.rule->name);
+        body.append(",\"firing\":");
+        body.append(status.firing ? "true" : "false");
+        body.append(",\"value\":");
+        append_json_number(body, status.value);
+        body.append(",\"samples\":");
+        append_uint(body, status.samples);
+        body.push_back('}');
+        first = false;
+    }
+    body.append("]}");
+    return response;
+}
+
+// Phase 33: GET /debug/traces[?slow=1][&limit=N], newest first. Without
+// slow, the last traces every thread finished; with it, the sampled
+// requests over the slow threshold.
+HttpResponse IngestionService::handle_traces_get(const HttpRequest& request) {
+    HttpResponse response;
+    response.set_json_content();
+    
+    bool slow_only = false;
+    int64_t limit = 100;
+    std::string error;
+    for_each_query_param(request.query, [&](std::string& key, std::string& value) {
+        if (key == "slow") {
+            slow_only = value == "1" || value == "true";
+        } else if (key == "limit") {
+            if (!parse_int64(value, limit) || limit <= 0) {
+                error = "Invalid limit";
+                return false;
             }
-            i++;
         }
-        
-        if (i < len && json_body[i] == '"') {
-            i++; // skip closing quote
-            return true;
+        return true;
+    });
+    if (!error.empty()) {
+        response.status_code = 400;
+        response.body = create_error_response(error);
+        return response;
+    }
+    
+    const Tracer& tracer = Tracer::global();
+    std::vector<RequestTrace> traces = slow_only ? tracer.slow(static_cast<size_t>(limit))
+                                                 : tracer.recent(static_cast<size_t>(limit));
+    std::string& body = response.body;
+    body.append("{\"enabled\":");
+    body.append(tracer.enabled() ? "true" : "false");
+    body.append(",\"slow_threshold_us\":");
+    append_uint(body, static_cast<uint64_t>(tracer.options().slow_threshold.count()));
+    body.append(",\"traced\":");
+    append_uint(body, tracer.traces_finished());
+    body.append(",\"slow\":");
+    append_uint(body, tracer.slow_requests());
+    body.append(",\"traces\":[");
+    for (size_t i = 0; i < traces.size(); ++i) {
+        if (i > 0) body.push_back(',');
+        append_trace_json(body, traces[i]);
+    }
+    body.append("]}");
+    return response;
+}
+
+// Phase 35: GET /debug/cardinality[?limit=N], clients with the most
+// distinct series this window first
+HttpResponse IngestionService::handle_cardinality_get(const HttpRequest& request) {
+    HttpResponse response;
+    response.set_json_content();
+    
+    int64_t limit = 100;
+    std::string error;
+    for_each_query_param(request.query, [&](std::string& key, std::string& value) {
+        if (key == "limit") {
+            if (!parse_int64(value, limit) || limit <= 0) {
+                error = "Invalid limit";
+                return false;
+            }
         }
-        return false;
-    };
+        return true;
+    });
+    if (!error.empty()) {
+        response.status_code = 400;
+        response.body = create_error_response(error);
+        return response;
+    }
     
-    auto parse_number = [&]() -> double {
-        size_t start = i;
-        if (i < len && json_body[i] == '-') i++;
-        while (i < len && (std::isdigit(json_body[i]) || json_body[i] == '.')) i++;
-        
-        if (start == i) return 0.0;
-        
-        // Use string_view equivalent to avoid allocation
-        const char* start_ptr = json_body.data() + start;
-        const char* end_ptr = json_body.data() + i;
-        return std::strtod(start_ptr, const_cast<char**>(&end_ptr));
-    };
+    const CardinalityLimiter::Options& options = cardinality_->options();
+    std::string& body = response.body;
+    body.append("{\"max_new_series\":");
+    append_uint(body, options.max_new_series);
+    body.append(",\"max_active_series\":");
+    append_uint(body, options.max_active_series);
+    body.append(",\"window_ms\":");
+    append_uint(body, static_cast<uint64_t>(options.window.count()));
+    body.append(",\"action\":");
+    body.append(options.action == CardinalityLimiter::Action::REJECT ? "\"reject\"" : "\"aggregate\"");
+    body.append(",\"tracked_clients\":");
+    append_uint(body, cardinality_->tracked_clients());
+    body.append(",\"refused\":");
+    append_uint(body, cardinality_->series_refused());
+    body.append(",\"clients\":[");
+    bool first = true;
+    for (const auto& client : cardinality_->top_clients(static_cast<size_t>(limit))) {
+        if (!first) body.push_back(',');
+        body.append("{\"client\":");
+        append_json_string(body, client.client_id);
+        body.append(",\"series_estimate\":");
+        append_uint(body, static_cast<uint64_t>(client.series_estimate + 0.5));
+        body.append(",\"previous_estimate\":");
+        append_uint(body, static_cast<uint64_t>(client.previous_estimate + 0.5));
+        body.append(",\"created\":");
+        append_uint(body, client.created);
+        body.append(",\"created_total\":");
+        append_uint(body, client.created_total);
+        body.append(",\"refused_total\":");
+        append_uint(body, client.refused_total);
+        body.push_back('}');
+        first = false;
+    }
+    body.append("]}");
+    return response;
+}
+
+// GET /query?name=cpu&host=web1&start=<ms>&end=<ms>[&agg=1[&step=<ms>]]
+// Parameters other than name/start/end/agg/step are tag filters. Without agg
+// the response lists each series' points as [timestamp_ms, value] pairs;
+// with it, count/sum/min/max/avg per series, plus with a step "steps" as
+// [bucket_start, count, sum, min, max, avg] for each non-empty bucket.
+HttpResponse IngestionService::handle_query(const HttpRequest& request) {
+    HttpResponse response;
+    response.set_json_content();
     
-    while (i < len && state != ParseState::DONE) {
-        skip_whitespace();
-        if (i >= len) break;
-        
-        char c = json_body[i];
-        
-        switch (state) {
-            case ParseState::LOOKING_FOR_METRICS:
-                if (c == '"') {
-                    if (parse_string(current_field) && current_field == "metrics") {
-                        skip_whitespace();
-                        if (i < len && json_body[i] == ':') {
-                            i++;
-                            skip_whitespace();
-                            if (i < len && json_body[i] == '[') {
-                                i++;
-                                state = ParseState::IN_METRICS_ARRAY;
-                            }
-                        }
-                    }
-                } else {
-                    i++;
-                }
-                break;
-                
-            case ParseState::IN_METRICS_ARRAY:
-                if (c == '{') {
-                    i++;
-                    state = ParseState::IN_METRIC_OBJECT;
-                    // Reset metric data
-                    metric_name.clear();
-                    metric_type = "gauge";
-                    metric_value = 0.0;
-                    metric_tags.clear();
-                } else if (c == ']') {
-                    state = ParseState::DONE;
-                } else {
-                    i++;
-                }
-                break;
-                
-            case ParseState::IN_METRIC_OBJECT:
-                if (c == '"') {
-                    if (parse_string(current_field)) {
-                        skip_whitespace();
-                        if (i < len && json_body[i] == ':') {
-                            i++;
-                            skip_whitespace();
-                            
-                            if (current_field == "name" || current_field == "type") {
-                                if (parse_string(current_value)) {
-                                    if (current_field == "name") {
-                                        metric_name = std::move(current_value);
-                                    } else {
-                                        metric_type = std::move(current_value);
-                                    }
-                                }
-                            } else if (current_field == "value") {
-                                metric_value = parse_number();
-                            } else if (current_field == "tags" && i < len && json_body[i] == '{') {
-                                i++;
-                                state = ParseState::IN_TAGS_OBJECT;
-                            }
-                        }
-                    }
-                } else if (c == '}') {
-                    // Finished parsing metric object
-                    if (!metric_name.empty()) {
-                        MetricType type = MetricType::GAUGE;
-                        if (metric_type == "counter") type = MetricType::COUNTER;
-                        else if (metric_type == "histogram") type = MetricType::HISTOGRAM;
-                        else if (metric_type == "summary") type = MetricType::SUMMARY;
-                        
-                        batch.add_metric(Metric(std::move(metric_name), metric_value, type, std::move(metric_tags)));
+    SeriesQuery query;
+    bool aggregate = false;
+    int64_t step_ms = 0;
+    std::string error;
+    for_each_query_param(request.query, [&](std::string& key, std::string& value) {
+        if (key == "name") {
+            query.name = std::move(value);
+        } else if (key == "start" || key == "end") {
+            int64_t& bound = key == "start" ? query.start_ms : query.end_ms;
+            if (!parse_int64(value, bound)) {
+                error = "Invalid " + key + " timestamp";
+                return false;
+            }
+        } else if (key == "agg") {
+            aggregate = value != "0";
+        } else if (key == "step") {
+            if (!parse_int64(value, step_ms) || step_ms <= 0) {
+                error = "Invalid step";
+                return false;
+            }
+        } else {
+            query.tags.emplace_back(std::move(key), std::move(value));
+        }
+        return true;
+    });
+    if (!error.empty()) {
+        response.status_code = 400;
+        response.body = create_error_response(error);
+        return response;
+    }
+    
+    // Pick up newly written blocks, at most once per interval across handlers
+    {
+        std::unique_lock<std::mutex> lock(query_refresh_mutex_, std::try_to_lock);
+        auto now = std::chrono::steady_clock::now();
+        if (lock.owns_lock() && now - last_query_refresh_ >= QUERY_REFRESH_INTERVAL) {
+            query_engine_->refresh();
+            last_query_refresh_ = now;
+        }
+    }
+    
+    std::string& body = response.body;
+    body.append("{\"series\":[");
+    if (aggregate) {
+        bool first = true;
+        for (const auto& series : query_executor_->aggregate(query, step_ms)) {
+            const QueryAggregate& agg = series.total;
+            if (!first) body.push_back(',');
+            body.append("{\"name\":");
+            append_json_string(body, series.info->name);
+            body.push_back(',');
+            append_tags_json(body, *series.info);
+            body.append(",\"count\":");
+            append_uint(body, agg.count);
+            body.append(",\"sum\":");
+            append_json_number(body, agg.sum);
+            body.append(",\"min\":");
+            append_json_number(body, agg.min);
+            body.append(",\"max\":");
+            append_json_number(body, agg.max);
+            body.append(",\"avg\":");
+            append_json_number(body, agg.avg());
+            if (step_ms > 0) {
+                body.append(",\"steps\":[");
+                for (size_t i = 0; i < series.steps.size(); ++i) {
+                    const auto& [start, step] = series.steps[i];
+                    if (i > 0) body.push_back(',');
+                    body.push_back('[');
+                    if (start < 0) body.push_back('-');
+                    append_uint(body, start < 0 ? 0 - static_cast<uint64_t>(start) : static_cast<uint64_t>(start));
+                    body.push_back(',');
+                    append_uint(body, step.count);
+                    for (double v : {step.sum, step.min, step.max, step.avg()}) {
+                        body.push_back(',');
+                        append_json_number(body, v);
                     }
-                    i++;
-                    state = ParseState::IN_METRICS_ARRAY;
-                } else {
-                    i++;
+                    body.push_back(']');
                 }
-                break;
-                
-            case ParseState::IN_TAGS_OBJECT:
-                if (c == '"') {
-                    if (parse_string(current_field)) {
-                        skip_whitespace();
-                        if (i < len && json_body[i] == ':') {
-                            i++;
-                            skip_whitespace();
-                            if (parse_string(current_value)) {
-                                metric_tags[std::move(current_field)] = std::move(current_value);
-                            }
-                        }
-                    }
-                } else if (c == '}') {
-                    i++;
-                    state = ParseState::IN_METRIC_OBJECT;
-                } else {
-                    i++;
+                body.push_back(']');
+            }
+            body.push_back('}');
+            first = false;
+        }
+        body.append("]}");
+        return response;
+    }
+    
+    QueryResult result = query_engine_->query(query);
+    body.reserve(body.size() + result.point_count() * 24);
+    bool first_series = true;
+    for (const auto& series : result.series()) {
+        if (!first_series) body.push_back(',');
+        body.append("{\"name\":");
+        append_json_string(body, series.info->name);
+        body.push_back(',');
+        append_tags_json(body, *series.info);
+        body.append(",\"points\":[");
+        bool first_point = true;
+        for (const DataPoint& point : series.points) {
+            if (!first_point) body.push_back(',');
+            body.push_back('[');
+            if (point.timestamp_ms < 0) body.push_back('-');
+            append_uint(body, point.timestamp_ms < 0 ? 0 - static_cast<uint64_t>(point.timestamp_ms)
+                                                     : static_cast<uint64_t>(point.timestamp_ms));
+            body.push_back(',');
+            append_json_number(body, point.value);
+            body.push_back(']');
+            first_point = false;
+        }
+        body.append("]}");
+        first_series = false;
+    }
+    body.append("],\"points\":");
+    append_uint(body, result.point_count());
+    body.push_back('}');
+    return response;
+}
+
+// Phase 27: GET /rollups?name=cpu&resolution=1m&start=..&end=..&host=web1
+// Points are [start, count, sum, min, max, last]; with fn=rate they are
+// [start, per-second increase] for counters. fn=quantiles (q=0.5,0.99,...)
+// merges the sketches of every bucket in the range instead, so a p99 over
+// a day reads 288 5 m sketches per series and no raw points.
+HttpResponse IngestionService::handle_rollups_get(const HttpRequest& request) {
+    HttpResponse response;
+    response.set_json_content();
+    
+    SeriesQuery query;
+    size_t resolution = rollup_resolution_index("1m");
+    enum class Fn { POINTS, RATE, QUANTILES } fn = Fn::POINTS;
+    std::vector<std::pair<std::string, double>> quantiles;   // As written, value
+    std::string error;
+    for_each_query_param(request.query, [&](std::string& key, std::string& value) {
+        if (key == "name") {
+            query.name = std::move(value);
+        } else if (key == "start" || key == "end") {
+            int64_t& bound = key == "start" ? query.start_ms : query.end_ms;
+            if (!parse_int64(value, bound)) {
+                error = "Invalid " + key + " timestamp";
+                return false;
+            }
+        } else if (key == "q") {
+            std::string_view list = value;
+            while (!list.empty()) {
+                size_t comma = list.find(',');
+                std::string text(list.substr(0, comma));
+                list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+                char* end = nullptr;
+                double q = std::strtod(text.c_str(), &end);
+                if (text.empty() || *end != '\0' || !(q >= 0 && q <= 1)) {
+                    error = "Invalid quantile " + text;
+                    return false;
                 }
-                break;
-                
-            default:
-                i++;
-                break;
+                quantiles.emplace_back(std::move(text), q);
+            }
+        } else if (key == "resolution") {
+            resolution = rollup_resolution_index(value);
+            if (resolution == ROLLUP_RESOLUTION_COUNT) {
+                error = "Unknown resolution (use 10s, 1m or 5m)";
+                return false;
+            }
+        } else if (key == "fn") {
+            if (value == "rate") {
+                fn = Fn::RATE;
+            } else if (value == "quantiles") {
+                fn = Fn::QUANTILES;
+            } else {
+                error = "Unknown fn (use rate or quantiles)";
+                return false;
+            }
+        } else {
+            query.tags.emplace_back(std::move(key), std::move(value));
         }
+        return true;
+    });
+    if (!error.empty()) {
+        response.status_code = 400;
+        response.body = create_error_response(error);
+        return response;
+    }
+    if (quantiles.empty()) {
+        quantiles = {{"0.5", 0.5}, {"0.99", 0.99}, {"0.999", 0.999}};
     }
     
-    return batch;
+    auto append_int = [](std::string& out, int64_t v) {
+        if (v < 0) out.push_back('-');
+        append_uint(out, v < 0 ? 0 - static_cast<uint64_t>(v) : static_cast<uint64_t>(v));
+    };
+    
+    std::string& body = response.body;
+    body.append("{\"resolution\":");
+    append_json_string(body, ROLLUP_RESOLUTIONS[resolution].name);
+    body.append(",\"series\":[");
+    bool first_series = true;
+    size_t total = 0;
+    for (const RollupSeries& series : query_rollups(rollup_dir_, resolution, query)) {
+        if (!first_series) body.push_back(',');
+        body.append("{\"name\":");
+        append_json_string(body, series.info.name);
+        body.push_back(',');
+        append_tags_json(body, series.info);
+        if (fn == Fn::QUANTILES) {
+            // HISTOGRAM and SUMMARY only; other types have no sketch
+            QuantileSketch merged;
+            for (const RollupPoint& point : series.points) {
+                merged.merge(point.sketch);
+            }
+            body.append(",\"count\":");
+            append_uint(body, merged.count());
+            body.append(",\"quantiles\":{");
+            for (size_t i = 0; i < quantiles.size(); ++i) {
+                if (i > 0) body.push_back(',');
+                append_json_string(body, quantiles[i].first);
+                body.push_back(':');
+                append_json_number(body, merged.quantile(quantiles[i].second));
+            }
+            body.append("}}");
+            first_series = false;
+            total += series.points.size();
+            continue;
+        }
+        body.append(",\"points\":[");
+        bool first_point = true;
+        if (fn == Fn::RATE) {
+            for (const DataPoint& point : counter_rates(series.points)) {
+                if (!first_point) body.push_back(',');
+                body.push_back('[');
+                append_int(body, point.timestamp_ms);
+                body.push_back(',');
+                append_json_number(body, point.value);
+                body.push_back(']');
+                first_point = false;
+                total++;
+            }
+        } else {
+            for (const RollupPoint& point : series.points) {
+                if (!first_point) body.push_back(',');
+                body.push_back('[');
+                append_int(body, point.start_ms);
+                body.push_back(',');
+                append_uint(body, point.count);
+                for (double v : {point.sum, point.min, point.max, point.last}) {
+                    body.push_back(',');
+                    append_json_number(body, v);
+                }
+                body.push_back(']');
+                first_point = false;
+                total++;
+            }
+        }
+        body.append("]}");
+        first_series = false;
+    }
+    body.append("],\"points\":");
+    append_uint(body, total);
+    body.push_back('}');
+    return response;
 }
 
 MetricBatch IngestionService::parse_json_metrics(const std::string& json_body) {
@@ -668,96 +1651,348 @@ Tags IngestionService::extract_tags(const std::string& json) {
     return tags;
 }
 
-void IngestionService::store_metrics_to_file(const MetricBatch& batch) {
-    if (!metrics_file_.is_open()) {
-        return;
+std::string IngestionService::create_error_response(const std::string& message) {
+    return "{\"error\":\"" + message + "\"}";
+}
+
+std::string IngestionService::create_success_response(size_t metrics_count) {
+    return "{\"success\":true,\"metrics_processed\":" + std::to_string(metrics_count) + "}";
+}
+
+bool IngestionService::queue_metrics_for_async_write(PooledBatch& batch) {
+    // Bounded: a stalled disk pushes back on clients instead of growing RSS.
+    // One client's batches stay in order within its partition.
+    return log_->append(log_->partition_for(batch->source_id), batch);
+}
+
+void IngestionService::replay_wal(const IngestionConfig& config) {
+    WriteAheadLog::Options options;
+    options.directory = config.wal_dir;
+    options.group_commit_delay = config.wal_group_commit_delay;
+    wal_ = std::make_unique<WriteAheadLog>(options);
+    if (checkpoints_ && !rollup_aggregators_.empty()) {
+        rollup_wal_consumer_ = wal_->add_consumer();
     }
     
-    std::lock_guard<std::mutex> lock(file_mutex_);
+    // Batches logged after the last checkpoint go to storage before any
+    // new request does
+    uint64_t replayed = 0;
+    // Replay goes to shard 0; the others start from an empty sink
+    StorageSink& sink = *storage_[0];
+    // Phase 34: Restored rollups also get what their checkpoint lacked,
+    // which may be older than storage's checkpoint
+    RollupAggregator* rollups = rollups_restored_ ? rollup_aggregators_[0].get() : nullptr;
+    uint64_t through = rollup_restored_through_;
+    const std::vector<uint64_t>& missing = rollup_restored_missing_;
+    uint64_t from = !rollups ? UINT64_MAX : missing.empty() ? through + 1 : std::min(missing.front(), through + 1);
+    WriteAheadLog& wal = *wal_;
+    bool ok = wal.open([&](const MetricBatch& batch) {
+        if (batch.wal_lsn > wal.checkpoint_lsn()) {
+            if (sink.is_open()) {
+                sink.append(batch);
+            }
+            if (++replayed % REPLAY_COMMIT_BATCHES == 0) {
+                sink.commit();
+            }
+        }
+        if (rollups && (batch.wal_lsn > through ||
+                        std::binary_search(missing.begin(), missing.end(), batch.wal_lsn))) {
+            rollups->add(batch);
+        }
+    }, from);
+    if (!ok) {
+        std::cerr << "Warning: Running without a write-ahead log" << std::endl;
+        wal_.reset();
+        rollup_wal_consumer_ = 0;
+        return;
+    }
+    if (rollups) {
+        wal_->retain_from(from);
+    }
+    for (size_t shard = 0; shard < storage_.size(); ++shard) {
+        shard_flushed_through_[shard].store(wal_->applied_through(), std::memory_order_relaxed);
+    }
+    checkpoint_wal(0);
+}
+
+// Phase 34: Rate-limit debts apply as they are; rollup buckets only next
+// to the WAL position they were saved at
+void IngestionService::restore_checkpoint(const IngestionConfig& config) {
+    CheckpointStore::Options options;
+    options.directory = config.checkpoint_dir;
+    checkpoints_ = std::make_unique<CheckpointStore>(options);
+    checkpoint_interval_ = config.checkpoint_interval;
+    if (!checkpoints_->load(SeriesRegistry::global())) {
+        return;
+    }
+    size_t clients = rate_limiter_->load(checkpoints_->section(CheckpointSection::RATE_LIMITS));
     
-    for (const auto& metric : batch.metrics) {
-        // Convert timestamp to ISO string
-        auto time_t = std::chrono::system_clock::to_time_t(metric.timestamp);
-        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-            metric.timestamp.time_since_epoch()) % 1000;
-        
-        char timestamp_str[32];
-        std::strftime(timestamp_str, sizeof(timestamp_str), "%Y-%m-%dT%H:%M:%S", std::gmtime(&time_t));
-        
-        // Convert metric type to string
-        std::string type_str;
-        switch (metric.type) {
-            case MetricType::COUNTER: type_str = "counter"; break;
-            case MetricType::GAUGE: type_str = "gauge"; break;
-            case MetricType::HISTOGRAM: type_str = "histogram"; break;
-            case MetricType::SUMMARY: type_str = "summary"; break;
+    size_t buckets = 0;
+    std::string_view position = checkpoints_->section(CheckpointSection::WAL);
+    if (!rollup_aggregators_.empty() && !position.empty()) {
+        ByteReader in(position);
+        rollup_restored_through_ = in.get_u64();
+        uint32_t count = in.get_u32();
+        for (uint32_t i = 0; i < count && in.ok(); ++i) {
+            rollup_restored_missing_.push_back(in.get_u64());
         }
-        
-        // Write as JSON Lines format
-        metrics_file_ << "{"
-                     << "\"timestamp\":\"" << timestamp_str << "." << std::setfill('0') << std::setw(3) << ms.count() << "Z\","
-                     << "\"name\":\"" << metric.name << "\","
-                     << "\"value\":" << metric.value << ","
-                     << "\"type\":\"" << type_str << "\"";
-        
-        // Add tags if present
-        if (!metric.tags.empty()) {
-            metrics_file_ << ",\"tags\":{";
-            bool first = true;
-            for (const auto& [key, value] : metric.tags) {
-                if (!first) metrics_file_ << ",";
-                metrics_file_ << "\"" << key << "\":\"" << value << "\"";
-                first = false;
+        bool ok = in.ok();
+        std::vector<std::string_view> images = checkpoints_->sections(CheckpointSection::ROLLUPS);
+        for (size_t i = 0; i < images.size() && ok; ++i) {
+            ok = rollup_aggregators_[i % rollup_aggregators_.size()]->load(images[i], checkpoints_->series_ids());
+        }
+        for (const auto& aggregator : rollup_aggregators_) {
+            buckets += aggregator->open_buckets();
+        }
+        rollups_restored_ = ok;
+        if (!ok) {
+            std::cerr << "Warning: Checkpointed rollup state is corrupt; rollups restart empty" << std::endl;
+        }
+    }
+    std::cerr << "[CHECKPOINT] Restored " << checkpoints_->series_ids().size() - 1 << " series, "
+              << clients << " rate-limited clients and " << buckets << " open rollup buckets from checkpoint "
+              << checkpoints_->sequence() << std::endl;
+    checkpoints_->release();
+}
+
+// Phase 34: The rollup workers park while their aggregators are saved, so
+// the WAL position read meanwhile matches what the buckets hold exactly.
+// The final checkpoint runs after they have exited.
+bool IngestionService::write_checkpoint(bool final) {
+    auto started = std::chrono::steady_clock::now();
+    CheckpointStore::Sections sections;
+    uint64_t last_lsn = 0;
+    std::vector<uint64_t> missing;
+    if (!rollup_aggregators_.empty()) {
+        std::vector<std::string> images(rollup_aggregators_.size());
+        auto read_position = [&] {
+            if (rollup_wal_consumer_ != 0) {
+                wal_->consumer_snapshot(rollup_wal_consumer_, last_lsn, missing);
+            }
+        };
+        if (final) {
+            for (size_t i = 0; i < images.size(); ++i) {
+                rollup_aggregators_[i]->save(images[i]);
             }
-            metrics_file_ << "}";
+            read_position();
+        } else {
+            std::unique_lock<std::mutex> lock(checkpoint_mutex_);
+            rollup_images_.assign(images.size(), std::string());
+            rollups_paused_ = 0;
+            rollup_pause_.store(true, std::memory_order_release);
+            checkpoint_cv_.wait(lock, [&] { return rollups_paused_ == images.size(); });
+            read_position();
+            images.swap(rollup_images_);
+            rollup_pause_.store(false, std::memory_order_release);
+            lock.unlock();
+            checkpoint_cv_.notify_all();
+        }
+        std::string position;
+        ByteWriter out(position);
+        out.put_u64(last_lsn);
+        out.put_u32(static_cast<uint32_t>(missing.size()));
+        for (uint64_t lsn : missing) {
+            out.put_u64(lsn);
+        }
+        sections.emplace_back(CheckpointSection::WAL, std::move(position));
+        for (std::string& image : images) {
+            sections.emplace_back(CheckpointSection::ROLLUPS, std::move(image));
         }
-        
-        metrics_file_ << "}\n";
     }
+    std::string limits;
+    rate_limiter_->save(limits);
+    sections.emplace_back(CheckpointSection::RATE_LIMITS, std::move(limits));
     
-    metrics_file_.flush(); // Ensure data is written immediately
+    if (!checkpoints_->write(SeriesRegistry::global(), sections)) {
+        return false;
+    }
+    // Replay after a crash starts here for rollups, however far storage got
+    if (rollup_wal_consumer_ != 0) {
+        wal_->retain_from(missing.empty() ? last_lsn + 1 : missing.front());
+    }
+    checkpoint_duration_us_.store(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - started).count()), std::memory_order_relaxed);
+    return true;
 }
 
-std::string IngestionService::create_error_response(const std::string& message) {
-    return "{\"error\":\"" + message + "\"}";
+void IngestionService::checkpoint_loop() {
+    std::unique_lock<std::mutex> lock(checkpoint_mutex_);
+    while (!checkpoint_cv_.wait_for(lock, checkpoint_interval_, [this] { return checkpoint_stopping_; })) {
+        lock.unlock();
+        write_checkpoint(/*final=*/false);
+        lock.lock();
+    }
 }
 
-std::string IngestionService::create_success_response(size_t metrics_count) {
-    return "{\"success\":true,\"metrics_processed\":" + std::to_string(metrics_count) + "}";
+// Phase 31: Gossip what this node admitted since the last round
+void IngestionService::usage_loop() {
+    std::vector<ClientUsage> usage;
+    std::unique_lock<std::mutex> lock(usage_mutex_);
+    while (!usage_cv_.wait_for(lock, usage_interval_, [this] { return usage_stopping_; })) {
+        lock.unlock();
+        usage.clear();
+        rate_limiter_->take_usage(usage);
+        forwarder_->share_usage(usage);
+        lock.lock();
+    }
 }
 
-void IngestionService::queue_metrics_for_async_write(const MetricBatch& batch) {
-    {
-        std::lock_guard<std::mutex> lock(queue_mutex_);
-        write_queue_.push(batch);
+void IngestionService::pause_for_checkpoint(size_t worker) {
+    std::string image;
+    rollup_aggregators_[worker]->save(image);
+    std::unique_lock<std::mutex> lock(checkpoint_mutex_);
+    rollup_images_[worker] = std::move(image);
+    rollups_paused_++;
+    checkpoint_cv_.notify_all();
+    checkpoint_cv_.wait(lock, [this] { return !rollup_pause_.load(std::memory_order_acquire); });
+}
+
+void IngestionService::checkpoint_wal(size_t shard, bool drained) {
+    // Read the watermark before flushing: everything at or below it is
+    // already in some shard's sink, and flush() makes this shard's part
+    // durable. Other shards' parts are durable once they flush past it too,
+    // so the log only moves to the lowest watermark any shard flushed.
+    uint64_t through = wal_->applied_through();
+    if (!storage_[shard]->flush()) {
+        return;
+    }
+    // A drained shard gets nothing more and stops holding the log back.
+    // Sequentially consistent, so of two shards draining at once the later
+    // one sees both.
+    constexpr uint64_t DONE = std::numeric_limits<uint64_t>::max();
+    shard_flushed_through_[shard].store(drained ? DONE : through);
+    uint64_t safe = DONE;
+    for (size_t i = 0; i < storage_.size(); ++i) {
+        safe = std::min(safe, shard_flushed_through_[i].load());
     }
-    queue_cv_.notify_one(); // Wake up writer thread
+    if (safe == DONE) {
+        safe = wal_->applied_through();   // Every shard drained and flushed
+    }
+    wal_->checkpoint(safe);
 }
 
-void IngestionService::async_writer_loop() {
-    while (writer_running_) {
-        std::unique_lock<std::mutex> lock(queue_mutex_);
+void IngestionService::async_writer_loop(size_t shard) {
+    if (pin_threads_) {
+        pin_current_thread(shard);
+    }
+    StorageSink& sink = *storage_[shard];
+    size_t stride = storage_.size();
+    std::vector<uint64_t> applied;
+    auto last_checkpoint = std::chrono::steady_clock::now();
+    while (true) {
+        // Phase 16: Group commit. Format every readable batch into the
+        // sink's buffer (each goes back to the pool once every cursor has
+        // read it), then hand the whole group to the kernel with one write().
+        // Phase 30: Only this shard's partitions, into this shard's sink.
+        size_t polled = 0;
+        for (size_t p = shard; p < log_->partition_count(); p += stride) {
+            polled += log_->poll(storage_cursor_, p, MAX_POLL_PER_PARTITION,
+                [&sink, &applied](const MetricBatch& batch, uint64_t) {
+                    if (sink.is_open()) {
+                        sink.append(batch);
+                    }
+                    if (batch.wal_lsn != 0) {
+                        applied.push_back(batch.wal_lsn);
+                    }
+                });
+        }
+        sink.commit();
+        sink.sync_if_due();
         
-        // Wait for batches to write or shutdown signal
-        queue_cv_.wait(lock, [this] { 
-            return !write_queue_.empty() || !writer_running_; 
-        });
+        if (wal_) {
+            wal_->mark_applied(applied.data(), applied.size());
+            applied.clear();
+            auto now = std::chrono::steady_clock::now();
+            if (now - last_checkpoint >= WAL_CHECKPOINT_INTERVAL) {
+                checkpoint_wal(shard);
+                last_checkpoint = now;
+            }
+        }
+        if (polled > 0) {
+            continue;
+        }
         
-        // Process all pending batches
-        while (!write_queue_.empty() && writer_running_) {
-            MetricBatch batch = write_queue_.front();
-            write_queue_.pop();
-            
-            // Release lock before expensive I/O operation
-            lock.unlock();
-            
-            // Write batch to file (this is now done asynchronously)
-            store_metrics_to_file(batch);
-            
-            // Reacquire lock for next iteration
-            lock.lock();
+        if (log_->closed() && !log_->readable(storage_cursor_, shard, stride)) {
+            // Drained: a clean shutdown leaves nothing to replay once the
+            // last shard to finish has checkpointed
+            if (wal_) {
+                checkpoint_wal(shard, /*drained=*/true);
+            }
+            return;
+        }
+        
+        // Wait for batches or shutdown; with unsynced data under an
+        // interval policy, also wake for the fsync
+        log_->wait(storage_cursor_, sink.wants_timed_sync()
+            ? std::min(sink.sync_if_due(), CONSUMER_IDLE_WAIT) : CONSUMER_IDLE_WAIT, shard, stride);
+    }
+}
+
+void IngestionService::alert_consumer_loop() {
+    while (true) {
+        size_t polled = log_->poll_all(alert_cursor_, MAX_POLL_PER_PARTITION,
+            [this](const MetricBatch& batch, uint64_t) { alert_engine_->observe(batch); });
+        if (polled > 0) {
+            continue;
+        }
+        if (log_->closed() && !log_->readable(alert_cursor_)) {
+            return;
+        }
+        log_->wait(alert_cursor_, CONSUMER_IDLE_WAIT);
+    }
+}
+
+// Phase 27: Off the request path like alerting; sees only accepted
+// batches. Worker k of n reads partitions k, k + n, ... of the one rollup
+// cursor, so no two workers touch the same aggregator.
+void IngestionService::rollup_consumer_loop(size_t worker) {
+    RollupAggregator& aggregator = *rollup_aggregators_[worker];
+    size_t stride = rollup_aggregators_.size();
+    auto emit = [this](size_t resolution, uint32_t series_id, MetricType type, const RollupPoint& point) {
+        rollup_writer_->append(resolution, series_id, type, point);
+    };
+    std::vector<uint64_t> applied;
+    bool track = rollup_wal_consumer_ != 0;
+    while (true) {
+        size_t polled = 0;
+        for (size_t p = worker; p < log_->partition_count(); p += stride) {
+            polled += log_->poll(rollup_cursor_, p, MAX_POLL_PER_PARTITION,
+                [&aggregator, &applied, track](const MetricBatch& batch, uint64_t) {
+                    aggregator.add(batch);
+                    if (track && batch.wal_lsn != 0) {
+                        applied.push_back(batch.wal_lsn);
+                    }
+                });
+        }
+        if (!applied.empty()) {
+            wal_->mark_applied(rollup_wal_consumer_, applied.data(), applied.size());
+            applied.clear();
+        }
+        
+        int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        if (aggregator.close(now_ms, emit) > 0) {
+            rollup_writer_->commit();
+        }
+        if (rollup_pause_.load(std::memory_order_acquire)) {
+            pause_for_checkpoint(worker);
+        }
+        if (polled > 0) {
+            continue;
+        }
+        
+        if (log_->closed() && !log_->readable(rollup_cursor_, worker, stride)) {
+            // Open buckets go out partial, unless the final checkpoint
+            // keeps them; readers merge them with whatever the next run
+            // writes for the same buckets
+            if (!checkpoints_) {
+                aggregator.close_all(emit);
+            }
+            rollup_writer_->flush();
+            return;
         }
+        log_->wait(rollup_cursor_, ROLLUP_CLOSE_INTERVAL, worker, stride);
     }
 }
 
-} // namespace metricstream
\ No newline at end of file
+} // namespace metricstream
@@ -0,0 +1,862 @@
+#include "json_batch_parser.h"
+#include "profiling.h"
+#include "series_registry.h"
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <system_error>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define METRICSTREAM_JSON_X86 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define METRICSTREAM_JSON_NEON 1
+#endif
+
+// Floating-point from_chars is missing from some standard libraries
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+#define METRICSTREAM_HAS_FP_FROM_CHARS 1
+#endif
+
+namespace metricstream {
+
+namespace {
+
+// ============================================================================
+// Stage 1: structural index
+// ============================================================================
+
+// One bit per byte of a 64-byte block
+struct BlockMasks {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t structural;   // {}[]:, before removing those inside strings
+};
+
+// Structurals are matched after OR-ing in 0x20, which folds [ ] onto { }
+// so every kernel needs four compares. It also folds two control bytes
+// (0x0C, 0x1A) onto , and : -- both are invalid outside strings, and stage
+// 2 checks the real byte, so they still fail to parse.
+inline bool is_structural(uint8_t c) {
+    c |= 0x20;
+    return c == '{' || c == '}' || c == ':' || c == ',';
+}
+
+BlockMasks scan_block_scalar(const uint8_t* p) {
+    BlockMasks m{0, 0, 0};
+    for (size_t i = 0; i < 64; ++i) {
+        uint64_t bit = uint64_t(1) << i;
+        if (p[i] == '"') m.quote |= bit;
+        else if (p[i] == '\\') m.backslash |= bit;
+        else if (is_structural(p[i])) m.structural |= bit;
+    }
+    return m;
+}
+
+#if METRICSTREAM_JSON_X86
+inline BlockMasks scan_block_sse2(const uint8_t* p) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i fold = _mm_set1_epi8(0x20);
+    const __m128i open = _mm_set1_epi8('{');
+    const __m128i close = _mm_set1_epi8('}');
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i comma = _mm_set1_epi8(',');
+
+    BlockMasks m{0, 0, 0};
+    for (size_t i = 0; i < 4; ++i) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i * 16));
+        __m128i f = _mm_or_si128(v, fold);
+        __m128i s = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(f, open), _mm_cmpeq_epi8(f, close)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(f, colon), _mm_cmpeq_epi8(f, comma)));
+        unsigned shift = static_cast<unsigned>(i * 16);
+        m.quote |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)))) << shift;
+        m.backslash |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash)))) << shift;
+        m.structural |= uint64_t(uint16_t(_mm_movemask_epi8(s))) << shift;
+    }
+    return m;
+}
+
+__attribute__((target("avx2")))
+inline BlockMasks scan_block_avx2(const uint8_t* p) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i fold = _mm256_set1_epi8(0x20);
+    const __m256i open = _mm256_set1_epi8('{');
+    const __m256i close = _mm256_set1_epi8('}');
+    const __m256i colon = _mm256_set1_epi8(':');
+    const __m256i comma = _mm256_set1_epi8(',');
+
+    BlockMasks m{0, 0, 0};
+    for (size_t i = 0; i < 2; ++i) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i * 32));
+        __m256i f = _mm256_or_si256(v, fold);
+        __m256i s = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(f, open), _mm256_cmpeq_epi8(f, close)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(f, colon), _mm256_cmpeq_epi8(f, comma)));
+        unsigned shift = static_cast<unsigned>(i * 32);
+        m.quote |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote)))) << shift;
+        m.backslash |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, backslash)))) << shift;
+        m.structural |= uint64_t(uint32_t(_mm256_movemask_epi8(s))) << shift;
+    }
+    return m;
+}
+#endif
+
+#if METRICSTREAM_JSON_NEON
+// NEON has no movemask: keep one distinct bit per lane, then fold four
+// vectors into 64 bits with three rounds of pairwise adds
+inline uint64_t neon_movemask(uint8x16_t a, uint8x16_t b, uint8x16_t c, uint8x16_t d) {
+    static const uint8_t LANE_BITS[16] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
+                                          0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80};
+    const uint8x16_t bits = vld1q_u8(LANE_BITS);
+    uint8x16_t ab = vpaddq_u8(vandq_u8(a, bits), vandq_u8(b, bits));
+    uint8x16_t cd = vpaddq_u8(vandq_u8(c, bits), vandq_u8(d, bits));
+    uint8x16_t abcd = vpaddq_u8(ab, cd);
+    abcd = vpaddq_u8(abcd, abcd);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(abcd), 0);
+}
+
+inline BlockMasks scan_block_neon(const uint8_t* p) {
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t fold = vdupq_n_u8(0x20);
+    const uint8x16_t open = vdupq_n_u8('{');
+    const uint8x16_t close = vdupq_n_u8('}');
+    const uint8x16_t colon = vdupq_n_u8(':');
+    const uint8x16_t comma = vdupq_n_u8(',');
+
+    uint8x16_t q[4], b[4], s[4];
+    for (size_t i = 0; i < 4; ++i) {
+        uint8x16_t v = vld1q_u8(p + i * 16);
+        uint8x16_t f = vorrq_u8(v, fold);
+        q[i] = vceqq_u8(v, quote);
+        b[i] = vceqq_u8(v, backslash);
+        s[i] = vorrq_u8(vorrq_u8(vceqq_u8(f, open), vceqq_u8(f, close)),
+                        vorrq_u8(vceqq_u8(f, colon), vceqq_u8(f, comma)));
+    }
+    return BlockMasks{neon_movemask(q[0], q[1], q[2], q[3]),
+                      neon_movemask(b[0], b[1], b[2], b[3]),
+                      neon_movemask(s[0], s[1], s[2], s[3])};
+}
+#endif
+
+// Bit i set iff an odd number of bits at or below i are set: turns quote
+// bits into an "inside a string" mask (opening quote inclusive)
+inline uint64_t prefix_xor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+// Block-to-block state shared by every kernel
+class StructuralIndexer {
+public:
+    explicit StructuralIndexer(uint32_t* out) : out_(out) {}
+
+    void add_block(const BlockMasks& m, size_t base) {
+        uint64_t quotes = m.quote & ~escaped(m.backslash);
+        uint64_t in_string = prefix_xor(quotes) ^ prev_in_string_;
+        prev_in_string_ = static_cast<uint64_t>(static_cast<int64_t>(in_string) >> 63);
+
+        uint64_t bits = (m.structural & ~in_string) | quotes;
+        uint32_t offset = static_cast<uint32_t>(base);
+        while (bits != 0) {
+            out_[count_++] = offset + static_cast<uint32_t>(__builtin_ctzll(bits));
+            bits &= bits - 1;
+        }
+    }
+
+    size_t count() const { return count_; }
+
+private:
+    uint32_t* out_;
+    size_t count_ = 0;
+    uint64_t prev_in_string_ = 0;   // All ones if the last block ended inside a string
+    uint64_t prev_odd_run_ = 0;     // 1 if the last block ended in an odd backslash run
+
+    // Bits just past odd-length backslash runs, i.e. escaped characters
+    // (Langdale & Lemire, "Parsing Gigabytes of JSON per Second")
+    uint64_t escaped(uint64_t backslash) {
+        if (backslash == 0 && prev_odd_run_ == 0) {
+            return 0;
+        }
+        const uint64_t even_bits = 0x5555555555555555ULL;
+        const uint64_t odd_bits = ~even_bits;
+
+        uint64_t start_edges = backslash & ~(backslash << 1);
+        uint64_t even_start_mask = even_bits ^ prev_odd_run_;
+        uint64_t even_starts = start_edges & even_start_mask;
+        uint64_t odd_starts = start_edges & ~even_start_mask;
+        uint64_t even_carries = backslash + even_starts;
+        uint64_t odd_carries = backslash + odd_starts;
+        bool odd_overflow = odd_carries < backslash;
+        odd_carries |= prev_odd_run_;
+        prev_odd_run_ = odd_overflow ? 1 : 0;
+
+        uint64_t even_carry_ends = even_carries & ~backslash;
+        uint64_t odd_carry_ends = odd_carries & ~backslash;
+        return (even_carry_ends & odd_bits) | (odd_carry_ends & even_bits);
+    }
+};
+
+// The last partial block is scanned from a copy padded with spaces
+inline const uint8_t* pad_tail(const uint8_t* p, size_t n, uint8_t* block) {
+    std::memset(block, ' ', 64);
+    std::memcpy(block, p, n);
+    return block;
+}
+
+size_t index_scalar(std::string_view json, uint32_t* out) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(json.data());
+    size_t n = json.size();
+    StructuralIndexer indexer(out);
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        indexer.add_block(scan_block_scalar(p + i), i);
+    }
+    if (i < n) {
+        uint8_t block[64];
+        indexer.add_block(scan_block_scalar(pad_tail(p + i, n - i, block)), i);
+    }
+    return indexer.count();
+}
+
+#if METRICSTREAM_JSON_X86
+size_t index_sse2(std::string_view json, uint32_t* out) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(json.data());
+    size_t n = json.size();
+    StructuralIndexer indexer(out);
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        indexer.add_block(scan_block_sse2(p + i), i);
+    }
+    if (i < n) {
+        uint8_t block[64];
+        indexer.add_block(scan_block_sse2(pad_tail(p + i, n - i, block)), i);
+    }
+    return indexer.count();
+}
+
+__attribute__((target("avx2")))
+size_t index_avx2(std::string_view json, uint32_t* out) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(json.data());
+    size_t n = json.size();
+    StructuralIndexer indexer(out);
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        indexer.add_block(scan_block_avx2(p + i), i);
+    }
+    if (i < n) {
+        uint8_t block[64];
+        indexer.add_block(scan_block_avx2(pad_tail(p + i, n - i, block)), i);
+    }
+    return indexer.count();
+}
+#endif
+
+#if METRICSTREAM_JSON_NEON
+size_t index_neon(std::string_view json, uint32_t* out) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(json.data());
+    size_t n = json.size();
+    StructuralIndexer indexer(out);
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        indexer.add_block(scan_block_neon(p + i), i);
+    }
+    if (i < n) {
+        uint8_t block[64];
+        indexer.add_block(scan_block_neon(pad_tail(p + i, n - i, block)), i);
+    }
+    return indexer.count();
+}
+#endif
+
+JsonKernel detect_json_kernel() {
+#if METRICSTREAM_JSON_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return JsonKernel::AVX2;
+    }
+    return JsonKernel::SSE2;
+#elif METRICSTREAM_JSON_NEON
+    return JsonKernel::NEON;
+#else
+    return JsonKernel::SCALAR;
+#endif
+}
+
+// ============================================================================
+// Numbers
+// ============================================================================
+
+// Every power of ten up to 1e22 is exact in a double
+constexpr double EXACT_POWERS_OF_TEN[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+constexpr int64_t MAX_EXACT_POWER = 22;
+constexpr uint64_t MAX_EXACT_MANTISSA = uint64_t(1) << 53;
+constexpr int MAX_MANTISSA_DIGITS = 19;
+
+inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+// Correctly rounded conversion for anything the fast path cannot do exactly
+bool parse_number_slow(std::string_view text, int64_t exponent, double& value) {
+#if METRICSTREAM_HAS_FP_FROM_CHARS
+    auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (result.ec == std::errc::result_out_of_range) {
+        // Overflow to infinity (which validation rejects) or underflow to zero
+        double magnitude = exponent > 0 ? HUGE_VAL : 0.0;
+        value = text[0] == '-' ? -magnitude : magnitude;
+        return true;
+    }
+    return result.ec == std::errc() && result.ptr == text.data() + text.size();
+#else
+    (void)exponent;
+    // The text is a view into the request and is not NUL-terminated
+    char stack[64];
+    std::string heap;
+    const char* copy;
+    if (text.size() < sizeof(stack)) {
+        std::memcpy(stack, text.data(), text.size());
+        stack[text.size()] = '\0';
+        copy = stack;
+    } else {
+        heap.assign(text);
+        copy = heap.c_str();
+    }
+    value = std::strtod(copy, nullptr);
+    return true;
+#endif
+}
+
+// ============================================================================
+// Stage 2: walk the index
+// ============================================================================
+
+constexpr size_t MAX_NESTING = 64;
+
+inline bool is_json_space(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+inline int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+inline bool parse_hex4(const char* p, uint32_t& code) {
+    code = 0;
+    for (size_t i = 0; i < 4; ++i) {
+        int digit = hex_value(p[i]);
+        if (digit < 0) return false;
+        code = (code << 4) | static_cast<uint32_t>(digit);
+    }
+    return true;
+}
+
+inline size_t encode_utf8(uint32_t code, char* out) {
+    if (code < 0x80) {
+        out[0] = static_cast<char>(code);
+        return 1;
+    }
+    if (code < 0x800) {
+        out[0] = static_cast<char>(0xC0 | (code >> 6));
+        out[1] = static_cast<char>(0x80 | (code & 0x3F));
+        return 2;
+    }
+    if (code < 0x10000) {
+        out[0] = static_cast<char>(0xE0 | (code >> 12));
+        out[1] = static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        out[2] = static_cast<char>(0x80 | (code & 0x3F));
+        return 3;
+    }
+    out[0] = static_cast<char>(0xF0 | (code >> 18));
+    out[1] = static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+    out[2] = static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+    out[3] = static_cast<char>(0x80 | (code & 0x3F));
+    return 4;
+}
+
+MetricType metric_type_from(std::string_view type) {
+    switch (type.size()) {
+        case 7:
+            if (type == "counter") return MetricType::COUNTER;
+            if (type == "summary") return MetricType::SUMMARY;
+            break;
+        case 9:
+            if (type == "histogram") return MetricType::HISTOGRAM;
+            break;
+        default:
+            break;
+    }
+    return MetricType::GAUGE;   // Includes "gauge" and unknown types
+}
+
+class IndexWalker {
+public:
+    IndexWalker(std::string_view body, const uint32_t* index, size_t count, Arena& arena)
+        : body_(body), index_(index), count_(count), arena_(arena),
+          tags_(ArenaAllocator<TagRef>(arena)) {
+        tags_.reserve(16);
+    }
+
+    bool parse_document(MetricBatch& batch) {
+        if (!expect('{')) return false;
+        if (peek() == '}') {
+            if (!next()) return false;
+        } else {
+            while (true) {
+                std::string_view key;
+                if (!parse_key(key)) return false;
+                bool ok = key == "metrics" ? parse_metrics(batch) : skip_value(1);
+                if (!ok) return false;
+                if (!end_member('}')) return false;
+                if (peek() == '}') {
+                    next();   // end_member() checked the gap
+                    break;
+                }
+            }
+        }
+        if (k_ != count_ || !spaces_only(cursor_, body_.size())) {
+            return fail("Unexpected data after JSON document");
+        }
+        return true;
+    }
+
+    const char* error() const { return error_; }
+
+private:
+    std::string_view body_;
+    const uint32_t* index_;
+    size_t count_;
+    size_t k_ = 0;          // Next index entry
+    size_t cursor_ = 0;     // First body byte after the last consumed token
+    Arena& arena_;
+    ArenaVector<TagRef> tags_;
+    const char* error_ = nullptr;
+
+    bool fail(const char* message) {
+        error_ = message;
+        return false;
+    }
+
+    char peek() const { return k_ < count_ ? body_[index_[k_]] : '\0'; }
+
+    // Consumes the next token, which must follow only whitespace
+    bool next() {
+        if (k_ >= count_) return fail("Unexpected end of JSON");
+        if (!spaces_only(cursor_, index_[k_])) return fail("Unexpected character in JSON");
+        cursor_ = index_[k_] + 1;
+        k_++;
+        return true;
+    }
+
+    bool expect(char c) {
+        if (peek() != c) {
+            return fail(k_ < count_ ? "Unexpected character in JSON" : "Unexpected end of JSON");
+        }
+        return next();
+    }
+
+    bool spaces_only(size_t from, size_t to) const {
+        for (size_t i = from; i < to; ++i) {
+            if (!is_json_space(body_[i])) return false;
+        }
+        return true;
+    }
+
+    // True if the next value opens with a token ({, [ or ") rather than
+    // being a bare scalar that runs up to the next token
+    bool value_is_token() const {
+        size_t i = cursor_;
+        while (i < body_.size() && is_json_space(body_[i])) i++;
+        return k_ < count_ && index_[k_] == i;
+    }
+
+    bool scalar(std::string_view& text) {
+        size_t start = cursor_;
+        size_t end = k_ < count_ ? index_[k_] : body_.size();
+        while (start < end && is_json_space(body_[start])) start++;
+        while (end > start && is_json_space(body_[end - 1])) end--;
+        if (start == end) return fail("Missing JSON value");
+        text = body_.substr(start, end - start);
+        cursor_ = end;
+        return true;
+    }
+
+    bool raw_string(std::string_view& raw) {
+        if (peek() != '"') return fail("Expected JSON string");
+        size_t open = index_[k_];
+        if (!next()) return false;
+        if (peek() != '"') return fail("Unterminated JSON string");
+        size_t close = index_[k_];
+        cursor_ = close + 1;
+        k_++;
+        raw = body_.substr(open + 1, close - open - 1);
+        return true;
+    }
+
+    // Strings without escapes are slices of the body; the rest are decoded
+    // into the arena, which is never longer than the raw text
+    bool parse_string(std::string_view& result) {
+        std::string_view raw;
+        if (!raw_string(raw)) return false;
+        const char* slash = static_cast<const char*>(std::memchr(raw.data(), '\\', raw.size()));
+        if (slash == nullptr) {
+            result = raw;
+            return true;
+        }
+
+        char* out = arena_.allocate_chars(raw.size());
+        size_t n = static_cast<size_t>(slash - raw.data());
+        std::memcpy(out, raw.data(), n);
+        for (size_t i = n; i < raw.size(); ++i) {
+            char c = raw[i];
+            if (c != '\\') {
+                out[n++] = c;
+                continue;
+            }
+            if (++i >= raw.size()) return fail("Invalid string escape");
+            switch (raw[i]) {
+                case '"': out[n++] = '"'; break;
+                case '\\': out[n++] = '\\'; break;
+                case '/': out[n++] = '/'; break;
+                case 'b': out[n++] = '\b'; break;
+                case 'f': out[n++] = '\f'; break;
+                case 'n': out[n++] = '\n'; break;
+                case 'r': out[n++] = '\r'; break;
+                case 't': out[n++] = '\t'; break;
+                case 'u': {
+                    uint32_t code;
+                    if (i + 4 >= raw.size() || !parse_hex4(raw.data() + i + 1, code)) return fail("Invalid string escape");
+                    i += 4;
+                    if (code >= 0xD800 && code <= 0xDBFF) {
+                        // A high surrogate pairs with a following \uDC00-\uDFFF
+                        uint32_t low;
+                        if (i + 6 < raw.size() && raw[i + 1] == '\\' && raw[i + 2] == 'u' &&
+                            parse_hex4(raw.data() + i + 3, low) && low >= 0xDC00 && low <= 0xDFFF) {
+                            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                            i += 6;
+                        } else {
+                            code = 0xFFFD;
+                        }
+                    } else if (code >= 0xDC00 && code <= 0xDFFF) {
+                        code = 0xFFFD;   // Lone low surrogate
+                    }
+                    n += encode_utf8(code, out + n);
+                    break;
+                }
+                default:
+                    return fail("Invalid string escape");
+            }
+        }
+        result = std::string_view(out, n);
+        return true;
+    }
+
+    bool parse_key(std::string_view& key) {
+        if (peek() != '"') return fail("Expected JSON object key");
+        return parse_string(key) && expect(':');
+    }
+
+    // After a member or element: a comma (and more to come) or the closer
+    bool end_member(char closer) {
+        char c = peek();
+        if (c == ',') {
+            if (!next()) return false;
+            if (peek() == closer) return fail("Trailing comma in JSON");
+            return true;
+        }
+        if (c != closer) {
+            return fail(k_ < count_ ? "Expected ',' in JSON" : "Unexpected end of JSON");
+        }
+        return spaces_only(cursor_, index_[k_]) || fail("Unexpected character in JSON");
+    }
+
+    bool skip_value(size_t depth) {
+        if (depth > MAX_NESTING) return fail("JSON nested too deeply");
+        if (!value_is_token()) {
+            std::string_view text;
+            if (!scalar(text)) return false;
+            double ignored;
+            if (text == "true" || text == "false" || text == "null" || parse_json_number(text, ignored)) {
+                return true;
+            }
+            return fail("Invalid JSON value");
+        }
+
+        char c = peek();
+        if (c == '"') {
+            std::string_view raw;
+            return raw_string(raw);
+        }
+        if (c == '{') {
+            next();
+            if (peek() == '}') return next();
+            while (true) {
+                std::string_view key;
+                if (!parse_key(key) || !skip_value(depth + 1) || !end_member('}')) return false;
+                if (peek() == '}') return next();
+            }
+        }
+        if (c == '[') {
+            next();
+            if (peek() == ']') return next();
+            while (true) {
+                if (!skip_value(depth + 1) || !end_member(']')) return false;
+                if (peek() == ']') return next();
+            }
+        }
+        return fail("Missing JSON value");
+    }
+
+    bool parse_metrics(MetricBatch& batch) {
+        if (!value_is_token() || peek() != '[') return fail("'metrics' must be an array");
+        next();
+        if (peek() == ']') return next();
+        while (true) {
+            if (!parse_metric(batch) || !end_member(']')) return false;
+            if (peek() == ']') return next();
+        }
+    }
+
+    bool parse_metric(MetricBatch& batch) {
+        if (!value_is_token() || peek() != '{') return fail("Each metric must be a JSON object");
+        next();
+
+        std::string_view name;
+        std::string_view type;
+        double value = 0.0;
+        tags_.clear();
+
+        if (peek() == '}') {
+            if (!next()) return false;
+        } else {
+            while (true) {
+                std::string_view key;
+                if (!parse_key(key)) return false;
+
+                // Dispatch on length, then first byte, before comparing
+                bool ok;
+                if (key.size() == 4 && key[0] == 'n' && key == "name") {
+                    ok = parse_string_field(name, "Metric name must be a string");
+                } else if (key.size() == 5 && key[0] == 'v' && key == "value") {
+                    ok = parse_value_field(value);
+                } else if (key.size() == 4 && key[0] == 't' && key == "type") {
+                    ok = parse_string_field(type, "Metric type must be a string");
+                } else if (key.size() == 4 && key[0] == 't' && key == "tags") {
+                    ok = parse_tags();
+                } else {
+                    ok = skip_value(1);
+                }
+                if (!ok || !end_member('}')) return false;
+                if (peek() == '}') {
+                    next();   // end_member() checked the gap
+                    break;
+                }
+            }
+        }
+
+        if (!name.empty()) {
+            uint32_t series = SeriesRegistry::global().intern(name, tags_.data(), tags_.size());
+            batch.add_metric(Metric(series, value, metric_type_from(type)));
+        }
+        return true;
+    }
+
+    bool parse_string_field(std::string_view& field, const char* type_error) {
+        if (!value_is_token() || peek() != '"') return fail(type_error);
+        return parse_string(field);
+    }
+
+    bool parse_value_field(double& value) {
+        std::string_view text;
+        if (value_is_token() || !scalar(text) || !parse_json_number(text, value)) {
+            return fail("Metric value must be a number");
+        }
+        return true;
+    }
+
+    // Non-string tag values are skipped
+    bool parse_tags() {
+        if (!value_is_token() || peek() != '{') return fail("Metric tags must be an object");
+        next();
+        if (peek() == '}') return next();
+        while (true) {
+            std::string_view key;
+            if (!parse_key(key)) return false;
+            if (value_is_token() && peek() == '"') {
+                std::string_view value;
+                if (!parse_string(value)) return false;
+                tags_.emplace_back(key, value);
+            } else if (!skip_value(2)) {
+                return false;
+            }
+            if (!end_member('}')) return false;
+            if (peek() == '}') return next();
+        }
+    }
+};
+
+} // namespace
+
+const char* json_kernel_name(JsonKernel kernel) {
+    switch (kernel) {
+        case JsonKernel::AUTO: return "auto";
+        case JsonKernel::SCALAR: return "scalar";
+        case JsonKernel::SSE2: return "sse2";
+        case JsonKernel::AVX2: return "avx2";
+        case JsonKernel::NEON: return "neon";
+    }
+    return "unknown";
+}
+
+bool json_kernel_supported(JsonKernel kernel) {
+    switch (kernel) {
+        case JsonKernel::AUTO:
+        case JsonKernel::SCALAR:
+            return true;
+#if METRICSTREAM_JSON_X86
+        case JsonKernel::SSE2:
+            return true;
+        case JsonKernel::AVX2:
+            return best_json_kernel() == JsonKernel::AVX2;
+#endif
+#if METRICSTREAM_JSON_NEON
+        case JsonKernel::NEON:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+JsonKernel best_json_kernel() {
+    static const JsonKernel best = detect_json_kernel();
+    return best;
+}
+
+size_t find_json_structurals(std::string_view json, JsonKernel kernel, uint32_t* out) {
+    if (kernel == JsonKernel::AUTO || !json_kernel_supported(kernel)) {
+        kernel = best_json_kernel();
+    }
+    switch (kernel) {
+#if METRICSTREAM_JSON_X86
+        case JsonKernel::SSE2: return index_sse2(json, out);
+        case JsonKernel::AVX2: return index_avx2(json, out);
+#endif
+#if METRICSTREAM_JSON_NEON
+        case JsonKernel::NEON: return index_neon(json, out);
+#endif
+        default: return index_scalar(json, out);
+    }
+}
+
+bool parse_json_number(std::string_view text, double& value) {
+    const char* p = text.data();
+    const char* end = p + text.size();
+
+    bool negative = p != end && *p == '-';
+    if (negative) ++p;
+    if (p == end) return false;
+
+    // Up to 19 significant digits fit a uint64; the rest only move the exponent
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int64_t exponent = 0;
+    bool truncated = false;
+
+    if (*p == '0') {
+        ++p;
+    } else if (is_digit(*p)) {
+        for (; p != end && is_digit(*p); ++p) {
+            if (digits < MAX_MANTISSA_DIGITS) {
+                mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+                digits++;
+            } else {
+                exponent++;
+                truncated |= *p != '0';
+            }
+        }
+    } else {
+        return false;
+    }
+
+    if (p != end && *p == '.') {
+        ++p;
+        if (p == end || !is_digit(*p)) return false;
+        for (; p != end && is_digit(*p); ++p) {
+            if (mantissa == 0 && *p == '0') {
+                exponent--;   // Leading zeros of the fraction are not significant
+            } else if (digits < MAX_MANTISSA_DIGITS) {
+                mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+                digits++;
+                exponent--;
+            } else {
+                truncated |= *p != '0';
+            }
+        }
+    }
+
+    if (p != end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        bool negative_exponent = p != end && *p == '-';
+        if (p != end && (*p == '-' || *p == '+')) ++p;
+        if (p == end || !is_digit(*p)) return false;
+        int64_t e = 0;
+        for (; p != end && is_digit(*p); ++p) {
+            if (e < 100000) e = e * 10 + (*p - '0');
+        }
+        exponent += negative_exponent ? -e : e;
+    }
+
+    if (p != end) return false;
+
+    if (mantissa == 0) {
+        value = negative ? -0.0 : 0.0;
+        return true;
+    }
+
+    // Clinger's fast path: mantissa and power of ten are both exact doubles,
+    // so one IEEE multiply or divide rounds correctly
+    if (!truncated && mantissa <= MAX_EXACT_MANTISSA &&
+        exponent >= -MAX_EXACT_POWER && exponent <= MAX_EXACT_POWER) {
+        double d = static_cast<double>(mantissa);
+        d = exponent < 0 ? d / EXACT_POWERS_OF_TEN[-exponent] : d * EXACT_POWERS_OF_TEN[exponent];
+        value = negative ? -d : d;
+        return true;
+    }
+    return parse_number_slow(text, exponent, value);
+}
+
+JsonBatchParser::JsonBatchParser(JsonKernel kernel)
+    : kernel_(kernel == JsonKernel::AUTO || !json_kernel_supported(kernel) ? best_json_kernel() : kernel) {}
+
+bool JsonBatchParser::parse(std::string_view body, MetricBatch& batch, Arena& arena,
+                            const char** error) const {
+    ScopedProbe probe(Probe::JSON_PARSE);
+
+    // Every structural is a distinct byte, so body.size() entries suffice
+    uint32_t* index = static_cast<uint32_t*>(
+        arena.allocate((body.size() + 1) * sizeof(uint32_t), alignof(uint32_t)));
+    size_t count = find_json_structurals(body, kernel_, index);
+
+    IndexWalker walker(body, index, count, arena);
+    if (!walker.parse_document(batch)) {
+        if (error) *error = walker.error();
+        return false;
+    }
+    return true;
+}
+
+} // namespace metricstream
@@ -0,0 +1,132 @@
+#include "jsonl_writer.h"
+#include "common.h"
+#include <iostream>
+
+namespace metricstream {
+
+namespace {
+
+inline void put2(char* out, unsigned value) {
+    out[0] = static_cast<char>('0' + value / 10);
+    out[1] = static_cast<char>('0' + value % 10);
+}
+
+const char* type_name(MetricType type) {
+    switch (type) {
+        case MetricType::COUNTER:   return "counter";
+        case MetricType::GAUGE:     return "gauge";
+        case MetricType::HISTOGRAM: return "histogram";
+        case MetricType::SUMMARY:   return "summary";
+    }
+    return "gauge";
+}
+
+} // namespace
+
+JsonlWriter::JsonlWriter(const std::string& path, FsyncPolicy policy, size_t buffer_bytes)
+    : file_(policy), buffer_limit_(buffer_bytes) {
+    if (!file_.open(path)) {
+        std::cerr << "Warning: Could not open " << path << " for writing" << std::endl;
+    }
+    // Headroom so the last line of a full buffer does not reallocate
+    buffer_.reserve(buffer_limit_ + 64 * 1024);
+}
+
+JsonlWriter::~JsonlWriter() {
+    // AppendFile syncs on close unless the policy is NEVER
+    commit();
+}
+
+void JsonlWriter::append(const MetricBatch& batch) {
+    for (const auto& metric : batch.metrics) {
+        format_metric(metric);
+        if (buffer_.size() >= buffer_limit_) {
+            commit();
+        }
+    }
+}
+
+void JsonlWriter::format_metric(const Metric& metric) {
+    // {"timestamp":"...Z","name":"...","value":V,"type":"...","tags":{...}}
+    buffer_.append("{\"timestamp\":\"");
+    append_timestamp(metric.timestamp);
+    buffer_.append("\",\"name\":");
+    const SeriesKey& series = metric.series();
+    append_json_string(buffer_, series.name);
+    buffer_.append(",\"value\":");
+    append_json_number(buffer_, metric.value);
+    buffer_.append(",\"type\":\"");
+    buffer_.append(type_name(metric.type));
+    buffer_.push_back('"');
+
+    if (!series.tags.empty()) {
+        buffer_.append(",\"tags\":{");
+        bool first = true;
+        for (const auto& [key, value] : series.tags) {
+            if (!first) buffer_.push_back(',');
+            append_json_string(buffer_, key);
+            buffer_.push_back(':');
+            append_json_string(buffer_, value);
+            first = false;
+        }
+        buffer_.push_back('}');
+    }
+    buffer_.append("}\n");
+}
+
+void JsonlWriter::append_timestamp(Timestamp ts) {
+    auto ms_total = std::chrono::duration_cast<std::chrono::milliseconds>(
+        ts.time_since_epoch()).count();
+    std::time_t seconds = static_cast<std::time_t>(ms_total / 1000);
+    int ms = static_cast<int>(ms_total % 1000);
+    if (ms < 0) {
+        ms += 1000;
+        seconds -= 1;
+    }
+
+    // Batches carry timestamps from the same second or so: format the
+    // date/time part only when the second changes
+    if (seconds != cached_second_) {
+        std::tm tm{};
+        gmtime_r(&seconds, &tm);
+        char* p = timestamp_prefix_;
+        unsigned year = static_cast<unsigned>(tm.tm_year + 1900);
+        put2(p, year / 100);
+        put2(p + 2, year % 100);
+        p[4] = '-';
+        put2(p + 5, static_cast<unsigned>(tm.tm_mon + 1));
+        p[7] = '-';
+        put2(p + 8, static_cast<unsigned>(tm.tm_mday));
+        p[10] = 'T';
+        put2(p + 11, static_cast<unsigned>(tm.tm_hour));
+        p[13] = ':';
+        put2(p + 14, static_cast<unsigned>(tm.tm_min));
+        p[16] = ':';
+        put2(p + 17, static_cast<unsigned>(tm.tm_sec));
+        cached_second_ = seconds;
+    }
+
+    char frac[5] = {'.', static_cast<char>('0' + ms / 100), 0, 0, 'Z'};
+    put2(frac + 2, static_cast<unsigned>(ms % 100));
+    buffer_.append(timestamp_prefix_, 19);
+    buffer_.append(frac, 5);
+}
+
+bool JsonlWriter::flush() {
+    uint64_t errors = file_.write_errors();
+    bool ok = commit();
+    file_.sync();
+    return ok && file_.write_errors() == errors;
+}
+
+bool JsonlWriter::commit() {
+    if (buffer_.empty() || !file_.is_open()) {
+        buffer_.clear();
+        return file_.is_open();
+    }
+    bool ok = file_.write(buffer_);
+    buffer_.clear();
+    return ok;
+}
+
+} // namespace metricstream
@@ -1,50 +1,139 @@
 #include "ingestion_service.h"
+#include "profiling.h"
+#include <algorithm>
 #include <iostream>
 #include <signal.h>
+#include <csignal>
 #include <thread>
 #include <chrono>
+#include <string>
 
 std::unique_ptr<metricstream::IngestionService> service;
 
-void signal_handler(int signal) {
-    if (service) {
-        std::cout << "\nShutting down gracefully..." << std::endl;
-        service->stop();
-    }
-    exit(0);
+// Phase 21: The handler only sets a flag; main() tears the service down so
+// the writer drains the log and checkpoints the WAL before exit
+volatile std::sig_atomic_t shutdown_requested = 0;
+
+void signal_handler(int /*signal*/) {
+    shutdown_requested = 1;
 }
 
 int main(int argc, char* argv[]) {
-    int port = 8080;
+    metricstream::IngestionConfig config;
     
-    if (argc > 1) {
-        port = std::stoi(argv[1]);
+    // Usage: metricstream_server [port] [--storage=jsonl|segments] [--no-wal]
+    //                           [--json-kernel=scalar|sse2|avx2|neon] [--binary-port=N]
+    //                           [--rollups] [--no-shedding] [--shards=N]
+    //                           [--cluster=host:port,host:port,... --node=N]
+    //                           [--no-tracing] [--slow-ms=N] [--no-checkpoints]
+    //                           [--max-new-series=N] [--max-active-series=N] [--aggregate-series]
+    //                           [--alert=metric{k=v}:avg:>:80:10 ...]
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--alert=", 0) == 0) {
+            metricstream::AlertRule rule;
+            if (!metricstream::AlertRule::parse(arg.substr(8), rule)) {
+                std::cerr << "Invalid alert rule: " << arg.substr(8) << std::endl;
+                return 1;
+            }
+            config.alert_rules.push_back(std::move(rule));
+        } else if (arg == "--storage=segments") {
+            config.storage_format = metricstream::StorageFormat::SEGMENTS;
+        } else if (arg == "--storage=jsonl") {
+            config.storage_format = metricstream::StorageFormat::JSONL;
+        } else if (arg == "--no-wal") {
+            config.wal_enabled = false;
+        } else if (arg == "--rollups") {
+            config.rollups_enabled = true;
+        } else if (arg == "--no-tracing") {
+            config.tracing.enabled = false;
+        } else if (arg.rfind("--slow-ms=", 0) == 0) {
+            // Phase 33: Requests slower than this land in GET /debug/traces?slow=1
+            config.tracing.slow_threshold = std::chrono::milliseconds(std::max(0, std::stoi(arg.substr(10))));
+        } else if (arg == "--no-checkpoints") {
+            // Phase 34: Restart from the WAL alone, with empty rollups and limits
+            config.checkpoints_enabled = false;
+        } else if (arg.rfind("--max-new-series=", 0) == 0) {
+            // Phase 35: Per client per minute; 0 lifts the limit
+            config.cardinality.max_new_series = static_cast<size_t>(std::max(0, std::stoi(arg.substr(17))));
+        } else if (arg.rfind("--max-active-series=", 0) == 0) {
+            config.cardinality.max_active_series = static_cast<size_t>(std::max(0, std::stoi(arg.substr(20))));
+        } else if (arg == "--aggregate-series") {
+            // Refused series keep their points under the bare metric name
+            config.cardinality.action = metricstream::CardinalityLimiter::Action::AGGREGATE;
+        } else if (arg == "--no-shedding") {
+            config.admission.enabled = false;
+        } else if (arg.rfind("--shards=", 0) == 0) {
+            // Phase 30: Shared-nothing mode, one pinned storage shard per core
+            config.storage_shards = std::max(1, std::stoi(arg.substr(9)));
+            config.log_partitions = std::max(config.log_partitions, config.storage_shards);
+            config.pin_threads = true;
+        } else if (arg.rfind("--cluster=", 0) == 0) {
+            // Phase 31: Binary endpoints of every node, in the same order on each
+            std::string list = arg.substr(10);
+            size_t begin = 0;
+            while (begin <= list.size()) {
+                size_t end = std::min(list.find(',', begin), list.size());
+                metricstream::ClusterNode node;
+                if (!metricstream::parse_cluster_node(std::string_view(list).substr(begin, end - begin), node)) {
+                    std::cerr << "Invalid cluster node: " << list.substr(begin, end - begin) << std::endl;
+                    return 1;
+                }
+                config.cluster_nodes.push_back(std::move(node));
+                begin = end + 1;
+            }
+        } else if (arg.rfind("--node=", 0) == 0) {
+            config.cluster_self = static_cast<size_t>(std::max(0, std::stoi(arg.substr(7))));
+        } else if (arg.rfind("--binary-port=", 0) == 0) {
+            config.binary_port = std::stoi(arg.substr(14));
+        } else if (arg.rfind("--json-kernel=", 0) == 0) {
+            std::string name = arg.substr(14);
+            if (name == "scalar") config.json_kernel = metricstream::JsonKernel::SCALAR;
+            else if (name == "sse2") config.json_kernel = metricstream::JsonKernel::SSE2;
+            else if (name == "avx2") config.json_kernel = metricstream::JsonKernel::AVX2;
+            else if (name == "neon") config.json_kernel = metricstream::JsonKernel::NEON;
+            else {
+                std::cerr << "Unknown JSON kernel: " << name << std::endl;
+                return 1;
+            }
+        } else {
+            config.port = std::stoi(arg);
+        }
     }
     
-    std::cout << "Starting MetricStream server on port " << port << std::endl;
+    if (!config.cluster_nodes.empty() && config.cluster_self >= config.cluster_nodes.size()) {
+        std::cerr << "--node must index the --cluster list" << std::endl;
+        return 1;
+    }
+    
+    std::cout << "Starting MetricStream server on port " << config.port << std::endl;
     
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
     
-    service = std::make_unique<metricstream::IngestionService>(port);
+    service = std::make_unique<metricstream::IngestionService>(config);
     service->start();
     
     // Keep running until signal with periodic stats
-    while (true) {
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+    int ticks = 0;
+    while (!shutdown_requested) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        // Phase 13: Profiling builds dump merged probe histograms every 10 s
+        if (metricstream::PROFILING_ENABLED && ++ticks % 100 == 0) {
+            metricstream::Profiler::report(std::cerr);
+        }
 
-        // TODO(human): Add performance monitoring here
-        // Consider tracking and logging:
-        // - Active connection count
-        // - Request processing time distribution
-        // - Queue depths and memory usage
-        // - Failed vs successful request ratios
-        // This will help identify bottlenecks at high load
+        // Phase 26: Connection count, queue depths and per-stage latency
+        // histograms are scraped from GET /metrics/stats (Prometheus text)
         
         // Phase 3 Analysis: JSON parsing optimization needed
         // Current bottleneck: Multiple string::find() calls and substr() allocations
         // Target: Single-pass parser with string views and pre-allocated containers
     }
     
+    std::cout << "\nShutting down gracefully..." << std::endl;
+    service->stop();
+    service.reset();
     return 0;
 }
\ No newline at end of file
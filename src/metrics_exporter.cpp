@@ -0,0 +1,124 @@
+#include "metrics_exporter.h"
+#include "common.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <iostream>
+
+namespace metricstream {
+
+DecisionExporter::DecisionExporter(RateLimiter& limiter, int fd, std::chrono::milliseconds interval)
+    : limiter_(limiter), fd_(fd), interval_(interval) {
+    buffer_.reserve(64 * 1024);
+    if (fd_ >= 0) {
+        limiter_.set_decision_log(true);
+    }
+}
+
+DecisionExporter::~DecisionExporter() {
+    stop();
+    limiter_.set_decision_log(false);
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+int DecisionExporter::open_file(const std::string& path) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        std::cerr << "Warning: Could not open " << path << " for writing" << std::endl;
+    }
+    return fd;
+}
+
+void DecisionExporter::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_ || fd_ < 0) {
+        return;
+    }
+    running_ = true;
+    thread_ = std::thread(&DecisionExporter::run, this);
+}
+
+void DecisionExporter::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    flush();
+}
+
+void DecisionExporter::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_) {
+        cv_.wait_for(lock, interval_, [this] { return !running_; });
+        if (!running_) {
+            break;
+        }
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+}
+
+size_t DecisionExporter::flush() {
+    std::lock_guard<std::mutex> lock(flush_mutex_);
+    if (fd_ < 0) {
+        return 0;
+    }
+
+    counts_.clear();
+    limiter_.drain_decisions(counts_);
+    if (counts_.empty()) {
+        return 0;
+    }
+
+    auto ts = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    std::string ts_field = std::to_string(ts);
+
+    buffer_.clear();
+    uint64_t dropped = 0;
+    for (const auto& c : counts_) {
+        buffer_.append("{\"ts\":").append(ts_field);
+        buffer_.append(",\"client\":");
+        append_json_string(buffer_, c.client_id);
+        buffer_.append(",\"allowed\":").append(std::to_string(c.allowed));
+        buffer_.append(",\"denied\":").append(std::to_string(c.denied));
+        buffer_.append(",\"dropped\":").append(std::to_string(c.dropped));
+        buffer_.append("}\n");
+        dropped += c.dropped;
+    }
+    dropped_events_.fetch_add(dropped, std::memory_order_relaxed);
+
+    if (!write_all(buffer_)) {
+        write_errors_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return counts_.size();
+}
+
+bool DecisionExporter::write_all(const std::string& data) {
+    // One write() in the common case; loop only on short writes
+    size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t n = ::write(fd_, data.data() + offset, data.size() - offset);
+        if (n > 0) {
+            offset += static_cast<size_t>(n);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            // Includes EAGAIN on a non-blocking socket: drop this interval
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace metricstream
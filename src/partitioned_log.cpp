@@ -0,0 +1,145 @@
+#include "partitioned_log.h"
+#include <functional>
+
+namespace metricstream {
+
+PartitionedLog::PartitionedLog(size_t partitions, size_t capacity) {
+    if (partitions == 0) partitions = 1;
+    size_t size = 2;
+    while (size < capacity) size <<= 1;
+    mask_ = size - 1;
+
+    partitions_.reserve(partitions);
+    for (size_t i = 0; i < partitions; ++i) {
+        partitions_.push_back(std::make_unique<Partition>(size));
+    }
+}
+
+PartitionedLog::~PartitionedLog() {
+    close();
+}
+
+size_t PartitionedLog::add_cursor(std::string name) {
+    size_t id = cursor_count_;
+    if (id >= MAX_CURSORS) {
+        return MAX_CURSORS;   // Out of cursors: callers check against cursor_count()
+    }
+    auto waiter = std::make_unique<Waiter>();
+    waiter->name = std::move(name);
+    waiters_.push_back(std::move(waiter));
+    // New cursors start at the current end of each partition
+    for (auto& partition : partitions_) {
+        partition->cursors[id].store(partition->head.load(std::memory_order_relaxed),
+                                     std::memory_order_relaxed);
+    }
+    cursor_count_++;
+    return id;
+}
+
+size_t PartitionedLog::partition_for(std::string_view key) const {
+    return std::hash<std::string_view>{}(key) % partitions_.size();
+}
+
+uint64_t PartitionedLog::slowest_cursor(const Partition& partition) const {
+    uint64_t slowest = partition.head.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < cursor_count_; ++i) {
+        uint64_t offset = partition.cursors[i].load(std::memory_order_acquire);
+        if (offset < slowest) slowest = offset;
+    }
+    return slowest;
+}
+
+bool PartitionedLog::append(size_t partition, PooledBatch& batch, uint64_t* offset_out) {
+    if (closed()) {
+        return false;
+    }
+    Partition& p = *partitions_[partition];
+
+    uint64_t offset = p.head.load(std::memory_order_relaxed);
+    while (true) {
+        if (offset - slowest_cursor(p) > mask_) {
+            return false;   // The slowest reader is a full ring behind
+        }
+        if (p.head.compare_exchange_weak(offset, offset + 1, std::memory_order_acq_rel,
+                                         std::memory_order_relaxed)) {
+            break;
+        }
+    }
+
+    Slot& slot = p.slots[offset & mask_];
+    slot.batch = std::move(batch);
+    slot.readers.store(static_cast<uint32_t>(cursor_count_), std::memory_order_relaxed);
+    slot.sequence.store(offset + 1, std::memory_order_release);
+    if (offset_out) {
+        *offset_out = offset;
+    }
+
+    wake_readers();
+    return true;
+}
+
+void PartitionedLog::wake_readers() {
+    // Pairs with wait(): a reader either sees the entry or is counted here
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (size_t i = 0; i < cursor_count_; ++i) {
+        Waiter& waiter = *waiters_[i];
+        if (waiter.sleepers.load(std::memory_order_relaxed) > 0) {
+            {
+                std::lock_guard<std::mutex> lock(waiter.mutex);
+            }
+            waiter.cv.notify_all();
+        }
+    }
+}
+
+bool PartitionedLog::readable(size_t cursor, size_t first_partition, size_t stride) const {
+    for (size_t i = first_partition; i < partitions_.size(); i += stride) {
+        const auto& partition = partitions_[i];
+        uint64_t offset = partition->cursors[cursor].load(std::memory_order_relaxed);
+        if (partition->slots[offset & mask_].sequence.load(std::memory_order_acquire) == offset + 1) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PartitionedLog::wait(size_t cursor, std::chrono::milliseconds timeout,
+                          size_t first_partition, size_t stride) {
+    Waiter& waiter = *waiters_[cursor];
+    std::unique_lock<std::mutex> lock(waiter.mutex);
+    waiter.sleepers.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool ready = waiter.cv.wait_for(lock, timeout, [&] {
+        return closed() || readable(cursor, first_partition, stride);
+    });
+    waiter.sleepers.fetch_sub(1, std::memory_order_relaxed);
+    return ready && readable(cursor, first_partition, stride);
+}
+
+void PartitionedLog::close() {
+    closed_.store(true, std::memory_order_release);
+    for (auto& waiter : waiters_) {
+        {
+            std::lock_guard<std::mutex> lock(waiter->mutex);
+        }
+        waiter->cv.notify_all();
+    }
+}
+
+uint64_t PartitionedLog::end_offset(size_t partition) const {
+    return partitions_[partition]->head.load(std::memory_order_acquire);
+}
+
+uint64_t PartitionedLog::cursor_offset(size_t cursor, size_t partition) const {
+    return partitions_[partition]->cursors[cursor].load(std::memory_order_acquire);
+}
+
+uint64_t PartitionedLog::lag(size_t cursor) const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < partitions_.size(); ++i) {
+        total += end_offset(i) - cursor_offset(cursor, i);
+    }
+    return total;
+}
+
+} // namespace metricstream
@@ -0,0 +1,110 @@
+#include "profiling.h"
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace metricstream {
+
+namespace {
+
+// Histograms outlive their threads so samples from exited workers still count
+std::mutex registry_mutex;
+std::vector<std::unique_ptr<ThreadProfile>> registry;
+
+// Cycle counter ticks per nanosecond, measured once against steady_clock
+double ticks_per_ns() {
+    static const double ratio = [] {
+        auto wall_start = std::chrono::steady_clock::now();
+        uint64_t tick_start = read_cycle_counter();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        uint64_t ticks = read_cycle_counter() - tick_start;
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - wall_start).count();
+        return ns > 0 ? static_cast<double>(ticks) / static_cast<double>(ns) : 1.0;
+    }();
+    return ratio;
+}
+
+// Upper bound of the bucket holding the given percentile
+uint64_t percentile(const std::array<uint64_t, ProbeHistogram::BUCKETS>& buckets,
+                    uint64_t count, double pct) {
+    uint64_t target = static_cast<uint64_t>(static_cast<double>(count) * pct);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < ProbeHistogram::BUCKETS; ++i) {
+        seen += buckets[i];
+        if (seen > target) {
+            return (uint64_t{1} << (i + 1)) - 1;
+        }
+    }
+    return uint64_t{1} << ProbeHistogram::BUCKETS;
+}
+
+} // namespace
+
+ThreadProfile* Profiler::register_thread() {
+    auto profile = std::make_unique<ThreadProfile>();
+    ThreadProfile* raw = profile.get();
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    registry.push_back(std::move(profile));
+    return raw;
+}
+
+const char* Profiler::probe_name(Probe probe) {
+    switch (probe) {
+        case Probe::RATE_LIMIT_DECISION:  return "rate_limit_decision";
+        case Probe::RATE_LIMIT_LOCK_WAIT: return "rate_limit_lock_wait";
+        case Probe::RATE_LIMIT_CLEANUP:   return "rate_limit_cleanup";
+        case Probe::JSON_PARSE:           return "json_parse";
+        case Probe::REQUEST_HANDLER:      return "request_handler";
+        case Probe::COUNT:                break;
+    }
+    return "unknown";
+}
+
+void Profiler::report(std::ostream& out) {
+    if (!PROFILING_ENABLED) {
+        return;
+    }
+
+    double ratio = ticks_per_ns();
+    auto to_ns = [ratio](uint64_t ticks) {
+        return static_cast<uint64_t>(static_cast<double>(ticks) / ratio);
+    };
+
+    // Merge under the registry lock only; the hot path never takes it
+    constexpr size_t PROBES = static_cast<size_t>(Probe::COUNT);
+    std::array<std::array<uint64_t, ProbeHistogram::BUCKETS>, PROBES> buckets{};
+    std::array<uint64_t, PROBES> counts{}, totals{}, maxima{};
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (const auto& profile : registry) {
+            for (size_t p = 0; p < PROBES; ++p) {
+                const ProbeHistogram& h = profile->probes[p];
+                for (size_t b = 0; b < ProbeHistogram::BUCKETS; ++b) {
+                    buckets[p][b] += h.buckets[b].load(std::memory_order_relaxed);
+                }
+                counts[p] += h.count.load(std::memory_order_relaxed);
+                totals[p] += h.total_cycles.load(std::memory_order_relaxed);
+                uint64_t max = h.max_cycles.load(std::memory_order_relaxed);
+                if (max > maxima[p]) maxima[p] = max;
+            }
+        }
+    }
+
+    for (size_t p = 0; p < PROBES; ++p) {
+        if (counts[p] == 0) {
+            continue;
+        }
+        out << "[PROFILE] " << probe_name(static_cast<Probe>(p))
+            << " count=" << counts[p]
+            << " mean=" << to_ns(totals[p] / counts[p]) << "ns"
+            << " p50<=" << to_ns(percentile(buckets[p], counts[p], 0.50)) << "ns"
+            << " p99<=" << to_ns(percentile(buckets[p], counts[p], 0.99)) << "ns"
+            << " max=" << to_ns(maxima[p]) << "ns\n";
+    }
+    out.flush();
+}
+
+} // namespace metricstream
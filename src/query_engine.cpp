@@ -0,0 +1,355 @@
+#include "query_engine.h"
+#include <algorithm>
+#include <mutex>
+
+namespace metricstream {
+
+namespace {
+
+std::string tag_key(const std::string& key, const std::string& value) {
+    std::string out;
+    out.reserve(key.size() + value.size() + 1);
+    out.append(key);
+    out.push_back('\0');
+    out.append(value);
+    return out;
+}
+
+} // namespace
+
+void aggregate_points(PointSpan points, QueryAggregate& agg) {
+    constexpr double INF = std::numeric_limits<double>::infinity();
+    double sum[4] = {0, 0, 0, 0};
+    double lo[4] = {INF, INF, INF, INF};
+    double hi[4] = {-INF, -INF, -INF, -INF};
+    size_t n = points.size;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        for (size_t lane = 0; lane < 4; ++lane) {
+            double v = points.data[i + lane].value;
+            sum[lane] += v;
+            lo[lane] = v < lo[lane] ? v : lo[lane];
+            hi[lane] = v > hi[lane] ? v : hi[lane];
+        }
+    }
+    for (; i < n; ++i) {
+        double v = points.data[i].value;
+        sum[0] += v;
+        lo[0] = v < lo[0] ? v : lo[0];
+        hi[0] = v > hi[0] ? v : hi[0];
+    }
+    agg.count += n;
+    agg.sum += (sum[0] + sum[1]) + (sum[2] + sum[3]);
+    agg.min = std::min({agg.min, lo[0], lo[1], lo[2], lo[3]});
+    agg.max = std::max({agg.max, hi[0], hi[1], hi[2], hi[3]});
+}
+
+QueryEngine::QueryEngine(std::string directory) : directory_(std::move(directory)) {}
+
+size_t QueryEngine::refresh() {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    size_t before = block_count_;
+    int64_t earliest = std::numeric_limits<int64_t>::max();
+
+    // Unsealed segments may have grown (or been sealed) since last time
+    for (uint32_t i = 0; i < segments_.size(); ++i) {
+        Segment& segment = *segments_[i];
+        size_t known = segment.reader.blocks().size();
+        if (!segment.reader.sealed() && segment.reader.refresh()) {
+            unindex_segment(i);
+            earliest = std::min(earliest, index_segment(i, known));
+        }
+    }
+
+    for (const auto& path : list_segment_files(directory_)) {
+        if (segment_by_path_.count(path)) {
+            continue;
+        }
+        auto segment = std::make_unique<Segment>();
+        segment->path = path;
+        if (!segment->reader.open(path)) {
+            continue;   // Empty or unreadable for now; retried next refresh
+        }
+        uint32_t index = static_cast<uint32_t>(segments_.size());
+        segments_.push_back(std::move(segment));
+        segment_by_path_.emplace(path, index);
+        earliest = std::min(earliest, index_segment(index, 0));
+    }
+
+    if (earliest != std::numeric_limits<int64_t>::max()) {
+        uint64_t generation = generation_.load(std::memory_order_relaxed) + 1;
+        changes_.emplace_back(generation, earliest);
+        if (changes_.size() > MAX_CHANGES) {
+            changes_.pop_front();
+        }
+        generation_.store(generation, std::memory_order_release);
+    }
+    return block_count_ - before;
+}
+
+int64_t QueryEngine::earliest_change_since(uint64_t generation) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    int64_t earliest = std::numeric_limits<int64_t>::max();
+    if (generation_.load(std::memory_order_relaxed) == generation) {
+        return earliest;
+    }
+    if (changes_.empty() || changes_.front().first > generation + 1) {
+        return std::numeric_limits<int64_t>::min();
+    }
+    for (const auto& [changed_at, timestamp_ms] : changes_) {
+        if (changed_at > generation) {
+            earliest = std::min(earliest, timestamp_ms);
+        }
+    }
+    return earliest;
+}
+
+uint32_t QueryEngine::intern_series(const SeriesInfo& info) {
+    std::string key = info.name;
+    for (const auto& [tag, value] : info.tags) {
+        key.push_back('\0');
+        key.append(tag);
+        key.push_back('\0');
+        key.append(value);
+    }
+    auto it = series_by_key_.find(key);
+    if (it != series_by_key_.end()) {
+        return it->second;
+    }
+
+    uint32_t id = static_cast<uint32_t>(series_.size());
+    series_.emplace_back();
+    IndexedSeries& series = series_.back();
+    series.info = info;
+    series.info.id = id;
+    series_by_key_.emplace(std::move(key), id);
+
+    // Ids only grow, so appending keeps every posting list sorted
+    by_name_[info.name].push_back(id);
+    for (const auto& [tag, value] : info.tags) {
+        by_tag_[tag_key(tag, value)].push_back(id);
+    }
+    return id;
+}
+
+int64_t QueryEngine::index_segment(uint32_t segment_index, size_t first_new) {
+    Segment& segment = *segments_[segment_index];
+    const SegmentReader& reader = segment.reader;
+
+    std::unordered_map<uint32_t, uint32_t> local_to_engine;
+    for (const SeriesInfo& info : reader.series()) {
+        local_to_engine[info.id] = intern_series(info);
+    }
+
+    size_t added = 0;
+    int64_t earliest_new = std::numeric_limits<int64_t>::max();
+    const auto& blocks = reader.blocks();
+    for (uint32_t i = 0; i < blocks.size(); ++i) {
+        const BlockInfo& block = blocks[i];
+        auto it = local_to_engine.find(block.series_id);
+        if (it == local_to_engine.end()) {
+            continue;   // Block without its series record: unusable
+        }
+        IndexedSeries& series = series_[it->second];
+        BlockRef ref{segment_index, i, block.min_timestamp_ms, block.max_timestamp_ms};
+
+        // Blocks mostly arrive in time order, so this is nearly always an append
+        auto pos = series.blocks.end();
+        while (pos != series.blocks.begin() && (pos - 1)->min_timestamp_ms > ref.min_timestamp_ms) {
+            --pos;
+        }
+        series.blocks.insert(pos, ref);
+
+        if (segment.series.empty() || segment.series.back() != it->second) {
+            segment.series.push_back(it->second);
+        }
+        segment.min_timestamp_ms = std::min(segment.min_timestamp_ms, block.min_timestamp_ms);
+        segment.max_timestamp_ms = std::max(segment.max_timestamp_ms, block.max_timestamp_ms);
+        if (i >= first_new) {
+            earliest_new = std::min(earliest_new, block.min_timestamp_ms);
+        }
+        added++;
+    }
+
+    std::sort(segment.series.begin(), segment.series.end());
+    segment.series.erase(std::unique(segment.series.begin(), segment.series.end()),
+                         segment.series.end());
+    block_count_ += added;
+    return earliest_new;
+}
+
+void QueryEngine::unindex_segment(uint32_t segment_index) {
+    Segment& segment = *segments_[segment_index];
+    for (uint32_t id : segment.series) {
+        auto& blocks = series_[id].blocks;
+        auto end = std::remove_if(blocks.begin(), blocks.end(), [&](const BlockRef& ref) {
+            return ref.segment == segment_index;
+        });
+        block_count_ -= static_cast<size_t>(blocks.end() - end);
+        blocks.erase(end, blocks.end());
+    }
+    segment.series.clear();
+    segment.min_timestamp_ms = std::numeric_limits<int64_t>::max();
+    segment.max_timestamp_ms = std::numeric_limits<int64_t>::min();
+}
+
+std::vector<uint32_t> QueryEngine::matching_ids(const SeriesQuery& query) const {
+    std::vector<const std::vector<uint32_t>*> postings;
+    if (!query.name.empty()) {
+        auto it = by_name_.find(query.name);
+        if (it == by_name_.end()) return {};
+        postings.push_back(&it->second);
+    }
+    for (const auto& [tag, value] : query.tags) {
+        auto it = by_tag_.find(tag_key(tag, value));
+        if (it == by_tag_.end()) return {};
+        postings.push_back(&it->second);
+    }
+
+    std::vector<uint32_t> ids;
+    if (postings.empty()) {
+        ids.resize(series_.size());
+        for (uint32_t i = 0; i < ids.size(); ++i) ids[i] = i;
+        return ids;
+    }
+
+    // Walk the shortest list, binary-search the others
+    std::sort(postings.begin(), postings.end(),
+              [](const auto* a, const auto* b) { return a->size() < b->size(); });
+    for (uint32_t id : *postings[0]) {
+        bool all = true;
+        for (size_t i = 1; i < postings.size() && all; ++i) {
+            all = std::binary_search(postings[i]->begin(), postings[i]->end(), id);
+        }
+        if (all) ids.push_back(id);
+    }
+    return ids;
+}
+
+template <typename F>
+size_t QueryEngine::scan_series(const IndexedSeries& series, const SeriesQuery& query,
+                                std::vector<DataPoint>& scratch, F&& visit) const {
+    size_t visited = 0;
+    for (const BlockRef& ref : series.blocks) {
+        if (ref.min_timestamp_ms > query.end_ms) {
+            break;   // Sorted by start: nothing later can overlap
+        }
+        if (ref.max_timestamp_ms < query.start_ms) {
+            continue;
+        }
+
+        const SegmentReader& reader = segments_[ref.segment]->reader;
+        blocks_decoded_.fetch_add(1, std::memory_order_relaxed);
+        scratch.clear();
+        if (!reader.read_block(reader.blocks()[ref.block], scratch)) {
+            continue;   // Corrupt block: skip rather than fail the query
+        }
+
+        size_t kept = scratch.size();
+        if (ref.min_timestamp_ms < query.start_ms || ref.max_timestamp_ms > query.end_ms) {
+            // Straddles the range: keep the points inside it
+            kept = 0;
+            for (const DataPoint& point : scratch) {
+                if (point.timestamp_ms >= query.start_ms && point.timestamp_ms <= query.end_ms) {
+                    scratch[kept++] = point;
+                }
+            }
+        }
+        if (kept > 0) {
+            visit(PointSpan{scratch.data(), kept});
+            visited += kept;
+        }
+    }
+    return visited;
+}
+
+QueryResult QueryEngine::query(const SeriesQuery& query) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    QueryResult result;
+    std::vector<DataPoint> scratch;
+    std::vector<size_t> offsets;
+
+    for (uint32_t id : matching_ids(query)) {
+        const IndexedSeries& series = series_[id];
+        size_t start = result.points_.size();
+        scan_series(series, query, scratch, [&](PointSpan points) {
+            result.points_.insert(result.points_.end(), points.begin(), points.end());
+        });
+        if (result.points_.size() > start) {
+            result.series_.push_back({&series.info, PointSpan{nullptr, result.points_.size() - start}});
+            offsets.push_back(start);
+        }
+    }
+
+    // The buffer is complete: point the spans into it
+    for (size_t i = 0; i < result.series_.size(); ++i) {
+        result.series_[i].points.data = result.points_.data() + offsets[i];
+    }
+    return result;
+}
+
+size_t QueryEngine::scan(const SeriesQuery& query, const Visitor& visit) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    std::vector<DataPoint> scratch;
+    size_t visited = 0;
+    for (uint32_t id : matching_ids(query)) {
+        const IndexedSeries& series = series_[id];
+        visited += scan_series(series, query, scratch, [&](PointSpan points) {
+            visit(series.info, points);
+        });
+    }
+    return visited;
+}
+
+std::vector<std::pair<const SeriesInfo*, QueryAggregate>>
+QueryEngine::aggregate(const SeriesQuery& query) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    std::vector<std::pair<const SeriesInfo*, QueryAggregate>> out;
+    std::vector<DataPoint> scratch;
+    for (uint32_t id : matching_ids(query)) {
+        const IndexedSeries& series = series_[id];
+        QueryAggregate agg;
+        scan_series(series, query, scratch, [&](PointSpan points) { aggregate_points(points, agg); });
+        if (agg.count > 0) {
+            out.emplace_back(&series.info, agg);
+        }
+    }
+    return out;
+}
+
+std::vector<const SeriesInfo*> QueryEngine::match(const SeriesQuery& query) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    std::vector<const SeriesInfo*> out;
+    for (uint32_t id : matching_ids(query)) {
+        out.push_back(&series_[id].info);
+    }
+    return out;
+}
+
+std::pair<int64_t, int64_t> QueryEngine::time_bounds() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    std::pair<int64_t, int64_t> bounds{std::numeric_limits<int64_t>::max(),
+                                       std::numeric_limits<int64_t>::min()};
+    for (const auto& segment : segments_) {
+        bounds.first = std::min(bounds.first, segment->min_timestamp_ms);
+        bounds.second = std::max(bounds.second, segment->max_timestamp_ms);
+    }
+    return bounds;
+}
+
+size_t QueryEngine::segment_count() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return segments_.size();
+}
+
+size_t QueryEngine::series_count() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return series_.size();
+}
+
+size_t QueryEngine::block_count() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return block_count_;
+}
+
+} // namespace metricstream
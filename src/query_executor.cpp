@@ -0,0 +1,235 @@
+#include "query_executor.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iterator>
+#include <limits>
+#include <thread>
+
+namespace metricstream {
+
+namespace {
+
+int64_t floor_div(int64_t value, int64_t divisor) {
+    int64_t q = value / divisor;
+    return (value % divisor != 0 && (value < 0) != (divisor < 0)) ? q - 1 : q;
+}
+
+// Name and sorted tags; the width and bucket start are appended per bucket
+std::string cache_prefix(const SeriesQuery& query, int64_t width_ms) {
+    auto tags = query.tags;
+    std::sort(tags.begin(), tags.end());
+    std::string key = query.name;
+    key += '\0';
+    for (const auto& [k, v] : tags) {
+        key += k;
+        key += '=';
+        key += v;
+        key += '\0';
+    }
+    key += std::to_string(width_ms);
+    key += '/';
+    return key;
+}
+
+// Counts down the tasks of one query
+class Latch {
+public:
+    explicit Latch(size_t count) : remaining_(count) {}
+
+    void count_down() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--remaining_ == 0) {
+            done_.notify_all();
+        }
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return remaining_ == 0; });
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable done_;
+    size_t remaining_;
+};
+
+} // namespace
+
+QueryExecutor::QueryExecutor(const QueryEngine& engine) : QueryExecutor(engine, Options()) {}
+
+QueryExecutor::QueryExecutor(const QueryEngine& engine, Options options)
+    : engine_(engine), options_(options),
+      newest_cached_end_ms_(std::numeric_limits<int64_t>::min()),
+      cached_generation_(engine.generation()) {
+    size_t threads = options_.threads;
+    if (threads == 0) {
+        threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+    pool_ = std::make_unique<ThreadPool>(threads, MAX_BUCKETS);
+}
+
+std::vector<QueryExecutor::Series> QueryExecutor::aggregate(const SeriesQuery& query, int64_t step_ms) {
+    uint64_t generation = sync_with_engine();
+
+    // Enumerate buckets over the data actually stored, not an open range
+    auto [data_start, data_end] = engine_.time_bounds();
+    int64_t start = std::max(query.start_ms, data_start);
+    int64_t end = std::min(query.end_ms, data_end);
+    if (start > end) {
+        return {};
+    }
+
+    int64_t width = step_ms > 0 ? step_ms : std::max<int64_t>(options_.bucket_ms, 1);
+    uint64_t span = static_cast<uint64_t>(floor_div(end, width) - floor_div(start, width)) + 1;
+    if (span > MAX_BUCKETS) {
+        // Stay a multiple of the requested width so buckets remain aligned
+        int64_t factor = static_cast<int64_t>((span + MAX_BUCKETS - 1) / MAX_BUCKETS);
+        width *= factor;
+    }
+    int64_t first = floor_div(start, width) * width;
+    size_t count = static_cast<size_t>(floor_div(end, width) - floor_div(start, width)) + 1;
+
+    int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    std::string prefix = cache_prefix(query, width);
+
+    std::vector<BucketResult> results(count);
+    std::vector<std::string> keys(count);   // Empty: not cacheable
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < count; ++i) {
+        int64_t bucket_start = first + static_cast<int64_t>(i) * width;
+        int64_t bucket_end = bucket_start + width - 1;
+        bool whole = bucket_start >= query.start_ms && bucket_end <= query.end_ms;
+        if (whole && bucket_end < now_ms - options_.settle_ms) {
+            keys[i] = prefix + std::to_string(bucket_start);
+            if (cache_lookup(keys[i], results[i])) {
+                continue;
+            }
+        }
+        pending.push_back(i);
+    }
+
+    auto compute = [&](size_t from, size_t to) {
+        for (size_t p = from; p < to; ++p) {
+            size_t i = pending[p];
+            SeriesQuery chunk = query;
+            int64_t bucket_start = first + static_cast<int64_t>(i) * width;
+            chunk.start_ms = std::max(query.start_ms, bucket_start);
+            chunk.end_ms = std::min(query.end_ms, bucket_start + width - 1);
+            results[i] = engine_.aggregate(chunk);
+        }
+    };
+
+    if (!pending.empty()) {
+        // A few tasks per worker so stealing evens out uneven buckets
+        size_t tasks = std::min(pending.size(), pool_->worker_count() * 4);
+        size_t per_task = (pending.size() + tasks - 1) / tasks;
+        tasks = (pending.size() + per_task - 1) / per_task;
+        Latch latch(tasks);
+        for (size_t t = 0; t < tasks; ++t) {
+            size_t from = t * per_task;
+            size_t to = std::min(pending.size(), from + per_task);
+            bool queued = pool_->enqueue([&compute, &latch, from, to] {
+                compute(from, to);
+                latch.count_down();
+            });
+            if (!queued) {
+                compute(from, to);
+                latch.count_down();
+            }
+        }
+        latch.wait();
+        buckets_computed_.fetch_add(pending.size(), std::memory_order_relaxed);
+
+        for (size_t i : pending) {
+            if (!keys[i].empty()) {
+                int64_t bucket_end = first + static_cast<int64_t>(i + 1) * width - 1;
+                cache_store(std::move(keys[i]), bucket_end, results[i], generation);
+            }
+        }
+    }
+
+    // Merge partials per series, buckets in time order
+    std::vector<Series> merged;
+    std::unordered_map<const SeriesInfo*, size_t> position;
+    for (size_t i = 0; i < count; ++i) {
+        int64_t bucket_start = first + static_cast<int64_t>(i) * width;
+        for (const auto& [info, agg] : results[i]) {
+            auto [it, inserted] = position.emplace(info, merged.size());
+            if (inserted) {
+                merged.push_back(Series{info, QueryAggregate{}, {}});
+            }
+            Series& series = merged[it->second];
+            series.total.merge(agg);
+            if (step_ms > 0) {
+                series.steps.emplace_back(bucket_start, agg);
+            }
+        }
+    }
+    std::sort(merged.begin(), merged.end(),
+              [](const Series& a, const Series& b) { return a.info->id < b.info->id; });
+    return merged;
+}
+
+void QueryExecutor::clear_cache() {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    cache_.clear();
+    cache_order_.clear();
+    newest_cached_end_ms_ = std::numeric_limits<int64_t>::min();
+}
+
+uint64_t QueryExecutor::sync_with_engine() {
+    uint64_t generation = engine_.generation();
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    if (generation == cached_generation_) {
+        return generation;
+    }
+    // Blocks of fresh data change nothing cached; only late ones cost a sweep
+    int64_t earliest = engine_.earliest_change_since(cached_generation_);
+    if (earliest <= newest_cached_end_ms_) {
+        for (auto it = cache_.begin(); it != cache_.end();) {
+            it = it->second.end_ms >= earliest ? cache_.erase(it) : std::next(it);
+        }
+    }
+    cached_generation_ = generation;
+    return generation;
+}
+
+size_t QueryExecutor::cached_buckets() const {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    return cache_.size();
+}
+
+bool QueryExecutor::cache_lookup(const std::string& key, BucketResult& out) {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    auto it = cache_.find(key);
+    if (it == cache_.end()) {
+        return false;
+    }
+    out = it->second.result;
+    cache_hits_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void QueryExecutor::cache_store(std::string key, int64_t end_ms, const BucketResult& result,
+                                uint64_t generation) {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    // Computed before blocks another query has since invalidated for
+    if (options_.max_cached_buckets == 0 || generation != cached_generation_) {
+        return;
+    }
+    if (!cache_.emplace(key, CachedBucket{result, end_ms}).second) {
+        return;
+    }
+    newest_cached_end_ms_ = std::max(newest_cached_end_ms_, end_ms);
+    cache_order_.push_back(std::move(key));
+    while (cache_.size() > options_.max_cached_buckets ||
+           cache_order_.size() > 2 * options_.max_cached_buckets) {
+        cache_.erase(cache_order_.front());
+        cache_order_.pop_front();
+    }
+}
+
+} // namespace metricstream
@@ -0,0 +1,656 @@
+#include "rollup.h"
+#include "common.h"
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <unordered_map>
+
+namespace metricstream {
+
+namespace {
+
+constexpr std::string_view ROLLUP_PREFIX = "rollup-";
+constexpr std::string_view ROLLUP_SUFFIX = ".rlp";
+constexpr size_t ROLLUP_RECORD_OVERHEAD = 9;
+constexpr uint32_t NO_SERIES = UINT32_MAX;
+constexpr int MAX_OPEN_ATTEMPTS = 16;
+
+int64_t to_epoch_ms(Timestamp ts) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(ts.time_since_epoch()).count();
+}
+
+// Start of the bucket holding ts, rounding down for negative timestamps too
+int64_t bucket_start(int64_t ts, int64_t width) {
+    int64_t start = ts - ts % width;
+    return start > ts ? start - width : start;
+}
+
+// "rollup-<resolution>-" for a resolution index
+std::string file_prefix(size_t resolution) {
+    std::string prefix(ROLLUP_PREFIX);
+    prefix.append(ROLLUP_RESOLUTIONS[resolution].name);
+    prefix.push_back('-');
+    return prefix;
+}
+
+uint64_t file_sequence(std::string_view path) {
+    size_t dash = path.rfind('-');
+    if (dash == std::string_view::npos || path.size() < dash + 1 + ROLLUP_SUFFIX.size()) {
+        return 0;
+    }
+    uint64_t sequence = 0;
+    for (size_t i = dash + 1; i < path.size() - ROLLUP_SUFFIX.size(); ++i) {
+        if (path[i] < '0' || path[i] > '9') return 0;
+        sequence = sequence * 10 + static_cast<uint64_t>(path[i] - '0');
+    }
+    return sequence;
+}
+
+size_t begin_record(std::string& out, RollupRecord type) {
+    size_t start = out.size();
+    ByteWriter writer(out);
+    writer.put_u8(static_cast<uint8_t>(type));
+    writer.put_u32(0);   // Payload length, patched by end_record()
+    return start;
+}
+
+void end_record(std::string& out, size_t start) {
+    size_t payload = out.size() - start - 5;
+    ByteWriter writer(out);
+    writer.patch_u32(start + 1, static_cast<uint32_t>(payload));
+    uint32_t crc = crc32c(out.data() + start, 1);
+    crc = crc32c(out.data() + start + 5, payload, crc);
+    writer.put_u32(crc);
+}
+
+bool read_record(std::string_view data, size_t offset, RollupRecord& type,
+                 std::string_view& payload, size_t& next) {
+    if (offset > data.size() || data.size() - offset < ROLLUP_RECORD_OVERHEAD) {
+        return false;
+    }
+    ByteReader in(data.substr(offset));
+    uint8_t raw_type = in.get_u8();
+    uint32_t length = in.get_u32();
+    payload = in.get_bytes(length);
+    uint32_t stored_crc = in.get_u32();
+    if (!in.ok()) {
+        return false;
+    }
+    uint32_t crc = crc32c(data.data() + offset, 1);
+    crc = crc32c(payload.data(), payload.size(), crc);
+    if (crc != stored_crc) {
+        return false;
+    }
+    type = static_cast<RollupRecord>(raw_type);
+    next = offset + ROLLUP_RECORD_OVERHEAD + length;
+    return true;
+}
+
+bool decode_series(std::string_view payload, SeriesInfo& info) {
+    ByteReader in(payload);
+    info.id = in.get_u32();
+    uint8_t type = in.get_u8();
+    info.name = std::string(in.get_string());
+    uint16_t tags = in.get_u16();
+    info.tags.clear();
+    for (uint16_t i = 0; i < tags && in.ok(); ++i) {
+        std::string key(in.get_string());
+        std::string value(in.get_string());
+        info.tags.emplace_back(std::move(key), std::move(value));
+    }
+    if (!in.ok() || type > static_cast<uint8_t>(MetricType::SUMMARY)) {
+        return false;
+    }
+    info.type = static_cast<MetricType>(type);
+    return true;
+}
+
+bool decode_rollup(std::string_view payload, uint32_t& file_id, RollupPoint& point) {
+    ByteReader in(payload);
+    file_id = in.get_u32();
+    point.start_ms = in.get_i64();
+    point.count = in.get_u64();
+    point.sum = in.get_f64();
+    point.min = in.get_f64();
+    point.max = in.get_f64();
+    point.last = in.get_f64();
+    point.last_ms = in.get_i64();
+    if (!in.ok()) {
+        return false;
+    }
+    return in.remaining() == 0 || point.sketch.deserialize(in.get_bytes(in.remaining()));
+}
+
+bool matches(const SeriesInfo& info, const SeriesQuery& query) {
+    if (!query.name.empty() && info.name != query.name) {
+        return false;
+    }
+    for (const auto& wanted : query.tags) {
+        if (std::find(info.tags.begin(), info.tags.end(), wanted) == info.tags.end()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string series_key(const SeriesInfo& info) {
+    std::string key = info.name;
+    for (const auto& [k, v] : info.tags) {
+        key.push_back('\0');
+        key.append(k);
+        key.push_back('\0');
+        key.append(v);
+    }
+    return key;
+}
+
+} // namespace
+
+size_t rollup_resolution_index(std::string_view name) {
+    for (size_t i = 0; i < ROLLUP_RESOLUTION_COUNT; ++i) {
+        if (ROLLUP_RESOLUTIONS[i].name == name) return i;
+    }
+    return ROLLUP_RESOLUTION_COUNT;
+}
+
+// ============================================================================
+// RollupPoint
+// ============================================================================
+
+void RollupPoint::add(int64_t timestamp_ms, double value, bool sketched) {
+    count++;
+    sum += value;
+    if (value < min) min = value;
+    if (value > max) max = value;
+    if (timestamp_ms >= last_ms) {
+        last = value;
+        last_ms = timestamp_ms;
+    }
+    if (sketched) {
+        sketch.add(value);
+    }
+}
+
+void RollupPoint::merge(const RollupPoint& other) {
+    count += other.count;
+    sum += other.sum;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+    if (other.last_ms >= last_ms) {
+        last = other.last;
+        last_ms = other.last_ms;
+    }
+    sketch.merge(other.sketch);
+}
+
+std::vector<DataPoint> counter_rates(const std::vector<RollupPoint>& points) {
+    std::vector<DataPoint> rates;
+    for (size_t i = 1; i < points.size(); ++i) {
+        const RollupPoint& previous = points[i - 1];
+        const RollupPoint& current = points[i];
+        if (current.last_ms <= previous.last_ms) {
+            continue;
+        }
+        double seconds = static_cast<double>(current.last_ms - previous.last_ms) / 1000.0;
+        double increase = current.last >= previous.last ? current.last - previous.last : current.last;
+        rates.push_back(DataPoint{current.start_ms, increase / seconds});
+    }
+    return rates;
+}
+
+// ============================================================================
+// RollupAggregator
+// ============================================================================
+
+// The open bucket of a series starting at `start`, created if need be
+RollupPoint& RollupAggregator::open_bucket(uint32_t series_id, MetricType type, size_t resolution, int64_t start) {
+    if (series_id >= series_.size()) {
+        series_.resize(static_cast<size_t>(series_id) + 1);
+    }
+    SeriesState& state = series_[series_id];
+    state.type = type;
+    if (!state.listed) {
+        active_.push_back(series_id);
+        state.listed = true;
+    }
+    std::vector<RollupPoint>& open = state.open[resolution];
+    auto it = std::find_if(open.begin(), open.end(),
+                           [start](const RollupPoint& p) { return p.start_ms == start; });
+    if (it != open.end()) {
+        return *it;
+    }
+    open.emplace_back();
+    open.back().start_ms = start;
+    open_buckets_++;
+    next_close_ms_ = std::min(next_close_ms_, start + ROLLUP_RESOLUTIONS[resolution].ms + lateness_ms_);
+    return open.back();
+}
+
+void RollupAggregator::add(const MetricBatch& batch) {
+    for (const Metric& metric : batch.metrics) {
+        bool sketched = is_sketched(metric.type);
+        int64_t ts = to_epoch_ms(metric.timestamp);
+        for (size_t r = 0; r < ROLLUP_RESOLUTION_COUNT; ++r) {
+            int64_t start = bucket_start(ts, ROLLUP_RESOLUTIONS[r].ms);
+            open_bucket(metric.series_id, metric.type, r, start).add(ts, metric.value, sketched);
+        }
+        points_added_++;
+    }
+}
+
+// Phase 34: u32 series; each: u32 id, u8 type, then per resolution u32 n
+// and n buckets as in ROLLUP records, with a u32 sketch length
+void RollupAggregator::save(std::string& out) const {
+    ByteWriter w(out);
+    w.put_u32(static_cast<uint32_t>(active_.size()));
+    for (uint32_t id : active_) {
+        const SeriesState& state = series_[id];
+        w.put_u32(id);
+        w.put_u8(static_cast<uint8_t>(state.type));
+        for (const std::vector<RollupPoint>& open : state.open) {
+            w.put_u32(static_cast<uint32_t>(open.size()));
+            for (const RollupPoint& point : open) {
+                w.put_i64(point.start_ms);
+                w.put_u64(point.count);
+                w.put_f64(point.sum);
+                w.put_f64(point.min);
+                w.put_f64(point.max);
+                w.put_f64(point.last);
+                w.put_i64(point.last_ms);
+                size_t length_at = w.size();
+                w.put_u32(0);
+                if (!point.sketch.empty()) {
+                    point.sketch.serialize(out);
+                }
+                w.patch_u32(length_at, static_cast<uint32_t>(w.size() - length_at - 4));
+            }
+        }
+    }
+}
+
+bool RollupAggregator::load(std::string_view data, const std::vector<uint32_t>& ids) {
+    struct Saved {
+        uint32_t id;
+        MetricType type;
+        size_t resolution;
+        RollupPoint point;
+    };
+    // Decode everything first, so corrupt data leaves the buckets alone
+    std::vector<Saved> saved;
+    ByteReader in(data);
+    uint32_t series = in.get_u32();
+    for (uint32_t i = 0; i < series && in.ok(); ++i) {
+        uint32_t id = in.get_u32();
+        uint8_t type = in.get_u8();
+        if (id >= ids.size() || type > static_cast<uint8_t>(MetricType::SUMMARY)) {
+            return false;
+        }
+        for (size_t r = 0; r < ROLLUP_RESOLUTION_COUNT && in.ok(); ++r) {
+            uint32_t buckets = in.get_u32();
+            for (uint32_t b = 0; b < buckets && in.ok(); ++b) {
+                Saved entry{ids[id], static_cast<MetricType>(type), r, RollupPoint()};
+                RollupPoint& point = entry.point;
+                point.start_ms = in.get_i64();
+                point.count = in.get_u64();
+                point.sum = in.get_f64();
+                point.min = in.get_f64();
+                point.max = in.get_f64();
+                point.last = in.get_f64();
+                point.last_ms = in.get_i64();
+                std::string_view sketch = in.get_bytes(in.get_u32());
+                if (!sketch.empty() && !point.sketch.deserialize(sketch)) {
+                    return false;
+                }
+                saved.push_back(std::move(entry));
+            }
+        }
+    }
+    if (!in.ok() || in.remaining() != 0) {
+        return false;
+    }
+    for (const Saved& entry : saved) {
+        open_bucket(entry.id, entry.type, entry.resolution, entry.point.start_ms).merge(entry.point);
+    }
+    return true;
+}
+
+size_t RollupAggregator::close(int64_t now_ms, const Emit& emit) {
+    if (now_ms < next_close_ms_) {
+        return 0;
+    }
+    return close_before(now_ms - lateness_ms_, emit);
+}
+
+size_t RollupAggregator::close_all(const Emit& emit) {
+    return close_before(std::numeric_limits<int64_t>::max(), emit);
+}
+
+size_t RollupAggregator::close_before(int64_t cutoff_ms, const Emit& emit) {
+    size_t emitted = 0;
+    size_t kept = 0;
+    next_close_ms_ = std::numeric_limits<int64_t>::max();
+    for (uint32_t id : active_) {
+        SeriesState& state = series_[id];
+        bool any_open = false;
+        for (size_t r = 0; r < ROLLUP_RESOLUTION_COUNT; ++r) {
+            int64_t width = ROLLUP_RESOLUTIONS[r].ms;
+            std::vector<RollupPoint>& open = state.open[r];
+            for (size_t i = 0; i < open.size();) {
+                if (open[i].start_ms <= cutoff_ms - width) {
+                    emit(r, id, state.type, open[i]);
+                    emitted++;
+                    open[i] = std::move(open.back());
+                    open.pop_back();
+                    continue;
+                }
+                next_close_ms_ = std::min(next_close_ms_, open[i].start_ms + width + lateness_ms_);
+                ++i;
+            }
+            any_open = any_open || !open.empty();
+        }
+        if (any_open) {
+            active_[kept++] = id;
+        } else {
+            state.listed = false;
+        }
+    }
+    active_.resize(kept);
+    open_buckets_ -= emitted;
+    return emitted;
+}
+
+// ============================================================================
+// RollupWriter
+// ============================================================================
+
+std::vector<std::string> list_rollup_files(const std::string& directory, size_t resolution) {
+    std::string prefix = file_prefix(resolution);
+    std::vector<std::string> names;
+    if (DIR* dir = opendir(directory.c_str())) {
+        while (dirent* entry = readdir(dir)) {
+            std::string_view name = entry->d_name;
+            if (name.size() > prefix.size() + ROLLUP_SUFFIX.size() &&
+                name.substr(0, prefix.size()) == prefix &&
+                name.substr(name.size() - ROLLUP_SUFFIX.size()) == ROLLUP_SUFFIX) {
+                names.emplace_back(name);
+            }
+        }
+        closedir(dir);
+    }
+    // Sequences are zero-padded, so name order is creation order
+    std::sort(names.begin(), names.end());
+    for (auto& name : names) {
+        name = directory + "/" + name;
+    }
+    return names;
+}
+
+RollupWriter::RollupWriter(Options options) : options_(std::move(options)) {
+    for (auto& stream : streams_) {
+        stream = std::make_unique<Stream>(options_.fsync);
+    }
+    if (mkdir(options_.directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "Warning: Could not create rollup directory "
+                  << options_.directory << std::endl;
+        usable_ = false;
+        return;
+    }
+    // One sequence for every resolution, after the newest existing file
+    for (size_t r = 0; r < ROLLUP_RESOLUTION_COUNT; ++r) {
+        auto existing = list_rollup_files(options_.directory, r);
+        if (!existing.empty()) {
+            sequence_ = std::max(sequence_, file_sequence(existing.back()) + 1);
+        }
+    }
+}
+
+RollupWriter::~RollupWriter() {
+    flush();
+}
+
+bool RollupWriter::ensure_file(size_t resolution) {
+    Stream& stream = *streams_[resolution];
+    if (stream.file.is_open()) {
+        return true;
+    }
+    if (!usable_) {
+        return false;
+    }
+
+    std::string prefix = file_prefix(resolution);
+    for (int attempt = 0; attempt < MAX_OPEN_ATTEMPTS; ++attempt) {
+        char name[48];
+        std::snprintf(name, sizeof(name), "%s%020llu.rlp", prefix.c_str(),
+                      static_cast<unsigned long long>(sequence_++));
+        stream.path = options_.directory + "/" + name;
+        if (stream.file.open(stream.path, /*exclusive=*/true)) {
+            break;
+        }
+        if (errno != EEXIST) {
+            break;
+        }
+    }
+    if (!stream.file.is_open()) {
+        std::cerr << "Warning: Could not open rollup file " << stream.path << " for writing" << std::endl;
+        open_errors_++;
+        stream.path.clear();
+        return false;
+    }
+
+    ByteWriter header(stream.pending);
+    header.put_bytes(ROLLUP_MAGIC.data(), ROLLUP_MAGIC.size());
+    header.put_u32(ROLLUP_VERSION);
+    header.put_u32(static_cast<uint32_t>(ROLLUP_RESOLUTIONS[resolution].ms));
+    stream.written = 0;
+    stream.file_ids.clear();
+    stream.next_id = 0;
+    return true;
+}
+
+uint32_t RollupWriter::file_series(Stream& stream, uint32_t series_id, MetricType type) {
+    if (series_id >= stream.file_ids.size()) {
+        stream.file_ids.resize(static_cast<size_t>(series_id) + 1, NO_SERIES);
+    }
+    uint32_t& slot = stream.file_ids[series_id];
+    if (slot != NO_SERIES) {
+        return slot;
+    }
+
+    slot = stream.next_id++;
+    const SeriesKey& key = SeriesRegistry::global().key(series_id);
+    size_t start = begin_record(stream.pending, RollupRecord::SERIES);
+    ByteWriter out(stream.pending);
+    out.put_u32(slot);
+    out.put_u8(static_cast<uint8_t>(type));
+    out.put_string(key.name);
+    size_t tags = std::min<size_t>(key.tags.size(), 0xFFFF);
+    out.put_u16(static_cast<uint16_t>(tags));
+    for (size_t i = 0; i < tags; ++i) {
+        out.put_string(key.tags[i].first);
+        out.put_string(key.tags[i].second);
+    }
+    end_record(stream.pending, start);
+    return slot;
+}
+
+void RollupWriter::append(size_t resolution, uint32_t series_id, MetricType type, const RollupPoint& point) {
+    if (resolution >= ROLLUP_RESOLUTION_COUNT) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    StagedKey key{series_id, static_cast<uint32_t>(resolution), point.start_ms};
+    auto [it, inserted] = staged_.try_emplace(key, Staged{type, point});
+    if (!inserted) {
+        it->second.point.merge(point);
+    }
+}
+
+void RollupWriter::encode(size_t resolution, uint32_t series_id, MetricType type, const RollupPoint& point) {
+    if (!ensure_file(resolution)) {
+        return;
+    }
+    Stream& stream = *streams_[resolution];
+    uint32_t file_id = file_series(stream, series_id, type);
+
+    size_t start = begin_record(stream.pending, RollupRecord::ROLLUP);
+    ByteWriter out(stream.pending);
+    out.put_u32(file_id);
+    out.put_i64(point.start_ms);
+    out.put_u64(point.count);
+    out.put_f64(point.sum);
+    out.put_f64(point.min);
+    out.put_f64(point.max);
+    out.put_f64(point.last);
+    out.put_i64(point.last_ms);
+    if (!point.sketch.empty()) {
+        point.sketch.serialize(stream.pending);
+    }
+    end_record(stream.pending, start);
+    rollups_written_++;
+}
+
+bool RollupWriter::commit() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return commit_locked();
+}
+
+bool RollupWriter::commit_locked() {
+    for (const auto& [key, staged] : staged_) {
+        encode(key.resolution, key.series_id, staged.type, staged.point);
+    }
+    staged_.clear();
+
+    bool ok = true;
+    for (auto& stream : streams_) {
+        if (stream->pending.empty()) {
+            stream->file.sync_if_due();
+            continue;
+        }
+        ok = stream->file.write(stream->pending) && ok;
+        stream->written += stream->pending.size();
+        stream->pending.clear();
+        if (stream->written >= options_.max_file_bytes) {
+            stream->file.close();   // The next record opens a new file
+        }
+    }
+    return ok;
+}
+
+bool RollupWriter::flush() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool ok = commit_locked();
+    for (auto& stream : streams_) {
+        stream->file.sync();
+    }
+    return ok;
+}
+
+uint64_t RollupWriter::rollups_written() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return rollups_written_;
+}
+
+uint64_t RollupWriter::write_errors() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t errors = open_errors_;
+    for (const auto& stream : streams_) {
+        errors += stream->file.write_errors();
+    }
+    return errors;
+}
+
+// ============================================================================
+// Queries
+// ============================================================================
+
+std::vector<RollupSeries> query_rollups(const std::string& directory, size_t resolution,
+                                        const SeriesQuery& query) {
+    std::vector<RollupSeries> result;
+    if (resolution >= ROLLUP_RESOLUTION_COUNT) {
+        return result;
+    }
+    std::unordered_map<std::string, size_t> by_key;
+
+    for (const std::string& path : list_rollup_files(directory, resolution)) {
+        MappedFile file;
+        if (!file.open(path)) {
+            continue;
+        }
+        std::string_view data = file.data();
+        ByteReader header(data);
+        std::string_view magic = header.get_bytes(ROLLUP_MAGIC.size());
+        uint32_t version = header.get_u32();
+        uint32_t width = header.get_u32();
+        if (!header.ok() || magic != ROLLUP_MAGIC || version != ROLLUP_VERSION ||
+            width != static_cast<uint32_t>(ROLLUP_RESOLUTIONS[resolution].ms)) {
+            continue;
+        }
+
+        // File id -> index into result, or NO_SERIES if it does not match
+        std::vector<uint32_t> file_series;
+        size_t offset = ROLLUP_HEADER_SIZE;
+        RollupRecord type;
+        std::string_view payload;
+        size_t next;
+        while (read_record(data, offset, type, payload, next)) {
+            offset = next;
+            if (type == RollupRecord::SERIES) {
+                SeriesInfo info;
+                if (!decode_series(payload, info)) {
+                    continue;
+                }
+                if (info.id >= file_series.size()) {
+                    file_series.resize(static_cast<size_t>(info.id) + 1, NO_SERIES);
+                }
+                if (!matches(info, query)) {
+                    file_series[info.id] = NO_SERIES;
+                    continue;
+                }
+                auto [it, inserted] = by_key.try_emplace(series_key(info), result.size());
+                if (inserted) {
+                    result.emplace_back();
+                    result.back().info = info;
+                    result.back().info.id = static_cast<uint32_t>(it->second);
+                }
+                file_series[info.id] = static_cast<uint32_t>(it->second);
+            } else if (type == RollupRecord::ROLLUP) {
+                uint32_t file_id;
+                RollupPoint point;
+                if (!decode_rollup(payload, file_id, point) || file_id >= file_series.size() ||
+                    file_series[file_id] == NO_SERIES ||
+                    point.start_ms < query.start_ms || point.start_ms > query.end_ms) {
+                    continue;
+                }
+                result[file_series[file_id]].points.push_back(std::move(point));
+            }
+        }
+    }
+
+    // Late points wrote a bucket more than once: add the records up
+    for (RollupSeries& series : result) {
+        auto& points = series.points;
+        std::stable_sort(points.begin(), points.end(), [](const RollupPoint& a, const RollupPoint& b) {
+            return a.start_ms < b.start_ms;
+        });
+        size_t kept = 0;
+        for (size_t i = 0; i < points.size(); ++i) {
+            if (kept > 0 && points[kept - 1].start_ms == points[i].start_ms) {
+                points[kept - 1].merge(points[i]);
+            } else {
+                if (kept != i) points[kept] = std::move(points[i]);
+                kept++;
+            }
+        }
+        points.resize(kept);
+    }
+    // Series with no rollups in the range are left out
+    result.erase(std::remove_if(result.begin(), result.end(),
+                                [](const RollupSeries& s) { return s.points.empty(); }),
+                 result.end());
+    return result;
+}
+
+} // namespace metricstream
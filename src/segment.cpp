@@ -0,0 +1,585 @@
+#include "segment.h"
+#include "common.h"
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+
+namespace metricstream {
+
+namespace {
+
+constexpr std::string_view SEGMENT_PREFIX = "segment-";
+constexpr std::string_view SEGMENT_SUFFIX = ".seg";
+
+// Give up after this many existing files with the sequence we picked
+constexpr int MAX_OPEN_ATTEMPTS = 16;
+
+bool is_segment_name(std::string_view name) {
+    return name.size() > SEGMENT_PREFIX.size() + SEGMENT_SUFFIX.size() &&
+           name.substr(0, SEGMENT_PREFIX.size()) == SEGMENT_PREFIX &&
+           name.substr(name.size() - SEGMENT_SUFFIX.size()) == SEGMENT_SUFFIX;
+}
+
+uint64_t segment_sequence(std::string_view path) {
+    size_t slash = path.rfind('/');
+    std::string_view name = slash == std::string_view::npos ? path : path.substr(slash + 1);
+    uint64_t sequence = 0;
+    for (size_t i = SEGMENT_PREFIX.size(); i < name.size() - SEGMENT_SUFFIX.size(); ++i) {
+        if (name[i] < '0' || name[i] > '9') return 0;
+        sequence = sequence * 10 + static_cast<uint64_t>(name[i] - '0');
+    }
+    return sequence;
+}
+
+int64_t to_epoch_ms(Timestamp ts) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(ts.time_since_epoch()).count();
+}
+
+} // namespace
+
+std::vector<std::string> list_segment_files(const std::string& directory) {
+    std::vector<std::string> names;
+    if (DIR* dir = opendir(directory.c_str())) {
+        while (dirent* entry = readdir(dir)) {
+            if (is_segment_name(entry->d_name)) {
+                names.emplace_back(entry->d_name);
+            }
+        }
+        closedir(dir);
+    }
+    // Sequences are zero-padded, so name order is creation order
+    std::sort(names.begin(), names.end());
+    for (auto& name : names) {
+        name = directory + "/" + name;
+    }
+    return names;
+}
+
+// ============================================================================
+// SegmentWriter
+// ============================================================================
+
+SegmentWriter::SegmentWriter(Options options)
+    : options_(std::move(options)), file_(options_.fsync) {
+    if (options_.block_points == 0) {
+        options_.block_points = 1;
+    }
+    if (mkdir(options_.directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "Warning: Could not create segment directory "
+                  << options_.directory << std::endl;
+        usable_ = false;
+        return;
+    }
+    // Continue after the newest existing segment
+    auto existing = list_segment_files(options_.directory);
+    if (!existing.empty()) {
+        next_sequence_ = segment_sequence(existing.back()) + 1;
+    }
+}
+
+SegmentWriter::~SegmentWriter() {
+    roll();
+}
+
+bool SegmentWriter::ensure_segment() {
+    if (file_.is_open()) {
+        return true;
+    }
+    if (!usable_) {
+        return false;
+    }
+
+    for (int attempt = 0; attempt < MAX_OPEN_ATTEMPTS; ++attempt) {
+        char name[48];
+        std::snprintf(name, sizeof(name), "segment-%020llu.seg",
+                      static_cast<unsigned long long>(next_sequence_++));
+        path_ = options_.directory + "/" + name;
+        if (file_.open(path_, /*exclusive=*/true)) {
+            break;
+        }
+        if (errno != EEXIST) {
+            break;
+        }
+    }
+    if (!file_.is_open()) {
+        std::cerr << "Warning: Could not open segment " << path_ << " for writing" << std::endl;
+        open_errors_++;
+        path_.clear();
+        return false;
+    }
+
+    ByteWriter header(pending_);
+    header.put_bytes(SEGMENT_MAGIC.data(), SEGMENT_MAGIC.size());
+    header.put_u32(SEGMENT_VERSION);
+    header.put_u32(0);
+    segment_written_ = 0;
+    return true;
+}
+
+void SegmentWriter::append(const MetricBatch& batch) {
+    if (batch.empty() || !ensure_segment()) {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    for (const auto& metric : batch.metrics) {
+        Series& series = series_[series_for(metric)];
+        if (!series.in_segment) {
+            write_series_record(series);
+        }
+
+        int64_t ts = to_epoch_ms(metric.timestamp);
+        if (series.block.count() == 0) {
+            series.min_timestamp_ms = ts;
+            series.max_timestamp_ms = ts;
+            series.opened = now;
+            if (!series.listed) {
+                if (open_blocks_.empty()) oldest_open_ = now;
+                open_blocks_.push_back(series.info.id);
+                series.listed = true;
+            }
+        } else {
+            series.min_timestamp_ms = std::min(series.min_timestamp_ms, ts);
+            series.max_timestamp_ms = std::max(series.max_timestamp_ms, ts);
+        }
+        series.block.append(ts, metric.value);
+        points_written_++;
+
+        if (series.block.count() >= options_.block_points) {
+            seal_block(series);
+        }
+    }
+}
+
+uint32_t SegmentWriter::series_for(const Metric& metric) {
+    // Phase 22: The registry already canonicalized the series; map its id
+    if (metric.series_id >= series_ids_.size()) {
+        series_ids_.resize(static_cast<size_t>(metric.series_id) + 1, NO_SERIES);
+    }
+    uint32_t& slot = series_ids_[metric.series_id];
+    if (slot != NO_SERIES) {
+        return slot;
+    }
+
+    uint32_t id = static_cast<uint32_t>(series_.size());
+    const SeriesKey& key = metric.series();
+    series_.emplace_back();
+    SeriesInfo& info = series_.back().info;
+    info.id = id;
+    info.type = metric.type;
+    info.name = key.name;
+    info.tags = key.tags;
+    slot = id;
+    return id;
+}
+
+size_t SegmentWriter::begin_record(SegmentRecord type) {
+    size_t start = pending_.size();
+    ByteWriter out(pending_);
+    out.put_u8(static_cast<uint8_t>(type));
+    out.put_u32(0);   // Payload length, patched by end_record()
+    return start;
+}
+
+void SegmentWriter::end_record(size_t start) {
+    size_t payload = pending_.size() - start - 5;
+    ByteWriter out(pending_);
+    out.patch_u32(start + 1, static_cast<uint32_t>(payload));
+    uint32_t crc = crc32c(pending_.data() + start, 1);
+    crc = crc32c(pending_.data() + start + 5, payload, crc);
+    out.put_u32(crc);
+}
+
+void SegmentWriter::write_series_record(Series& series) {
+    const SeriesInfo& info = series.info;
+    uint64_t offset = segment_written_ + pending_.size();
+    size_t start = begin_record(SegmentRecord::SERIES);
+    ByteWriter out(pending_);
+    out.put_u32(info.id);
+    out.put_u8(static_cast<uint8_t>(info.type));
+    out.put_string(info.name);
+    size_t tags = std::min<size_t>(info.tags.size(), 0xFFFF);
+    out.put_u16(static_cast<uint16_t>(tags));
+    for (size_t i = 0; i < tags; ++i) {
+        out.put_string(info.tags[i].first);
+        out.put_string(info.tags[i].second);
+    }
+    end_record(start);
+    series_offsets_.emplace_back(info.id, offset);
+    series.in_segment = true;
+}
+
+void SegmentWriter::seal_block(Series& series) {
+    if (series.block.count() == 0) {
+        return;
+    }
+    BlockInfo block;
+    block.series_id = series.info.id;
+    block.count = series.block.count();
+    block.min_timestamp_ms = series.min_timestamp_ms;
+    block.max_timestamp_ms = series.max_timestamp_ms;
+    block.offset = segment_written_ + pending_.size();
+
+    size_t start = begin_record(SegmentRecord::BLOCK);
+    ByteWriter out(pending_);
+    out.put_u32(block.series_id);
+    out.put_u32(block.count);
+    out.put_i64(block.min_timestamp_ms);
+    out.put_i64(block.max_timestamp_ms);
+    out.put_bytes(series.block.bytes().data(), series.block.bytes().size());
+    end_record(start);
+
+    blocks_.push_back(block);
+    blocks_written_++;
+    series.block.clear();
+}
+
+bool SegmentWriter::commit() {
+    if (!file_.is_open()) {
+        return usable_;
+    }
+
+    // Seal blocks that have waited long enough; keep the rest open
+    auto now = std::chrono::steady_clock::now();
+    size_t kept = 0;
+    for (uint32_t id : open_blocks_) {
+        Series& series = series_[id];
+        if (series.block.count() > 0 && now - series.opened >= options_.max_block_age) {
+            seal_block(series);
+        }
+        if (series.block.count() == 0) {
+            series.listed = false;
+            continue;
+        }
+        if (kept == 0 || series.opened < oldest_open_) {
+            oldest_open_ = series.opened;
+        }
+        open_blocks_[kept++] = id;
+    }
+    open_blocks_.resize(kept);
+
+    bool ok = flush_pending();
+    if (segment_written_ >= options_.max_segment_bytes) {
+        ok = roll() && ok;
+    }
+    return ok;
+}
+
+std::chrono::milliseconds SegmentWriter::sync_if_due() {
+    auto delay = file_.sync_if_due();
+    if (open_blocks_.empty()) {
+        return delay;
+    }
+    // Wake in time to seal the oldest open block
+    auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - oldest_open_);
+    auto until_seal = waited >= options_.max_block_age
+        ? std::chrono::milliseconds(1) : options_.max_block_age - waited;
+    return std::min(delay, until_seal);
+}
+
+bool SegmentWriter::flush() {
+    if (!file_.is_open()) {
+        return usable_;
+    }
+    for (uint32_t id : open_blocks_) {
+        seal_block(series_[id]);
+        series_[id].listed = false;
+    }
+    open_blocks_.clear();
+
+    uint64_t errors = file_.write_errors();
+    bool ok = commit();
+    file_.sync();
+    return ok && file_.write_errors() == errors;
+}
+
+bool SegmentWriter::flush_pending() {
+    if (pending_.empty()) {
+        return true;
+    }
+    bool ok = file_.write(pending_);
+    segment_written_ += pending_.size();
+    pending_.clear();
+    return ok;
+}
+
+bool SegmentWriter::roll() {
+    if (!file_.is_open()) {
+        return true;
+    }
+
+    for (uint32_t id : open_blocks_) {
+        seal_block(series_[id]);
+        series_[id].listed = false;
+    }
+    open_blocks_.clear();
+
+    uint64_t index_offset = segment_written_ + pending_.size();
+    size_t start = begin_record(SegmentRecord::INDEX);
+    ByteWriter out(pending_);
+    out.put_u32(static_cast<uint32_t>(series_offsets_.size()));
+    for (const auto& [id, offset] : series_offsets_) {
+        out.put_u32(id);
+        out.put_u64(offset);
+    }
+    out.put_u32(static_cast<uint32_t>(blocks_.size()));
+    for (const BlockInfo& block : blocks_) {
+        out.put_u32(block.series_id);
+        out.put_u32(block.count);
+        out.put_i64(block.min_timestamp_ms);
+        out.put_i64(block.max_timestamp_ms);
+        out.put_u64(block.offset);
+    }
+    end_record(start);
+    out.put_u64(index_offset);
+    out.put_bytes(SEGMENT_TRAILER_MAGIC.data(), SEGMENT_TRAILER_MAGIC.size());
+
+    bool ok = flush_pending();
+    file_.close();
+    segments_sealed_++;
+
+    series_offsets_.clear();
+    blocks_.clear();
+    for (Series& series : series_) {
+        series.in_segment = false;
+    }
+    path_.clear();
+    return ok;
+}
+
+// ============================================================================
+// SegmentReader
+// ============================================================================
+
+bool SegmentReader::open(const std::string& path) {
+    path_ = path;
+    series_.clear();
+    blocks_.clear();
+    series_by_id_.clear();
+    sealed_ = false;
+    scan_offset_ = SEGMENT_HEADER_SIZE;
+    error_.clear();
+
+    if (!map_and_check()) {
+        return false;
+    }
+    if (!try_load_index()) {
+        scan_records();
+    }
+    return true;
+}
+
+bool SegmentReader::refresh() {
+    if (sealed_ || path_.empty()) {
+        return false;
+    }
+    size_t old_size = data_.size();
+    if (!map_and_check() || data_.size() == old_size) {
+        return false;
+    }
+    if (try_load_index()) {
+        return true;
+    }
+    return scan_records();
+}
+
+bool SegmentReader::map_and_check() {
+    data_ = {};
+    if (!file_.open(path_)) {
+        error_ = "cannot map " + path_;
+        return false;
+    }
+    data_ = file_.data();
+
+    ByteReader header(data_);
+    std::string_view magic = header.get_bytes(SEGMENT_MAGIC.size());
+    uint32_t version = header.get_u32();
+    if (!header.ok() || magic != SEGMENT_MAGIC) {
+        error_ = "not a segment file";
+        return false;
+    }
+    if (version != SEGMENT_VERSION) {
+        error_ = "unsupported segment version " + std::to_string(version);
+        return false;
+    }
+    return true;
+}
+
+bool SegmentReader::try_load_index() {
+    if (data_.size() < SEGMENT_HEADER_SIZE + SEGMENT_TRAILER_SIZE) {
+        return false;
+    }
+    ByteReader trailer(data_.substr(data_.size() - SEGMENT_TRAILER_SIZE));
+    uint64_t index_offset = trailer.get_u64();
+    if (trailer.get_bytes(SEGMENT_TRAILER_MAGIC.size()) != SEGMENT_TRAILER_MAGIC) {
+        return false;
+    }
+
+    // The index lists everything; replace whatever a scan found
+    std::vector<SeriesInfo> old_series;
+    std::vector<BlockInfo> old_blocks;
+    old_series.swap(series_);
+    old_blocks.swap(blocks_);
+    series_by_id_.clear();
+    if (load_index(index_offset)) {
+        sealed_ = true;
+        return true;
+    }
+
+    series_.swap(old_series);
+    blocks_.swap(old_blocks);
+    series_by_id_.clear();
+    for (size_t i = 0; i < series_.size(); ++i) {
+        series_by_id_[series_[i].id] = i;
+    }
+    return false;
+}
+
+const SeriesInfo* SegmentReader::find_series(uint32_t id) const {
+    auto it = series_by_id_.find(id);
+    return it == series_by_id_.end() ? nullptr : &series_[it->second];
+}
+
+bool SegmentReader::read_record(uint64_t offset, SegmentRecord& type, std::string_view& payload,
+                                uint64_t* next) const {
+    if (offset < SEGMENT_HEADER_SIZE || offset > data_.size() ||
+        data_.size() - offset < SEGMENT_RECORD_OVERHEAD) {
+        return false;
+    }
+    ByteReader in(std::string_view(data_).substr(offset));
+    uint8_t raw_type = in.get_u8();
+    uint32_t length = in.get_u32();
+    payload = in.get_bytes(length);
+    uint32_t stored_crc = in.get_u32();
+    if (!in.ok()) {
+        return false;
+    }
+    uint32_t crc = crc32c(data_.data() + offset, 1);
+    crc = crc32c(payload.data(), payload.size(), crc);
+    if (crc != stored_crc) {
+        return false;
+    }
+    type = static_cast<SegmentRecord>(raw_type);
+    if (next) {
+        *next = offset + SEGMENT_RECORD_OVERHEAD + length;
+    }
+    return true;
+}
+
+bool SegmentReader::load_index(uint64_t index_offset) {
+    SegmentRecord type;
+    std::string_view payload;
+    if (!read_record(index_offset, type, payload) || type != SegmentRecord::INDEX) {
+        return false;
+    }
+
+    ByteReader in(payload);
+    uint32_t series_count = in.get_u32();
+    for (uint32_t i = 0; i < series_count && in.ok(); ++i) {
+        in.get_u32();   // Id, repeated inside the record
+        uint64_t offset = in.get_u64();
+        std::string_view series_payload;
+        if (!in.ok() || !read_record(offset, type, series_payload) ||
+            type != SegmentRecord::SERIES || !add_series(series_payload)) {
+            return false;
+        }
+    }
+
+    uint32_t block_count = in.get_u32();
+    blocks_.reserve(block_count);
+    for (uint32_t i = 0; i < block_count && in.ok(); ++i) {
+        BlockInfo block;
+        block.series_id = in.get_u32();
+        block.count = in.get_u32();
+        block.min_timestamp_ms = in.get_i64();
+        block.max_timestamp_ms = in.get_i64();
+        block.offset = in.get_u64();
+        blocks_.push_back(block);
+    }
+    return in.ok();
+}
+
+bool SegmentReader::scan_records() {
+    // No trailer: take every intact record up to the first torn one, which
+    // may just be still in flight
+    SegmentRecord type;
+    std::string_view payload;
+    uint64_t next;
+    bool changed = false;
+    while (read_record(scan_offset_, type, payload, &next)) {
+        if (type == SegmentRecord::SERIES) {
+            changed = add_series(payload) || changed;
+        } else if (type == SegmentRecord::BLOCK) {
+            changed = add_block(payload, scan_offset_) || changed;
+        }
+        scan_offset_ = next;
+    }
+    return changed;
+}
+
+bool SegmentReader::add_series(std::string_view payload) {
+    ByteReader in(payload);
+    SeriesInfo info;
+    info.id = in.get_u32();
+    uint8_t type = in.get_u8();
+    info.name = std::string(in.get_string());
+    uint16_t tags = in.get_u16();
+    for (uint16_t i = 0; i < tags && in.ok(); ++i) {
+        std::string key(in.get_string());
+        std::string value(in.get_string());
+        info.tags.emplace_back(std::move(key), std::move(value));
+    }
+    if (!in.ok() || type > static_cast<uint8_t>(MetricType::SUMMARY)) {
+        return false;
+    }
+    info.type = static_cast<MetricType>(type);
+    series_by_id_[info.id] = series_.size();
+    series_.push_back(std::move(info));
+    return true;
+}
+
+bool SegmentReader::add_block(std::string_view payload, uint64_t offset) {
+    ByteReader in(payload);
+    BlockInfo block;
+    block.series_id = in.get_u32();
+    block.count = in.get_u32();
+    block.min_timestamp_ms = in.get_i64();
+    block.max_timestamp_ms = in.get_i64();
+    block.offset = offset;
+    if (!in.ok()) {
+        return false;
+    }
+    blocks_.push_back(block);
+    return true;
+}
+
+bool SegmentReader::read_block(const BlockInfo& block, std::vector<DataPoint>& out) const {
+    SegmentRecord type;
+    std::string_view payload;
+    if (!read_record(block.offset, type, payload) || type != SegmentRecord::BLOCK) {
+        return false;
+    }
+    ByteReader in(payload);
+    uint32_t series_id = in.get_u32();
+    uint32_t count = in.get_u32();
+    in.get_i64();
+    in.get_i64();
+    if (!in.ok() || series_id != block.series_id || count != block.count) {
+        return false;
+    }
+
+    GorillaDecoder decoder(in.get_bytes(in.remaining()), count);
+    DataPoint point;
+    uint32_t decoded = 0;
+    while (decoder.next(point.timestamp_ms, point.value)) {
+        out.push_back(point);
+        decoded++;
+    }
+    return decoder.ok() && decoded == count;
+}
+
+} // namespace metricstream
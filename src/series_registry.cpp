@@ -0,0 +1,261 @@
+#include "series_registry.h"
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <utility>
+
+namespace metricstream {
+
+namespace {
+
+// Reused per thread so interning a known series does not allocate
+thread_local TagRefs tls_sorted;
+thread_local std::string tls_canonical;
+
+thread_local ScopedSeriesBudget* tls_budget = nullptr;
+
+void sort_tags(TagRefs& tags) {
+    std::stable_sort(tags.begin(), tags.end(),
+                     [](const auto& a, const auto& b) { return a.first < b.first; });
+    // Keep the last of duplicate keys, as assigning into a map would
+    size_t out = 0;
+    for (size_t i = 0; i < tags.size(); ++i) {
+        if (i + 1 < tags.size() && tags[i + 1].first == tags[i].first) {
+            continue;
+        }
+        tags[out++] = tags[i];
+    }
+    tags.resize(out);
+}
+
+void build_canonical(std::string& out, std::string_view name, const TagRefs& sorted) {
+    out.assign(name);
+    for (const auto& [key, value] : sorted) {
+        out.push_back('\0');
+        out.append(key);
+        out.push_back('\0');
+        out.append(value);
+    }
+}
+
+} // namespace
+
+ScopedSeriesBudget::ScopedSeriesBudget(size_t allowed, bool strip_tags)
+    : previous_(tls_budget), allowed_(allowed), strip_tags_(strip_tags) {
+    tls_budget = this;
+}
+
+ScopedSeriesBudget::~ScopedSeriesBudget() {
+    tls_budget = previous_;
+}
+
+const std::string* SeriesKey::tag(std::string_view key) const {
+    auto it = std::lower_bound(tags.begin(), tags.end(), key,
+                               [](const auto& tag, std::string_view k) { return tag.first < k; });
+    return it != tags.end() && it->first == key ? &it->second : nullptr;
+}
+
+SeriesRegistry::SeriesRegistry()
+    : shards_(new Shard[SHARDS]), chunks_(new std::atomic<SeriesKey*>[MAX_CHUNKS]) {
+    for (size_t i = 0; i < MAX_CHUNKS; ++i) {
+        chunks_[i].store(nullptr, std::memory_order_relaxed);
+    }
+    // Never charged to a budget in scope, even when this is global()'s first use
+    ScopedSeriesBudget* budget = std::exchange(tls_budget, nullptr);
+    intern_sorted("<overflow>", {});
+    tls_budget = budget;
+}
+
+SeriesRegistry::~SeriesRegistry() {
+    for (size_t i = 0; i < MAX_CHUNKS; ++i) {
+        delete[] chunks_[i].load(std::memory_order_relaxed);
+    }
+}
+
+SeriesRegistry& SeriesRegistry::global() {
+    static SeriesRegistry registry;
+    return registry;
+}
+
+uint32_t SeriesRegistry::intern(std::string_view name, const TagRef* tags, size_t count) {
+    tls_sorted.assign(tags, tags + count);
+    sort_tags(tls_sorted);
+    return intern_sorted(name, tls_sorted);
+}
+
+uint32_t SeriesRegistry::intern(std::string_view name, const TagList& tags) {
+    tls_sorted.clear();
+    for (const auto& [key, value] : tags) {
+        tls_sorted.emplace_back(key, value);
+    }
+    sort_tags(tls_sorted);
+    return intern_sorted(name, tls_sorted);
+}
+
+// Caller holds alloc_mutex_
+SeriesKey* SeriesRegistry::slot(uint32_t id) {
+    size_t chunk = id / CHUNK_SIZE;
+    SeriesKey* keys = chunks_[chunk].load(std::memory_order_relaxed);
+    if (keys == nullptr) {
+        keys = new SeriesKey[CHUNK_SIZE];
+        chunks_[chunk].store(keys, std::memory_order_release);
+    }
+    return &keys[id % CHUNK_SIZE];
+}
+
+size_t SeriesRegistry::shard_for(std::string_view canonical) {
+    // High bits pick the shard; the shard's map rehashes with its own
+    size_t hash = std::hash<std::string_view>{}(canonical);
+    return (hash >> (sizeof(size_t) * 8 - 16)) % SHARDS;
+}
+
+uint32_t SeriesRegistry::intern_sorted(std::string_view name, const TagRefs& sorted) {
+    std::string& canonical = tls_canonical;
+    build_canonical(canonical, name, sorted);
+
+    Shard& shard = shards_[shard_for(canonical)];
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.ids.find(canonical);
+        if (it != shard.ids.end()) {
+            return it->second;
+        }
+    }
+
+    ScopedSeriesBudget* budget = tls_budget;
+    if (budget && budget->created_ >= budget->allowed_) {
+        budget->refused_++;
+        if (!budget->strip_tags_ || sorted.empty()) {
+            return OVERFLOW_ID;
+        }
+        // The bare name is one series per metric, whatever the tags
+        tls_budget = nullptr;
+        uint32_t id = intern_sorted(name, {});
+        tls_budget = budget;
+        return id;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.ids.find(canonical);
+    if (it != shard.ids.end()) {
+        return it->second;
+    }
+
+    // New series are rare: assign ids one at a time, and fill the key
+    // before the id is published through the map or size()
+    std::lock_guard<std::mutex> alloc(alloc_mutex_);
+    uint32_t id = next_id_.load(std::memory_order_relaxed);
+    if (id >= CHUNK_SIZE * MAX_CHUNKS) {
+        return OVERFLOW_ID;
+    }
+    SeriesKey* key = slot(id);
+    key->name.assign(name);
+    key->tags.reserve(sorted.size());
+    for (const auto& [k, v] : sorted) {
+        key->tags.emplace_back(std::string(k), std::string(v));
+    }
+    key->canonical = canonical;
+    next_id_.store(id + 1, std::memory_order_release);
+    shard.ids.emplace(key->canonical, id);
+    if (budget) {
+        budget->created_++;
+    }
+    return id;
+}
+
+bool SeriesRegistry::split_canonical(std::string_view canonical, std::string_view& name, TagRefs& tags) {
+    tags.clear();
+    size_t end = canonical.find('\0');
+    name = canonical.substr(0, end);
+    while (end != std::string_view::npos) {
+        size_t key_start = end + 1;
+        size_t key_end = canonical.find('\0', key_start);
+        if (key_end == std::string_view::npos) {
+            return false;   // A key without a value
+        }
+        end = canonical.find('\0', key_end + 1);
+        tags.emplace_back(canonical.substr(key_start, key_end - key_start),
+                          canonical.substr(key_end + 1, end == std::string_view::npos
+                                                            ? std::string_view::npos : end - key_end - 1));
+    }
+    return true;
+}
+
+// Phase 34: A million series is a few million small allocations, so keys
+// are built on several threads, each filling a contiguous range of ids,
+// then each thread inserts into its own subset of the shard maps
+bool SeriesRegistry::restore(const std::vector<std::string_view>& canonicals) {
+    std::lock_guard<std::mutex> alloc(alloc_mutex_);
+    size_t count = canonicals.size();
+    if (next_id_.load(std::memory_order_relaxed) != 1 || count >= CHUNK_SIZE * MAX_CHUNKS) {
+        return false;
+    }
+    if (count == 0) {
+        return true;
+    }
+    for (size_t chunk = 0; chunk <= count / CHUNK_SIZE; ++chunk) {
+        slot(static_cast<uint32_t>(chunk * CHUNK_SIZE));
+    }
+
+    size_t threads = count < 4 * CHUNK_SIZE ? 1
+        : std::clamp<size_t>(std::thread::hardware_concurrency(), 1, 8);
+    auto run = [threads](auto&& work) {
+        std::vector<std::thread> workers;
+        for (size_t t = 1; t < threads; ++t) {
+            workers.emplace_back(work, t);
+        }
+        work(0);
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    };
+
+    std::vector<uint8_t> shard_of(count);
+    std::atomic<bool> ok{true};
+    run([&](size_t t) {
+        TagRefs tags;
+        std::string_view name;
+        for (size_t i = count * t / threads; i < count * (t + 1) / threads; ++i) {
+            if (!split_canonical(canonicals[i], name, tags)) {
+                ok.store(false, std::memory_order_relaxed);
+                continue;
+            }
+            SeriesKey& key = *slot(static_cast<uint32_t>(i + 1));   // Allocated above
+            key.name.assign(name);
+            key.tags.reserve(tags.size());
+            for (const auto& [k, v] : tags) {
+                key.tags.emplace_back(std::string(k), std::string(v));
+            }
+            key.canonical.assign(canonicals[i]);
+            shard_of[i] = static_cast<uint8_t>(shard_for(key.canonical));
+        }
+    });
+    if (!ok.load()) {
+        for (size_t i = 0; i < count; ++i) {
+            *slot(static_cast<uint32_t>(i + 1)) = SeriesKey();
+        }
+        return false;
+    }
+
+    run([&](size_t t) {
+        std::vector<size_t> in_shard(SHARDS, 0);
+        for (uint8_t shard : shard_of) {
+            in_shard[shard]++;
+        }
+        std::vector<std::unique_lock<std::shared_mutex>> locks;
+        for (size_t shard = t; shard < SHARDS; shard += threads) {
+            locks.emplace_back(shards_[shard].mutex);
+            shards_[shard].ids.reserve(shards_[shard].ids.size() + in_shard[shard]);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (shard_of[i] % threads == t) {
+                uint32_t id = static_cast<uint32_t>(i + 1);
+                shards_[shard_of[i]].ids.emplace(key(id).canonical, id);
+            }
+        }
+    });
+    next_id_.store(static_cast<uint32_t>(count + 1), std::memory_order_release);
+    return true;
+}
+
+} // namespace metricstream
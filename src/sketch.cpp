@@ -0,0 +1,290 @@
+#include "sketch.h"
+#include "common.h"
+#include <algorithm>
+#include <cmath>
+
+namespace metricstream {
+
+namespace {
+
+const double GAMMA = (1 + QuantileSketch::RELATIVE_ACCURACY) / (1 - QuantileSketch::RELATIVE_ACCURACY);
+const double LOG_GAMMA = std::log(GAMMA);
+
+// Finite doubles need about +-36000; anything further is a corrupt record
+constexpr int64_t MAX_INDEX = 1 << 16;
+
+void put_varint(ByteWriter& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.put_u8(static_cast<uint8_t>(v | 0x80));
+        v >>= 7;
+    }
+    out.put_u8(static_cast<uint8_t>(v));
+}
+
+uint64_t get_varint(ByteReader& in) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64 && in.ok(); shift += 7) {
+        uint8_t byte = in.get_u8();
+        v |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return v;
+        }
+    }
+    return 0;   // Truncated or over-long; ok() tells which
+}
+
+uint64_t zigzag(int64_t v) {
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+int64_t unzigzag(uint64_t v) {
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+} // namespace
+
+// ============================================================================
+// Store
+// ============================================================================
+
+void QuantileSketch::Store::add(int32_t index, uint64_t n) {
+    if (bins.empty()) {
+        offset = index;
+        bins.assign(1, n);
+        return;
+    }
+    if (index < offset) {
+        bins.insert(bins.begin(), static_cast<size_t>(offset - index), 0);
+        offset = index;
+    } else if (static_cast<size_t>(index - offset) >= bins.size()) {
+        bins.resize(static_cast<size_t>(index - offset) + 1, 0);
+    }
+    bins[static_cast<size_t>(index - offset)] += n;
+
+    if (bins.size() > MAX_BINS) {
+        // Fold the lowest bins into the lowest one that remains
+        size_t fold = bins.size() - MAX_BINS;
+        uint64_t folded = 0;
+        for (size_t i = 0; i <= fold; ++i) folded += bins[i];
+        bins.erase(bins.begin(), bins.begin() + static_cast<std::ptrdiff_t>(fold));
+        bins[0] = folded;
+        offset += static_cast<int32_t>(fold);
+    }
+}
+
+void QuantileSketch::Store::merge(const Store& other) {
+    if (other.bins.empty()) {
+        return;
+    }
+    if (bins.empty()) {
+        *this = other;
+        return;
+    }
+    // Widen once to cover both ranges, then add bin by bin
+    int32_t other_top = other.offset + static_cast<int32_t>(other.bins.size()) - 1;
+    add(std::min(offset, other.offset), 0);
+    add(std::max(offset + static_cast<int32_t>(bins.size()) - 1, other_top), 0);
+    for (size_t i = 0; i < other.bins.size(); ++i) {
+        if (other.bins[i] != 0) {
+            add(other.offset + static_cast<int32_t>(i), other.bins[i]);
+        }
+    }
+}
+
+// ============================================================================
+// QuantileSketch
+// ============================================================================
+
+int32_t QuantileSketch::index_of(double magnitude) {
+    return static_cast<int32_t>(std::ceil(std::log(magnitude) / LOG_GAMMA));
+}
+
+double QuantileSketch::value_of(int32_t index) {
+    // Midpoint (in relative terms) of (gamma^(i-1), gamma^i]
+    return 2 * std::exp(index * LOG_GAMMA) / (GAMMA + 1);
+}
+
+void QuantileSketch::add(double value, uint64_t n) {
+    if (n == 0 || !std::isfinite(value)) {
+        return;
+    }
+    if (value > MIN_INDEXABLE) {
+        positive_.add(index_of(value), n);
+    } else if (value < -MIN_INDEXABLE) {
+        negative_.add(index_of(-value), n);
+    } else {
+        zero_count_ += n;
+    }
+    count_ += n;
+    sum_ += value * static_cast<double>(n);
+    if (value < min_) min_ = value;
+    if (value > max_) max_ = value;
+}
+
+void QuantileSketch::merge(const QuantileSketch& other) {
+    if (other.empty()) {
+        return;
+    }
+    positive_.merge(other.positive_);
+    negative_.merge(other.negative_);
+    zero_count_ += other.zero_count_;
+    count_ += other.count_;
+    sum_ += other.sum_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+}
+
+void QuantileSketch::clear() {
+    *this = QuantileSketch();
+}
+
+double QuantileSketch::quantile(double q) const {
+    if (count_ == 0 || std::isnan(q)) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    if (q <= 0) return min_;
+    if (q >= 1) return max_;
+
+    double rank = q * static_cast<double>(count_ - 1);
+    double seen = 0;
+    double estimate = max_;
+    bool found = false;
+    // Ascending value order: negatives by falling magnitude, zero, positives
+    for (size_t i = negative_.bins.size(); i-- > 0 && !found;) {
+        seen += static_cast<double>(negative_.bins[i]);
+        if (seen > rank) {
+            estimate = -value_of(negative_.offset + static_cast<int32_t>(i));
+            found = true;
+        }
+    }
+    if (!found) {
+        seen += static_cast<double>(zero_count_);
+        if (seen > rank) {
+            estimate = 0;
+            found = true;
+        }
+    }
+    for (size_t i = 0; i < positive_.bins.size() && !found; ++i) {
+        seen += static_cast<double>(positive_.bins[i]);
+        if (seen > rank) {
+            estimate = value_of(positive_.offset + static_cast<int32_t>(i));
+            found = true;
+        }
+    }
+    return std::clamp(estimate, min_, max_);
+}
+
+// Layout: f64 sum, f64 min, f64 max, varint zero count, then the positive
+// and the negative store, each a varint count of non-empty bins followed by
+// (zigzag varint index delta, varint count) pairs
+void QuantileSketch::serialize(std::string& out) const {
+    ByteWriter writer(out);
+    writer.put_f64(sum_);
+    writer.put_f64(min_);
+    writer.put_f64(max_);
+    put_varint(writer, zero_count_);
+    for (const Store* store : {&positive_, &negative_}) {
+        uint64_t used = 0;
+        for (uint64_t n : store->bins) used += n != 0;
+        put_varint(writer, used);
+        int64_t previous = 0;
+        for (size_t i = 0; i < store->bins.size(); ++i) {
+            if (store->bins[i] == 0) continue;
+            int64_t index = store->offset + static_cast<int64_t>(i);
+            put_varint(writer, zigzag(index - previous));
+            put_varint(writer, store->bins[i]);
+            previous = index;
+        }
+    }
+}
+
+bool QuantileSketch::deserialize(std::string_view data) {
+    clear();
+    ByteReader in(data);
+    double sum = in.get_f64();
+    double min = in.get_f64();
+    double max = in.get_f64();
+    uint64_t zeros = get_varint(in);
+    zero_count_ = zeros;
+    count_ = zeros;
+    for (Store* store : {&positive_, &negative_}) {
+        uint64_t used = get_varint(in);
+        int64_t index = 0;
+        for (uint64_t i = 0; i < used && in.ok(); ++i) {
+            int64_t delta = unzigzag(get_varint(in));
+            uint64_t n = get_varint(in);
+            if (delta < -2 * MAX_INDEX || delta > 2 * MAX_INDEX) {
+                clear();
+                return false;
+            }
+            index += delta;
+            if (index < -MAX_INDEX || index > MAX_INDEX || n == 0) {
+                clear();
+                return false;
+            }
+            store->add(static_cast<int32_t>(index), n);
+            count_ += n;
+        }
+    }
+    if (!in.ok() || in.remaining() != 0) {
+        clear();
+        return false;
+    }
+    if (count_ > 0) {
+        sum_ = sum;
+        min_ = min;
+        max_ = max;
+    }
+    return true;
+}
+
+// ============================================================================
+// HyperLogLog
+// ============================================================================
+
+HyperLogLog::HyperLogLog() {
+    clear();
+}
+
+bool HyperLogLog::add(uint64_t hash) {
+    size_t index = static_cast<size_t>(hash >> (64 - PRECISION));
+    uint64_t rest = hash << PRECISION;
+    unsigned rank = rest == 0 ? MAX_RANK : std::min<unsigned>(__builtin_clzll(rest) + 1, MAX_RANK);
+
+    std::atomic<uint8_t>& reg = registers_[index];
+    uint8_t current = reg.load(std::memory_order_relaxed);
+    while (current < rank) {
+        if (reg.compare_exchange_weak(current, static_cast<uint8_t>(rank), std::memory_order_relaxed)) {
+            inverse_sum_.fetch_sub((uint64_t{1} << (MAX_RANK - current)) - (uint64_t{1} << (MAX_RANK - rank)),
+                                   std::memory_order_relaxed);
+            if (current == 0) {
+                zero_registers_.fetch_sub(1, std::memory_order_relaxed);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+double HyperLogLog::estimate() const {
+    const double m = static_cast<double>(REGISTERS);
+    double sum = std::ldexp(static_cast<double>(inverse_sum_.load(std::memory_order_relaxed)),
+                            -static_cast<int>(MAX_RANK));
+    double raw = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    // Small cardinalities: linear counting over the empty registers
+    uint32_t zeros = zero_registers_.load(std::memory_order_relaxed);
+    if (raw <= 2.5 * m && zeros > 0) {
+        return m * std::log(m / zeros);
+    }
+    return raw;
+}
+
+void HyperLogLog::clear() {
+    for (auto& reg : registers_) {
+        reg.store(0, std::memory_order_relaxed);
+    }
+    inverse_sum_.store(static_cast<uint64_t>(REGISTERS) << MAX_RANK, std::memory_order_relaxed);
+    zero_registers_.store(static_cast<uint32_t>(REGISTERS), std::memory_order_relaxed);
+}
+
+} // namespace metricstream
@@ -0,0 +1,172 @@
+#include "stats.h"
+#include "common.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace metricstream {
+
+size_t next_stat_cell() {
+    static std::atomic<size_t> next{0};
+    return next.fetch_add(1, std::memory_order_relaxed) % STAT_CELLS;
+}
+
+// ============================================================================
+// LatencyHistogram
+// ============================================================================
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+    Snapshot snapshot;
+    for (const Cell& cell : cells_) {
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            snapshot.buckets[i] += cell.buckets[i].load(std::memory_order_relaxed);
+        }
+        snapshot.sum_ns += cell.sum_ns.load(std::memory_order_relaxed);
+    }
+    for (uint64_t n : snapshot.buckets) {
+        snapshot.count += n;
+    }
+    return snapshot;
+}
+
+double LatencyHistogram::bucket_bound_seconds(size_t i) {
+    if (i + 1 >= BUCKETS) {
+        return std::numeric_limits<double>::infinity();
+    }
+    return static_cast<double>(uint64_t(1) << i) * 1e-6;
+}
+
+// ============================================================================
+// HdrHistogram
+// ============================================================================
+
+HdrHistogram::HdrHistogram() : counts_(COUNTS, 0) {}
+
+void HdrHistogram::merge(const HdrHistogram& other) {
+    for (size_t i = 0; i < COUNTS; ++i) {
+        counts_[i] += other.counts_[i];
+    }
+    count_ += other.count_;
+    sum_ += other.sum_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+}
+
+void HdrHistogram::reset() {
+    std::fill(counts_.begin(), counts_.end(), 0);
+    count_ = 0;
+    sum_ = 0;
+    min_ = UINT64_MAX;
+    max_ = 0;
+}
+
+uint64_t HdrHistogram::highest_equivalent(size_t index) {
+    if (index < 2 * SUB_BUCKETS) {
+        return index;
+    }
+    unsigned shift = static_cast<unsigned>(index >> SUB_BUCKET_BITS) - 1;
+    uint64_t mantissa = index - (size_t(shift) << SUB_BUCKET_BITS);
+    uint64_t top = mantissa + 1;
+    // The top sub-bucket of the last range ends at UINT64_MAX
+    return shift + SUB_BUCKET_BITS + 1 >= 64 && top == 2 * SUB_BUCKETS
+               ? UINT64_MAX
+               : (top << shift) - 1;
+}
+
+uint64_t HdrHistogram::percentile(double q) const {
+    if (count_ == 0) {
+        return 0;
+    }
+    q = std::clamp(q, 0.0, 1.0);
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * static_cast<double>(count_))));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < COUNTS; ++i) {
+        seen += counts_[i];
+        if (seen >= rank) {
+            return std::min(highest_equivalent(i), max_);
+        }
+    }
+    return max_;
+}
+
+// ============================================================================
+// PrometheusWriter
+// ============================================================================
+
+void PrometheusWriter::append_name(std::string_view name, std::string_view suffix,
+                                   std::string_view labels, std::string_view extra_label) {
+    out_.append(name);
+    out_.append(suffix);
+    if (labels.empty() && extra_label.empty()) {
+        return;
+    }
+    out_.push_back('{');
+    out_.append(labels);
+    if (!labels.empty() && !extra_label.empty()) {
+        out_.push_back(',');
+    }
+    out_.append(extra_label);
+    out_.push_back('}');
+}
+
+void PrometheusWriter::family(std::string_view name, std::string_view type, std::string_view help) {
+    out_.append("# HELP ");
+    out_.append(name);
+    out_.push_back(' ');
+    out_.append(help);
+    out_.append("\n# TYPE ");
+    out_.append(name);
+    out_.push_back(' ');
+    out_.append(type);
+    out_.push_back('\n');
+}
+
+void PrometheusWriter::sample(std::string_view name, double value, std::string_view labels) {
+    append_name(name, {}, labels);
+    out_.push_back(' ');
+    append_json_number(out_, value);
+    out_.push_back('\n');
+}
+
+void PrometheusWriter::histogram(std::string_view name, const LatencyHistogram::Snapshot& snapshot,
+                                 std::string_view labels) {
+    uint64_t cumulative = 0;
+    std::string le;
+    for (size_t i = 0; i < LatencyHistogram::BUCKETS; ++i) {
+        cumulative += snapshot.buckets[i];
+        le.assign("le=\"");
+        if (i + 1 == LatencyHistogram::BUCKETS) {
+            le.append("+Inf");
+        } else {
+            append_json_number(le, LatencyHistogram::bucket_bound_seconds(i));
+        }
+        le.push_back('"');
+        append_name(name, "_bucket", labels, le);
+        out_.push_back(' ');
+        append_uint(out_, cumulative);
+        out_.push_back('\n');
+    }
+    append_name(name, "_sum", labels);
+    out_.push_back(' ');
+    append_json_number(out_, static_cast<double>(snapshot.sum_ns) / 1e9);
+    out_.push_back('\n');
+    append_name(name, "_count", labels);
+    out_.push_back(' ');
+    append_uint(out_, snapshot.count);
+    out_.push_back('\n');
+}
+
+void PrometheusWriter::counter(std::string_view name, std::string_view help, uint64_t value) {
+    family(name, "counter", help);
+    append_name(name, {}, {});
+    out_.push_back(' ');
+    append_uint(out_, value);
+    out_.push_back('\n');
+}
+
+void PrometheusWriter::gauge(std::string_view name, std::string_view help, double value) {
+    family(name, "gauge", help);
+    sample(name, value);
+}
+
+} // namespace metricstream
@@ -0,0 +1,106 @@
+#include "storage_sink.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+
+namespace metricstream {
+
+bool AppendFile::open(const std::string& path, bool exclusive) {
+    close();
+    int flags = O_WRONLY | O_CREAT | O_APPEND;
+    if (exclusive) {
+        flags |= O_EXCL;
+    }
+    fd_ = ::open(path.c_str(), flags, 0644);
+    return fd_ >= 0;
+}
+
+void AppendFile::close() {
+    if (fd_ < 0) {
+        return;
+    }
+    if (policy_.mode != FsyncPolicy::Mode::NEVER) {
+        sync();
+    }
+    ::close(fd_);
+    fd_ = -1;
+    unsynced_bytes_ = 0;
+}
+
+bool AppendFile::write(std::string_view data) {
+    if (fd_ < 0) {
+        return false;
+    }
+    if (data.empty()) {
+        return true;
+    }
+
+    // One write() for the whole group; loop only on short writes
+    size_t offset = 0;
+    bool ok = true;
+    while (offset < data.size()) {
+        ssize_t n = ::write(fd_, data.data() + offset, data.size() - offset);
+        if (n > 0) {
+            offset += static_cast<size_t>(n);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            write_errors_++;
+            ok = false;
+            break;
+        }
+    }
+
+    if (offset > 0 && unsynced_bytes_ == 0) {
+        first_unsynced_ = std::chrono::steady_clock::now();
+    }
+    unsynced_bytes_ += offset;
+    bytes_written_ += offset;
+
+    switch (policy_.mode) {
+        case FsyncPolicy::Mode::NEVER:
+            break;   // Still tracked, so an explicit sync() works
+        case FsyncPolicy::Mode::EVERY_COMMIT:
+            sync();
+            break;
+        case FsyncPolicy::Mode::BYTES:
+            if (unsynced_bytes_ >= policy_.bytes) sync();
+            break;
+        case FsyncPolicy::Mode::INTERVAL:
+            sync_if_due();
+            break;
+    }
+    return ok;
+}
+
+void AppendFile::sync() {
+    if (fd_ < 0 || unsynced_bytes_ == 0) {
+        return;
+    }
+    // fdatasync skips the metadata flush where available
+#if defined(__linux__)
+    int rc = fdatasync(fd_);
+#else
+    int rc = fsync(fd_);
+#endif
+    if (rc != 0) {
+        write_errors_++;
+    }
+    fsync_count_++;
+    unsynced_bytes_ = 0;
+}
+
+std::chrono::milliseconds AppendFile::sync_if_due() {
+    if (policy_.mode != FsyncPolicy::Mode::INTERVAL || unsynced_bytes_ == 0) {
+        return policy_.interval;
+    }
+    auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - first_unsynced_);
+    if (waited >= policy_.interval) {
+        sync();
+        return policy_.interval;
+    }
+    return policy_.interval - waited;
+}
+
+} // namespace metricstream
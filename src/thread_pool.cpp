@@ -1,15 +1,124 @@
 #include "thread_pool.h"
 #include <iostream>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 namespace metricstream {
 
+namespace {
+
+// Spin rounds before a worker gives up its time slice, then parks
+constexpr int SPIN_ITERATIONS = 64;
+constexpr int YIELD_ITERATIONS = 4;
+
+// The worker (if any) running on this thread, so nested enqueues stay local
+thread_local const ThreadPool* tls_pool = nullptr;
+thread_local size_t tls_worker_index = 0;
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+size_t round_up_pow2(size_t n) {
+    size_t size = 2;
+    while (size < n) size <<= 1;
+    return size;
+}
+
+} // namespace
+
+// ============================================================================
+// WorkStealingDeque (Chase-Lev, with the C11 orderings from Le et al. 2013)
+// ============================================================================
+
+WorkStealingDeque::WorkStealingDeque(size_t capacity) {
+    size_t size = round_up_pow2(capacity);
+    mask_ = static_cast<int64_t>(size - 1);
+    buffer_ = std::make_unique<std::atomic<uint32_t>[]>(size);
+}
+
+bool WorkStealingDeque::push(uint32_t value) {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_acquire);
+    if (b - t > mask_) {
+        return false;
+    }
+    buffer_[b & mask_].store(value, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+    return true;
+}
+
+bool WorkStealingDeque::pop(uint32_t& value) {
+    int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_relaxed);
+
+    if (t > b) {
+        // Empty
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return false;
+    }
+
+    value = buffer_[b & mask_].load(std::memory_order_relaxed);
+    if (t == b) {
+        // Last element: race thieves for it
+        bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                std::memory_order_relaxed);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+bool WorkStealingDeque::steal(uint32_t& value) {
+    int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom_.load(std::memory_order_acquire);
+    if (t >= b) {
+        return false;
+    }
+
+    value = buffer_[t & mask_].load(std::memory_order_relaxed);
+    return top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                        std::memory_order_relaxed);
+}
+
+// ============================================================================
+// ThreadPool
+// ============================================================================
+
 ThreadPool::ThreadPool(size_t num_threads, size_t max_queue_size)
-    : max_queue_size_(max_queue_size), stop_(false) {
+    : free_slots_(max_queue_size), max_queue_size_(max_queue_size), stop_(false) {
+
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
+
+    slots_ = std::make_unique<TaskSlot[]>(max_queue_size_);
+    for (size_t i = 0; i < max_queue_size_; ++i) {
+        free_slots_.try_push(static_cast<uint32_t>(i));
+    }
+
+    // Each worker's queues hold its share of the slots. Together the
+    // inboxes hold them all, so enqueue() finds room by trying the others.
+    size_t per_worker = (max_queue_size_ + num_threads - 1) / num_threads;
+    queues_.reserve(num_threads);
+    for (size_t i = 0; i < num_threads; ++i) {
+        queues_.push_back(std::make_unique<Worker>(per_worker));
+    }
 
     // Pre-create all worker threads
     workers_.reserve(num_threads);
     for (size_t i = 0; i < num_threads; ++i) {
-        workers_.emplace_back(&ThreadPool::worker_loop, this);
+        workers_.emplace_back(&ThreadPool::worker_loop, this, i);
     }
 
     std::cerr << "[ThreadPool] Started with " << num_threads
@@ -19,7 +128,7 @@ ThreadPool::ThreadPool(size_t num_threads, size_t max_queue_size)
 ThreadPool::~ThreadPool() {
     // Signal shutdown
     {
-        std::lock_guard<std::mutex> lock(queue_mutex_);
+        std::lock_guard<std::mutex> lock(park_mutex_);
         stop_.store(true);
     }
 
@@ -36,68 +145,133 @@ ThreadPool::~ThreadPool() {
     std::cerr << "[ThreadPool] Shutdown complete" << std::endl;
 }
 
-bool ThreadPool::enqueue(std::function<void()> task) {
-    {
-        std::lock_guard<std::mutex> lock(queue_mutex_);
+bool ThreadPool::enqueue(Task task) {
+    // Check if shutting down
+    if (stop_.load(std::memory_order_relaxed)) {
+        return false;
+    }
 
-        // Check if queue is full (backpressure)
-        if (tasks_.size() >= max_queue_size_) {
-            return false; // Reject task, queue is full
-        }
+    // A free slot is the backpressure check: none left means the queue is full
+    uint32_t slot;
+    if (!free_slots_.try_pop(slot)) {
+        return false;
+    }
+    slots_[slot].task = std::move(task);
 
-        // Check if shutting down
-        if (stop_.load()) {
-            return false;
-        }
+    // Counted before publishing so a worker that takes it never sees < 0
+    queued_.fetch_add(1, std::memory_order_seq_cst);
 
-        tasks_.push(std::move(task));
+    // Our own deque from a worker, else the inboxes round-robin. A queue is
+    // full when it holds its share, or for a moment while a consumer is
+    // mid-pop on the cell we need: move on to the next.
+    bool handed_off = tls_pool == this && queues_[tls_worker_index]->deque.push(slot);
+    size_t count = queues_.size();
+    size_t start = handed_off ? 0 : next_worker_.fetch_add(1, std::memory_order_relaxed);
+    for (size_t i = 0; i < count && !handed_off; ++i) {
+        handed_off = queues_[(start + i) % count]->inbox.try_push(slot);
+    }
+    if (!handed_off) {
+        queued_.fetch_sub(1, std::memory_order_seq_cst);
+        slots_[slot].task = Task();
+        release_slot(slot);
+        return false;
     }
 
-    // Notify one worker that a task is available
-    condition_.notify_one();
+    // Pairs with park(): a worker either sees queued_ > 0 or is counted here
+    if (sleepers_.load(std::memory_order_seq_cst) > 0) {
+        {
+            std::lock_guard<std::mutex> lock(park_mutex_);
+        }
+        condition_.notify_one();
+    }
     return true;
 }
 
 size_t ThreadPool::queue_size() const {
-    std::lock_guard<std::mutex> lock(queue_mutex_);
-    return tasks_.size();
+    int64_t queued = queued_.load(std::memory_order_relaxed);
+    return queued > 0 ? static_cast<size_t>(queued) : 0;
 }
 
-void ThreadPool::worker_loop() {
+bool ThreadPool::find_task(size_t index, uint32_t& slot) {
+    Worker& self = *queues_[index];
+    if (self.deque.pop(slot) || self.inbox.try_pop(slot)) {
+        return true;
+    }
+
+    // Steal, starting after ourselves so thieves spread over victims
+    size_t count = queues_.size();
+    for (size_t i = 1; i < count; ++i) {
+        Worker& victim = *queues_[(index + i) % count];
+        if (victim.deque.steal(slot) || victim.inbox.try_pop(slot)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run_slot(uint32_t slot) {
+    queued_.fetch_sub(1, std::memory_order_relaxed);
+
+    // Release the slot before running so queue_size() tracks waiting tasks only
+    Task task = std::move(slots_[slot].task);
+    release_slot(slot);
+
+    // Execute task
+    try {
+        task();
+    } catch (const std::exception& e) {
+        std::cerr << "[ThreadPool] Task threw exception: "
+                  << e.what() << std::endl;
+    } catch (...) {
+        std::cerr << "[ThreadPool] Task threw unknown exception"
+                  << std::endl;
+    }
+}
+
+void ThreadPool::release_slot(uint32_t slot) {
+    // The free list holds every slot, so this only fails while another
+    // thread is mid-pop on the cell we need
+    while (!free_slots_.try_push(slot)) {
+        cpu_relax();
+    }
+}
+
+void ThreadPool::park() {
+    std::unique_lock<std::mutex> lock(park_mutex_);
+    sleepers_.fetch_add(1, std::memory_order_seq_cst);
+    condition_.wait(lock, [this] {
+        return stop_.load() || queued_.load(std::memory_order_seq_cst) > 0;
+    });
+    sleepers_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void ThreadPool::worker_loop(size_t index) {
+    tls_pool = this;
+    tls_worker_index = index;
+
+    uint32_t slot;
+    int idle_rounds = 0;
     while (true) {
-        std::function<void()> task;
+        if (find_task(index, slot)) {
+            run_slot(slot);
+            idle_rounds = 0;
+            continue;
+        }
 
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex_);
-
-            // Wait for a task or shutdown signal
-            condition_.wait(lock, [this] {
-                return stop_.load() || !tasks_.empty();
-            });
-
-            // If stopping and no tasks left, exit
-            if (stop_.load() && tasks_.empty()) {
-                return;
-            }
-
-            // Get task from queue
-            if (!tasks_.empty()) {
-                task = std::move(tasks_.front());
-                tasks_.pop();
-            }
+        // If stopping and no tasks left, exit
+        if (stop_.load() && queued_.load() <= 0) {
+            return;
         }
 
-        // Execute task outside the lock
-        if (task) {
-            try {
-                task();
-            } catch (const std::exception& e) {
-                std::cerr << "[ThreadPool] Task threw exception: "
-                          << e.what() << std::endl;
-            } catch (...) {
-                std::cerr << "[ThreadPool] Task threw unknown exception"
-                          << std::endl;
-            }
+        // Spin, then yield, then sleep until an enqueue wakes us
+        idle_rounds++;
+        if (idle_rounds <= SPIN_ITERATIONS) {
+            cpu_relax();
+        } else if (idle_rounds <= SPIN_ITERATIONS + YIELD_ITERATIONS) {
+            std::this_thread::yield();
+        } else {
+            park();
+            idle_rounds = 0;
         }
     }
 }
@@ -0,0 +1,182 @@
+#include "trace.h"
+#include "common.h"
+#include <algorithm>
+#include <cstring>
+
+namespace metricstream {
+
+namespace {
+
+thread_local RequestTrace* tls_current_trace = nullptr;
+
+std::atomic<uint64_t> next_tracer_instance{0};
+
+// Microseconds with one decimal, e.g. 12.3
+void append_us(std::string& out, int64_t ns) {
+    if (ns < 0) ns = 0;
+    out += std::to_string(ns / 1000);
+    out += '.';
+    out += static_cast<char>('0' + (ns % 1000) / 100);
+}
+
+} // namespace
+
+std::string_view trace_stage_name(TraceStage stage) {
+    switch (stage) {
+        case TraceStage::RECEIVED: return "received";
+        case TraceStage::HEADERS: return "headers";
+        case TraceStage::BODY: return "body";
+        case TraceStage::DEQUEUED: return "dequeued";
+        case TraceStage::RATE_LIMITED: return "rate_limited";
+        case TraceStage::PARSED: return "parsed";
+        case TraceStage::VALIDATED: return "validated";
+        case TraceStage::WAL_APPENDED: return "wal_appended";
+        case TraceStage::ENQUEUED: return "enqueued";
+        case TraceStage::WAL_SYNCED: return "wal_synced";
+        case TraceStage::RESPONDED: return "responded";
+    }
+    return "unknown";
+}
+
+void RequestTrace::set_route(std::string_view request_method, std::string_view request_path) {
+    size_t n = std::min(request_method.size(), METHOD_BYTES - 1);
+    std::memcpy(method, request_method.data(), n);
+    method[n] = '\0';
+    n = std::min(request_path.size(), PATH_BYTES - 1);
+    std::memcpy(path, request_path.data(), n);
+    path[n] = '\0';
+}
+
+int64_t RequestTrace::total_ns() const {
+    int64_t start = at_ns[static_cast<size_t>(TraceStage::RECEIVED)];
+    int64_t last = *std::max_element(at_ns.begin(), at_ns.end());
+    return start == 0 ? 0 : last - start;
+}
+
+RequestTrace* current_trace() {
+    return tls_current_trace;
+}
+
+ScopedTraceContext::ScopedTraceContext(RequestTrace* trace) : previous_(tls_current_trace) {
+    tls_current_trace = trace;
+}
+
+ScopedTraceContext::~ScopedTraceContext() {
+    tls_current_trace = previous_;
+}
+
+// ============================================================================
+// Tracer
+// ============================================================================
+
+Tracer::Tracer() : Tracer(Options()) {}
+
+Tracer::Tracer(Options options)
+    : options_(options), instance_(next_tracer_instance.fetch_add(1, std::memory_order_relaxed)) {}
+
+Tracer::~Tracer() = default;
+
+Tracer& Tracer::global() {
+    static Tracer tracer;
+    return tracer;
+}
+
+Tracer::Ring& Tracer::thread_ring() {
+    // Usually one entry: the global tracer's
+    thread_local std::vector<std::pair<uint64_t, Ring*>> rings;
+    for (const auto& [instance, ring] : rings) {
+        if (instance == instance_) {
+            return *ring;
+        }
+    }
+    auto ring = std::make_unique<Ring>();
+    ring->traces.reserve(std::max<size_t>(options_.recent_per_thread, 1));
+    Ring* raw = ring.get();
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        rings_.push_back(std::move(ring));
+    }
+    rings.emplace_back(instance_, raw);
+    return *raw;
+}
+
+void Tracer::push(Ring& ring, const RequestTrace& trace, size_t capacity) {
+    capacity = std::max<size_t>(capacity, 1);
+    std::lock_guard<std::mutex> lock(ring.mutex);
+    if (ring.traces.size() < capacity) {
+        ring.traces.push_back(trace);
+    } else {
+        ring.traces[ring.next] = trace;
+    }
+    ring.next = (ring.next + 1) % capacity;
+}
+
+void Tracer::collect(const Ring& ring, std::vector<RequestTrace>& out) {
+    std::lock_guard<std::mutex> lock(ring.mutex);
+    out.insert(out.end(), ring.traces.begin(), ring.traces.end());
+}
+
+void Tracer::finish(const RequestTrace& trace) {
+    finished_.fetch_add(1, std::memory_order_relaxed);
+    push(thread_ring(), trace, options_.recent_per_thread);
+
+    auto threshold = std::chrono::duration_cast<std::chrono::nanoseconds>(options_.slow_threshold).count();
+    if (trace.total_ns() < threshold) {
+        return;
+    }
+    uint64_t seen = slow_seen_.fetch_add(1, std::memory_order_relaxed);
+    if (seen % std::max<uint32_t>(options_.slow_sample_every, 1) == 0) {
+        push(slow_, trace, options_.slow_capacity);
+    }
+}
+
+std::vector<RequestTrace> Tracer::recent(size_t limit) const {
+    std::vector<RequestTrace> out;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        for (const auto& ring : rings_) {
+            collect(*ring, out);
+        }
+    }
+    std::sort(out.begin(), out.end(), [](const RequestTrace& a, const RequestTrace& b) { return a.id > b.id; });
+    if (out.size() > limit) out.resize(limit);
+    return out;
+}
+
+std::vector<RequestTrace> Tracer::slow(size_t limit) const {
+    std::vector<RequestTrace> out;
+    collect(slow_, out);
+    std::sort(out.begin(), out.end(), [](const RequestTrace& a, const RequestTrace& b) { return a.id > b.id; });
+    if (out.size() > limit) out.resize(limit);
+    return out;
+}
+
+void append_trace_json(std::string& out, const RequestTrace& trace) {
+    out += "{\"id\":";
+    out += std::to_string(trace.id);
+    out += ",\"method\":";
+    append_json_string(out, std::string_view(trace.method));
+    out += ",\"path\":";
+    append_json_string(out, std::string_view(trace.path));
+    out += ",\"status\":";
+    out += std::to_string(trace.status);
+    out += ",\"metrics\":";
+    out += std::to_string(trace.metrics);
+    out += ",\"total_us\":";
+    append_us(out, trace.total_ns());
+    out += ",\"stages_us\":{";
+    int64_t start = trace.at_ns[static_cast<size_t>(TraceStage::RECEIVED)];
+    bool first = true;
+    for (size_t i = 1; i < TRACE_STAGE_COUNT; ++i) {
+        if (trace.at_ns[i] == 0) continue;
+        if (!first) out += ',';
+        first = false;
+        out += '"';
+        out += trace_stage_name(static_cast<TraceStage>(i));
+        out += "\":";
+        append_us(out, trace.at_ns[i] - start);
+    }
+    out += "}}";
+}
+
+} // namespace metricstream
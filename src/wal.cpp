@@ -0,0 +1,489 @@
+#include "wal.h"
+#include "common.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+
+namespace metricstream {
+
+namespace {
+
+constexpr std::string_view WAL_PREFIX = "wal-";
+constexpr std::string_view WAL_SUFFIX = ".log";
+constexpr std::string_view CHECKPOINT_MAGIC = "MSWALCP1";
+
+bool is_wal_name(std::string_view name) {
+    return name.size() > WAL_PREFIX.size() + WAL_SUFFIX.size() &&
+           name.substr(0, WAL_PREFIX.size()) == WAL_PREFIX &&
+           name.substr(name.size() - WAL_SUFFIX.size()) == WAL_SUFFIX;
+}
+
+uint64_t wal_first_lsn(std::string_view name) {
+    uint64_t lsn = 0;
+    for (size_t i = WAL_PREFIX.size(); i < name.size() - WAL_SUFFIX.size(); ++i) {
+        if (name[i] < '0' || name[i] > '9') return 0;
+        lsn = lsn * 10 + static_cast<uint64_t>(name[i] - '0');
+    }
+    return lsn;
+}
+
+int64_t to_epoch_ns(Timestamp ts) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(ts.time_since_epoch()).count();
+}
+
+Timestamp from_epoch_ns(int64_t ns) {
+    return Timestamp(std::chrono::duration_cast<Timestamp::duration>(std::chrono::nanoseconds(ns)));
+}
+
+// Write a small file so that it either fully replaces `path` or not at all
+bool replace_file(const std::string& path, std::string_view contents) {
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = ::write(fd, contents.data(), contents.size()) == static_cast<ssize_t>(contents.size());
+    ok = ::fsync(fd) == 0 && ok;
+    ::close(fd);
+    return ok && std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+} // namespace
+
+// ============================================================================
+// Record payloads
+// ============================================================================
+
+void encode_wal_batch(std::string& out, uint64_t lsn, const MetricBatch& batch) {
+    ByteWriter w(out);
+    w.put_u64(lsn);
+    w.put_string(batch.source_id);
+    w.put_i64(to_epoch_ns(batch.received_at));
+    w.put_u32(static_cast<uint32_t>(batch.metrics.size()));
+    for (const Metric& metric : batch.metrics) {
+        // Ids are per process, so records carry the series itself
+        const SeriesKey& series = metric.series();
+        w.put_string(series.name);
+        w.put_u8(static_cast<uint8_t>(metric.type));
+        w.put_f64(metric.value);
+        w.put_i64(to_epoch_ns(metric.timestamp));
+        w.put_u16(static_cast<uint16_t>(std::min<size_t>(series.tags.size(), 0xFFFF)));
+        size_t written = 0;
+        for (const auto& [key, value] : series.tags) {
+            if (written++ == 0xFFFF) break;
+            w.put_string(key);
+            w.put_string(value);
+        }
+    }
+}
+
+bool decode_wal_batch(std::string_view payload, uint64_t& lsn, MetricBatch& batch) {
+    ByteReader r(payload);
+    lsn = r.get_u64();
+    batch.source_id.assign(r.get_string());
+    batch.received_at = from_epoch_ns(r.get_i64());
+    uint32_t count = r.get_u32();
+    // Each metric needs at least 21 bytes, which bounds a corrupt count
+    if (!r.ok() || count > r.remaining() / 21) {
+        return false;
+    }
+    batch.metrics.reserve(batch.metrics.size() + count);
+    TagRefs tags;
+    for (uint32_t i = 0; i < count && r.ok(); ++i) {
+        std::string_view name = r.get_string();
+        uint8_t type = r.get_u8();
+        double value = r.get_f64();
+        Timestamp ts = from_epoch_ns(r.get_i64());
+        uint16_t tag_count = r.get_u16();
+        tags.clear();
+        for (uint16_t t = 0; t < tag_count && r.ok(); ++t) {
+            std::string_view key = r.get_string();
+            tags.emplace_back(key, r.get_string());
+        }
+        if (!r.ok() || type > static_cast<uint8_t>(MetricType::SUMMARY)) {
+            return false;
+        }
+        batch.metrics.emplace_back(SeriesRegistry::global().intern(name, tags), value,
+                                   static_cast<MetricType>(type), ts);
+    }
+    return r.ok() && r.remaining() == 0;
+}
+
+// ============================================================================
+// WriteAheadLog
+// ============================================================================
+
+WriteAheadLog::WriteAheadLog(Options options)
+    : options_(std::move(options)),
+      checkpoint_path_(options_.directory + "/checkpoint"),
+      outstanding_(1),
+      file_(FsyncPolicy{FsyncPolicy::Mode::EVERY_COMMIT}) {}
+
+WriteAheadLog::~WriteAheadLog() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    flush_cv_.notify_all();
+    if (flusher_.joinable()) {
+        flusher_.join();
+    }
+}
+
+bool WriteAheadLog::read_checkpoint(uint64_t& lsn) const {
+    MappedFile file;
+    if (!file.open(checkpoint_path_)) {
+        return false;
+    }
+    ByteReader r(file.data());
+    std::string_view magic = r.get_bytes(CHECKPOINT_MAGIC.size());
+    uint64_t value = r.get_u64();
+    uint32_t crc = r.get_u32();
+    if (!r.ok() || magic != CHECKPOINT_MAGIC || crc != crc32c(&value, sizeof(value))) {
+        std::cerr << "Warning: Ignoring corrupt WAL checkpoint " << checkpoint_path_ << std::endl;
+        return false;
+    }
+    lsn = value;
+    return true;
+}
+
+bool WriteAheadLog::open(const ReplayVisitor& replay, ReplayStats* stats) {
+    return open(replay, UINT64_MAX, stats);
+}
+
+bool WriteAheadLog::open(const ReplayVisitor& replay, uint64_t from, ReplayStats* stats) {
+    ReplayStats local;
+    ReplayStats& st = stats ? *stats : local;
+
+    if (mkdir(options_.directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "Warning: Could not create WAL directory " << options_.directory << std::endl;
+        return false;
+    }
+
+    uint64_t checkpoint = 0;
+    read_checkpoint(checkpoint);
+    checkpoint_lsn_ = checkpoint;   // Visitors compare with checkpoint_lsn()
+    uint64_t replay_from = std::min(from, checkpoint + 1);
+
+    std::vector<std::string> names;
+    if (DIR* dir = opendir(options_.directory.c_str())) {
+        while (dirent* entry = readdir(dir)) {
+            if (is_wal_name(entry->d_name)) {
+                names.emplace_back(entry->d_name);
+            }
+        }
+        closedir(dir);
+    }
+    // First lsns are zero-padded, so name order is lsn order
+    std::sort(names.begin(), names.end());
+
+    // Map each file once; cancels follow their batch, so collect them first
+    std::vector<MappedFile> maps(names.size());
+    std::set<uint64_t> cancelled;
+    auto for_each_record = [&](const MappedFile& file, auto&& visit) {
+        std::string_view data = file.data();
+        size_t offset = 0;
+        while (offset < data.size()) {
+            ByteReader r(data.substr(offset));
+            uint8_t type = r.get_u8();
+            uint32_t length = r.get_u32();
+            std::string_view payload = r.get_bytes(length);
+            uint32_t crc = r.get_u32();
+            if (!r.ok() || crc != crc32c(payload.data(), payload.size(), crc32c(&type, 1))) {
+                return false;   // Torn or corrupt: nothing after it is trusted
+            }
+            visit(type, payload);
+            offset += WAL_RECORD_OVERHEAD + length;
+        }
+        return true;
+    };
+
+    uint64_t last_lsn = checkpoint;
+    for (size_t i = 0; i < names.size(); ++i) {
+        std::string path = options_.directory + "/" + names[i];
+        files_.push_back({path, wal_first_lsn(names[i])});
+        if (!maps[i].open(path)) {
+            continue;   // Empty: created just before a crash
+        }
+        st.files++;
+        bool clean = for_each_record(maps[i], [&](uint8_t type, std::string_view payload) {
+            ByteReader r(payload);
+            uint64_t lsn = r.get_u64();
+            if (type == WAL_CANCEL) {
+                cancelled.insert(lsn);
+            }
+            last_lsn = std::max(last_lsn, lsn);
+            // A file holding only cancels of earlier batches is named for
+            // the lsn after them; move past it so it is not reused as empty
+            last_lsn = std::max(last_lsn, files_[i].first_lsn);
+        });
+        if (!clean) {
+            st.corrupt_records++;
+            std::cerr << "Warning: WAL " << path << " ends in a torn or corrupt record" << std::endl;
+        }
+    }
+
+    MetricBatch batch;
+    for (const MappedFile& file : maps) {
+        if (file.size() == 0) {
+            continue;
+        }
+        for_each_record(file, [&](uint8_t type, std::string_view payload) {
+            if (type != WAL_BATCH) {
+                return;
+            }
+            // Only the tail is decoded: what lies before it is not interned
+            uint64_t lsn = ByteReader(payload).get_u64();
+            if (lsn < replay_from) {
+                return;
+            }
+            if (cancelled.count(lsn)) {
+                st.cancelled++;
+                return;
+            }
+            batch.clear();
+            if (!decode_wal_batch(payload, lsn, batch)) {
+                st.corrupt_records++;
+                return;
+            }
+            batch.wal_lsn = lsn;
+            replay(batch);
+            st.batches++;
+            st.metrics += batch.size();
+        });
+    }
+    maps.clear();
+
+    // New records go to a new file, so a torn tail is never appended to
+    next_lsn_ = last_lsn + 1;
+    durable_lsn_ = last_lsn;
+    if (!open_file(next_lsn_)) {
+        return false;
+    }
+    if (st.batches > 0 || st.cancelled > 0) {
+        std::cerr << "[WAL] Replayed " << st.batches << " batches (" << st.metrics
+                  << " metrics) from " << st.files << " files" << std::endl;
+    }
+
+    open_ = true;
+    flusher_ = std::thread(&WriteAheadLog::flusher_loop, this);
+    return true;
+}
+
+bool WriteAheadLog::open_file(uint64_t first_lsn) {
+    char name[48];
+    std::snprintf(name, sizeof(name), "wal-%020llu.log", static_cast<unsigned long long>(first_lsn));
+    std::string path = options_.directory + "/" + name;
+
+    file_.close();
+    std::lock_guard<std::mutex> lock(files_mutex_);
+    // A leftover file for this lsn can only be empty or torn: nothing in it
+    // got past replay, so start it afresh
+    if (!files_.empty() && files_.back().path == path) {
+        files_.pop_back();
+        ::unlink(path.c_str());
+    }
+    if (!file_.open(path, /*exclusive=*/true)) {
+        std::cerr << "Warning: Could not open WAL " << path << std::endl;
+        return false;
+    }
+    files_.push_back({path, first_lsn});
+    file_first_lsn_ = first_lsn;
+    return true;
+}
+
+void WriteAheadLog::frame(WalRecord type, size_t start) {
+    // pending_[start] holds the type and 4 placeholder bytes; the payload follows
+    size_t payload = pending_.size() - start - 5;
+    ByteWriter out(pending_);
+    out.patch_u32(start + 1, static_cast<uint32_t>(payload));
+    uint8_t t = static_cast<uint8_t>(type);
+    out.put_u32(crc32c(pending_.data() + start + 5, payload, crc32c(&t, 1)));
+}
+
+uint64_t WriteAheadLog::append(const MetricBatch& batch) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!open_ || failed_ || stopping_) {
+        return 0;
+    }
+    uint64_t lsn = next_lsn_++;
+    size_t start = pending_.size();
+    ByteWriter out(pending_);
+    out.put_u8(WAL_BATCH);
+    out.put_u32(0);
+    encode_wal_batch(pending_, lsn, batch);
+    frame(WAL_BATCH, start);
+    pending_last_lsn_ = lsn;
+    records_written_++;
+    for (auto& outstanding : outstanding_) {
+        outstanding.insert(lsn);
+    }
+
+    bool first = start == 0;
+    bool full = pending_.size() >= options_.group_commit_bytes;
+    lock.unlock();
+    if (first || full) {
+        flush_cv_.notify_one();
+    }
+    return lsn;
+}
+
+void WriteAheadLog::cancel(uint64_t lsn) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (auto& outstanding : outstanding_) {
+        outstanding.erase(lsn);
+    }
+    if (!open_ || failed_) {
+        return;
+    }
+    size_t start = pending_.size();
+    ByteWriter out(pending_);
+    out.put_u8(WAL_CANCEL);
+    out.put_u32(0);
+    out.put_u64(lsn);
+    frame(WAL_CANCEL, start);
+    lock.unlock();
+    flush_cv_.notify_one();
+}
+
+bool WriteAheadLog::wait_durable(uint64_t lsn) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    durable_cv_.wait(lock, [&] { return durable_lsn_ >= lsn || failed_; });
+    return durable_lsn_ >= lsn;
+}
+
+void WriteAheadLog::flusher_loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        flush_cv_.wait(lock, [this] { return !pending_.empty() || stopping_; });
+        if (pending_.empty()) {
+            return;   // Stopping with nothing left
+        }
+
+        // Let concurrent requests join this group
+        if (!stopping_ && options_.group_commit_delay.count() > 0) {
+            flush_cv_.wait_for(lock, options_.group_commit_delay, [this] {
+                return pending_.size() >= options_.group_commit_bytes || stopping_;
+            });
+        }
+
+        flushing_.swap(pending_);
+        uint64_t last = pending_last_lsn_;
+        lock.unlock();
+
+        // One write() and one fdatasync for the whole group
+        uint64_t errors = file_.write_errors();
+        bool ok = file_.write(flushing_) && file_.write_errors() == errors;
+        bytes_written_.fetch_add(flushing_.size(), std::memory_order_relaxed);
+        group_commits_.fetch_add(1, std::memory_order_relaxed);
+        flushing_.clear();
+        // A group of only cancels names no newer lsn: keep its file
+        if (ok && file_.bytes_written() >= options_.max_file_bytes && last >= file_first_lsn_) {
+            ok = open_file(last + 1);
+        }
+
+        lock.lock();
+        if (ok) {
+            durable_lsn_ = std::max(durable_lsn_, last);
+        } else if (!failed_) {
+            // Whatever reached the file is unknown now: refuse further acks
+            failed_ = true;
+            std::cerr << "[WAL] Write or fsync failed; refusing further appends" << std::endl;
+        }
+        durable_cv_.notify_all();
+    }
+}
+
+size_t WriteAheadLog::add_consumer() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    outstanding_.emplace_back();
+    return outstanding_.size() - 1;
+}
+
+void WriteAheadLog::mark_applied(size_t consumer, const uint64_t* lsns, size_t count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::set<uint64_t>& outstanding = outstanding_[consumer];
+    for (size_t i = 0; i < count; ++i) {
+        outstanding.erase(lsns[i]);
+    }
+}
+
+uint64_t WriteAheadLog::applied_through(size_t consumer) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const std::set<uint64_t>& outstanding = outstanding_[consumer];
+    return outstanding.empty() ? next_lsn_ - 1 : *outstanding.begin() - 1;
+}
+
+void WriteAheadLog::consumer_snapshot(size_t consumer, uint64_t& last_lsn,
+                                      std::vector<uint64_t>& outstanding) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    last_lsn = next_lsn_ - 1;
+    outstanding.assign(outstanding_[consumer].begin(), outstanding_[consumer].end());
+}
+
+bool WriteAheadLog::checkpoint(uint64_t lsn) {
+    std::lock_guard<std::mutex> lock(files_mutex_);
+    if (lsn > checkpoint_lsn_ && !write_checkpoint(lsn)) {
+        return false;
+    }
+    drop_files();
+    return true;
+}
+
+uint64_t WriteAheadLog::checkpoint_lsn() const {
+    std::lock_guard<std::mutex> lock(files_mutex_);
+    return checkpoint_lsn_;
+}
+
+void WriteAheadLog::retain_from(uint64_t lsn) {
+    std::lock_guard<std::mutex> lock(files_mutex_);
+    retain_from_ = lsn;
+    drop_files();
+}
+
+void WriteAheadLog::drop_files() {
+    // A file holds lsns up to the next file's first; the newest is in use
+    uint64_t keep = std::min(checkpoint_lsn_ + 1, retain_from_);
+    size_t drop = 0;
+    while (drop + 1 < files_.size() && files_[drop + 1].first_lsn <= keep) {
+        ::unlink(files_[drop].path.c_str());
+        drop++;
+    }
+    files_.erase(files_.begin(), files_.begin() + static_cast<std::ptrdiff_t>(drop));
+}
+
+bool WriteAheadLog::write_checkpoint(uint64_t lsn) {
+    std::string contents;
+    ByteWriter out(contents);
+    out.put_bytes(CHECKPOINT_MAGIC.data(), CHECKPOINT_MAGIC.size());
+    out.put_u64(lsn);
+    out.put_u32(crc32c(&lsn, sizeof(lsn)));
+    if (!replace_file(checkpoint_path_, contents)) {
+        std::cerr << "Warning: Could not write WAL checkpoint " << checkpoint_path_ << std::endl;
+        return false;
+    }
+    checkpoint_lsn_ = lsn;
+    return true;
+}
+
+bool WriteAheadLog::failed() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return failed_;
+}
+
+uint64_t WriteAheadLog::durable_lsn() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return durable_lsn_;
+}
+
+uint64_t WriteAheadLog::records_written() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return records_written_;
+}
+
+} // namespace metricstream
@@ -0,0 +1,297 @@
+#include "admission.h"
+#include "http_server.h"
+#include "test_check.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+using namespace metricstream;
+
+using std::chrono::milliseconds;
+
+static AdmissionController::Options test_options() {
+    AdmissionController::Options options;
+    options.target = std::chrono::microseconds(1000);
+    options.interval = milliseconds(20);
+    options.normal_shed_intervals = 2;
+    return options;
+}
+
+static void next_window() {
+    std::this_thread::sleep_for(milliseconds(25));
+}
+
+static void test_sojourn_levels() {
+    AdmissionController admission(test_options());
+    CHECK(admission.admit(RequestPriority::SHEDDABLE, 0));   // Opens the first window
+    CHECK(admission.admit_dequeued(RequestPriority::SHEDDABLE, milliseconds(5)));
+    CHECK(admission.overload_level() == 0);
+
+    // Nothing got through faster than 5 ms: a standing queue
+    next_window();
+    CHECK(!admission.admit(RequestPriority::SHEDDABLE, 0));
+    CHECK(admission.overload_level() == 1);
+    CHECK(admission.admit(RequestPriority::NORMAL, 0));
+    CHECK(admission.admit(RequestPriority::CRITICAL, 0));
+
+    // Overloaded, queued ingest past target is dropped; queries get the interval
+    CHECK(!admission.admit_dequeued(RequestPriority::SHEDDABLE, milliseconds(2)));
+    CHECK(admission.admit_dequeued(RequestPriority::NORMAL, milliseconds(2)));
+    CHECK(!admission.admit_dequeued(RequestPriority::NORMAL, milliseconds(50)));
+    CHECK(admission.admit_dequeued(RequestPriority::CRITICAL, milliseconds(50)));
+
+    // A second bad window sheds queries as well
+    next_window();
+    CHECK(!admission.admit(RequestPriority::NORMAL, 0));
+    CHECK(admission.overload_level() == 2);
+    CHECK(admission.admit(RequestPriority::CRITICAL, 0));
+
+    // One quick dequeue makes the window good again
+    admission.admit_dequeued(RequestPriority::NORMAL, std::chrono::microseconds(10));
+    next_window();
+    CHECK(admission.admit(RequestPriority::SHEDDABLE, 0));
+    CHECK(admission.overload_level() == 0);
+
+    CHECK(admission.shed(RequestPriority::SHEDDABLE) == 2);
+    CHECK(admission.shed(RequestPriority::NORMAL) == 2);
+    CHECK(admission.shed(RequestPriority::CRITICAL) == 0);
+}
+
+static void test_stuck_workers_and_probe() {
+    AdmissionController admission(test_options());
+    CHECK(admission.admit(RequestPriority::SHEDDABLE, 0));
+
+    // No dequeues at all while requests wait
+    next_window();
+    CHECK(!admission.admit(RequestPriority::SHEDDABLE, 3));
+    // An idle window is fine
+    next_window();
+    CHECK(admission.admit(RequestPriority::SHEDDABLE, 0));
+
+    // A lagging downstream counts even with an empty queue
+    std::atomic<bool> lagging{true};
+    admission.set_pressure_probe([&] { return lagging.load(); });
+    next_window();
+    CHECK(!admission.admit(RequestPriority::SHEDDABLE, 0));
+    lagging = false;
+    next_window();
+    CHECK(admission.admit(RequestPriority::SHEDDABLE, 0));
+
+    AdmissionController::Options off = test_options();
+    off.enabled = false;
+    AdmissionController disabled(off);
+    disabled.admit(RequestPriority::SHEDDABLE, 0);
+    next_window();
+    CHECK(disabled.admit(RequestPriority::SHEDDABLE, 100));
+    CHECK(disabled.admit_dequeued(RequestPriority::SHEDDABLE, std::chrono::seconds(10)));
+}
+
+static int connect_to(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    timeval timeout{5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void send_all(int fd, const std::string& data) {
+    CHECK(send(fd, data.data(), data.size(), 0) == static_cast<ssize_t>(data.size()));
+}
+
+// Reads until the headers are complete; empty on timeout or close
+static std::string read_headers(int fd) {
+    std::string response;
+    char chunk[1024];
+    while (response.find("\r\n\r\n") == std::string::npos) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            return {};
+        }
+        response.append(chunk, static_cast<size_t>(n));
+    }
+    return response;
+}
+
+static void test_server_sheds() {
+    int port = 20000 + static_cast<int>((getpid() + 7) % 20000);
+    HttpServer server(port, 1, 1);
+    server.admission().set_options(test_options());
+
+    std::atomic<bool> release{false};
+    server.add_handler("/block", "GET", [&](const HttpRequest&) {
+        while (!release.load()) std::this_thread::sleep_for(milliseconds(1));
+        return HttpResponse();
+    });
+    server.add_handler("/ingest", "POST", [](const HttpRequest&) { return HttpResponse(); },
+                       RequestPriority::SHEDDABLE);
+    server.add_handler("/health", "GET", [](const HttpRequest&) { return HttpResponse(); },
+                       RequestPriority::CRITICAL, true);
+    server.start();
+
+    // Occupy the only worker, then queue a query behind it
+    int blocker = connect_to(port);
+    int queued = connect_to(port);
+    CHECK(blocker >= 0 && queued >= 0);
+    send_all(blocker, "GET /block HTTP/1.1\r\nHost: x\r\n\r\n");
+    std::this_thread::sleep_for(milliseconds(10));
+    send_all(queued, "GET /block HTTP/1.1\r\nHost: x\r\n\r\n");
+
+    // Health is answered on the loop whatever the queue
+    int health = connect_to(port);
+    send_all(health, "GET /health HTTP/1.1\r\nHost: x\r\n\r\n");
+    CHECK(read_headers(health).rfind("HTTP/1.1 200", 0) == 0);
+    close(health);
+
+    // Ingest is refused on its headers alone once a window has gone by with
+    // nothing dequeued
+    std::string refused;
+    for (int attempt = 0; attempt < 10 && refused.empty(); ++attempt) {
+        next_window();
+        int ingest = connect_to(port);
+        send_all(ingest, "POST /ingest HTTP/1.1\r\nHost: x\r\nContent-Length: 100000\r\n\r\n");
+        timeval quick{0, 200000};
+        setsockopt(ingest, SOL_SOCKET, SO_RCVTIMEO, &quick, sizeof(quick));
+        refused = read_headers(ingest);
+        close(ingest);
+    }
+    CHECK(refused.rfind("HTTP/1.1 503", 0) == 0);
+    CHECK(refused.find("Retry-After: 1\r\n") != std::string::npos);
+    CHECK(server.admission().shed(RequestPriority::SHEDDABLE) >= 1);
+
+    // The queued query waited far past the interval and is dropped at the worker
+    release = true;
+    CHECK(read_headers(blocker).rfind("HTTP/1.1 200", 0) == 0);
+    CHECK(read_headers(queued).rfind("HTTP/1.1 503", 0) == 0);
+    CHECK(server.admission().shed(RequestPriority::NORMAL) == 1);
+
+    close(blocker);
+    close(queued);
+    server.stop();
+}
+
+// Inline answers must not nest one call per pipelined request
+static void test_pipelined_critical() {
+    int port = 20000 + static_cast<int>((getpid() + 8) % 20000);
+    HttpServer server(port, 1, 1);
+    server.add_handler("/health", "GET", [](const HttpRequest&) { return HttpResponse(); },
+                       RequestPriority::CRITICAL, true);
+    server.start();
+
+    const size_t count = 200000;
+    const std::string request = "GET /health HTTP/1.1\r\nHost: x\r\n\r\n";
+    int fd = connect_to(port);
+    CHECK(fd >= 0);
+
+    std::thread sender([&] {
+        std::string batch;
+        for (size_t i = 0; i < 1000; ++i) batch += request;
+        for (size_t sent = 0; sent < count; sent += 1000) {
+            size_t offset = 0;
+            while (offset < batch.size()) {
+                ssize_t n = send(fd, batch.data() + offset, batch.size() - offset, 0);
+                if (n <= 0) return;
+                offset += static_cast<size_t>(n);
+            }
+        }
+    });
+
+    const std::string status = "HTTP/1.1 200";
+    size_t responses = 0;
+    std::string pending;
+    char chunk[65536];
+    while (responses < count) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            break;
+        }
+        pending.append(chunk, static_cast<size_t>(n));
+        size_t pos = 0;
+        while ((pos = pending.find(status, pos)) != std::string::npos) {
+            ++responses;
+            pos += status.size();
+        }
+        pending.erase(0, pending.size() > status.size() ? pending.size() - status.size() + 1 : 0);
+    }
+    sender.join();
+    CHECK(responses == count);
+
+    close(fd);
+    server.stop();
+}
+
+// A client that pipelines without reading stalls its connection, and gets
+// every response once it starts reading again
+static void test_unread_responses_resume() {
+    int port = 20000 + static_cast<int>((getpid() + 9) % 20000);
+    HttpServer server(port, 1, 1);
+    server.add_handler("/health", "GET", [](const HttpRequest&) { return HttpResponse(); },
+                       RequestPriority::CRITICAL, true);
+    server.start();
+
+    const size_t count = 100000;
+    const std::string request = "GET /health HTTP/1.1\r\nHost: x\r\n\r\n";
+    int fd = connect_to(port);
+    CHECK(fd >= 0);
+
+    std::thread sender([&] {
+        std::string batch;
+        for (size_t i = 0; i < 1000; ++i) batch += request;
+        for (size_t sent = 0; sent < count; sent += 1000) {
+            size_t offset = 0;
+            while (offset < batch.size()) {
+                ssize_t n = send(fd, batch.data() + offset, batch.size() - offset, 0);
+                if (n <= 0) return;
+                offset += static_cast<size_t>(n);
+            }
+        }
+    });
+
+    // Let both socket buffers and the server's output queue fill up
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    const std::string status = "HTTP/1.1 200";
+    size_t responses = 0;
+    std::string pending;
+    char chunk[65536];
+    while (responses < count) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            break;
+        }
+        pending.append(chunk, static_cast<size_t>(n));
+        size_t pos = 0;
+        while ((pos = pending.find(status, pos)) != std::string::npos) {
+            ++responses;
+            pos += status.size();
+        }
+        pending.erase(0, pending.size() > status.size() ? pending.size() - status.size() + 1 : 0);
+    }
+    sender.join();
+    CHECK(responses == count);
+
+    close(fd);
+    server.stop();
+}
+
+int main() {
+    test_sojourn_levels();
+    test_stuck_workers_and_probe();
+    test_server_sheds();
+    test_pipelined_critical();
+    test_unread_responses_resume();
+
+    return test_result("admission_test");
+}
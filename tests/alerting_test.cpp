@@ -0,0 +1,199 @@
+#include "alerting.h"
+#include "test_check.h"
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using metricstream::AlertEngine;
+using metricstream::AlertEvent;
+using metricstream::AlertRule;
+using metricstream::Metric;
+using metricstream::MetricBatch;
+using metricstream::MetricType;
+using metricstream::SlidingWindowAggregate;
+
+static metricstream::Timestamp at_ms(int64_t ms) {
+    return metricstream::Timestamp(std::chrono::milliseconds(ms));
+}
+
+struct Recorder {
+    std::mutex mutex;
+    std::vector<AlertEvent> events;
+
+    AlertEngine::Notifier notifier() {
+        return [this](const AlertEvent& event) {
+            std::lock_guard<std::mutex> lock(mutex);
+            events.push_back(event);
+        };
+    }
+};
+
+static MetricBatch batch_of(const std::string& name, double value, int64_t ts,
+                            metricstream::Tags tags = {}) {
+    MetricBatch batch;
+    batch.add_metric(Metric(name, value, MetricType::GAUGE, std::move(tags), at_ms(ts)));
+    return batch;
+}
+
+static void test_parse() {
+    AlertRule rule;
+    CHECK(AlertRule::parse("cpu_usage:avg:>:80:10", rule));
+    CHECK(rule.metric_name == "cpu_usage");
+    CHECK(rule.tags.empty());
+    CHECK(rule.aggregation == AlertRule::Aggregation::AVG);
+    CHECK(rule.condition == AlertRule::Condition::ABOVE);
+    CHECK(rule.threshold == 80);
+    CHECK(rule.window == std::chrono::milliseconds(10000));
+    CHECK(rule.name == "cpu_usage:avg:>:80:10");
+
+    CHECK(AlertRule::parse("mem{host=web1,dc=eu}:count:<:1:0.5", rule));
+    CHECK(rule.metric_name == "mem");
+    CHECK(rule.tags.size() == 2 && rule.tags[1].first == "dc" && rule.tags[1].second == "eu");
+    CHECK(rule.aggregation == AlertRule::Aggregation::COUNT);
+    CHECK(rule.condition == AlertRule::Condition::BELOW);
+    CHECK(rule.window == std::chrono::milliseconds(500));
+
+    CHECK(!AlertRule::parse("cpu:avg:>:80", rule));
+    CHECK(!AlertRule::parse("cpu:median:>:80:10", rule));
+    CHECK(!AlertRule::parse("cpu:avg:>=:80:10", rule));
+    CHECK(!AlertRule::parse("cpu:avg:>:eighty:10", rule));
+    CHECK(!AlertRule::parse("cpu:avg:>:80:0", rule));
+    CHECK(!AlertRule::parse("cpu{host}:avg:>:80:10", rule));
+    CHECK(!AlertRule::parse(":avg:>:80:10", rule));
+}
+
+static void test_sliding_window() {
+    // 10 s window in 1 s buckets
+    SlidingWindowAggregate window(10000, 10);
+    CHECK(window.stats().count == 0);
+
+    for (int i = 0; i < 10; ++i) {
+        window.add(i * 1000, i);
+    }
+    auto stats = window.stats();
+    CHECK(stats.count == 10);
+    CHECK(stats.sum == 45);
+    CHECK(stats.min == 0 && stats.max == 9);
+
+    // Two buckets later the first two have expired
+    window.add(11000, 100);
+    stats = window.stats();
+    CHECK(stats.count == 9);
+    CHECK(stats.min == 2 && stats.max == 100);
+
+    // Late point inside the window counts, one older than it does not
+    window.add(2500, -1);
+    window.add(1500, -50);
+    stats = window.stats();
+    CHECK(stats.count == 10);
+    CHECK(stats.min == -1);
+
+    window.advance(100000);
+    CHECK(window.stats().count == 0);
+}
+
+static void test_fire_and_resolve() {
+    Recorder recorder;
+    AlertEngine engine(recorder.notifier());
+    AlertRule rule;
+    CHECK(AlertRule::parse("cpu{host=web1}:avg:>:80:10", rule));
+    engine.add_rule(rule);
+
+    // Other hosts and metrics never touch the rule
+    engine.observe(batch_of("cpu", 99, 1000, {{"host", "web2"}}));
+    engine.observe(batch_of("mem", 99, 1000, {{"host", "web1"}}));
+    CHECK(recorder.events.empty());
+    CHECK(engine.status()[0].samples == 0);
+
+    engine.observe(batch_of("cpu", 70, 1000, {{"host", "web1"}}));
+    CHECK(recorder.events.empty());
+
+    // avg(70, 100) = 85 crosses 80: fires inside observe()
+    engine.observe(batch_of("cpu", 100, 2000, {{"host", "web1"}}));
+    CHECK(recorder.events.size() == 1);
+    if (recorder.events.size() == 1) {
+        CHECK(recorder.events[0].kind == AlertEvent::Kind::FIRING);
+        CHECK(recorder.events[0].value == 85);
+        CHECK(recorder.events[0].samples == 2);
+        CHECK(recorder.events[0].timestamp_ms == 2000);
+    }
+    CHECK(engine.status()[0].firing);
+
+    // Staying above does not re-notify
+    engine.observe(batch_of("cpu", 90, 3000, {{"host", "web1"}}));
+    CHECK(recorder.events.size() == 1);
+
+    // Back below: resolved
+    MetricBatch low;
+    for (int i = 0; i < 5; ++i) {
+        low.add_metric(Metric("cpu", 10, MetricType::GAUGE, {{"host", "web1"}}, at_ms(4000)));
+    }
+    engine.observe(low);
+    CHECK(recorder.events.size() == 2);
+    if (recorder.events.size() == 2) {
+        CHECK(recorder.events[1].kind == AlertEvent::Kind::RESOLVED);
+    }
+    CHECK(!engine.status()[0].firing);
+    CHECK(engine.notifications() == 2);
+}
+
+static void test_advance_expires() {
+    Recorder recorder;
+    AlertEngine engine(recorder.notifier());
+    AlertRule high;
+    CHECK(AlertRule::parse("load:max:>:5:1", high));
+    engine.add_rule(high);
+    AlertRule silent;
+    CHECK(AlertRule::parse("heartbeat:count:<:1:1", silent));
+    engine.add_rule(silent);
+
+    engine.observe(batch_of("load", 9, 10000));
+    engine.observe(batch_of("heartbeat", 1, 10000));
+    CHECK(recorder.events.size() == 1);   // load fired; heartbeat is fine
+
+    // No data for a while: load resolves, missing heartbeats fire
+    engine.advance(20000);
+    CHECK(recorder.events.size() == 3);
+    bool load_resolved = false, heartbeat_fired = false;
+    for (const auto& event : recorder.events) {
+        if (event.rule->metric_name == "load" && event.kind == AlertEvent::Kind::RESOLVED) load_resolved = true;
+        if (event.rule->metric_name == "heartbeat" && event.kind == AlertEvent::Kind::FIRING) heartbeat_fired = true;
+    }
+    CHECK(load_resolved);
+    CHECK(heartbeat_fired);
+}
+
+static void test_concurrent_observe() {
+    Recorder recorder;
+    AlertEngine engine(recorder.notifier());
+    AlertRule rule;
+    CHECK(AlertRule::parse("rps:sum:>:1000000:60", rule));
+    engine.add_rule(rule);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&engine] {
+            for (int i = 0; i < 1000; ++i) {
+                engine.observe(batch_of("rps", 1, 5000 + i));
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+
+    auto status = engine.status();
+    CHECK(status[0].samples == 4000);
+    CHECK(status[0].value == 4000);
+    CHECK(recorder.events.empty());
+}
+
+int main() {
+    test_parse();
+    test_sliding_window();
+    test_fire_and_resolve();
+    test_advance_expires();
+    test_concurrent_observe();
+
+    return test_result("alerting_test");
+}
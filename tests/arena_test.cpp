@@ -0,0 +1,76 @@
+#include "arena.h"
+#include "test_check.h"
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+using metricstream::Arena;
+using metricstream::ArenaAllocator;
+using metricstream::ArenaVector;
+
+static void test_bump_and_alignment() {
+    Arena arena(1024);
+    char* a = arena.allocate_chars(3);
+    void* b = arena.allocate(sizeof(double), alignof(double));
+    CHECK(a != nullptr);
+    CHECK(reinterpret_cast<uintptr_t>(b) % alignof(double) == 0);
+    CHECK(static_cast<char*>(b) > a);
+    CHECK(arena.block_count() == 1);
+    CHECK(arena.bytes_used() >= 3 + sizeof(double));
+
+    std::string_view copied = arena.copy("hello");
+    CHECK(copied == "hello");
+    CHECK(arena.copy("").empty());
+}
+
+static void test_reset_reuses_memory() {
+    Arena arena(1024);
+    char* first = arena.allocate_chars(100);
+    arena.reset();
+    CHECK(arena.bytes_used() == 0);
+    CHECK(arena.allocate_chars(100) == first);
+}
+
+static void test_grows_then_coalesces() {
+    Arena arena(256);
+    for (int i = 0; i < 10; ++i) {
+        arena.allocate_chars(200);
+    }
+    CHECK(arena.block_count() > 1);
+    CHECK(arena.bytes_used() >= 2000);
+    size_t capacity = arena.capacity();
+
+    // The next request fits in one block
+    arena.reset();
+    CHECK(arena.block_count() == 1);
+    CHECK(arena.capacity() == capacity);
+    for (int i = 0; i < 10; ++i) {
+        arena.allocate_chars(200);
+    }
+    CHECK(arena.block_count() == 1);
+
+    // Oversized requests get a block of their own
+    char* big = arena.allocate_chars(1 << 20);
+    big[(1 << 20) - 1] = 'x';
+    CHECK(arena.block_count() == 2);
+}
+
+static void test_vector_in_arena() {
+    Arena arena(4096);
+    ArenaVector<int> values{ArenaAllocator<int>(arena)};
+    for (int i = 0; i < 500; ++i) {
+        values.push_back(i);
+    }
+    CHECK(values.size() == 500);
+    CHECK(values[499] == 499);
+    CHECK(arena.bytes_used() >= 500 * sizeof(int));
+}
+
+int main() {
+    test_bump_and_alignment();
+    test_reset_reuses_memory();
+    test_grows_then_coalesces();
+    test_vector_in_arena();
+
+    return test_result("arena_test");
+}
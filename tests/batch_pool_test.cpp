@@ -0,0 +1,60 @@
+#include "batch_pool.h"
+#include "test_check.h"
+#include <iostream>
+#include <string>
+
+using metricstream::BatchPool;
+using metricstream::Metric;
+using metricstream::MetricType;
+using metricstream::PooledBatch;
+using metricstream::Tags;
+
+static void test_recycles_capacity() {
+    BatchPool pool(4);
+    const metricstream::MetricBatch* first = nullptr;
+    size_t capacity = 0;
+    {
+        PooledBatch batch = pool.acquire();
+        for (int i = 0; i < 500; ++i) {
+            batch->add_metric(Metric("cpu.usage", i, MetricType::GAUGE));
+        }
+        first = batch.get();
+        capacity = batch->metrics.capacity();
+    }
+    CHECK(pool.pooled() == 1);
+
+    PooledBatch again = pool.acquire();
+    CHECK(again.get() == first);
+    CHECK(again->empty());
+    CHECK(again->metrics.capacity() == capacity);
+    CHECK(pool.pooled() == 0);
+}
+
+static void test_bounded_free_list() {
+    BatchPool pool(2);
+    {
+        PooledBatch a = pool.acquire();
+        PooledBatch b = pool.acquire();
+        PooledBatch c = pool.acquire();
+    }
+    CHECK(pool.pooled() == 2);
+}
+
+static void test_metric_shares_series() {
+    std::string name(64, 'n');
+    Metric first(name, 1.0, MetricType::COUNTER, Tags{{"host", "a"}});
+    Metric second(name, 2.0, MetricType::COUNTER, Tags{{"host", "a"}});
+    CHECK(first.series_id == second.series_id);
+    CHECK(&first.name() == &second.name());
+    CHECK(first.name() == name);
+    CHECK(first.tags().size() == 1);
+    CHECK(sizeof(Metric) <= 24);
+}
+
+int main() {
+    test_recycles_capacity();
+    test_bounded_free_list();
+    test_metric_shares_series();
+
+    return test_result("batch_pool_test");
+}
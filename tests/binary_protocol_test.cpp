@@ -0,0 +1,257 @@
+#include "binary_protocol.h"
+#include "binary_server.h"
+#include "test_check.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+
+using namespace metricstream;
+
+static void test_round_trip() {
+    BinaryEncoder encoder;
+    uint32_t cpu = encoder.series_ref("cpu", MetricType::GAUGE, {{"host", "a"}});
+    uint32_t reqs = encoder.series_ref("requests", MetricType::COUNTER);
+    CHECK(cpu == 0 && reqs == 1);
+    CHECK(encoder.series_ref("cpu", MetricType::GAUGE, {{"host", "a"}}) == cpu);
+
+    encoder.add_sample(cpu, 75.5, 1700000000123456789LL);
+    encoder.add_sample(reqs, 3);
+    std::string wire;
+    encode_hello(wire, "agent-1");
+    encoder.flush(wire);
+    CHECK(encoder.pending_samples() == 0);
+
+    size_t frames = 0;
+    CHECK(complete_frames(wire, MAX_BATCH_SAMPLES, &frames, nullptr) == wire.size());
+    CHECK(frames == 3);
+
+    BinaryDecoder decoder;
+    MetricBatch batch;
+    const char* error = nullptr;
+    CHECK(decoder.decode(wire, batch, &error));
+    CHECK(decoder.client_id() == "agent-1");
+    CHECK(decoder.series_count() == 2);
+    CHECK(batch.size() == 2);
+    if (batch.size() == 2) {
+        CHECK(batch.metrics[0].name() == "cpu");
+        CHECK(*batch.metrics[0].series().tag("host") == "a");
+        CHECK(batch.metrics[0].value == 75.5);
+        CHECK(batch.metrics[0].type == MetricType::GAUGE);
+        CHECK(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  batch.metrics[0].timestamp.time_since_epoch()).count() / 1000 == 1700000000123456LL);
+        CHECK(batch.metrics[1].name() == "requests");
+        CHECK(batch.metrics[1].type == MetricType::COUNTER);
+        CHECK(batch.metrics[1].timestamp == batch.received_at);
+    }
+
+    // Later frames reuse the connection's dictionary: samples only
+    encoder.add_sample(reqs, 4);
+    std::string next;
+    encoder.flush(next);
+    CHECK(next.size() == FRAME_HEADER_BYTES + 4 + SAMPLE_BYTES);
+    batch.clear();
+    CHECK(decoder.decode(next, batch, &error));
+    CHECK(batch.size() == 1 && batch.metrics[0].name() == "requests" && batch.metrics[0].value == 4);
+}
+
+static void test_partial_and_limits() {
+    BinaryEncoder encoder;
+    uint32_t ref = encoder.series_ref("m", MetricType::GAUGE);
+    std::string wire;
+    for (int frame = 0; frame < 3; ++frame) {
+        for (int i = 0; i < 400; ++i) encoder.add_sample(ref, i);
+        encoder.flush(wire);
+    }
+
+    // Any truncation leaves only whole frames
+    size_t frames = 0;
+    CHECK(complete_frames(std::string_view(wire).substr(0, 3), MAX_BATCH_SAMPLES, &frames, nullptr) == 0);
+    size_t first = complete_frames(std::string_view(wire).substr(0, wire.size() - 1), 100000, &frames, nullptr);
+    CHECK(frames == 3);   // SERIES + two SAMPLES frames
+    CHECK(first < wire.size());
+
+    // Two 400-sample frames fit under 1000, a third does not
+    size_t limited = complete_frames(wire, MAX_BATCH_SAMPLES, &frames, nullptr);
+    CHECK(frames == 3);
+    CHECK(limited == first);
+
+    const char* error = nullptr;
+    std::string bad("\x00\x00\x00\x00\x03", 5);
+    CHECK(complete_frames(bad, MAX_BATCH_SAMPLES, &frames, &error) == 0 && error != nullptr);
+    error = nullptr;
+    std::string unknown("\x01\x00\x00\x00\x09", 5);
+    CHECK(complete_frames(unknown, MAX_BATCH_SAMPLES, &frames, &error) == 0 && error != nullptr);
+}
+
+static void test_rejects_bad_frames() {
+    BinaryEncoder encoder;
+    encoder.add_sample(7, 1.0);   // Ref never defined
+    std::string wire;
+    encoder.flush(wire);
+    BinaryDecoder decoder;
+    MetricBatch batch;
+    const char* error = nullptr;
+    CHECK(!decoder.decode(wire, batch, &error));
+    CHECK(error && std::string(error) == "Unknown series ref");
+
+    // A count that disagrees with the frame length
+    std::string samples;
+    encoder.reset();
+    encoder.series_ref("m", MetricType::GAUGE);
+    encoder.add_sample(0, 1.0);
+    encoder.flush(samples);
+    samples[samples.size() - SAMPLE_BYTES - 4] = 2;
+    decoder.reset();
+    batch.clear();
+    CHECK(!decoder.decode(samples, batch, &error));
+
+    // Redefining a ref replaces it
+    BinaryEncoder a;
+    a.series_ref("old", MetricType::GAUGE);
+    std::string first;
+    a.flush(first);
+    BinaryEncoder b;
+    b.series_ref("new", MetricType::COUNTER);
+    b.add_sample(0, 2.0);
+    std::string second;
+    b.flush(second);
+    decoder.reset();
+    batch.clear();
+    CHECK(decoder.decode(first + second, batch, &error));
+    CHECK(decoder.series_count() == 1);
+    CHECK(batch.size() == 1 && batch.metrics[0].name() == "new");
+}
+
+static void test_usage_round_trip() {
+    std::vector<ClientUsage> usage = {{"tenant", 3}, {"", 1}};
+    std::string wire;
+    encode_usage(wire, usage.data(), usage.size());
+    size_t frames = 0;
+    CHECK(complete_frames(wire, MAX_BATCH_SAMPLES, &frames, nullptr) == wire.size() && frames == 1);
+
+    BinaryDecoder decoder;
+    MetricBatch batch;
+    CHECK(decoder.decode(wire, batch, nullptr));
+    CHECK(batch.empty());
+    CHECK(decoder.usage().size() == 2);
+    CHECK(decoder.usage()[0].client_id == "tenant" && decoder.usage()[0].requests == 3);
+    CHECK(decoder.usage()[1].client_id.empty() && decoder.usage()[1].requests == 1);
+
+    // A count the body cannot hold
+    wire[FRAME_HEADER_BYTES] = 9;
+    decoder.reset();
+    const char* error = nullptr;
+    CHECK(!decoder.decode(wire, batch, &error));
+    CHECK(error && std::string(error) == "Invalid USAGE frame");
+}
+
+static void test_ack_round_trip() {
+    std::string wire;
+    encode_ack(wire, BinaryAck{AckStatus::RATE_LIMITED, 3, 42});
+    BinaryAck ack;
+    size_t consumed = 0;
+    CHECK(decode_ack(wire, ack, consumed));
+    CHECK(consumed == wire.size());
+    CHECK(ack.status == AckStatus::RATE_LIMITED && ack.frames == 3 && ack.metrics == 42);
+    CHECK(!decode_ack(std::string_view(wire).substr(0, wire.size() - 1), ack, consumed));
+}
+
+static bool read_ack(int fd, BinaryAck& ack) {
+    static std::string buffer;
+    char chunk[64];
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (std::chrono::steady_clock::now() < deadline) {
+        size_t consumed;
+        if (decode_ack(buffer, ack, consumed)) {
+            buffer.erase(0, consumed);
+            return true;
+        }
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            return false;
+        }
+        buffer.append(chunk, static_cast<size_t>(n));
+    }
+    return false;
+}
+
+static void test_server_acks_frames() {
+    int port = 20000 + static_cast<int>(getpid() % 20000);
+    std::atomic<size_t> received{0};
+    BinaryServer server(port, [&](BinaryDecoder& decoder, std::string_view frames, std::string_view) {
+        MetricBatch batch;
+        BinaryAck ack;
+        if (!decoder.decode(frames, batch, nullptr)) {
+            ack.status = AckStatus::INVALID;
+            return ack;
+        }
+        received += batch.size();
+        ack.metrics = static_cast<uint32_t>(batch.size());
+        return ack;
+    }, 2, 1);
+    server.start();
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    timeval timeout{5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    bool connected = connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    CHECK(connected);
+    if (connected) {
+        BinaryEncoder encoder;
+        uint32_t ref = encoder.series_ref("tcp_metric", MetricType::GAUGE);
+        encoder.add_sample(ref, 1.0);
+        encoder.add_sample(ref, 2.0);
+        std::string wire;
+        encode_hello(wire, "tcp-test");
+        encoder.flush(wire);
+
+        // Dribble the bytes in to exercise reassembly
+        size_t half = wire.size() / 2;
+        CHECK(send(fd, wire.data(), half, 0) == static_cast<ssize_t>(half));
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        CHECK(send(fd, wire.data() + half, wire.size() - half, 0) == static_cast<ssize_t>(wire.size() - half));
+
+        // Whatever was complete on each read is acked separately
+        BinaryAck ack;
+        uint32_t frames = 0;
+        uint32_t metrics = 0;
+        while (frames < 3 && read_ack(fd, ack)) {
+            CHECK(ack.status == AckStatus::OK);
+            frames += ack.frames;
+            metrics += ack.metrics;
+        }
+        CHECK(frames == 3);
+        CHECK(metrics == 2);
+
+        // Garbage ends the connection with an INVALID ack
+        std::string garbage("\xff\xff\xff\xff\x03", 5);
+        CHECK(send(fd, garbage.data(), garbage.size(), 0) == 5);
+        CHECK(read_ack(fd, ack));
+        CHECK(ack.status == AckStatus::INVALID);
+    }
+    close(fd);
+    server.stop();
+    CHECK(received.load() == 2);
+}
+
+int main() {
+    test_round_trip();
+    test_partial_and_limits();
+    test_rejects_bad_frames();
+    test_usage_round_trip();
+    test_ack_round_trip();
+    test_server_acks_frames();
+
+    return test_result("binary_protocol_test");
+}
@@ -0,0 +1,231 @@
+#include "cardinality.h"
+#include "binary_protocol.h"
+#include "ingestion_service.h"
+#include "test_check.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace metricstream;
+
+static uint64_t mix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static bool near(double estimate, double actual, double tolerance) {
+    return std::fabs(estimate - actual) <= actual * tolerance;
+}
+
+static void test_hyperloglog() {
+    HyperLogLog sketch;
+    CHECK(sketch.estimate() == 0);
+    CHECK(sketch.add(mix(1)));
+    CHECK(!sketch.add(mix(1)));   // Seen: the register is already there
+    CHECK(near(sketch.estimate(), 1, 0.01));
+
+    // About 3% standard error; allow three of them
+    for (uint64_t i = 2; i <= 1000; ++i) sketch.add(mix(i));
+    CHECK(near(sketch.estimate(), 1000, 0.1));
+    for (uint64_t i = 1; i <= 1000; ++i) sketch.add(mix(i));   // Repeats change nothing
+    CHECK(near(sketch.estimate(), 1000, 0.1));
+    for (uint64_t i = 1001; i <= 200000; ++i) sketch.add(mix(i));
+    CHECK(near(sketch.estimate(), 200000, 0.1));
+
+    sketch.clear();
+    CHECK(sketch.estimate() == 0);
+
+    // Concurrent adds of overlapping ranges count each hash once
+    std::vector<std::thread> threads;
+    for (uint64_t t = 0; t < 4; ++t) {
+        threads.emplace_back([&sketch, t] {
+            for (uint64_t i = t * 25000; i < t * 25000 + 50000; ++i) sketch.add(mix(i));
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    CHECK(near(sketch.estimate(), 125000, 0.1));
+}
+
+// Parses `count` metrics of fresh series the way a request would
+static void ingest(CardinalityLimiter& limiter, CardinalityLimiter::Client& client, MetricBatch& batch,
+                   const std::string& prefix, int count, std::chrono::steady_clock::time_point now) {
+    batch.clear();
+    ScopedSeriesBudget budget(limiter.budget(client, now),
+                              limiter.options().action == CardinalityLimiter::Action::AGGREGATE);
+    for (int i = 0; i < count; ++i) {
+        std::string value = prefix + std::to_string(i);
+        TagRefs tags{{"request", value}};
+        batch.add_metric(Metric(SeriesRegistry::global().intern("latency", tags), 1.0, MetricType::GAUGE));
+    }
+    limiter.record(client, budget, batch);
+}
+
+static void test_new_series_limit() {
+    CardinalityLimiter::Options options;
+    options.max_new_series = 10;
+    options.window = std::chrono::milliseconds(1000);
+    CardinalityLimiter limiter(options);
+    auto now = std::chrono::steady_clock::now();
+    CardinalityLimiter::ClientRef tenant = limiter.client("tenant");
+    CardinalityLimiter::Client& client = *tenant;
+    MetricBatch batch;
+
+    ingest(limiter, client, batch, "a", 6, now);
+    CHECK(batch.size() == 6);
+    CHECK(limiter.budget(client, now) == 4);
+    // The rest of the budget, then refusals, which REJECT drops
+    ingest(limiter, client, batch, "b", 6, now);
+    CHECK(batch.size() == 4);
+    CHECK(client.refused_total.load() == 2 && limiter.series_refused() == 2);
+    CHECK(limiter.budget(client, now) == 0);
+    CHECK(limiter.clients_limited() == 1);
+
+    // Known series still pass once the budget is spent
+    ingest(limiter, client, batch, "a", 6, now);
+    CHECK(batch.size() == 6);
+    CHECK(near(client.sketches[client.window.load() % 2].estimate(), 10, 0.1));
+
+    // Other clients have their own budget
+    CardinalityLimiter::ClientRef other = limiter.client("other");
+    ingest(limiter, *other, batch, "c", 3, now);
+    CHECK(batch.size() == 3);
+
+    // A new window starts the count over and keeps the last estimate
+    auto later = now + std::chrono::milliseconds(1500);
+    CHECK(limiter.budget(client, later) == 10);
+    ingest(limiter, client, batch, "b", 6, later);
+    CHECK(batch.size() == 6);
+    CHECK(client.created.load() == 2 && client.created_total.load() == 12);
+
+    std::vector<CardinalityLimiter::ClientStats> top = limiter.top_clients(1);
+    CHECK(top.size() == 1 && top[0].client_id == "tenant");
+    CHECK(near(top[0].series_estimate, 6, 0.1) && near(top[0].previous_estimate, 10, 0.1));
+    CHECK(limiter.top_clients(10).size() == 2);
+}
+
+static void test_active_series_and_aggregate() {
+    CardinalityLimiter::Options options;
+    options.max_new_series = 0;
+    options.max_active_series = 20;
+    options.action = CardinalityLimiter::Action::AGGREGATE;
+    CardinalityLimiter limiter(options);
+    auto now = std::chrono::steady_clock::now();
+    CardinalityLimiter::ClientRef tenant = limiter.client("tenant");
+    CardinalityLimiter::Client& client = *tenant;
+    MetricBatch batch;
+
+    ingest(limiter, client, batch, "x", 25, now);   // One request may overshoot
+    CHECK(batch.size() == 25);
+    CHECK(limiter.budget(client, now) == 0);
+
+    // Refused series keep their points under the bare name
+    ingest(limiter, client, batch, "y", 5, now);
+    CHECK(batch.size() == 5);
+    for (const Metric& metric : batch.metrics) {
+        CHECK(metric.name() == "latency" && metric.tags().empty());
+    }
+    CHECK(client.refused_total.load() == 5);
+}
+
+static int connect_binary(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    timeval timeout{5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Sends `wire` in one write and reads the ack for it; INVALID if none came
+static BinaryAck send_frames(int fd, const std::string& wire) {
+    send(fd, wire.data(), wire.size(), 0);
+    std::string inbox;
+    BinaryAck ack;
+    size_t consumed = 0;
+    while (!decode_ack(inbox, ack, consumed)) {
+        char chunk[64];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            ack.status = AckStatus::INVALID;
+            return ack;
+        }
+        inbox.append(chunk, static_cast<size_t>(n));
+    }
+    return ack;
+}
+
+// One sample each of five series the server has not seen
+static std::string five_new_series(const std::string& prefix) {
+    BinaryEncoder encoder;
+    for (int i = 0; i < 5; ++i) {
+        encoder.add_sample(encoder.series_ref(prefix + std::to_string(i), MetricType::GAUGE), 1.0);
+    }
+    std::string wire;
+    encoder.flush(wire);
+    return wire;
+}
+
+// Over TCP the budget applies from the first SERIES frame: to the HELLO
+// name when it arrives in the same read, and to the address without one
+static void test_binary_stream_budget() {
+    int port = 20000 + static_cast<int>((getpid() + 60) % 20000);
+    std::string jsonl_path = "/tmp/metricstream_budget_" + std::to_string(getpid()) + ".jsonl";
+    std::string prefix = "budget." + std::to_string(getpid());
+    IngestionConfig config;
+    config.port = port;
+    config.binary_port = port + 1;
+    config.wal_enabled = false;
+    config.checkpoints_enabled = false;
+    config.jsonl_path = jsonl_path;
+    config.cardinality.max_new_series = 3;
+    IngestionService service(config);
+    service.start();
+
+    int fd = connect_binary(port + 1);
+    CHECK(fd >= 0);
+    std::string wire;
+    encode_hello(wire, "tenant");
+    wire += five_new_series(prefix + ".hello.");
+    BinaryAck ack = send_frames(fd, wire);
+    CHECK(ack.status == AckStatus::OK && ack.metrics == 3);
+    close(fd);
+
+    fd = connect_binary(port + 1);
+    CHECK(fd >= 0);
+    ack = send_frames(fd, five_new_series(prefix + ".anonymous."));
+    CHECK(ack.status == AckStatus::OK && ack.metrics == 3);
+    close(fd);
+
+    // A new connection from the same address has no budget left
+    fd = connect_binary(port + 1);
+    CHECK(fd >= 0);
+    ack = send_frames(fd, five_new_series(prefix + ".again."));
+    CHECK(ack.status == AckStatus::REJECTED && ack.metrics == 0);
+    close(fd);
+
+    service.stop();
+    unlink(jsonl_path.c_str());
+}
+
+int main() {
+    test_hyperloglog();
+    test_new_series_limit();
+    test_active_series_and_aggregate();
+    test_binary_stream_budget();
+
+    return test_result("cardinality_test");
+}
@@ -0,0 +1,203 @@
+#include "checkpoint.h"
+#include "test_check.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace metricstream;
+
+static std::string temp_dir(const char* name) {
+    return "/tmp/metricstream_" + std::string(name) + "_" + std::to_string(getpid());
+}
+
+static void remove_dir(const std::string& dir) {
+    if (DIR* d = opendir(dir.c_str())) {
+        while (dirent* entry = readdir(d)) {
+            std::string name = entry->d_name;
+            if (name != "." && name != "..") unlink((dir + "/" + name).c_str());
+        }
+        closedir(d);
+    }
+    rmdir(dir.c_str());
+}
+
+static off_t file_size(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_size : -1;
+}
+
+static CheckpointStore::Options options_for(const std::string& dir) {
+    CheckpointStore::Options options;
+    options.directory = dir;
+    return options;
+}
+
+static void add_series(SeriesRegistry& registry, int from, int to) {
+    for (int i = from; i < to; ++i) {
+        registry.intern("cpu", TagRefs{{"host", "web" + std::to_string(i)}, {"dc", "eu"}});
+    }
+}
+
+static CheckpointStore::Sections sections_of(const std::string& wal) {
+    return {{CheckpointSection::WAL, wal},
+            {CheckpointSection::ROLLUPS, "x"},
+            {CheckpointSection::ROLLUPS, "yz"},
+            {CheckpointSection::RATE_LIMITS, ""}};
+}
+
+static void test_roundtrip_and_append() {
+    std::string dir = temp_dir("checkpoint_roundtrip");
+    remove_dir(dir);
+    {
+        SeriesRegistry registry;
+        CheckpointStore store(options_for(dir));
+        CHECK(!store.load(registry));
+        add_series(registry, 0, 100);
+        CHECK(store.write(registry, sections_of("first")));
+        CHECK(store.sequence() == 1 && store.checkpoints_written() == 1);
+        CHECK(store.dictionary_series() == 101);
+        CHECK(list_checkpoint_files(dir).size() == 1);
+    }
+    off_t dictionary = file_size(dir + "/series.dict");
+    {
+        SeriesRegistry registry;
+        CheckpointStore store(options_for(dir));
+        CHECK(store.load(registry));
+        CHECK(store.loaded());
+        CHECK(registry.size() == 101);
+        CHECK(store.series_ids().size() == 101 && store.series_ids()[37] == 37);
+        CHECK(registry.intern("cpu", TagRefs{{"dc", "eu"}, {"host", "web36"}}) == 37);
+        CHECK(store.section(CheckpointSection::WAL) == "first");
+        std::vector<std::string_view> rollups = store.sections(CheckpointSection::ROLLUPS);
+        CHECK(rollups.size() == 2 && rollups[0] == "x" && rollups[1] == "yz");
+        CHECK(store.section(CheckpointSection::RATE_LIMITS).empty());
+        store.release();
+        CHECK(!store.loaded());
+
+        // Only the new series are appended; two state files are kept
+        add_series(registry, 100, 110);
+        CHECK(store.write(registry, sections_of("second")));
+        std::string canonical = registry.key(105).canonical;
+        CHECK(file_size(dir + "/series.dict") == dictionary + 10 * static_cast<off_t>(4 + canonical.size()));
+        CHECK(store.write(registry, sections_of("third")));
+        CHECK(file_size(dir + "/series.dict") == dictionary + 10 * static_cast<off_t>(4 + canonical.size()));
+        CHECK(store.sequence() == 3);
+        CHECK(list_checkpoint_files(dir).size() == 2);
+    }
+    {
+        SeriesRegistry registry;
+        CheckpointStore store(options_for(dir));
+        CHECK(store.load(registry));
+        CHECK(store.sequence() == 3);
+        CHECK(store.section(CheckpointSection::WAL) == "third");
+        CHECK(registry.size() == 111);
+        CHECK(*registry.key(105).tag("host") == "web104");
+    }
+    remove_dir(dir);
+}
+
+static void test_fallback_and_leftovers() {
+    std::string dir = temp_dir("checkpoint_fallback");
+    remove_dir(dir);
+    {
+        SeriesRegistry registry;
+        CheckpointStore store(options_for(dir));
+        store.load(registry);
+        add_series(registry, 0, 5);
+        CHECK(store.write(registry, sections_of("older")));
+        add_series(registry, 5, 8);
+        CHECK(store.write(registry, sections_of("newer")));
+    }
+    // A crash after a dictionary append but before its state file leaves
+    // records no state names
+    off_t dictionary = file_size(dir + "/series.dict");
+    {
+        int fd = open((dir + "/series.dict").c_str(), O_WRONLY | O_APPEND);
+        CHECK(write(fd, "\x05\0\0\0junk!", 9) == 9);
+        close(fd);
+    }
+    // Flip a byte of the newest state's first section
+    std::string newest = list_checkpoint_files(dir).back();
+    {
+        int fd = open(newest.c_str(), O_RDWR);
+        off_t size = lseek(fd, 0, SEEK_END);
+        char byte = 0;
+        CHECK(pread(fd, &byte, 1, size - 20) == 1);
+        byte ^= 0x40;
+        CHECK(pwrite(fd, &byte, 1, size - 20) == 1);
+        close(fd);
+    }
+    {
+        SeriesRegistry registry;
+        CheckpointStore store(options_for(dir));
+        CHECK(store.load(registry));
+        CHECK(store.section(CheckpointSection::WAL) == "older");
+        CHECK(registry.size() == 6);
+        store.release();
+
+        // The next write continues after the older state's series,
+        // dropping the leftover records, and sorts after the corrupt file
+        add_series(registry, 5, 8);
+        CHECK(store.write(registry, sections_of("again")));
+        CHECK(file_size(dir + "/series.dict") == dictionary);
+        CHECK(list_checkpoint_files(dir).back() > newest);
+    }
+    {
+        SeriesRegistry registry;
+        CheckpointStore store(options_for(dir));
+        CHECK(store.load(registry));
+        CHECK(store.section(CheckpointSection::WAL) == "again");
+    }
+    remove_dir(dir);
+}
+
+static void test_shared_registry() {
+    std::string dir = temp_dir("checkpoint_shared");
+    remove_dir(dir);
+    {
+        SeriesRegistry registry;
+        CheckpointStore store(options_for(dir));
+        store.load(registry);
+        add_series(registry, 0, 20);
+        CHECK(store.write(registry, sections_of("saved")));
+    }
+
+    // Series registered before the load get their own ids; saved ones map
+    SeriesRegistry registry;
+    uint32_t early = registry.intern("early", TagRefs{});
+    {
+        CheckpointStore store(options_for(dir));
+        CHECK(store.load(registry));
+        CHECK(registry.size() == 22);
+        const std::vector<uint32_t>& ids = store.series_ids();
+        CHECK(ids.size() == 21 && ids[0] == SeriesRegistry::OVERFLOW_ID);
+        CHECK(ids[1] == early + 1);
+        CHECK(*registry.key(ids[20]).tag("host") == "web19");
+        store.release();
+
+        // The dictionary no longer matches the ids: it is started over,
+        // and older states no longer load against it
+        CHECK(store.write(registry, sections_of("rewritten")));
+        CHECK(list_checkpoint_files(dir).size() == 2);
+        unlink(list_checkpoint_files(dir).back().c_str());
+    }
+    {
+        SeriesRegistry fresh;
+        CheckpointStore store(options_for(dir));
+        CHECK(!store.load(fresh));
+        CHECK(fresh.size() == 1);
+    }
+    remove_dir(dir);
+}
+
+int main() {
+    test_roundtrip_and_append();
+    test_fallback_and_leftovers();
+    test_shared_registry();
+
+    return test_result("checkpoint_test");
+}
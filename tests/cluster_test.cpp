@@ -0,0 +1,357 @@
+#include "cluster.h"
+#include "binary_server.h"
+#include "ingestion_service.h"
+#include "test_check.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace metricstream;
+
+static std::string key_for(size_t i) {
+    return "cpu.usage\x1fhost=web-" + std::to_string(i);
+}
+
+static void test_parse_node() {
+    ClusterNode node;
+    CHECK(parse_cluster_node("10.0.0.7:9100", node));
+    CHECK(node.host == "10.0.0.7" && node.port == 9100);
+    CHECK(parse_cluster_node("localhost:1", node));
+    CHECK(node.host == "localhost" && node.port == 1);
+    CHECK(!parse_cluster_node("localhost", node));
+    CHECK(!parse_cluster_node(":9100", node));
+    CHECK(!parse_cluster_node("host:", node));
+    CHECK(!parse_cluster_node("host:0", node));
+    CHECK(!parse_cluster_node("host:70000", node));
+    CHECK(!parse_cluster_node("host:91a", node));
+}
+
+static void test_ring_balance_and_movement() {
+    constexpr size_t KEYS = 10000;
+    HashRing three(3);
+    HashRing again(3);
+    HashRing four(4);
+    CHECK(three.node_count() == 3);
+
+    std::vector<size_t> counts(3, 0);
+    size_t moved = 0;
+    for (size_t i = 0; i < KEYS; ++i) {
+        uint64_t hash = series_hash(key_for(i));
+        size_t owner = three.owner(hash);
+        CHECK(owner < 3);
+        CHECK(again.owner(hash) == owner);   // Every node computes the same owner
+        counts[owner]++;
+        size_t next = four.owner(hash);
+        if (next != owner) {
+            moved++;
+            CHECK(next == 3);   // Growing only moves keys onto the new node
+        }
+    }
+    for (size_t count : counts) {
+        CHECK(std::abs(static_cast<double>(count) - KEYS / 3.0) < KEYS / 3.0 * 0.2);
+    }
+    CHECK(std::abs(static_cast<double>(moved) - KEYS / 4.0) < KEYS / 4.0 * 0.2);
+
+    HashRing one(1);
+    CHECK(one.owner(0) == 0 && one.owner(~0ULL) == 0);
+    CHECK(series_hash("a") != series_hash("b"));
+}
+
+struct FakePeer {
+    std::mutex mutex;
+    std::vector<std::string> names;
+    std::vector<double> values;
+    std::string client_id;
+    std::atomic<bool> refuse{false};
+
+    BinaryAck handle(BinaryDecoder& decoder, std::string_view frames) {
+        BinaryAck ack;
+        MetricBatch batch;
+        if (!decoder.decode(frames, batch, nullptr)) {
+            ack.status = AckStatus::INVALID;
+            return ack;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        client_id.assign(decoder.client_id());
+        if (refuse && !batch.empty()) {
+            ack.status = AckStatus::REJECTED;
+            return ack;
+        }
+        for (const Metric& metric : batch.metrics) {
+            names.push_back(metric.series().canonical);
+            values.push_back(metric.value);
+        }
+        ack.metrics = static_cast<uint32_t>(batch.size());
+        return ack;
+    }
+};
+
+static void test_forwarding() {
+    int port = 20000 + static_cast<int>((getpid() + 11) % 20000);
+    FakePeer fake;
+    BinaryServer server(port, [&](BinaryDecoder& decoder, std::string_view frames, std::string_view) {
+        return fake.handle(decoder, frames);
+    });
+    server.start();
+
+    std::vector<ClusterNode> nodes{{"127.0.0.1", 1}, {"127.0.0.1", port}};
+    ClusterForwarder forwarder(nodes, 0);
+    CHECK(forwarder.node_count() == 2);
+
+    std::vector<Metric> metrics;
+    for (int i = 0; i < 2500; ++i) {
+        metrics.emplace_back("forward.test", static_cast<double>(i), MetricType::GAUGE,
+                             Tags{{"host", "web-" + std::to_string(i % 3)}});
+    }
+    CHECK(forwarder.send(0, metrics.data(), 1) == nullptr);   // Never to itself
+
+    // Concurrent senders share groups; all of them are acked
+    std::vector<std::thread> senders;
+    std::vector<bool> results(5, false);
+    for (size_t t = 0; t < results.size(); ++t) {
+        senders.emplace_back([&, t] {
+            auto ticket = forwarder.send(1, metrics.data() + t * 500, 500);
+            results[t] = forwarder.wait(ticket);
+        });
+    }
+    for (auto& sender : senders) {
+        sender.join();
+    }
+    for (bool ok : results) {
+        CHECK(ok);
+    }
+    CHECK(forwarder.metrics_forwarded() == 2500);
+    CHECK(forwarder.forward_errors() == 0);
+    {
+        std::lock_guard<std::mutex> lock(fake.mutex);
+        CHECK(fake.client_id == "cluster:0");
+        CHECK(fake.values.size() == 2500);
+        double sum = 0;
+        for (double value : fake.values) sum += value;
+        CHECK(sum == 2499.0 * 2500.0 / 2.0);
+        CHECK(!fake.names.empty() && fake.names[0].rfind("forward.test", 0) == 0);
+    }
+
+    // A refusal fails the group without breaking the connection
+    fake.refuse = true;
+    CHECK(!forwarder.wait(forwarder.send(1, metrics.data(), 10)));
+    fake.refuse = false;
+    CHECK(forwarder.wait(forwarder.send(1, metrics.data(), 10)));
+    CHECK(forwarder.forward_errors() == 1);
+
+    // A peer that goes away fails its waiters instead of hanging them
+    server.stop();
+    bool ok = true;
+    for (int attempt = 0; attempt < 3 && ok; ++attempt) {
+        ok = forwarder.wait(forwarder.send(1, metrics.data(), 10));
+    }
+    CHECK(!ok);
+}
+
+static void test_peer_down() {
+    ClusterForwarder::Options options;
+    options.connect_timeout = std::chrono::milliseconds(200);
+    options.max_pending_metrics = 100;
+    int port = 20000 + static_cast<int>((getpid() + 13) % 20000);
+    ClusterForwarder forwarder({{"127.0.0.1", port}, {"127.0.0.1", 1}}, 0, options);
+
+    std::vector<Metric> metrics(200, Metric("down.test", 1.0, MetricType::COUNTER));
+    CHECK(forwarder.send(1, metrics.data(), 200) == nullptr);   // Over the queue limit
+    auto start = std::chrono::steady_clock::now();
+    CHECK(!forwarder.wait(forwarder.send(1, metrics.data(), 10)));
+    CHECK(!forwarder.wait(forwarder.send(1, metrics.data(), 10)));   // Backing off
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(2));
+    CHECK(forwarder.metrics_forwarded() == 0);
+    CHECK(forwarder.forward_errors() == 3);
+}
+
+static void test_peer_trust() {
+    std::vector<ClusterNode> nodes = {{"127.0.0.1", 9000}, {"127.0.0.2", 9001}, {"localhost", 9002}};
+    ClusterPeers peers(nodes, 0);
+    CHECK(peers.trusted("cluster:1", "127.0.0.2"));
+    CHECK(peers.trusted("cluster:2", "127.0.0.1"));    // Hosts are resolved
+    CHECK(!peers.trusted("cluster:1", "127.0.0.1"));   // Not node 1's address
+    CHECK(!peers.trusted("cluster:0", "127.0.0.1"));   // This node never forwards to itself
+    CHECK(!peers.trusted("cluster:3", "127.0.0.2"));
+    CHECK(!peers.trusted("cluster:1x", "127.0.0.2"));
+    CHECK(!peers.trusted("cluster:", "127.0.0.2"));
+    CHECK(!peers.trusted("client-a", "127.0.0.2"));
+}
+
+// Connects to the local listener from `source`, any loopback address
+static int connect_from(const char* source, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in local{};
+    local.sin_family = AF_INET;
+    inet_pton(AF_INET, source, &local.sin_addr);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    timeval timeout{5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (bind(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0 ||
+        connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Sends `batches` one-sample batches under the HELLO id, one at a time, and
+// counts the RATE_LIMITED acks; -1 if the stream broke
+static int count_rate_limited(int port, const char* source, std::string_view client_id, int batches) {
+    int fd = connect_from(source, port);
+    if (fd < 0) {
+        return -1;
+    }
+    BinaryEncoder encoder;
+    uint32_t ref = encoder.series_ref("trust.test", MetricType::GAUGE);
+    std::string wire;
+    encode_hello(wire, client_id);
+    std::string inbox;
+    int limited = 0;
+    for (int i = 0; i < batches && limited >= 0; ++i) {
+        encoder.add_sample(ref, static_cast<double>(i));
+        encoder.flush(wire);
+        send(fd, wire.data(), wire.size(), 0);
+        wire.clear();
+
+        BinaryAck ack;
+        size_t consumed = 0;
+        while (!decode_ack(inbox, ack, consumed)) {
+            char chunk[64];
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0) {
+                limited = -1;
+                break;
+            }
+            inbox.append(chunk, static_cast<size_t>(n));
+        }
+        inbox.erase(0, consumed);
+        if (limited >= 0 && ack.status == AckStatus::RATE_LIMITED) {
+            limited++;
+        }
+    }
+    close(fd);
+    return limited;
+}
+
+static IngestionConfig trust_config(int http_port, const std::string& jsonl_path) {
+    IngestionConfig config;
+    config.port = http_port;
+    config.rate_limit = 2;
+    config.wal_enabled = false;
+    config.checkpoints_enabled = false;
+    config.jsonl_path = jsonl_path;
+    return config;
+}
+
+// A "cluster:" HELLO from anything but a configured peer is rate-limited
+// like any client, with or without clustering
+static void test_cluster_hello_from_client() {
+    int port = 20000 + static_cast<int>((getpid() + 14) % 20000);
+    std::string jsonl_path = "/tmp/metricstream_trust_" + std::to_string(getpid()) + ".jsonl";
+
+    {
+        IngestionConfig config = trust_config(port, jsonl_path);
+        config.binary_port = port + 1;
+        IngestionService service(config);
+        service.start();
+        CHECK(count_rate_limited(port + 1, "127.0.0.1", "cluster:1", 5) == 3);
+        service.stop();
+    }
+
+    // Node 1 lives at 127.0.0.2; the owner stores its stream without limits
+    {
+        IngestionConfig config = trust_config(port + 2, jsonl_path);
+        config.cluster_nodes = {{"127.0.0.1", port + 3}, {"127.0.0.2", port + 4}};
+        config.cluster_self = 0;
+        IngestionService service(config);
+        service.start();
+        CHECK(count_rate_limited(port + 3, "127.0.0.1", "cluster:1", 5) == 3);
+        CHECK(count_rate_limited(port + 3, "127.0.0.2", "cluster:1", 5) == 0);
+        CHECK(service.get_rate_limited_requests() == 3);
+        service.stop();
+    }
+    unlink(jsonl_path.c_str());
+}
+
+// One client split over two nodes gets rate_limit in total, not per node
+static void test_shared_rate_limit() {
+    int port = 20000 + static_cast<int>((getpid() + 20) % 20000);
+    std::string jsonl_a = "/tmp/metricstream_shared_a_" + std::to_string(getpid()) + ".jsonl";
+    std::string jsonl_b = "/tmp/metricstream_shared_b_" + std::to_string(getpid()) + ".jsonl";
+    std::vector<ClusterNode> nodes = {{"127.0.0.1", port + 2}, {"127.0.0.1", port + 3}};
+    {
+        IngestionConfig config_a = trust_config(port, jsonl_a);
+        config_a.cluster_nodes = nodes;
+        config_a.cluster_self = 0;
+        config_a.cluster_usage_interval = std::chrono::milliseconds(20);
+        IngestionConfig config_b = trust_config(port + 1, jsonl_b);
+        config_b.cluster_nodes = nodes;
+        config_b.cluster_self = 1;
+        config_b.cluster_usage_interval = std::chrono::milliseconds(20);
+        IngestionService a(config_a);
+        IngestionService b(config_b);
+        a.start();
+        b.start();
+
+        CHECK(count_rate_limited(port + 2, "127.0.0.1", "tenant", 3) == 1);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while (b.get_peer_rate_limit_usage() < 2 && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        CHECK(b.get_peer_rate_limit_usage() == 2);
+        CHECK(count_rate_limited(port + 3, "127.0.0.1", "tenant", 3) == 3);
+
+        // B's refusals admitted nothing, so A hears of nothing new
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        CHECK(a.get_peer_rate_limit_usage() == 0);
+
+        // A client cannot spend another's allowance
+        int fd = connect_from("127.0.0.1", port + 2);
+        CHECK(fd >= 0);
+        std::string wire;
+        encode_hello(wire, "tenant");
+        ClientUsage usage{"victim", 100};
+        encode_usage(wire, &usage, 1);
+        send(fd, wire.data(), wire.size(), 0);
+        std::string inbox;
+        BinaryAck ack;
+        size_t consumed = 0;
+        char chunk[64];
+        ssize_t n;
+        while (!decode_ack(inbox, ack, consumed) && (n = recv(fd, chunk, sizeof(chunk), 0)) > 0) {
+            inbox.append(chunk, static_cast<size_t>(n));
+        }
+        CHECK(consumed > 0 && ack.status == AckStatus::INVALID);
+        CHECK(a.get_peer_rate_limit_usage() == 0);
+        close(fd);
+
+        a.stop();
+        b.stop();
+    }
+    unlink(jsonl_a.c_str());
+    unlink(jsonl_b.c_str());
+}
+
+int main() {
+    test_parse_node();
+    test_ring_balance_and_movement();
+    test_forwarding();
+    test_peer_down();
+    test_peer_trust();
+    test_cluster_hello_from_client();
+    test_shared_rate_limit();
+
+    return test_result("cluster_test");
+}
@@ -0,0 +1,123 @@
+#include "http_parser.h"
+#include "test_check.h"
+#include <iostream>
+#include <string>
+
+using metricstream::HttpRequestParser;
+using Status = HttpRequestParser::Status;
+
+// Feed input one byte at a time, as the worst-case sequence of partial reads
+static Status feed_bytewise(HttpRequestParser& parser, std::string& buffer, const std::string& input) {
+    Status status = Status::NEED_MORE;
+    for (char c : input) {
+        buffer.push_back(c);
+        status = parser.parse(buffer);
+        if (status != Status::NEED_MORE) break;
+    }
+    return status;
+}
+
+static void test_simple_get() {
+    HttpRequestParser parser;
+    std::string buffer = "GET /health?verbose=1 HTTP/1.1\r\nHost: x\r\n\r\n";
+    CHECK(parser.parse(buffer) == Status::COMPLETE);
+    const auto& req = parser.request();
+    CHECK(req.method == "GET");
+    CHECK(req.path == "/health");
+    CHECK(req.query == "verbose=1");
+    CHECK(req.version == "HTTP/1.1");
+    CHECK(req.header("host") == "x");
+    CHECK(req.body.empty());
+    CHECK(parser.consumed() == buffer.size());
+}
+
+static void test_content_length_partial_reads() {
+    std::string body = R"({"metrics":[{"name":"cpu","value":1}]})";
+    std::string input = "POST /metrics HTTP/1.1\r\ncontent-length: " + std::to_string(body.size()) +
+                        "\r\nAuthorization:   client_1  \r\n\r\n" + body;
+    HttpRequestParser parser;
+    std::string buffer;
+    CHECK(feed_bytewise(parser, buffer, input) == Status::COMPLETE);
+    CHECK(parser.request().body == body);
+    CHECK(parser.request().header("Authorization") == "client_1");
+}
+
+static void test_chunked_body() {
+    std::string input =
+        "POST /metrics HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "5\r\nhello\r\n"
+        "7;ext=1\r\n, world\r\n"
+        "0\r\nX-Trailer: y\r\n\r\n";
+    HttpRequestParser parser;
+    std::string buffer;
+    CHECK(feed_bytewise(parser, buffer, input) == Status::COMPLETE);
+    CHECK(parser.request().body == "hello, world");
+    CHECK(parser.consumed() == input.size());
+}
+
+static void test_pipelined_requests() {
+    std::string first = "GET /a HTTP/1.1\r\n\r\n";
+    std::string second = "POST /b HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc";
+    std::string buffer = first + second;
+
+    HttpRequestParser parser;
+    CHECK(parser.parse(buffer) == Status::COMPLETE);
+    CHECK(parser.request().path == "/a");
+    CHECK(parser.consumed() == first.size());
+
+    buffer.erase(0, parser.consumed());
+    parser.reset();
+    CHECK(parser.parse(buffer) == Status::COMPLETE);
+    CHECK(parser.request().path == "/b");
+    CHECK(parser.request().body == "abc");
+}
+
+static void test_limits_and_errors() {
+    {
+        HttpRequestParser parser(10);
+        std::string buffer = "POST / HTTP/1.1\r\nContent-Length: 11\r\n\r\n";
+        CHECK(parser.parse(buffer) == Status::ERROR);
+        CHECK(parser.error_status() == 413);
+    }
+    {
+        HttpRequestParser parser(1024, 64);
+        std::string buffer = "GET / HTTP/1.1\r\nX-Big: " + std::string(100, 'a');
+        CHECK(parser.parse(buffer) == Status::ERROR);
+        CHECK(parser.error_status() == 431);
+    }
+    {
+        HttpRequestParser parser;
+        std::string buffer = "POST / HTTP/1.1\r\nContent-Length: 3\r\nTransfer-Encoding: chunked\r\n\r\n";
+        CHECK(parser.parse(buffer) == Status::ERROR);
+        CHECK(parser.error_status() == 400);
+    }
+    {
+        HttpRequestParser parser;
+        std::string buffer = "GET / HTTP/2.0\r\n\r\n";
+        CHECK(parser.parse(buffer) == Status::ERROR);
+        CHECK(parser.error_status() == 505);
+    }
+}
+
+static void test_expect_continue() {
+    HttpRequestParser parser;
+    std::string buffer = "POST / HTTP/1.1\r\nExpect: 100-continue\r\nContent-Length: 2\r\n\r\n";
+    CHECK(parser.parse(buffer) == Status::NEED_MORE);
+    CHECK(parser.expects_continue());
+    parser.acknowledge_continue();
+    CHECK(!parser.expects_continue());
+    buffer += "ok";
+    CHECK(parser.parse(buffer) == Status::COMPLETE);
+    CHECK(parser.request().body == "ok");
+}
+
+int main() {
+    test_simple_get();
+    test_content_length_partial_reads();
+    test_chunked_body();
+    test_pipelined_requests();
+    test_limits_and_errors();
+    test_expect_continue();
+
+    return test_result("http_parser_test");
+}
@@ -0,0 +1,94 @@
+#include "http_response.h"
+#include "test_check.h"
+#include <sys/uio.h>
+#include <iostream>
+#include <string>
+
+using metricstream::CannedResponse;
+using metricstream::HttpResponse;
+using metricstream::OutboundMessage;
+
+// Concatenate what a vectored write starting at skip would send
+static std::string gather(const OutboundMessage& message, size_t skip = 0) {
+    struct iovec iov[OutboundMessage::MAX_SEGMENTS];
+    size_t count = message.fill_iovec(iov, OutboundMessage::MAX_SEGMENTS, skip);
+    std::string bytes;
+    for (size_t i = 0; i < count; ++i) {
+        bytes.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+    }
+    return bytes;
+}
+
+static void test_serialize_json() {
+    HttpResponse response;
+    response.set_json_content();
+    response.body = R"({"success":true})";
+    OutboundMessage message = metricstream::serialize_response(std::move(response), true);
+    std::string expected =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: 16\r\n"
+        "Connection: keep-alive\r\n"
+        "\r\n"
+        R"({"success":true})";
+    CHECK(gather(message) == expected);
+    CHECK(message.size() == expected.size());
+    CHECK(gather(message, 20) == expected.substr(20));
+}
+
+static void test_extra_headers_and_unknown_status() {
+    HttpResponse response;
+    response.status_code = 299;
+    response.headers["Retry-After"] = "1";
+    OutboundMessage message = metricstream::serialize_response(std::move(response), false);
+    CHECK(gather(message) ==
+          "HTTP/1.1 299 Unknown\r\n"
+          "Content-Length: 0\r\n"
+          "Retry-After: 1\r\n"
+          "Connection: close\r\n"
+          "\r\n");
+}
+
+static void test_canned() {
+    static const CannedResponse canned(429, "application/json", "{}");
+    CHECK(canned.bytes(false) ==
+          "HTTP/1.1 429 Too Many Requests\r\n"
+          "Content-Type: application/json\r\n"
+          "Content-Length: 2\r\n"
+          "Connection: close\r\n"
+          "\r\n{}");
+
+    HttpResponse response;
+    response.canned = &canned;
+    OutboundMessage message = metricstream::serialize_response(std::move(response), true);
+    CHECK(gather(message) == canned.bytes(true));
+}
+
+static void test_segment_overflow() {
+    // More pieces than segments still produce every byte in order
+    OutboundMessage message;
+    std::string expected;
+    for (int i = 0; i < 20; ++i) {
+        std::string piece(static_cast<size_t>(i + 1), static_cast<char>('a' + i));
+        if (i % 2 == 0) {
+            message.add_owned(piece);
+        } else {
+            message.add_inline(piece);
+        }
+        expected += piece;
+    }
+    CHECK(gather(message) == expected);
+    CHECK(message.size() == expected.size());
+
+    OutboundMessage moved = std::move(message);
+    CHECK(gather(moved) == expected);
+}
+
+int main() {
+    test_serialize_json();
+    test_extra_headers_and_unknown_status();
+    test_canned();
+    test_segment_overflow();
+
+    return test_result("http_response_test");
+}
@@ -0,0 +1,254 @@
+#include "http_server.h"
+#include "test_check.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace metricstream;
+
+using std::chrono::milliseconds;
+
+static int test_port(int offset) {
+    return 20000 + static_cast<int>((getpid() + 40 + offset) % 20000);
+}
+
+static int connect_to(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    timeval timeout{5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void send_all(int fd, const std::string& data) {
+    size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t n = send(fd, data.data() + offset, data.size() - offset, 0);
+        if (n <= 0) return;
+        offset += static_cast<size_t>(n);
+    }
+}
+
+// One response off the connection; `buffer` keeps bytes that belong to the
+// next one. Returns the body, or "<none>" if the connection ended first.
+static std::string read_response(int fd, std::string& buffer) {
+    char chunk[4096];
+    while (true) {
+        size_t header_end = buffer.find("\r\n\r\n");
+        if (header_end != std::string::npos) {
+            size_t length = 0;
+            size_t at = buffer.find("Content-Length: ");
+            if (at != std::string::npos && at < header_end) {
+                length = std::stoul(buffer.substr(at + 16));
+            }
+            if (buffer.size() >= header_end + 4 + length) {
+                std::string body = buffer.substr(header_end + 4, length);
+                buffer.erase(0, header_end + 4 + length);
+                return body;
+            }
+        }
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            return "<none>";
+        }
+        buffer.append(chunk, static_cast<size_t>(n));
+    }
+}
+
+// True once the server has closed its end (recv sees EOF before the timeout)
+static bool closed_by_server(int fd) {
+    char byte;
+    return recv(fd, &byte, 1, 0) == 0;
+}
+
+// Still open: nothing arrives within a short wait, and no EOF
+static bool still_open(int fd) {
+    timeval short_wait{0, 200000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &short_wait, sizeof(short_wait));
+    char byte;
+    bool open = recv(fd, &byte, 1, 0) < 0;
+    timeval timeout{5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return open;
+}
+
+static void add_echo_handler(HttpServer& server) {
+    server.add_handler("/echo", "GET", [](const HttpRequest& request) {
+        HttpResponse response;
+        response.body = std::string(request.query);
+        return response;
+    });
+}
+
+// A request that dribbles in over several reads is still answered
+static void test_split_request() {
+    int port = test_port(0);
+    HttpServer server(port, 2, 1);
+    add_echo_handler(server);
+    server.start();
+
+    int fd = connect_to(port);
+    CHECK(fd >= 0);
+    const std::string request = "GET /echo?split HTTP/1.1\r\nHost: x\r\n\r\n";
+    for (size_t i = 0; i < request.size(); i += 7) {
+        send_all(fd, request.substr(i, 7));
+        std::this_thread::sleep_for(milliseconds(5));
+    }
+    std::string buffer;
+    CHECK(read_response(fd, buffer) == "split");
+
+    close(fd);
+    server.stop();
+}
+
+// Two requests in one write come back in order on the same connection
+static void test_pipelined_in_order() {
+    int port = test_port(2);
+    HttpServer server(port, 4, 1);
+    add_echo_handler(server);
+    server.add_handler("/slow", "GET", [](const HttpRequest& request) {
+        std::this_thread::sleep_for(milliseconds(50));
+        HttpResponse response;
+        response.body = std::string(request.query);
+        return response;
+    });
+    server.start();
+
+    int fd = connect_to(port);
+    CHECK(fd >= 0);
+    // The slow one first: a worker finishing the second early must not overtake it
+    send_all(fd, "GET /slow?first HTTP/1.1\r\nHost: x\r\n\r\n"
+                 "GET /echo?second HTTP/1.1\r\nHost: x\r\n\r\n");
+    std::string buffer;
+    CHECK(read_response(fd, buffer) == "first");
+    CHECK(read_response(fd, buffer) == "second");
+    CHECK(buffer.empty());
+    CHECK(still_open(fd));
+
+    close(fd);
+    server.stop();
+}
+
+// HTTP/1.1 persists by default; "Connection: close" and HTTP/1.0 end it
+static void test_keep_alive_and_close() {
+    int port = test_port(3);
+    HttpServer server(port, 2, 1);
+    add_echo_handler(server);
+    server.start();
+
+    int fd = connect_to(port);
+    CHECK(fd >= 0);
+    std::string buffer;
+    for (int i = 0; i < 3; ++i) {
+        send_all(fd, "GET /echo?again HTTP/1.1\r\nHost: x\r\n\r\n");
+        CHECK(read_response(fd, buffer) == "again");
+    }
+    CHECK(still_open(fd));
+
+    send_all(fd, "GET /echo?bye HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n");
+    CHECK(read_response(fd, buffer) == "bye");
+    CHECK(closed_by_server(fd));
+    close(fd);
+
+    fd = connect_to(port);
+    CHECK(fd >= 0);
+    buffer.clear();
+    send_all(fd, "GET /echo?old HTTP/1.0\r\n\r\n");
+    CHECK(read_response(fd, buffer) == "old");
+    CHECK(closed_by_server(fd));
+    close(fd);
+
+    server.stop();
+}
+
+// A second server on a taken port fails instead of quietly sharing it
+static void test_port_in_use() {
+    int port = test_port(4);
+    std::vector<int> first = EventLoop::open_listeners(port, 4);
+    CHECK(!first.empty());
+    CHECK(EventLoop::open_listeners(port, 4).empty());
+    CHECK(EventLoop::open_listeners(port, 1).empty());
+    for (int fd : first) close(fd);
+
+    std::vector<int> again = EventLoop::open_listeners(port, 4);
+    CHECK(!again.empty());
+    for (int fd : again) close(fd);
+}
+
+// Out of descriptors, the listener must back off instead of spinning on a
+// connection it cannot accept, and pick it up once descriptors free up
+static void test_accept_out_of_descriptors() {
+    int port = test_port(1);
+    HttpServer server(port, 2, 1);
+    add_echo_handler(server);
+    server.start();
+
+    rlimit original{};
+    getrlimit(RLIMIT_NOFILE, &original);
+    rlimit lowered = original;
+    lowered.rlim_cur = std::min<rlim_t>(original.rlim_cur, 256);
+    CHECK(setrlimit(RLIMIT_NOFILE, &lowered) == 0);
+
+    // Use up the table, then give the last descriptor to the client socket
+    std::vector<int> fillers;
+    while (true) {
+        int fd = open("/dev/null", O_RDONLY);
+        if (fd < 0) break;
+        fillers.push_back(fd);
+    }
+    CHECK(!fillers.empty());
+    close(fillers.back());
+    fillers.pop_back();
+    int client = connect_to(port);
+    CHECK(client >= 0);
+
+    rusage before{};
+    getrusage(RUSAGE_SELF, &before);
+    std::this_thread::sleep_for(milliseconds(300));
+    rusage after{};
+    getrusage(RUSAGE_SELF, &after);
+    auto cpu_us = [](const rusage& usage) {
+        return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL +
+               usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    };
+    CHECK(cpu_us(after) - cpu_us(before) < 100000);
+
+    for (int fd : fillers) close(fd);
+    setrlimit(RLIMIT_NOFILE, &original);
+
+    send_all(client, "GET /echo?late HTTP/1.1\r\nHost: x\r\n\r\n");
+    std::string buffer;
+    CHECK(read_response(client, buffer) == "late");
+
+    close(client);
+    server.stop();
+}
+
+int main() {
+    test_split_request();
+    test_pipelined_in_order();
+    test_keep_alive_and_close();
+    test_port_in_use();
+    test_accept_out_of_descriptors();
+
+    return test_result("http_server_test");
+}
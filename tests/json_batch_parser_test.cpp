@@ -0,0 +1,214 @@
+#include "json_batch_parser.h"
+#include "test_check.h"
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using metricstream::Arena;
+using metricstream::JsonBatchParser;
+using metricstream::JsonKernel;
+using metricstream::MetricBatch;
+using metricstream::MetricType;
+
+static std::vector<JsonKernel> supported_kernels() {
+    std::vector<JsonKernel> kernels;
+    for (JsonKernel k : {JsonKernel::SCALAR, JsonKernel::SSE2, JsonKernel::AVX2, JsonKernel::NEON}) {
+        if (metricstream::json_kernel_supported(k)) kernels.push_back(k);
+    }
+    return kernels;
+}
+
+// Byte-at-a-time stage 1, the definition every kernel must match. Escapes
+// only matter for quotes: a backslash outside a string is invalid anyway
+static std::vector<uint32_t> reference_structurals(const std::string& json) {
+    std::vector<uint32_t> out;
+    bool in_string = false;
+    bool escaped = false;
+    for (size_t i = 0; i < json.size(); ++i) {
+        char c = json[i];
+        bool is_escaped = escaped;
+        escaped = c == '\\' && !is_escaped;
+        if (c == '"') {
+            if (!is_escaped) {
+                in_string = !in_string;
+                out.push_back(static_cast<uint32_t>(i));
+            }
+        } else if (!in_string && (c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',')) {
+            out.push_back(static_cast<uint32_t>(i));
+        }
+    }
+    return out;
+}
+
+static void test_structurals_match_reference() {
+    // Backslash runs and quotes straddling 64-byte block boundaries are
+    // where the carries matter, so lengths run well past one block
+    const char alphabet[] = "\"\\\\\\{}[]:,a ";
+    std::mt19937 rng(42);
+    for (int round = 0; round < 3000; ++round) {
+        size_t len = rng() % 300;
+        std::string json;
+        for (size_t i = 0; i < len; ++i) {
+            json.push_back(alphabet[rng() % (sizeof(alphabet) - 1)]);
+        }
+        std::vector<uint32_t> expected = reference_structurals(json);
+        for (JsonKernel kernel : supported_kernels()) {
+            std::vector<uint32_t> got(json.size() + 1);
+            size_t n = metricstream::find_json_structurals(json, kernel, got.data());
+            got.resize(n);
+            if (got != expected) {
+                std::cerr << metricstream::json_kernel_name(kernel) << " differs on: " << json << std::endl;
+                failures++;
+                return;
+            }
+        }
+    }
+}
+
+static void test_numbers() {
+    const char* cases[] = {"0", "-0", "1", "-17", "75.5", "0.1", "3.14159", "1e3", "1E+2", "-2.5e-3",
+                           "123456789012345678", "9007199254740993", "3.141592653589793238462643383279",
+                           "1e22", "1e23", "4.9e-324", "1.7976931348623157e308", "0.000001234",
+                           "12345678901234567890123", "2.2250738585072014e-308"};
+    for (const char* text : cases) {
+        double value = -1;
+        CHECK(metricstream::parse_json_number(text, value));
+        CHECK(value == std::strtod(text, nullptr));
+    }
+
+    double value = 0;
+    CHECK(metricstream::parse_json_number("1e400", value));
+    CHECK(std::isinf(value));
+    CHECK(metricstream::parse_json_number("-0", value));
+    CHECK(value == 0.0 && std::signbit(value));
+
+    for (const char* bad : {"", "-", "01", "1.", ".5", "+1", "1e", "1e+", "1x", "0x10", " 1", "nan", "--1"}) {
+        CHECK(!metricstream::parse_json_number(bad, value));
+    }
+}
+
+static bool parse_with(JsonKernel kernel, const std::string& body, MetricBatch& batch,
+                       const char** error = nullptr) {
+    Arena arena;
+    JsonBatchParser parser(kernel);
+    batch.clear();
+    return parser.parse(body, batch, arena, error);
+}
+
+static void test_parses_batch() {
+    std::string body = R"({"metrics": [
+        {"name": "cpu_usage", "value": 75.5, "type": "gauge", "tags": {"host": "server1", "dc": "eu"}},
+        {"value": 1.5e3, "name": "requests", "type": "counter"},
+        {"name": "latency", "value": -2E-3, "type": "histogram", "extra": {"a": [1, {"b": null}], "c": true}},
+        {"name": "no_value"},
+        {"value": 1}
+    ], "source": "agent"})";
+
+    for (JsonKernel kernel : supported_kernels()) {
+        MetricBatch batch;
+        CHECK(parse_with(kernel, body, batch));
+        CHECK(batch.size() == 4);
+        if (batch.size() != 4) continue;
+
+        CHECK(batch.metrics[0].name() == "cpu_usage");
+        CHECK(batch.metrics[0].value == 75.5);
+        CHECK(batch.metrics[0].type == MetricType::GAUGE);
+        CHECK(batch.metrics[0].tags().size() == 2);
+        CHECK(*batch.metrics[0].series().tag("host") == "server1");
+        CHECK(*batch.metrics[0].series().tag("dc") == "eu");
+
+        CHECK(batch.metrics[1].name() == "requests");
+        CHECK(batch.metrics[1].value == 1500.0);
+        CHECK(batch.metrics[1].type == MetricType::COUNTER);
+
+        CHECK(batch.metrics[2].value == -0.002);
+        CHECK(batch.metrics[2].type == MetricType::HISTOGRAM);
+        CHECK(batch.metrics[3].value == 0.0);
+    }
+}
+
+static void test_string_escapes() {
+    std::string body = R"({"metrics":[{"name":"esc\"aped\\\/\n","value":1,)"
+                       R"("tags":{"city":"Zürich","emoji":"😀","lone":"\ud800x","kA":"v"}}]})";
+    for (JsonKernel kernel : supported_kernels()) {
+        MetricBatch batch;
+        CHECK(parse_with(kernel, body, batch));
+        CHECK(batch.size() == 1);
+        if (batch.size() != 1) continue;
+        const auto& series = batch.metrics[0].series();
+        CHECK(series.name == "esc\"aped\\/\n");
+        CHECK(series.tag("city") && *series.tag("city") == "Z\xc3\xbcrich");
+        CHECK(series.tag("emoji") && *series.tag("emoji") == "\xf0\x9f\x98\x80");
+        CHECK(series.tag("lone") && *series.tag("lone") == "\xef\xbf\xbdx");
+        CHECK(series.tag("kA") && *series.tag("kA") == "v");
+    }
+}
+
+static void test_rejects_malformed() {
+    const char* cases[] = {
+        "",
+        "[]",
+        R"({"metrics": [)",
+        R"({"metrics": [{"name": "a", "value": 1}])",
+        R"({"metrics": [{"name": "a", "value": 1}]} x)",
+        R"({"metrics": [{"name": "a" "value": 1}]})",
+        R"({"metrics": [{"name": "a", "value": "1"}]})",
+        R"({"metrics": [{"name": "a", "value": 1,}]})",
+        R"({"metrics": [{"name": "a", "value": 01}]})",
+        R"({"metrics": [{"name": "a\q", "value": 1}]})",
+        R"({"metrics": [{"name": "a\u12", "value": 1}]})",
+        R"({"metrics": [{"name": "unterminated, "value": 1}]})",
+        R"({"metrics": [{"name": 5, "value": 1}]})",
+        R"({"metrics": [7]})",
+        R"({"metrics": {"name": "a"}})",
+        R"({"metrics": [{"name": "a", "value": 1, "extra": tru}]})",
+        R"({x "metrics": []})",
+    };
+    for (JsonKernel kernel : supported_kernels()) {
+        for (const char* body : cases) {
+            MetricBatch batch;
+            const char* error = nullptr;
+            bool ok = parse_with(kernel, body, batch, &error);
+            if (ok || error == nullptr) {
+                std::cerr << metricstream::json_kernel_name(kernel) << " accepted: " << body << std::endl;
+                failures++;
+            }
+        }
+    }
+}
+
+static void test_large_batch_all_kernels_agree() {
+    std::string body = "{\"metrics\":[";
+    for (int i = 0; i < 2000; ++i) {
+        if (i > 0) body += ",\n  ";
+        body += "{\"name\":\"metric_" + std::to_string(i % 37) + "\",\"value\":" + std::to_string(i) + ".25e-1," +
+                "\"type\":\"counter\",\"tags\":{\"host\":\"h\\\\" + std::to_string(i % 5) + "\"}}";
+    }
+    body += "]}";
+
+    for (JsonKernel kernel : supported_kernels()) {
+        MetricBatch batch;
+        CHECK(parse_with(kernel, body, batch));
+        CHECK(batch.size() == 2000);
+        if (batch.size() != 2000) continue;
+        CHECK(batch.metrics[1999].name() == "metric_1");
+        CHECK(batch.metrics[1999].value == 199.925);
+        CHECK(*batch.metrics[1999].series().tag("host") == "h\\4");
+    }
+}
+
+int main() {
+    test_structurals_match_reference();
+    test_numbers();
+    test_parses_batch();
+    test_string_escapes();
+    test_rejects_malformed();
+    test_large_batch_all_kernels_agree();
+
+    return test_result("json_batch_parser_test");
+}
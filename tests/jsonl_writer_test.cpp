@@ -0,0 +1,102 @@
+#include "jsonl_writer.h"
+#include "test_check.h"
+#include <unistd.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using metricstream::FsyncPolicy;
+using metricstream::JsonlWriter;
+using metricstream::Metric;
+using metricstream::MetricBatch;
+using metricstream::MetricType;
+
+static std::string temp_path(const char* name) {
+    return "/tmp/metricstream_" + std::string(name) + "_" + std::to_string(getpid()) + ".jsonl";
+}
+
+static std::string read_file(const std::string& path) {
+    std::ifstream in(path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+// 2024-01-02T03:04:05.678Z
+static metricstream::Timestamp fixed_time() {
+    return metricstream::Timestamp(std::chrono::milliseconds(1704164645678LL));
+}
+
+static void test_format() {
+    std::string path = temp_path("format");
+    {
+        FsyncPolicy policy;
+        policy.mode = FsyncPolicy::Mode::NEVER;
+        JsonlWriter writer(path, policy);
+        CHECK(writer.is_open());
+
+        MetricBatch batch;
+        batch.add_metric(Metric("cpu", 42, MetricType::COUNTER, {}, fixed_time()));
+        batch.add_metric(Metric("we\"ird", 0.25, MetricType::GAUGE, {{"host", "a\\b"}}, fixed_time()));
+        writer.append(batch);
+        CHECK(writer.commit());
+    }
+    std::string expected =
+        R"({"timestamp":"2024-01-02T03:04:05.678Z","name":"cpu","value":42,"type":"counter"})" "\n"
+        R"({"timestamp":"2024-01-02T03:04:05.678Z","name":"we\"ird","value":0.25,"type":"gauge","tags":{"host":"a\\b"}})" "\n";
+    CHECK(read_file(path) == expected);
+    unlink(path.c_str());
+}
+
+static void test_group_commit_and_policies() {
+    std::string path = temp_path("policy");
+    MetricBatch batch;
+    for (int i = 0; i < 100; ++i) {
+        batch.add_metric(Metric("m", i + 0.5, MetricType::GAUGE));
+    }
+
+    {
+        FsyncPolicy policy;
+        policy.mode = FsyncPolicy::Mode::EVERY_COMMIT;
+        JsonlWriter writer(path, policy);
+        writer.append(batch);
+        writer.append(batch);
+        CHECK(writer.bytes_written() == 0);   // Nothing hits the file before commit
+        CHECK(writer.commit());
+        CHECK(writer.fsync_count() == 1);
+        CHECK(writer.buffered_bytes() == 0);
+    }
+    {
+        FsyncPolicy policy;
+        policy.mode = FsyncPolicy::Mode::BYTES;
+        policy.bytes = 1 << 20;
+        JsonlWriter writer(path, policy);
+        writer.append(batch);
+        writer.commit();
+        CHECK(writer.fsync_count() == 0);
+    }
+
+    // A tiny buffer commits on its own while appending
+    {
+        FsyncPolicy policy;
+        policy.mode = FsyncPolicy::Mode::NEVER;
+        JsonlWriter writer(path, policy, 256);
+        writer.append(batch);
+        CHECK(writer.bytes_written() > 0);
+        CHECK(writer.buffered_bytes() < 512);
+    }
+
+    std::string contents = read_file(path);
+    size_t lines = 0;
+    for (char c : contents) lines += c == '\n';
+    CHECK(lines == 400);
+    unlink(path.c_str());
+}
+
+int main() {
+    test_format();
+    test_group_commit_and_policies();
+
+    return test_result("jsonl_writer_test");
+}
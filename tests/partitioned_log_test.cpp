@@ -0,0 +1,209 @@
+#include "partitioned_log.h"
+#include "test_check.h"
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using metricstream::BatchPool;
+using metricstream::Metric;
+using metricstream::MetricBatch;
+using metricstream::MetricType;
+using metricstream::PartitionedLog;
+using metricstream::PooledBatch;
+
+static PooledBatch batch_with(BatchPool& pool, double value) {
+    PooledBatch batch = pool.acquire();
+    batch->add_metric(Metric("cpu.usage", value, MetricType::GAUGE));
+    return batch;
+}
+
+static void test_offsets_and_order() {
+    BatchPool pool;
+    PartitionedLog log(2, 8);
+    size_t cursor = log.add_cursor("storage");
+    CHECK(log.capacity() == 8);
+
+    for (int i = 0; i < 5; ++i) {
+        PooledBatch batch = batch_with(pool, i);
+        uint64_t offset = 99;
+        CHECK(log.append(1, batch, &offset));
+        CHECK(offset == static_cast<uint64_t>(i));
+        CHECK(!batch);
+    }
+    CHECK(log.end_offset(0) == 0);
+    CHECK(log.end_offset(1) == 5);
+    CHECK(log.lag(cursor) == 5);
+
+    std::vector<double> seen;
+    std::vector<uint64_t> offsets;
+    size_t polled = log.poll(cursor, 1, 3, [&](const MetricBatch& batch, uint64_t offset) {
+        seen.push_back(batch.metrics[0].value);
+        offsets.push_back(offset);
+    });
+    CHECK(polled == 3);
+    CHECK(log.cursor_offset(cursor, 1) == 3);
+    polled = log.poll_all(cursor, 16, [&](const MetricBatch& batch, uint64_t offset) {
+        seen.push_back(batch.metrics[0].value);
+        offsets.push_back(offset);
+    });
+    CHECK(polled == 2);
+    CHECK((seen == std::vector<double>{0, 1, 2, 3, 4}));
+    CHECK((offsets == std::vector<uint64_t>{0, 1, 2, 3, 4}));
+    CHECK(log.lag(cursor) == 0);
+    CHECK(!log.readable(cursor));
+    CHECK(pool.pooled() == 5);   // Batches went back as they were read
+}
+
+static void test_backpressure() {
+    BatchPool pool;
+    PartitionedLog log(1, 4);
+    size_t cursor = log.add_cursor("storage");
+
+    for (int i = 0; i < 4; ++i) {
+        PooledBatch batch = batch_with(pool, i);
+        CHECK(log.append(0, batch));
+    }
+    PooledBatch refused = batch_with(pool, 4);
+    CHECK(!log.append(0, refused));
+    CHECK(refused);   // Still the caller's
+
+    auto ignore = [](const MetricBatch&, uint64_t) {};
+    CHECK(log.poll(cursor, 0, 1, ignore) == 1);
+    CHECK(log.append(0, refused));
+    CHECK(log.end_offset(0) == 5);
+}
+
+static void test_cursors_read_independently() {
+    BatchPool pool;
+    PartitionedLog log(1, 4);
+    size_t storage = log.add_cursor("storage");
+    size_t alerts = log.add_cursor("alerts");
+    CHECK(log.cursor_count() == 2);
+    CHECK(log.cursor_name(alerts) == "alerts");
+
+    for (int i = 0; i < 4; ++i) {
+        PooledBatch batch = batch_with(pool, i);
+        CHECK(log.append(0, batch));
+    }
+    auto ignore = [](const MetricBatch&, uint64_t) {};
+    CHECK(log.poll(storage, 0, 16, ignore) == 4);
+    CHECK(pool.pooled() == 0);   // The alert cursor has not read them yet
+
+    // The slowest cursor gates the producer
+    PooledBatch batch = batch_with(pool, 4);
+    CHECK(!log.append(0, batch));
+
+    double sum = 0;
+    CHECK(log.poll(alerts, 0, 16, [&](const MetricBatch& b, uint64_t) {
+        sum += b.metrics[0].value;
+    }) == 4);
+    CHECK(sum == 6);
+    CHECK(pool.pooled() == 4);
+    CHECK(log.append(0, batch));
+}
+
+static void test_close_and_wait() {
+    BatchPool pool;
+    PartitionedLog log(2, 4);
+    size_t cursor = log.add_cursor("storage");
+
+    CHECK(!log.wait(cursor, std::chrono::milliseconds(1)));
+
+    std::thread producer([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        PooledBatch batch = batch_with(pool, 1);
+        log.append(0, batch);
+    });
+    CHECK(log.wait(cursor, std::chrono::milliseconds(5000)));
+    producer.join();
+
+    log.close();
+    CHECK(log.closed());
+    PooledBatch late = batch_with(pool, 2);
+    CHECK(!log.append(1, late));
+    // Entries appended before close stay readable
+    CHECK(log.poll_all(cursor, 16, [](const MetricBatch&, uint64_t) {}) == 1);
+}
+
+static void test_split_cursor() {
+    BatchPool pool;
+    PartitionedLog log(4, 8);
+    size_t cursor = log.add_cursor("rollups");
+
+    PooledBatch batch = batch_with(pool, 1);
+    CHECK(log.append(2, batch));
+    // Worker 0 of 2 owns partitions 0 and 2, worker 1 owns 1 and 3
+    CHECK(log.readable(cursor, 0, 2));
+    CHECK(!log.readable(cursor, 1, 2));
+    CHECK(!log.wait(cursor, std::chrono::milliseconds(1), 1, 2));
+    CHECK(log.wait(cursor, std::chrono::milliseconds(1), 0, 2));
+    CHECK(log.poll(cursor, 2, 16, [](const MetricBatch&, uint64_t) {}) == 1);
+    CHECK(!log.readable(cursor));
+}
+
+static void test_concurrent_producers() {
+    BatchPool pool;
+    PartitionedLog log(4, 64);
+    size_t storage = log.add_cursor("storage");
+    size_t alerts = log.add_cursor("alerts");
+
+    constexpr int PRODUCERS = 4;
+    constexpr int PER_PRODUCER = 5000;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < PRODUCERS; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < PER_PRODUCER; ++i) {
+                PooledBatch batch = batch_with(pool, t * PER_PRODUCER + i);
+                size_t partition = static_cast<size_t>(i) % log.partition_count();
+                while (!log.append(partition, batch)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    auto consume = [&](size_t cursor, uint64_t& count, double& sum) {
+        return std::thread([&, cursor] {
+            while (true) {
+                size_t polled = log.poll_all(cursor, 16, [&](const MetricBatch& b, uint64_t) {
+                    count++;
+                    sum += b.metrics[0].value;
+                });
+                if (polled == 0) {
+                    if (log.closed() && !log.readable(cursor)) return;
+                    log.wait(cursor, std::chrono::milliseconds(10));
+                }
+            }
+        });
+    };
+    uint64_t storage_count = 0, alert_count = 0;
+    double storage_sum = 0, alert_sum = 0;
+    std::thread storage_thread = consume(storage, storage_count, storage_sum);
+    std::thread alert_thread = consume(alerts, alert_count, alert_sum);
+
+    for (auto& thread : threads) thread.join();
+    log.close();
+    storage_thread.join();
+    alert_thread.join();
+
+    constexpr uint64_t TOTAL = PRODUCERS * PER_PRODUCER;
+    double expected = static_cast<double>(TOTAL) * (TOTAL - 1) / 2;
+    CHECK(storage_count == TOTAL);
+    CHECK(alert_count == TOTAL);
+    CHECK(storage_sum == expected);
+    CHECK(alert_sum == expected);
+    CHECK(log.lag(storage) == 0);
+    CHECK(log.lag(alerts) == 0);
+}
+
+int main() {
+    test_offsets_and_order();
+    test_backpressure();
+    test_cursors_read_independently();
+    test_close_and_wait();
+    test_split_cursor();
+    test_concurrent_producers();
+
+    return test_result("partitioned_log_test");
+}
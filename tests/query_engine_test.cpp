@@ -0,0 +1,191 @@
+#include "query_engine.h"
+#include "test_check.h"
+#include <sys/stat.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using metricstream::DataPoint;
+using metricstream::FsyncPolicy;
+using metricstream::Metric;
+using metricstream::MetricBatch;
+using metricstream::MetricType;
+using metricstream::QueryEngine;
+using metricstream::SegmentWriter;
+using metricstream::SeriesQuery;
+
+static std::string temp_dir(const char* name) {
+    return "/tmp/metricstream_" + std::string(name) + "_" + std::to_string(getpid());
+}
+
+static void remove_dir(const std::string& dir) {
+    for (const auto& path : metricstream::list_segment_files(dir)) {
+        unlink(path.c_str());
+    }
+    rmdir(dir.c_str());
+}
+
+static metricstream::Timestamp at_ms(int64_t ms) {
+    return metricstream::Timestamp(std::chrono::milliseconds(ms));
+}
+
+static SegmentWriter::Options test_options(const std::string& dir) {
+    SegmentWriter::Options options;
+    options.directory = dir;
+    options.block_points = 100;
+    options.fsync.mode = FsyncPolicy::Mode::NEVER;
+    return options;
+}
+
+// cpu{host=h,dc=d} for 4 hosts over 2 dcs, mem{host=h}; one point per 10 ms
+static void write_points(SegmentWriter& writer, int64_t from_ms, int count) {
+    MetricBatch batch;
+    for (int i = 0; i < count; ++i) {
+        int64_t ts = from_ms + i * 10;
+        for (int h = 0; h < 4; ++h) {
+            std::string host = "web" + std::to_string(h);
+            batch.add_metric(Metric("cpu", h * 1000 + i, MetricType::GAUGE,
+                                    {{"host", host}, {"dc", h < 2 ? "eu" : "us"}}, at_ms(ts)));
+        }
+        batch.add_metric(Metric("mem", 0.5, MetricType::GAUGE, {{"host", "web0"}}, at_ms(ts)));
+    }
+    writer.append(batch);
+    writer.commit();
+}
+
+static void test_index_lookup() {
+    std::string dir = temp_dir("query_index");
+    {
+        SegmentWriter writer(test_options(dir));
+        write_points(writer, 0, 1000);
+    }
+
+    QueryEngine engine(dir);
+    CHECK(engine.refresh() == 50);   // 5 series x 10 blocks
+    CHECK(engine.segment_count() == 1);
+    CHECK(engine.series_count() == 5);
+
+    SeriesQuery q;
+    q.name = "cpu";
+    CHECK(engine.match(q).size() == 4);
+    q.tags = {{"dc", "eu"}};
+    CHECK(engine.match(q).size() == 2);
+    q.tags = {{"dc", "eu"}, {"host", "web1"}};
+    CHECK(engine.match(q).size() == 1);
+    q.tags = {{"dc", "us"}, {"host", "web1"}};
+    CHECK(engine.match(q).empty());
+    q.tags = {{"host", "web0"}};
+    q.name.clear();
+    CHECK(engine.match(q).size() == 2);   // cpu and mem
+    q.name = "disk";
+    CHECK(engine.match(q).empty());
+
+    remove_dir(dir);
+}
+
+static void test_range_query() {
+    std::string dir = temp_dir("query_range");
+    {
+        SegmentWriter writer(test_options(dir));
+        write_points(writer, 0, 1000);   // 0 .. 9990 ms
+    }
+    QueryEngine engine(dir);
+    engine.refresh();
+
+    // 2500..3495 ms: points 250..349, straddling blocks 2 and 3 only
+    SeriesQuery q;
+    q.name = "cpu";
+    q.tags = {{"host", "web2"}};
+    q.start_ms = 2500;
+    q.end_ms = 3495;
+    uint64_t decoded_before = engine.blocks_decoded();
+    auto result = engine.query(q);
+    CHECK(engine.blocks_decoded() - decoded_before == 2);
+    CHECK(result.series().size() == 1);
+    CHECK(result.point_count() == 100);
+    if (result.series().size() == 1) {
+        const auto& series = result.series()[0];
+        CHECK(series.info->name == "cpu");
+        CHECK(series.points.size == 100);
+        CHECK(series.points[0].timestamp_ms == 2500);
+        CHECK(series.points[0].value == 2250);
+        CHECK(series.points[99].timestamp_ms == 3490);
+    }
+
+    // Visitor sees the same points without the copy
+    size_t visited = engine.scan(q, [&](const metricstream::SeriesInfo& info,
+                                        metricstream::PointSpan points) {
+        CHECK(info.name == "cpu");
+        for (const DataPoint& p : points) {
+            CHECK(p.timestamp_ms >= 2500 && p.timestamp_ms <= 3495);
+        }
+    });
+    CHECK(visited == 100);
+
+    // Aggregates per series
+    SeriesQuery all_cpu;
+    all_cpu.name = "cpu";
+    all_cpu.tags = {{"dc", "eu"}};
+    all_cpu.start_ms = 0;
+    all_cpu.end_ms = 90;   // Points 0..9
+    auto aggs = engine.aggregate(all_cpu);
+    CHECK(aggs.size() == 2);
+    for (const auto& [info, agg] : aggs) {
+        CHECK(agg.count == 10);
+        double base = info->tags[1].second == "web0" ? 0 : 1000;
+        CHECK(agg.min == base && agg.max == base + 9);
+        CHECK(agg.sum == base * 10 + 45);
+    }
+
+    // Outside all data
+    q.start_ms = 20000;
+    q.end_ms = 30000;
+    decoded_before = engine.blocks_decoded();
+    CHECK(engine.query(q).series().empty());
+    CHECK(engine.blocks_decoded() == decoded_before);
+
+    remove_dir(dir);
+}
+
+static void test_refresh_growing_segment() {
+    std::string dir = temp_dir("query_refresh");
+    SegmentWriter writer(test_options(dir));
+    QueryEngine engine(dir);
+    CHECK(engine.refresh() == 0);
+
+    write_points(writer, 0, 100);   // Seals one block per series
+    CHECK(engine.refresh() == 5);
+    CHECK(engine.refresh() == 0);
+
+    write_points(writer, 1000, 250);   // Two more full blocks each
+    CHECK(engine.refresh() == 10);
+
+    SeriesQuery q;
+    q.name = "mem";
+    CHECK(engine.query(q).point_count() == 300);
+
+    // Sealing replaces the scanned records with the index, no duplicates
+    writer.roll();
+    size_t added = engine.refresh();
+    CHECK(added == 5);   // The 50 leftover points per series
+    CHECK(engine.block_count() == 20);
+    CHECK(engine.query(q).point_count() == 350);
+
+    // The next segment is picked up as a new file
+    write_points(writer, 5000, 100);
+    CHECK(engine.refresh() == 5);
+    CHECK(engine.segment_count() == 2);
+    CHECK(engine.query(q).point_count() == 450);
+
+    writer.roll();
+    remove_dir(dir);
+}
+
+int main() {
+    test_index_lookup();
+    test_range_query();
+    test_refresh_growing_segment();
+
+    return test_result("query_engine_test");
+}
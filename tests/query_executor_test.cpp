@@ -0,0 +1,247 @@
+#include "query_executor.h"
+#include "test_check.h"
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+using metricstream::DataPoint;
+using metricstream::FsyncPolicy;
+using metricstream::Metric;
+using metricstream::MetricBatch;
+using metricstream::MetricType;
+using metricstream::QueryAggregate;
+using metricstream::QueryEngine;
+using metricstream::QueryExecutor;
+using metricstream::SegmentWriter;
+using metricstream::SeriesQuery;
+
+static std::string temp_dir(const char* name) {
+    return "/tmp/metricstream_" + std::string(name) + "_" + std::to_string(getpid());
+}
+
+static void remove_dir(const std::string& dir) {
+    for (const auto& path : metricstream::list_segment_files(dir)) {
+        unlink(path.c_str());
+    }
+    rmdir(dir.c_str());
+}
+
+static metricstream::Timestamp at_ms(int64_t ms) {
+    return metricstream::Timestamp(std::chrono::milliseconds(ms));
+}
+
+static SegmentWriter::Options test_options(const std::string& dir) {
+    SegmentWriter::Options options;
+    options.directory = dir;
+    options.block_points = 100;
+    options.fsync.mode = FsyncPolicy::Mode::NEVER;
+    return options;
+}
+
+// cpu{host=h} for 3 hosts, one point per 7 ms so blocks straddle buckets
+static void write_points(SegmentWriter& writer, int64_t from_ms, int count) {
+    MetricBatch batch;
+    for (int i = 0; i < count; ++i) {
+        int64_t ts = from_ms + i * 7;
+        for (int h = 0; h < 3; ++h) {
+            batch.add_metric(Metric("cpu", (i * 37 + h * 11) % 101 - 50.0, MetricType::GAUGE,
+                                    {{"host", "web" + std::to_string(h)}}, at_ms(ts)));
+        }
+    }
+    writer.append(batch);
+    writer.commit();
+}
+
+static bool same(const QueryAggregate& a, const QueryAggregate& b) {
+    return a.count == b.count && a.sum == b.sum && a.min == b.min && a.max == b.max;
+}
+
+static QueryExecutor::Options test_executor_options() {
+    QueryExecutor::Options options;
+    options.threads = 4;
+    options.bucket_ms = 1000;
+    return options;
+}
+
+static void test_kernel() {
+    std::vector<DataPoint> points;
+    for (int n = 0; n < 11; ++n) {
+        QueryAggregate expected, actual;
+        for (const DataPoint& p : points) expected.add(p.value);
+        metricstream::aggregate_points({points.data(), points.size()}, actual);
+        CHECK(same(expected, actual));
+        points.push_back(DataPoint{n, static_cast<double>((n * 5) % 7) - 3});
+    }
+}
+
+static void test_matches_serial() {
+    std::string dir = temp_dir("executor_serial");
+    {
+        SegmentWriter writer(test_options(dir));
+        write_points(writer, 0, 3000);   // 0 .. 20993 ms
+    }
+    QueryEngine engine(dir);
+    engine.refresh();
+    QueryExecutor executor(engine, test_executor_options());
+
+    const std::pair<int64_t, int64_t> ranges[] = {
+        {std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max()},
+        {0, 20993},
+        {1234, 5678},
+        {999, 1000},
+        {20000, 90000},
+        {30000, 40000},
+    };
+    for (const auto& [start, end] : ranges) {
+        SeriesQuery q;
+        q.name = "cpu";
+        q.start_ms = start;
+        q.end_ms = end;
+        auto serial = engine.aggregate(q);
+        auto parallel = executor.aggregate(q);
+        CHECK(parallel.size() == serial.size());
+        for (size_t i = 0; i < serial.size() && i < parallel.size(); ++i) {
+            CHECK(parallel[i].info == serial[i].first);
+            // Chunked sums may round differently; the data is integral
+            CHECK(same(parallel[i].total, serial[i].second));
+            CHECK(parallel[i].steps.empty());
+        }
+    }
+
+    // Steps partition the total, aligned and in order
+    SeriesQuery q;
+    q.name = "cpu";
+    q.tags = {{"host", "web1"}};
+    q.start_ms = 500;
+    q.end_ms = 10499;
+    auto stepped = executor.aggregate(q, 2000);
+    CHECK(stepped.size() == 1);
+    if (stepped.size() == 1) {
+        const auto& steps = stepped[0].steps;
+        CHECK(steps.size() == 6);   // 0(partial), 2000, ..., 10000(partial)
+        QueryAggregate sum;
+        int64_t previous = -1;
+        for (const auto& [start, agg] : steps) {
+            CHECK(start % 2000 == 0);
+            CHECK(start > previous);
+            previous = start;
+            sum.merge(agg);
+        }
+        CHECK(same(sum, stepped[0].total));
+        CHECK(same(stepped[0].total, engine.aggregate(q)[0].second));
+    }
+
+    remove_dir(dir);
+}
+
+static void test_cache() {
+    std::string dir = temp_dir("executor_cache");
+    SegmentWriter writer(test_options(dir));
+    write_points(writer, 0, 3000);
+    QueryEngine engine(dir);
+    engine.refresh();
+    QueryExecutor executor(engine, test_executor_options());
+
+    SeriesQuery q;
+    q.name = "cpu";
+    q.start_ms = 500;
+    q.end_ms = 9999;
+    auto first = executor.aggregate(q);
+    CHECK(executor.buckets_computed() == 10);   // 0 .. 9000
+    CHECK(executor.cached_buckets() == 9);      // All but the partial first one
+    CHECK(executor.cache_hits() == 0);
+
+    // A refresh recomputes only the edge bucket
+    auto second = executor.aggregate(q);
+    CHECK(executor.buckets_computed() == 11);
+    CHECK(executor.cache_hits() == 9);
+    CHECK(second.size() == first.size());
+    for (size_t i = 0; i < first.size() && i < second.size(); ++i) {
+        CHECK(same(first[i].total, second[i].total));
+    }
+
+    // Another tag filter or width is a different key
+    q.tags = {{"host", "web0"}};
+    executor.aggregate(q);
+    CHECK(executor.cache_hits() == 9);
+    executor.aggregate(q, 500);
+    CHECK(executor.cache_hits() == 9);
+
+    // Recent buckets are never cached: their blocks may still be open
+    int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    write_points(writer, now_ms - 5000, 500);
+    engine.refresh();
+    size_t cached = executor.cached_buckets();
+    SeriesQuery recent;
+    recent.name = "cpu";
+    recent.start_ms = now_ms - 10000;
+    auto live = executor.aggregate(recent);
+    CHECK(executor.cached_buckets() == cached);
+    CHECK(live.size() == 3);
+    for (const auto& series : live) {
+        CHECK(series.total.count == 500);
+    }
+
+    executor.clear_cache();
+    CHECK(executor.cached_buckets() == 0);
+
+    writer.roll();
+    remove_dir(dir);
+}
+
+// Late points invalidate the cached buckets from their timestamp on
+static void test_backfill() {
+    std::string dir = temp_dir("executor_backfill");
+    SegmentWriter writer(test_options(dir));
+    write_points(writer, 0, 3000);
+    QueryEngine engine(dir);
+    engine.refresh();
+    QueryExecutor executor(engine, test_executor_options());
+
+    SeriesQuery q;
+    q.name = "cpu";
+    q.start_ms = 0;
+    q.end_ms = 9999;
+    auto before = executor.aggregate(q);
+    CHECK(executor.cached_buckets() == 10);
+
+    // Ten more points per host at 4000 .. 4063, arriving long after
+    write_points(writer, 4000, 10);
+    writer.roll();
+    CHECK(engine.refresh() > 0);
+    auto after = executor.aggregate(q);
+    CHECK(executor.cache_hits() == 4);          // 0 .. 3000 are untouched
+    CHECK(executor.buckets_computed() == 16);   // 4000 .. 9000 again
+    CHECK(after.size() == before.size());
+    for (size_t i = 0; i < before.size() && i < after.size(); ++i) {
+        CHECK(after[i].total.count == before[i].total.count + 10);
+    }
+    CHECK(executor.cached_buckets() == 10);
+
+    // An engine more refreshes ahead than it remembers drops everything
+    for (int i = 0; i < 70; ++i) {
+        write_points(writer, 100000 + i * 10, 1);
+        writer.roll();
+        engine.refresh();
+    }
+    CHECK(engine.earliest_change_since(0) == std::numeric_limits<int64_t>::min());
+    executor.aggregate(q);
+    CHECK(executor.cache_hits() == 4);
+
+    writer.roll();
+    remove_dir(dir);
+}
+
+int main() {
+    test_kernel();
+    test_matches_serial();
+    test_cache();
+    test_backfill();
+
+    return test_result("query_executor_test");
+}
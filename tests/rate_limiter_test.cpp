@@ -0,0 +1,241 @@
+#include "ingestion_service.h"
+#include "metrics_exporter.h"
+#include "sharded_map.h"
+#include "test_check.h"
+#include <unistd.h>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using metricstream::ClientDecisionCounts;
+using metricstream::ClientMetrics;
+using metricstream::ClientState;
+using metricstream::DecisionExporter;
+using metricstream::MetricEvent;
+using metricstream::RateLimiter;
+using metricstream::ShardedMap;
+
+static void test_sharded_map() {
+    ShardedMap<std::atomic<int>> map(1024, 8);
+    CHECK(!map.find("a"));
+    (*map.get_or_insert("a"))++;
+    (*map.get_or_insert("a"))++;
+    CHECK(map.find("a") && map.find("a")->load() == 2);
+    CHECK(map.size() == 1);
+
+    // Concurrent first sightings of the same keys insert each key once
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&map]() {
+            for (int i = 0; i < 500; ++i) {
+                (*map.get_or_insert("client_" + std::to_string(i)))++;
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    CHECK(map.size() == 501);
+    CHECK(map.find("client_42")->load() == 4);
+
+    size_t visited = 0;
+    map.for_each([&visited](const std::string&, std::atomic<int>&) { visited++; });
+    CHECK(visited == 501);
+}
+
+static void test_sharded_map_bounded() {
+    ShardedMap<int> map(16, 4);
+    for (int i = 0; i < 1000; ++i) {
+        // "hot" is seen between every new key, so the sweep never takes it
+        *map.get_or_insert("hot") = -1;
+        *map.get_or_insert("k" + std::to_string(i)) = i;
+    }
+    // Beyond capacity, idle keys are evicted; every key keeps its own value
+    CHECK(map.size() <= 16);
+    CHECK(map.evictions() >= 1000 - 16);
+    CHECK(map.find("hot") && *map.find("hot") == -1);
+    CHECK(map.find("k999") && *map.find("k999") == 999);
+    CHECK(!map.find("k0"));
+    size_t visited = 0;
+    map.for_each([&visited](const std::string& key, int& value) {
+        CHECK(key == "hot" ? value == -1 : key == "k" + std::to_string(value));
+        visited++;
+    });
+    CHECK(visited == map.size());
+
+    // An evicted key comes back as a fresh entry
+    CHECK(*map.get_or_insert("k0") == 0);
+}
+
+// Entries evicted while other threads hold them stay valid until released
+static void test_sharded_map_eviction_concurrent() {
+    ShardedMap<std::atomic<int>> map(64, 4);
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&map, &stop, t]() {
+            for (int i = 0; !stop.load(); ++i) {
+                auto held = map.get_or_insert("t" + std::to_string(t) + "_" + std::to_string(i % 500));
+                (*held)++;
+                std::this_thread::yield();
+                (*held)--;
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    stop = true;
+    for (auto& t : threads) t.join();
+
+    CHECK(map.size() <= 64);
+    CHECK(map.evictions() > 0);
+    map.for_each([](const std::string&, std::atomic<int>& value) { CHECK(value.load() == 0); });
+}
+
+static void test_limit(RateLimiter::Mode mode) {
+    RateLimiter limiter(10, mode);
+    int allowed = 0;
+    for (int i = 0; i < 20; ++i) {
+        if (limiter.allow_request("client_a")) allowed++;
+    }
+    CHECK(allowed == 10);
+
+    // Clients are limited independently
+    CHECK(limiter.allow_request("client_b"));
+    CHECK(limiter.tracked_clients() == 2);
+}
+
+static void test_gcra_refill() {
+    RateLimiter limiter(100);
+    auto start = std::chrono::steady_clock::now();
+    while (limiter.allow_request("c", start)) {}
+    // One emission interval is 10 ms: 30 ms later exactly three are allowed again
+    auto later = start + std::chrono::milliseconds(30);
+    int allowed = 0;
+    for (int i = 0; i < 10; ++i) {
+        if (limiter.allow_request("c", later)) allowed++;
+    }
+    CHECK(allowed == 3);
+}
+
+static void test_save_and_load() {
+    RateLimiter limiter(100);
+    auto start = std::chrono::steady_clock::now();
+    limiter.allow_request("idle", start);
+    auto saved_at = start + std::chrono::milliseconds(20);
+    while (limiter.allow_request("spent", saved_at)) {}
+    limiter.allow_request("fresh", saved_at);
+    std::string image;
+    limiter.save(image, saved_at);
+
+    // The exhausted client stays exhausted across a restart and the barely
+    // used one keeps what it had left; the idle one was not saved at all.
+    // The restarted clock is unrelated to the old one.
+    RateLimiter restarted(100);
+    auto loaded_at = start + std::chrono::seconds(3600);
+    CHECK(restarted.load(image, loaded_at) == 2);
+    CHECK(!restarted.allow_request("spent", loaded_at));
+    int allowed = 0;
+    while (restarted.allow_request("fresh", loaded_at) && allowed < 200) allowed++;
+    CHECK(allowed == 99);
+    CHECK(restarted.tracked_clients() == 2);
+
+    CHECK(restarted.load(std::string_view(image).substr(0, 6)) == 0);
+    CHECK(restarted.load("") == 0);
+}
+
+static void test_gcra_concurrent() {
+    RateLimiter limiter(1000);
+    std::atomic<int> allowed{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < 1000; ++i) {
+                if (limiter.allow_request("shared")) allowed++;
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    // The whole burst allowance, plus whatever refilled while the threads ran
+    CHECK(allowed.load() >= 1000 && allowed.load() < 1100);
+}
+
+static void test_decision_drain() {
+    // Nothing is recorded, or allocated, until an exporter asks for it
+    RateLimiter limiter(5);
+    limiter.allow_request("unlogged");
+    std::vector<ClientDecisionCounts> unlogged;
+    limiter.drain_decisions(unlogged);
+    CHECK(unlogged.empty());
+    CHECK(sizeof(ClientState) <= 32);
+
+    limiter.set_decision_log(true);
+    for (int i = 0; i < 8; ++i) limiter.allow_request("a");
+    limiter.allow_request("b");
+
+    std::vector<ClientDecisionCounts> counts;
+    limiter.drain_decisions(counts);
+    CHECK(counts.size() == 2);
+    for (const auto& c : counts) {
+        if (c.client_id == "a") {
+            CHECK(c.allowed == 5 && c.denied == 3 && c.dropped == 0);
+        } else {
+            CHECK(c.allowed == 1 && c.denied == 0);
+        }
+    }
+
+    // Already drained: nothing new to report
+    counts.clear();
+    limiter.drain_decisions(counts);
+    CHECK(counts.empty());
+}
+
+static void test_ring_overflow_counted() {
+    ClientMetrics metrics;
+    MetricEvent event(std::chrono::steady_clock::now(), true);
+    for (size_t i = 0; i < ClientMetrics::BUFFER_SIZE + 100; ++i) {
+        metrics.record(event);
+    }
+    size_t seen = 0;
+    uint64_t dropped = metrics.drain([&seen](int64_t, bool) { seen++; });
+    CHECK(dropped == 100);
+    CHECK(seen == ClientMetrics::BUFFER_SIZE);
+}
+
+static void test_exporter_single_write() {
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+
+    RateLimiter limiter(1);
+    {
+        DecisionExporter exporter(limiter, fds[1]);
+        limiter.allow_request("x\"y");
+        limiter.allow_request("x\"y");
+        CHECK(exporter.flush() == 1);
+    }  // Closes the write end
+
+    std::string output;
+    char buf[512];
+    ssize_t n;
+    while ((n = read(fds[0], buf, sizeof(buf))) > 0) {
+        output.append(buf, static_cast<size_t>(n));
+    }
+    close(fds[0]);
+    CHECK(output.find(R"("client":"x\"y","allowed":1,"denied":1,"dropped":0})") != std::string::npos);
+    CHECK(output.back() == '\n');
+}
+
+int main() {
+    test_sharded_map();
+    test_sharded_map_bounded();
+    test_sharded_map_eviction_concurrent();
+    test_limit(RateLimiter::Mode::GCRA);
+    test_limit(RateLimiter::Mode::SLIDING_WINDOW);
+    test_gcra_refill();
+    test_save_and_load();
+    test_gcra_concurrent();
+    test_decision_drain();
+    test_ring_overflow_counted();
+    test_exporter_single_write();
+
+    return test_result("rate_limiter_test");
+}
@@ -0,0 +1,390 @@
+#include "rollup.h"
+#include "test_check.h"
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using namespace metricstream;
+
+static std::string temp_dir(const char* name) {
+    return "/tmp/metricstream_" + std::string(name) + "_" + std::to_string(getpid());
+}
+
+static void remove_dir(const std::string& dir) {
+    for (size_t r = 0; r < ROLLUP_RESOLUTION_COUNT; ++r) {
+        for (const auto& path : list_rollup_files(dir, r)) {
+            unlink(path.c_str());
+        }
+    }
+    rmdir(dir.c_str());
+}
+
+static Timestamp at_ms(int64_t ms) {
+    return Timestamp(std::chrono::milliseconds(ms));
+}
+
+static bool near(double a, double b, double relative) {
+    return std::fabs(a - b) <= relative * std::fabs(b);
+}
+
+static void test_sketch() {
+    QuantileSketch sketch;
+    CHECK(std::isnan(sketch.quantile(0.5)));
+    std::vector<double> values;
+    std::mt19937 rng(7);
+    std::lognormal_distribution<double> dist(0.0, 2.0);
+    for (int i = 0; i < 20000; ++i) {
+        double v = dist(rng);
+        values.push_back(v);
+        sketch.add(v);
+    }
+    std::sort(values.begin(), values.end());
+    for (double q : {0.5, 0.9, 0.99, 0.999}) {
+        double exact = values[static_cast<size_t>(q * (values.size() - 1))];
+        CHECK(near(sketch.quantile(q), exact, QuantileSketch::RELATIVE_ACCURACY * 1.01));
+    }
+    CHECK(sketch.quantile(0) == values.front());
+    CHECK(sketch.quantile(1) == values.back());
+
+    // Merging two halves is the same as adding everything to one
+    QuantileSketch a, b;
+    for (size_t i = 0; i < values.size(); ++i) (i % 2 ? a : b).add(values[i]);
+    a.merge(b);
+    CHECK(a.count() == sketch.count());
+    CHECK(a.quantile(0.99) == sketch.quantile(0.99));
+
+    // Negative values and zeros order correctly
+    QuantileSketch mixed;
+    for (double v : {-100.0, -1.0, 0.0, 0.0, 1.0, 100.0, std::nan("")}) mixed.add(v);
+    CHECK(mixed.count() == 6);
+    CHECK(near(mixed.quantile(0.2), -1.0, 0.011));
+    CHECK(mixed.quantile(0.5) == 0.0);
+    CHECK(near(mixed.quantile(0.8), 1.0, 0.011));
+
+    std::string bytes;
+    sketch.serialize(bytes);
+    QuantileSketch copy;
+    CHECK(copy.deserialize(bytes));
+    CHECK(copy.count() == sketch.count());
+    CHECK(copy.quantile(0.999) == sketch.quantile(0.999));
+    CHECK(copy.min() == sketch.min() && copy.max() == sketch.max());
+    CHECK(!copy.deserialize(std::string_view(bytes).substr(0, bytes.size() - 1)));
+    CHECK(copy.empty());
+}
+
+static void test_aggregator() {
+    RollupAggregator aggregator(std::chrono::milliseconds(1000));
+    MetricBatch batch;
+    // 0..59 s, one point per second
+    for (int s = 0; s < 60; ++s) {
+        batch.add_metric(Metric("rollup_cpu", s, MetricType::GAUGE, {{"host", "a"}}, at_ms(s * 1000)));
+    }
+    aggregator.add(batch);
+    CHECK(aggregator.points_added() == 60);
+    CHECK(aggregator.open_buckets() == 6 + 1 + 1);
+
+    struct Emitted {
+        size_t resolution;
+        RollupPoint point;
+    };
+    std::vector<Emitted> emitted;
+    auto emit = [&](size_t resolution, uint32_t, MetricType, const RollupPoint& point) {
+        emitted.push_back({resolution, point});
+    };
+
+    // Before the first 10 s bucket is 1 s past its end
+    CHECK(aggregator.close(10999, emit) == 0);
+    CHECK(aggregator.close(11000, emit) == 1);
+    CHECK(emitted.size() == 1);
+    CHECK(emitted[0].resolution == 0);
+    CHECK(emitted[0].point.start_ms == 0);
+    CHECK(emitted[0].point.count == 10);
+    CHECK(emitted[0].point.sum == 45);
+    CHECK(emitted[0].point.min == 0 && emitted[0].point.max == 9);
+    CHECK(emitted[0].point.last == 9 && emitted[0].point.last_ms == 9000);
+    CHECK(emitted[0].point.sketch.empty());
+
+    // The 1 m bucket closes with the last 10 s one
+    emitted.clear();
+    CHECK(aggregator.close(61000, emit) == 6);
+    CHECK(emitted.back().resolution == 1 || emitted.front().resolution == 1);
+    for (const Emitted& e : emitted) {
+        if (e.resolution == 1) {
+            CHECK(e.point.count == 60 && e.point.sum == 1770 && e.point.last == 59);
+        }
+    }
+    CHECK(aggregator.open_buckets() == 1);   // 5 m
+
+    // A late point reopens a closed bucket; it is emitted again, partial
+    MetricBatch late;
+    late.add_metric(Metric("rollup_cpu", 100, MetricType::GAUGE, {{"host", "a"}}, at_ms(500)));
+    aggregator.add(late);
+    emitted.clear();
+    CHECK(aggregator.close(61000, emit) == 2);
+    CHECK(aggregator.close_all(emit) == 1);
+    CHECK(aggregator.open_buckets() == 0);
+
+    // Histograms carry a sketch; negative timestamps round down
+    RollupAggregator histograms;
+    MetricBatch h;
+    h.add_metric(Metric("rollup_latency", 5, MetricType::HISTOGRAM, {}, at_ms(-1)));
+    h.add_metric(Metric("rollup_latency", 7, MetricType::HISTOGRAM, {}, at_ms(-2)));
+    histograms.add(h);
+    emitted.clear();
+    histograms.close_all(emit);
+    CHECK(emitted.size() == 3);
+    CHECK(emitted[0].point.start_ms == -ROLLUP_RESOLUTIONS[emitted[0].resolution].ms);
+    CHECK(emitted[0].point.sketch.count() == 2);
+    CHECK(emitted[0].point.last == 5);   // Latest timestamp wins, not arrival order
+}
+
+static void test_save_and_load() {
+    MetricBatch batch;
+    for (int s = 0; s < 25; ++s) {
+        batch.add_metric(Metric("rollup_saved", s, MetricType::GAUGE, {{"host", "a"}}, at_ms(s * 1000)));
+        batch.add_metric(Metric("rollup_saved_latency", s, MetricType::SUMMARY, {}, at_ms(s * 1000)));
+    }
+    RollupAggregator saved(std::chrono::milliseconds(1000));
+    saved.add(batch);
+    std::string image;
+    saved.save(image);
+
+    // Registry ids are the identity here
+    std::vector<uint32_t> ids(SeriesRegistry::global().size());
+    for (uint32_t i = 0; i < ids.size(); ++i) ids[i] = i;
+
+    // Loading into a second aggregator, one on top of the other, was as if
+    // every point had been added twice
+    RollupAggregator twice(std::chrono::milliseconds(1000));
+    CHECK(twice.load(image, ids));
+    CHECK(twice.load(image, ids));
+    CHECK(twice.open_buckets() == saved.open_buckets());
+    CHECK(twice.points_added() == 0);
+    RollupAggregator added(std::chrono::milliseconds(1000));
+    added.add(batch);
+    added.add(batch);
+
+    struct Emitted {
+        size_t resolution;
+        uint32_t series;
+        RollupPoint point;
+    };
+    auto drain = [](RollupAggregator& aggregator, int64_t now_ms) {
+        std::vector<Emitted> out;
+        aggregator.close(now_ms, [&](size_t resolution, uint32_t series, MetricType, const RollupPoint& point) {
+            out.push_back({resolution, series, point});
+        });
+        std::sort(out.begin(), out.end(), [](const Emitted& a, const Emitted& b) {
+            return std::tie(a.resolution, a.series, a.point.start_ms) <
+                   std::tie(b.resolution, b.series, b.point.start_ms);
+        });
+        return out;
+    };
+    // Loaded buckets close on schedule: the first two 10 s ones by 21 s
+    std::vector<Emitted> expected = drain(added, 21000);
+    std::vector<Emitted> got = drain(twice, 21000);
+    CHECK(expected.size() == 4);
+    CHECK(got.size() == expected.size());
+    for (size_t i = 0; i < got.size() && i < expected.size(); ++i) {
+        CHECK(got[i].series == expected[i].series && got[i].point.start_ms == expected[i].point.start_ms);
+        CHECK(got[i].point.count == 20 && got[i].point.sum == expected[i].point.sum);
+        CHECK(got[i].point.min == expected[i].point.min && got[i].point.max == expected[i].point.max);
+        CHECK(got[i].point.last == expected[i].point.last && got[i].point.last_ms == expected[i].point.last_ms);
+        CHECK(got[i].point.sketch.count() == expected[i].point.sketch.count());
+    }
+
+    // Saved ids are mapped on load
+    uint32_t gauge_id = batch.metrics[0].series_id;
+    std::vector<uint32_t> moved = ids;
+    uint32_t other = SeriesRegistry::global().intern("rollup_saved_moved", TagRefs{});
+    moved[gauge_id] = other;
+    RollupAggregator remapped(std::chrono::milliseconds(1000));
+    CHECK(remapped.load(image, moved));
+    bool found = false;
+    for (const Emitted& e : drain(remapped, 21000)) {
+        CHECK(e.series != gauge_id);
+        found = found || e.series == other;
+    }
+    CHECK(found);
+
+    // Corrupt or truncated images load nothing; ids must be known
+    RollupAggregator rejected;
+    CHECK(!rejected.load(std::string_view(image).substr(0, image.size() - 3), ids));
+    CHECK(!rejected.load(image, std::vector<uint32_t>(1, 0)));
+    CHECK(rejected.open_buckets() == 0);
+    RollupAggregator empty;
+    std::string none;
+    empty.save(none);
+    CHECK(rejected.load(none, ids) && rejected.open_buckets() == 0);
+}
+
+static void test_write_and_query() {
+    std::string dir = temp_dir("rollups");
+    remove_dir(dir);
+    RollupWriter::Options options;
+    options.directory = dir;
+    options.fsync.mode = FsyncPolicy::Mode::NEVER;
+
+    RollupAggregator aggregator(std::chrono::milliseconds(0));
+    {
+        RollupWriter writer(options);
+        CHECK(writer.is_open());
+        auto emit = [&writer](size_t r, uint32_t id, MetricType type, const RollupPoint& point) {
+            writer.append(r, id, type, point);
+        };
+        MetricBatch batch;
+        // A counter growing 5/s with a reset at 120 s, for two hosts
+        for (int s = 0; s < 180; ++s) {
+            double value = s < 120 ? s * 5.0 : (s - 120) * 5.0;
+            batch.add_metric(Metric("rollup_requests", value, MetricType::COUNTER, {{"host", "a"}}, at_ms(s * 1000)));
+            batch.add_metric(Metric("rollup_requests", 1, MetricType::COUNTER, {{"host", "b"}}, at_ms(s * 1000)));
+            batch.add_metric(Metric("rollup_latency", s % 100, MetricType::SUMMARY, {}, at_ms(s * 1000)));
+        }
+        aggregator.add(batch);
+        aggregator.close(90000, emit);
+        CHECK(writer.commit());
+        aggregator.close_all(emit);
+        CHECK(writer.flush());
+        CHECK(writer.write_errors() == 0);
+        CHECK(writer.rollups_written() == 3 * (18 + 3 + 1));
+    }
+    CHECK(list_rollup_files(dir, 0).size() == 1);
+
+    SeriesQuery query;
+    query.name = "rollup_requests";
+    auto minutes = query_rollups(dir, rollup_resolution_index("1m"), query);
+    CHECK(minutes.size() == 2);
+    query.tags = {{"host", "a"}};
+    minutes = query_rollups(dir, rollup_resolution_index("1m"), query);
+    CHECK(minutes.size() == 1);
+    if (minutes.size() == 1) {
+        const auto& points = minutes[0].points;
+        CHECK(minutes[0].info.type == MetricType::COUNTER);
+        CHECK(points.size() == 3);
+        CHECK(points[0].start_ms == 0 && points[1].start_ms == 60000 && points[2].start_ms == 120000);
+        CHECK(points[0].count == 60 && points[0].last == 295);
+
+        auto rates = counter_rates(points);
+        CHECK(rates.size() == 2);
+        CHECK(rates.size() == 2 && rates[0].value == 5.0);
+        // After the reset the increase is the new value: 295 over 60 s
+        CHECK(rates.size() == 2 && near(rates[1].value, 295.0 / 60.0, 1e-12));
+    }
+
+    // Range filters on bucket start
+    query.start_ms = 60000;
+    query.end_ms = 60000;
+    minutes = query_rollups(dir, rollup_resolution_index("1m"), query);
+    CHECK(minutes.size() == 1 && minutes[0].points.size() == 1);
+
+    // A second run's records for the same bucket are merged on read
+    {
+        RollupWriter writer(options);
+        RollupPoint extra;
+        extra.start_ms = 60000;
+        extra.add(61000, 1000, false);
+        uint32_t id = Metric("rollup_requests", 0, MetricType::COUNTER, {{"host", "a"}}).series_id;
+        writer.append(rollup_resolution_index("1m"), id, MetricType::COUNTER, extra);
+    }
+    CHECK(list_rollup_files(dir, 1).size() == 2);
+    minutes = query_rollups(dir, rollup_resolution_index("1m"), query);
+    CHECK(minutes.size() == 1 && minutes[0].points.size() == 1);
+    if (minutes.size() == 1 && minutes[0].points.size() == 1) {
+        CHECK(minutes[0].points[0].count == 61);
+        CHECK(minutes[0].points[0].max == 1000);
+        CHECK(minutes[0].points[0].last == 595);   // Later timestamp than the extra point
+    }
+
+    // Summary sketches survive the round trip
+    SeriesQuery latency;
+    latency.name = "rollup_latency";
+    auto fives = query_rollups(dir, rollup_resolution_index("5m"), latency);
+    CHECK(fives.size() == 1 && fives[0].points.size() == 1);
+    if (fives.size() == 1 && fives[0].points.size() == 1) {
+        const QuantileSketch& sketch = fives[0].points[0].sketch;
+        CHECK(sketch.count() == 180);
+        CHECK(near(sketch.quantile(0.5), 44, 0.011));   // 0..79 twice, 80..99 once
+    }
+
+    // A torn tail is ignored
+    std::string path = list_rollup_files(dir, 0).front();
+    struct stat st;
+    CHECK(stat(path.c_str(), &st) == 0);
+    CHECK(truncate(path.c_str(), st.st_size - 3) == 0);
+    SeriesQuery all;
+    auto tens = query_rollups(dir, 0, all);
+    size_t points = 0;
+    for (const auto& series : tens) points += series.points.size();
+    CHECK(points == 3 * 18 - 1);
+
+    remove_dir(dir);
+}
+
+static void test_parallel_workers() {
+    std::string dir = temp_dir("rollup_workers");
+    remove_dir(dir);
+    RollupWriter::Options options;
+    options.directory = dir;
+    options.fsync.mode = FsyncPolicy::Mode::NEVER;
+
+    // Two workers see different halves of one histogram's points
+    constexpr int POINTS = 20000;
+    QuantileSketch reference;
+    std::vector<double> values;
+    for (int i = 0; i < POINTS; ++i) {
+        values.push_back(1.0 + (i * 7919) % 10007);
+        reference.add(values.back());
+    }
+    {
+        RollupWriter writer(options);
+        std::vector<std::thread> workers;
+        for (int w = 0; w < 2; ++w) {
+            workers.emplace_back([&, w] {
+                RollupAggregator aggregator;
+                MetricBatch batch;
+                for (int i = w; i < POINTS; i += 2) {
+                    batch.add_metric(Metric("rollup_parallel", values[i], MetricType::HISTOGRAM, {},
+                                            at_ms(1000 + i % 5000)));
+                }
+                aggregator.add(batch);
+                aggregator.close_all([&writer](size_t r, uint32_t id, MetricType type, const RollupPoint& p) {
+                    writer.append(r, id, type, p);
+                });
+            });
+        }
+        for (auto& worker : workers) worker.join();
+        CHECK(writer.commit());
+        // Merged before writing: one record per resolution
+        CHECK(writer.rollups_written() == ROLLUP_RESOLUTION_COUNT);
+    }
+
+    SeriesQuery query;
+    query.name = "rollup_parallel";
+    auto tens = query_rollups(dir, 0, query);
+    CHECK(tens.size() == 1 && tens[0].points.size() == 1);
+    if (tens.size() == 1 && tens[0].points.size() == 1) {
+        const QuantileSketch& sketch = tens[0].points[0].sketch;
+        CHECK(sketch.count() == POINTS);
+        for (double q : {0.5, 0.99, 0.999}) {
+            CHECK(sketch.quantile(q) == reference.quantile(q));
+        }
+    }
+    remove_dir(dir);
+}
+
+int main() {
+    test_sketch();
+    test_aggregator();
+    test_save_and_load();
+    test_write_and_query();
+    test_parallel_workers();
+
+    return test_result("rollup_test");
+}
@@ -0,0 +1,323 @@
+#include "gorilla.h"
+#include "segment.h"
+#include "test_check.h"
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+using metricstream::BlockInfo;
+using metricstream::DataPoint;
+using metricstream::FsyncPolicy;
+using metricstream::GorillaDecoder;
+using metricstream::GorillaEncoder;
+using metricstream::Metric;
+using metricstream::MetricBatch;
+using metricstream::MetricType;
+using metricstream::SegmentReader;
+using metricstream::SegmentWriter;
+using metricstream::SeriesInfo;
+
+static std::string temp_dir(const char* name) {
+    return "/tmp/metricstream_" + std::string(name) + "_" + std::to_string(getpid());
+}
+
+static void remove_dir(const std::string& dir) {
+    for (const auto& path : metricstream::list_segment_files(dir)) {
+        unlink(path.c_str());
+    }
+    rmdir(dir.c_str());
+}
+
+static metricstream::Timestamp at_ms(int64_t ms) {
+    return metricstream::Timestamp(std::chrono::milliseconds(ms));
+}
+
+static SegmentWriter::Options test_options(const std::string& dir) {
+    SegmentWriter::Options options;
+    options.directory = dir;
+    options.fsync.mode = FsyncPolicy::Mode::NEVER;
+    return options;
+}
+
+static bool same_bits(double a, double b) {
+    return std::memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+static void check_round_trip(const std::vector<DataPoint>& points) {
+    GorillaEncoder encoder;
+    for (const auto& p : points) {
+        encoder.append(p.timestamp_ms, p.value);
+    }
+    CHECK(encoder.count() == points.size());
+
+    GorillaDecoder decoder(encoder.bytes(), encoder.count());
+    size_t i = 0;
+    int64_t ts;
+    double value;
+    while (decoder.next(ts, value)) {
+        CHECK(i < points.size());
+        if (i >= points.size()) break;
+        CHECK(ts == points[i].timestamp_ms);
+        CHECK(same_bits(value, points[i].value));
+        i++;
+    }
+    CHECK(decoder.ok());
+    CHECK(i == points.size());
+}
+
+static void test_gorilla_round_trip() {
+    // Regular interval, constant value: ~2 bits per point after the first
+    std::vector<DataPoint> steady;
+    for (int i = 0; i < 1000; ++i) {
+        steady.push_back({1704164645000LL + i * 1000, 42.0});
+    }
+    check_round_trip(steady);
+
+    GorillaEncoder encoder;
+    for (const auto& p : steady) encoder.append(p.timestamp_ms, p.value);
+    CHECK(encoder.bytes().size() < 16 + 1000 / 4 + 8);
+
+    // Jitter, out-of-order points, huge gaps and awkward doubles
+    std::vector<DataPoint> messy = {
+        {1000, 1.5}, {1003, -1.5}, {999, 0.0}, {2000000000000LL, -0.0},
+        {-5, std::numeric_limits<double>::infinity()},
+        {std::numeric_limits<int64_t>::max(), std::numeric_limits<double>::quiet_NaN()},
+        {std::numeric_limits<int64_t>::min(), std::numeric_limits<double>::denorm_min()},
+        {0, std::numeric_limits<double>::max()}, {100, 3.14159}, {164, 3.14160},
+        {420, 1e-300}, {2468, 12345678.9},
+    };
+    check_round_trip(messy);
+
+    // Slowly changing gauge
+    std::vector<DataPoint> gauge;
+    double v = 50.0;
+    for (int i = 0; i < 500; ++i) {
+        v += (i % 7) * 0.25 - 0.75;
+        gauge.push_back({static_cast<int64_t>(i) * 15000 + (i % 3), v});
+    }
+    check_round_trip(gauge);
+
+    check_round_trip({});
+    check_round_trip({{7, 7.0}});
+}
+
+static void test_gorilla_truncated() {
+    GorillaEncoder encoder;
+    for (int i = 0; i < 100; ++i) encoder.append(i * 10 + (i * i) % 17, i * 1.1);
+    std::string bytes = encoder.bytes();
+    bytes.resize(bytes.size() / 2);
+
+    GorillaDecoder decoder(bytes, encoder.count());
+    int64_t ts;
+    double value;
+    uint32_t decoded = 0;
+    while (decoder.next(ts, value)) decoded++;
+    CHECK(!decoder.ok());
+    CHECK(decoded < 100);
+}
+
+static void test_write_and_read() {
+    std::string dir = temp_dir("segment_rw");
+    std::string path;
+    {
+        auto options = test_options(dir);
+        options.block_points = 100;
+        SegmentWriter writer(options);
+        CHECK(writer.is_open());
+
+        MetricBatch batch;
+        for (int i = 0; i < 250; ++i) {
+            batch.add_metric(Metric("cpu", i, MetricType::GAUGE,
+                                    {{"host", "a"}, {"dc", "eu"}}, at_ms(1000 + i * 10)));
+            batch.add_metric(Metric("cpu", -i, MetricType::GAUGE,
+                                    {{"host", "b"}}, at_ms(1000 + i * 10)));
+        }
+        // Same series as host=a: tag order does not matter
+        batch.add_metric(Metric("cpu", 999, MetricType::GAUGE,
+                                {{"dc", "eu"}, {"host", "a"}}, at_ms(5000)));
+        batch.add_metric(Metric("requests", 1, MetricType::COUNTER, {}, at_ms(6000)));
+        writer.append(batch);
+        CHECK(writer.commit());
+        CHECK(writer.series_count() == 3);
+        CHECK(writer.points_written() == 502);
+        path = writer.current_path();
+        CHECK(!path.empty());
+    }
+
+    SegmentReader reader;
+    CHECK(reader.open(path));
+    CHECK(reader.sealed());
+    CHECK(reader.series().size() == 3);
+
+    // host=a: 251 points in blocks of 100, 100, 51
+    const SeriesInfo* host_a = nullptr;
+    for (const auto& s : reader.series()) {
+        if (s.name == "cpu" && s.tags.size() == 2) host_a = &s;
+    }
+    CHECK(host_a != nullptr);
+    if (!host_a) return;
+    CHECK(host_a->tags[0].first == "dc" && host_a->tags[1].first == "host");
+    CHECK(reader.find_series(host_a->id) == host_a);
+
+    std::vector<DataPoint> points;
+    size_t blocks = 0;
+    for (const BlockInfo& block : reader.blocks()) {
+        if (block.series_id != host_a->id) continue;
+        blocks++;
+        CHECK(reader.read_block(block, points));
+    }
+    CHECK(blocks == 3);
+    CHECK(points.size() == 251);
+    if (points.size() == 251) {
+        CHECK(points[0].timestamp_ms == 1000 && points[0].value == 0);
+        CHECK(points[249].timestamp_ms == 3490 && points[249].value == 249);
+        CHECK(points[250].timestamp_ms == 5000 && points[250].value == 999);
+    }
+
+    size_t total = 0;
+    for (const BlockInfo& block : reader.blocks()) total += block.count;
+    CHECK(total == 502);
+
+    remove_dir(dir);
+}
+
+static void test_recover_unsealed() {
+    std::string dir = temp_dir("segment_recover");
+    std::string path;
+    {
+        auto options = test_options(dir);
+        options.block_points = 10;
+        SegmentWriter writer(options);
+        MetricBatch batch;
+        for (int i = 0; i < 35; ++i) {
+            batch.add_metric(Metric("mem", i * 2.5, MetricType::GAUGE, {}, at_ms(i)));
+        }
+        writer.append(batch);
+        CHECK(writer.commit());
+        path = writer.current_path();
+    }
+
+    // Cut the trailer, the index and a few bytes of the last block, as a
+    // crash mid-write would
+    struct stat st;
+    CHECK(stat(path.c_str(), &st) == 0);
+    SegmentReader sealed;
+    CHECK(sealed.open(path));
+    CHECK(sealed.blocks().size() == 4);
+    uint64_t last_block = sealed.blocks().back().offset;
+    CHECK(truncate(path.c_str(), static_cast<off_t>(last_block + 5)) == 0);
+
+    SegmentReader reader;
+    CHECK(reader.open(path));
+    CHECK(!reader.sealed());
+    CHECK(reader.series().size() == 1);
+    CHECK(reader.blocks().size() == 3);
+    std::vector<DataPoint> points;
+    for (const BlockInfo& block : reader.blocks()) {
+        CHECK(reader.read_block(block, points));
+    }
+    CHECK(points.size() == 30);
+
+    remove_dir(dir);
+}
+
+static void test_roll_and_sequence() {
+    std::string dir = temp_dir("segment_roll");
+    {
+        auto options = test_options(dir);
+        options.block_points = 50;
+        options.max_segment_bytes = 512;
+        SegmentWriter writer(options);
+        for (int round = 0; round < 5; ++round) {
+            MetricBatch batch;
+            for (int i = 0; i < 200; ++i) {
+                batch.add_metric(Metric("series" + std::to_string(i % 4), i * 1.37,
+                                        MetricType::GAUGE, {}, at_ms(round * 1000 + i)));
+            }
+            writer.append(batch);
+            CHECK(writer.commit());
+        }
+        CHECK(writer.segments_sealed() >= 2);
+    }
+    auto files = metricstream::list_segment_files(dir);
+    CHECK(files.size() >= 3);
+
+    // Every segment stands alone: its own series records and index
+    size_t total = 0;
+    for (const auto& file : files) {
+        SegmentReader reader;
+        CHECK(reader.open(file));
+        CHECK(reader.sealed());
+        for (const BlockInfo& block : reader.blocks()) {
+            CHECK(reader.find_series(block.series_id) != nullptr);
+            std::vector<DataPoint> points;
+            CHECK(reader.read_block(block, points));
+            total += points.size();
+        }
+    }
+    CHECK(total == 1000);
+
+    // A new writer continues the sequence instead of reusing a name
+    std::string next_path;
+    {
+        SegmentWriter writer(test_options(dir));
+        MetricBatch batch;
+        batch.add_metric(Metric("late", 1, MetricType::GAUGE, {}, at_ms(1)));
+        writer.append(batch);
+        writer.commit();
+        next_path = writer.current_path();
+    }
+    CHECK(next_path > files.back());
+    CHECK(metricstream::list_segment_files(dir).size() == files.size() + 1);
+
+    remove_dir(dir);
+}
+
+static void test_block_age() {
+    std::string dir = temp_dir("segment_age");
+    auto options = test_options(dir);
+    options.max_block_age = std::chrono::milliseconds(0);
+    {
+        SegmentWriter writer(options);
+        MetricBatch batch;
+        batch.add_metric(Metric("idle", 1, MetricType::GAUGE, {}, at_ms(1)));
+        writer.append(batch);
+        CHECK(writer.wants_timed_sync());
+        CHECK(writer.commit());
+        // Aged block sealed and on disk before the segment is
+        CHECK(writer.blocks_written() == 1);
+        CHECK(!writer.wants_timed_sync());
+    }
+    remove_dir(dir);
+}
+
+static void test_rejects_garbage() {
+    std::string path = temp_dir("segment_garbage") + ".seg";
+    FILE* f = std::fopen(path.c_str(), "wb");
+    std::fputs("{\"not\":\"a segment\"}\n", f);
+    std::fclose(f);
+
+    SegmentReader reader;
+    CHECK(!reader.open(path));
+    CHECK(!reader.error().empty());
+    CHECK(!reader.open(path + ".missing"));
+    unlink(path.c_str());
+}
+
+int main() {
+    test_gorilla_round_trip();
+    test_gorilla_truncated();
+    test_write_and_read();
+    test_recover_unsealed();
+    test_roll_and_sequence();
+    test_block_age();
+    test_rejects_garbage();
+
+    return test_result("segment_test");
+}
@@ -0,0 +1,159 @@
+#include "series_registry.h"
+#include "test_check.h"
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using metricstream::ScopedSeriesBudget;
+using metricstream::SeriesKey;
+using metricstream::SeriesRegistry;
+using metricstream::TagList;
+using metricstream::TagRefs;
+
+static void test_canonical_ids() {
+    SeriesRegistry registry;
+    CHECK(registry.size() == 1);   // The overflow series
+    CHECK(registry.key(SeriesRegistry::OVERFLOW_ID).name == "<overflow>");
+
+    uint32_t a = registry.intern("cpu", TagRefs{{"host", "web1"}, {"dc", "eu"}});
+    uint32_t b = registry.intern("cpu", TagRefs{{"dc", "eu"}, {"host", "web1"}});
+    uint32_t c = registry.intern("cpu", TagList{{"dc", "eu"}, {"host", "web2"}});
+    uint32_t d = registry.intern("cpu", TagRefs{});
+    CHECK(a == b);
+    CHECK(a != c && a != d && c != d);
+    CHECK(registry.size() == 4);
+
+    const SeriesKey& key = registry.key(a);
+    CHECK(key.name == "cpu");
+    CHECK(key.tags.size() == 2);
+    CHECK(key.tags[0].first == "dc" && key.tags[1].first == "host");
+    CHECK(*key.tag("host") == "web1");
+    CHECK(key.tag("rack") == nullptr);
+    CHECK(key.canonical == std::string("cpu\0dc\0eu\0host\0web1", 19));
+}
+
+static void test_duplicate_keys() {
+    SeriesRegistry registry;
+    uint32_t id = registry.intern("mem", TagRefs{{"host", "old"}, {"dc", "eu"}, {"host", "new"}});
+    const SeriesKey& key = registry.key(id);
+    CHECK(key.tags.size() == 2);
+    CHECK(*key.tag("host") == "new");
+    CHECK(id == registry.intern("mem", TagRefs{{"dc", "eu"}, {"host", "new"}}));
+}
+
+static void test_keys_are_stable() {
+    SeriesRegistry registry;
+    uint32_t first = registry.intern("series0", TagRefs{});
+    const std::string* name = &registry.key(first).name;
+    for (int i = 1; i < 10000; ++i) {
+        registry.intern("series" + std::to_string(i), TagRefs{});
+    }
+    CHECK(&registry.key(first).name == name);
+    CHECK(registry.key(registry.intern("series9999", TagRefs{})).name == "series9999");
+    CHECK(registry.size() == 10001);
+}
+
+static void test_concurrent_intern() {
+    SeriesRegistry registry;
+    constexpr int THREADS = 8;
+    constexpr int SERIES = 2000;
+    std::vector<std::vector<uint32_t>> ids(THREADS);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < SERIES; ++i) {
+                std::string host = "web" + std::to_string(i);
+                ids[t].push_back(registry.intern("cpu", TagRefs{{"host", host}}));
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+
+    CHECK(registry.size() == SERIES + 1);
+    for (int t = 1; t < THREADS; ++t) {
+        CHECK(ids[t] == ids[0]);
+    }
+    for (int i = 0; i < SERIES; ++i) {
+        CHECK(*registry.key(ids[0][i]).tag("host") == "web" + std::to_string(i));
+    }
+}
+
+static void test_restore() {
+    std::string_view name;
+    TagRefs tags;
+    SeriesRegistry source;
+    uint32_t id = source.intern("cpu", TagRefs{{"host", "web1"}, {"dc", "eu"}});
+    CHECK(SeriesRegistry::split_canonical(source.key(id).canonical, name, tags));
+    CHECK(name == "cpu" && tags.size() == 2);
+    CHECK(tags[0].first == "dc" && tags[0].second == "eu" && tags[1].second == "web1");
+    CHECK(SeriesRegistry::split_canonical("bare", name, tags) && name == "bare" && tags.empty());
+    CHECK(SeriesRegistry::split_canonical(std::string_view("a\0k\0", 4), name, tags));
+    CHECK(tags.size() == 1 && tags[0].second.empty());
+    CHECK(!SeriesRegistry::split_canonical(std::string_view("a\0k", 3), name, tags));
+
+    // Enough series for the threaded path, and to span several chunks
+    constexpr size_t SERIES = 5 * SeriesRegistry::CHUNK_SIZE + 17;
+    for (size_t i = 1; i < SERIES; ++i) {
+        source.intern("mem", TagRefs{{"host", "web" + std::to_string(i)}});
+    }
+    std::vector<std::string_view> canonicals;
+    for (uint32_t i = 1; i < source.size(); ++i) {
+        canonicals.push_back(source.key(i).canonical);
+    }
+
+    SeriesRegistry restored;
+    CHECK(restored.restore(canonicals));
+    CHECK(restored.size() == source.size());
+    for (uint32_t i = 1; i < source.size(); i += 997) {
+        CHECK(restored.key(i).canonical == source.key(i).canonical);
+        CHECK(restored.key(i).name == source.key(i).name && restored.key(i).tags == source.key(i).tags);
+    }
+    // Lookups find the restored ids; new series continue after them
+    CHECK(restored.intern("cpu", TagRefs{{"dc", "eu"}, {"host", "web1"}}) == id);
+    CHECK(restored.intern("mem", TagRefs{{"host", "web4242"}}) == source.intern("mem", TagRefs{{"host", "web4242"}}));
+    CHECK(restored.intern("new", TagRefs{}) == source.size());
+    CHECK(!restored.restore(canonicals));   // No longer empty
+
+    SeriesRegistry rejected;
+    std::vector<std::string_view> bad{"ok", std::string_view("x\0y", 3)};
+    CHECK(!rejected.restore(bad));
+    CHECK(rejected.size() == 1);
+    CHECK(rejected.intern("ok", TagRefs{}) == 1 && rejected.key(1).tags.empty());
+}
+
+static void test_series_budget() {
+    SeriesRegistry registry;
+    uint32_t known = registry.intern("cpu", TagRefs{{"host", "a"}});
+    {
+        ScopedSeriesBudget budget(1, false);
+        CHECK(registry.intern("cpu", TagRefs{{"host", "a"}}) == known);   // Existing: free
+        uint32_t created = registry.intern("cpu", TagRefs{{"host", "b"}});
+        CHECK(created != SeriesRegistry::OVERFLOW_ID);
+        CHECK(registry.intern("cpu", TagRefs{{"host", "c"}}) == SeriesRegistry::OVERFLOW_ID);
+        CHECK(registry.intern("cpu", TagRefs{{"host", "b"}}) == created);
+        CHECK(budget.created() == 1 && budget.refused() == 1);
+        {
+            // The inner scope applies; stripped, the name alone is created
+            ScopedSeriesBudget inner(0, true);
+            uint32_t bare = registry.intern("cpu", TagRefs{{"host", "d"}});
+            CHECK(registry.key(bare).tags.empty() && registry.key(bare).name == "cpu");
+            CHECK(registry.intern("cpu", TagRefs{{"host", "e"}}) == bare);
+            CHECK(inner.created() == 0 && inner.refused() == 2);
+        }
+        CHECK(registry.intern("mem", TagRefs{}) == SeriesRegistry::OVERFLOW_ID);
+    }
+    CHECK(registry.size() == 4);   // Overflow, a, b, bare cpu
+    CHECK(registry.intern("cpu", TagRefs{{"host", "c"}}) == 4);
+}
+
+int main() {
+    test_canonical_ids();
+    test_duplicate_keys();
+    test_keys_are_stable();
+    test_concurrent_intern();
+    test_restore();
+    test_series_budget();
+
+    return test_result("series_registry_test");
+}
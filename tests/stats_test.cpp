@@ -0,0 +1,133 @@
+#include "stats.h"
+#include "test_check.h"
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace metricstream;
+
+static void test_sharded_counter() {
+    ShardedCounter counter;
+    CHECK(counter.value() == 0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&counter] {
+            for (int i = 0; i < 10000; ++i) counter.add();
+            counter.add(5);
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    CHECK(counter.value() == 8 * 10005);
+}
+
+static void test_histogram_buckets() {
+    using std::chrono::microseconds;
+    using std::chrono::nanoseconds;
+    LatencyHistogram histogram;
+    histogram.observe(nanoseconds(0));        // <= 1us
+    histogram.observe(nanoseconds(1000));     // <= 1us
+    histogram.observe(nanoseconds(1001));     // <= 2us
+    histogram.observe(microseconds(3));       // <= 4us
+    histogram.observe(microseconds(4));       // <= 4us
+    histogram.observe(std::chrono::hours(1)); // +Inf
+    histogram.observe(nanoseconds(-5));       // Clock went backwards: <= 1us
+
+    auto snapshot = histogram.snapshot();
+    CHECK(snapshot.count == 7);
+    CHECK(snapshot.buckets[0] == 3);
+    CHECK(snapshot.buckets[1] == 1);
+    CHECK(snapshot.buckets[2] == 2);
+    CHECK(snapshot.buckets[LatencyHistogram::BUCKETS - 1] == 1);
+    CHECK(snapshot.sum_ns == 1000 + 1001 + 3000 + 4000 + 3600000000000ULL);
+
+    CHECK(LatencyHistogram::bucket_bound_seconds(0) == 1e-6);
+    CHECK(LatencyHistogram::bucket_bound_seconds(3) == 8e-6);
+    CHECK(std::isinf(LatencyHistogram::bucket_bound_seconds(LatencyHistogram::BUCKETS - 1)));
+
+    LatencyHistogram scoped;
+    { ScopedLatency timer(scoped); }
+    CHECK(scoped.snapshot().count == 1);
+}
+
+static bool contains(const std::string& text, const std::string& needle) {
+    return text.find(needle) != std::string::npos;
+}
+
+static void test_prometheus_text() {
+    std::string out;
+    PrometheusWriter writer(out);
+    writer.counter("requests_total", "Requests seen", 42);
+    writer.gauge("queue_depth", "Waiting", 3);
+
+    LatencyHistogram histogram;
+    histogram.observe(std::chrono::microseconds(1));
+    histogram.observe(std::chrono::microseconds(3));
+    writer.family("stage_seconds", "histogram", "Per stage");
+    writer.histogram("stage_seconds", histogram.snapshot(), "stage=\"parse\"");
+
+    CHECK(contains(out, "# HELP requests_total Requests seen\n# TYPE requests_total counter\nrequests_total 42\n"));
+    CHECK(contains(out, "# TYPE queue_depth gauge\nqueue_depth 3\n"));
+    CHECK(contains(out, "stage_seconds_bucket{stage=\"parse\",le=\"1e-06\"} 1\n"));
+    CHECK(contains(out, "stage_seconds_bucket{stage=\"parse\",le=\"2e-06\"} 1\n"));
+    CHECK(contains(out, "stage_seconds_bucket{stage=\"parse\",le=\"4e-06\"} 2\n"));
+    CHECK(contains(out, "stage_seconds_bucket{stage=\"parse\",le=\"+Inf\"} 2\n"));
+    CHECK(contains(out, "stage_seconds_sum{stage=\"parse\"} 4e-06\n"));
+    CHECK(contains(out, "stage_seconds_count{stage=\"parse\"} 2\n"));
+
+    // Unlabeled histograms carry only le
+    std::string plain;
+    PrometheusWriter(plain).histogram("rt", LatencyHistogram::Snapshot{});
+    CHECK(contains(plain, "rt_bucket{le=\"+Inf\"} 0\n"));
+    CHECK(contains(plain, "rt_count 0\n"));
+}
+
+static void test_hdr_histogram() {
+    HdrHistogram histogram;
+    CHECK(histogram.percentile(0.5) == 0 && histogram.min() == 0 && histogram.max() == 0);
+
+    // Exact below 256, within 1/128 above
+    for (uint64_t v : {0ULL, 1ULL, 255ULL, 256ULL, 1000ULL, 123456789ULL, ~0ULL}) {
+        size_t index = HdrHistogram::index_of(v);
+        CHECK(index < HdrHistogram::COUNTS);
+        uint64_t top = HdrHistogram::highest_equivalent(index);
+        CHECK(top >= v);
+        CHECK(v < 256 ? top == v : static_cast<double>(top - v) <= static_cast<double>(v) / 128.0);
+        if (index > 0) {
+            CHECK(HdrHistogram::highest_equivalent(index - 1) < v);
+        }
+    }
+
+    // 1..10000 ns; the tail is not averaged away
+    for (uint64_t v = 1; v <= 10000; ++v) {
+        histogram.record(v);
+    }
+    CHECK(histogram.count() == 10000);
+    CHECK(histogram.min() == 1 && histogram.max() == 10000);
+    CHECK(histogram.mean() == 5000.5);
+    auto near = [](uint64_t got, double want) { return std::abs(static_cast<double>(got) - want) <= want / 128.0; };
+    CHECK(near(histogram.percentile(0.5), 5000));
+    CHECK(near(histogram.percentile(0.99), 9900));
+    CHECK(near(histogram.percentile(0.999), 9990));
+    CHECK(histogram.percentile(1.0) == 10000);
+    CHECK(histogram.percentile(0.0) == 1);
+
+    HdrHistogram slow;
+    slow.record(5000000, 100);
+    histogram.merge(slow);
+    CHECK(histogram.count() == 10100 && histogram.max() == 5000000);
+    CHECK(near(histogram.percentile(0.995), 5000000));
+
+    histogram.reset();
+    CHECK(histogram.count() == 0 && histogram.percentile(0.99) == 0);
+}
+
+int main() {
+    test_sharded_counter();
+    test_histogram_buckets();
+    test_prometheus_text();
+    test_hdr_histogram();
+
+    return test_result("stats_test");
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <iostream>
+
+// Shared by the test executables, one translation unit each: CHECK records a
+// failure and carries on, test_result() reports and picks the exit code.
+static int failures = 0;
+
+#define CHECK(cond)                                                              \
+    do {                                                                         \
+        if (!(cond)) {                                                           \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK failed: " #cond \
+                      << std::endl;                                              \
+            failures++;                                                          \
+        }                                                                        \
+    } while (0)
+
+static int test_result(const char* name) {
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << name << " passed" << std::endl;
+    return 0;
+}
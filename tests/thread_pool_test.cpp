@@ -0,0 +1,168 @@
+#include "thread_pool.h"
+#include "test_check.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using metricstream::Task;
+using metricstream::ThreadPool;
+
+static void wait_for(const std::atomic<int>& counter, int expected) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (counter.load() < expected && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+static void test_task_storage() {
+    int calls = 0;
+    auto owned = std::make_unique<int>(7);
+    Task small([&calls, p = std::move(owned)]() { calls += *p; });
+    Task moved = std::move(small);
+    CHECK(!small);
+    moved();
+    CHECK(calls == 7);
+
+    // Too big for the inline buffer: stored on the heap, same behaviour
+    std::array<char, 256> big{};
+    big[255] = 3;
+    Task large([&calls, big]() { calls += big[255]; });
+    Task target;
+    target = std::move(large);
+    target();
+    CHECK(calls == 10);
+}
+
+static void test_many_producers() {
+    constexpr int PRODUCERS = 4;
+    constexpr int PER_PRODUCER = 20000;
+    std::atomic<int> done{0};
+    std::atomic<int> rejected{0};
+    {
+        ThreadPool pool(4, 1024);
+        std::vector<std::thread> producers;
+        for (int p = 0; p < PRODUCERS; ++p) {
+            producers.emplace_back([&]() {
+                for (int i = 0; i < PER_PRODUCER; ++i) {
+                    while (!pool.enqueue([&done]() { done++; })) {
+                        rejected++;
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+        for (auto& t : producers) t.join();
+        wait_for(done, PRODUCERS * PER_PRODUCER);
+    }
+    CHECK(done.load() == PRODUCERS * PER_PRODUCER);
+}
+
+static void test_nested_enqueue() {
+    std::atomic<int> done{0};
+    {
+        ThreadPool pool(2, 256);
+        for (int i = 0; i < 50; ++i) {
+            pool.enqueue([&pool, &done]() {
+                pool.enqueue([&done]() { done++; });
+                done++;
+            });
+        }
+        wait_for(done, 100);
+    }
+    CHECK(done.load() == 100);
+}
+
+static void test_backpressure() {
+    std::atomic<bool> release{false};
+    std::atomic<int> started{0};
+    ThreadPool pool(1, 4);
+
+    CHECK(pool.enqueue([&]() {
+        started++;
+        while (!release.load()) std::this_thread::yield();
+    }));
+    wait_for(started, 1);
+
+    // The worker is busy, so exactly max_queue_size tasks can wait
+    int accepted = 0;
+    for (int i = 0; i < 10; ++i) {
+        if (pool.enqueue([]() {})) accepted++;
+    }
+    CHECK(accepted == 4);
+    CHECK(pool.queue_size() == 4);
+
+    release = true;
+}
+
+// A worker enqueueing more than its deque holds spills into the inboxes:
+// every task is accepted and runs, and the queue count returns to zero
+static void test_saturated_queue() {
+    std::atomic<int> accepted{0};
+    std::atomic<int> done{0};
+    {
+        ThreadPool pool(2, 64);   // 32 per worker queue
+        CHECK(pool.enqueue([&]() {
+            for (int i = 0; i < 64; ++i) {
+                if (pool.enqueue([&done]() { done++; })) accepted++;
+            }
+        }));
+        wait_for(done, 64);
+        CHECK(pool.queue_size() == 0);
+    }
+    CHECK(accepted.load() == 64);
+    CHECK(done.load() == 64);
+
+    // Every inbox full behind busy workers: refused, not lost
+    std::atomic<bool> release{false};
+    std::atomic<int> started{0};
+    done = 0;
+    {
+        ThreadPool pool(2, 8);
+        for (int i = 0; i < 2; ++i) {
+            CHECK(pool.enqueue([&]() {
+                started++;
+                while (!release.load()) std::this_thread::yield();
+            }));
+        }
+        wait_for(started, 2);
+
+        int taken = 0;
+        for (int i = 0; i < 12; ++i) {
+            if (pool.enqueue([&done]() { done++; })) taken++;
+        }
+        CHECK(taken == 8);
+        CHECK(pool.queue_size() == 8);
+
+        release = true;
+        wait_for(done, 8);
+        CHECK(pool.queue_size() == 0);
+        CHECK(pool.enqueue([&done]() { done++; }));
+    }
+    CHECK(done.load() == 9);
+}
+
+static void test_drains_on_shutdown() {
+    std::atomic<int> done{0};
+    {
+        ThreadPool pool(2, 1000);
+        for (int i = 0; i < 500; ++i) {
+            pool.enqueue([&done]() { done++; });
+        }
+    }
+    CHECK(done.load() == 500);
+}
+
+int main() {
+    test_task_storage();
+    test_many_producers();
+    test_nested_enqueue();
+    test_backpressure();
+    test_saturated_queue();
+    test_drains_on_shutdown();
+
+    return test_result("thread_pool_test");
+}
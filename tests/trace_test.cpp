@@ -0,0 +1,141 @@
+#include "trace.h"
+#include "test_check.h"
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace metricstream;
+
+static bool contains(const std::string& text, const std::string& part) {
+    return text.find(part) != std::string::npos;
+}
+
+// A finished request whose stages are `stage_us` apart, starting at 1 s
+static RequestTrace make_trace(uint64_t id, int64_t stage_us) {
+    RequestTrace trace;
+    trace.id = id;
+    trace.set_route("POST", "/metrics");
+    for (size_t i = 0; i < TRACE_STAGE_COUNT; ++i) {
+        trace.at_ns[i] = 1000000000 + static_cast<int64_t>(i) * stage_us * 1000;
+    }
+    trace.status = 200;
+    return trace;
+}
+
+static void test_request_trace() {
+    RequestTrace trace;
+    CHECK(trace.total_ns() == 0);
+    trace.mark(TraceStage::RECEIVED);
+    CHECK(trace.reached(TraceStage::RECEIVED));
+    CHECK(!trace.reached(TraceStage::PARSED));
+    trace.mark(TraceStage::PARSED);
+    CHECK(trace.total_ns() >= 0);
+    CHECK(trace.at_ns[static_cast<size_t>(TraceStage::PARSED)] >=
+          trace.at_ns[static_cast<size_t>(TraceStage::RECEIVED)]);
+
+    trace.set_route("GET", std::string(200, 'x'));
+    CHECK(std::string(trace.method) == "GET");
+    CHECK(std::string(trace.path).size() == RequestTrace::PATH_BYTES - 1);
+
+    CHECK(trace_stage_name(TraceStage::WAL_SYNCED) == "wal_synced");
+    CHECK(trace_stage_name(TraceStage::RESPONDED) == "responded");
+}
+
+static void test_context() {
+    CHECK(current_trace() == nullptr);
+    trace_mark(TraceStage::PARSED);   // No-op without a context
+
+    RequestTrace outer;
+    RequestTrace inner;
+    {
+        ScopedTraceContext a(&outer);
+        trace_mark(TraceStage::RATE_LIMITED);
+        {
+            ScopedTraceContext b(&inner);
+            CHECK(current_trace() == &inner);
+            trace_mark(TraceStage::PARSED);
+        }
+        CHECK(current_trace() == &outer);
+    }
+    CHECK(current_trace() == nullptr);
+    CHECK(outer.reached(TraceStage::RATE_LIMITED) && !outer.reached(TraceStage::PARSED));
+    CHECK(inner.reached(TraceStage::PARSED) && !inner.reached(TraceStage::RATE_LIMITED));
+
+    // Other threads have their own
+    std::thread other([] { CHECK(current_trace() == nullptr); });
+    ScopedTraceContext c(&outer);
+    other.join();
+}
+
+static void test_rings_and_slow_log() {
+    Tracer::Options options;
+    options.recent_per_thread = 4;
+    options.slow_capacity = 3;
+    options.slow_threshold = std::chrono::microseconds(500);
+    options.slow_sample_every = 2;
+    Tracer tracer(options);
+
+    // Fast (10 us per stage, 100 us total) on this thread; the ring keeps 4
+    for (uint64_t id = 1; id <= 6; ++id) {
+        tracer.finish(make_trace(id, 10));
+    }
+    std::vector<RequestTrace> recent = tracer.recent(100);
+    CHECK(recent.size() == 4);
+    CHECK(recent.front().id == 6 && recent.back().id == 3);
+    CHECK(tracer.recent(2).size() == 2);
+    CHECK(tracer.slow(10).empty());
+
+    // Slow ones (100 us per stage, 1 ms total) from two more threads:
+    // every second one counted across threads is sampled, the log keeps
+    // the newest 3
+    std::thread a([&] { for (uint64_t id = 100; id < 105; ++id) tracer.finish(make_trace(id, 100)); });
+    a.join();
+    std::thread b([&] { for (uint64_t id = 200; id < 205; ++id) tracer.finish(make_trace(id, 100)); });
+    b.join();
+    CHECK(tracer.traces_finished() == 16);
+    CHECK(tracer.slow_requests() == 10);
+    std::vector<RequestTrace> slow = tracer.slow(10);
+    CHECK(slow.size() == 3);
+    CHECK(slow[0].id == 203 && slow[1].id == 201 && slow[2].id == 104);
+
+    recent = tracer.recent(100);
+    CHECK(recent.size() == 12);   // 4 per thread
+    CHECK(recent.front().id == 204);
+
+    // A second tracer on the same thread has its own rings
+    Tracer other;
+    other.finish(make_trace(1, 1));
+    CHECK(other.recent(10).size() == 1);
+    CHECK(tracer.recent(100).size() == 12);
+}
+
+static void test_json() {
+    RequestTrace trace = make_trace(7, 12);
+    trace.at_ns[static_cast<size_t>(TraceStage::WAL_APPENDED)] = 0;   // Not reached
+    trace.metrics = 3;
+    std::string json;
+    append_trace_json(json, trace);
+    CHECK(contains(json, "{\"id\":7,\"method\":\"POST\",\"path\":\"/metrics\",\"status\":200,\"metrics\":3"));
+    CHECK(contains(json, "\"total_us\":120.0"));
+    CHECK(contains(json, "\"stages_us\":{\"headers\":12.0,\"body\":24.0,"));
+    CHECK(!contains(json, "wal_appended"));
+    CHECK(!contains(json, "\"received\""));
+    CHECK(contains(json, "\"responded\":120.0}}"));
+
+    RequestTrace odd;
+    odd.set_route("GET", "/a\"b");
+    json.clear();
+    append_trace_json(json, odd);
+    CHECK(contains(json, "\"path\":\"/a\\\"b\""));
+    CHECK(contains(json, "\"total_us\":0.0,\"stages_us\":{}"));
+}
+
+int main() {
+    test_request_trace();
+    test_context();
+    test_rings_and_slow_log();
+    test_json();
+
+    return test_result("trace_test");
+}
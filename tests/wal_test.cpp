@@ -0,0 +1,280 @@
+#include "wal.h"
+#include "test_check.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using metricstream::Metric;
+using metricstream::MetricBatch;
+using metricstream::MetricType;
+using metricstream::WriteAheadLog;
+
+static std::string temp_dir(const char* name) {
+    return "/tmp/metricstream_" + std::string(name) + "_" + std::to_string(getpid());
+}
+
+static std::vector<std::string> wal_files(const std::string& dir) {
+    std::vector<std::string> names;
+    if (DIR* d = opendir(dir.c_str())) {
+        while (dirent* entry = readdir(d)) {
+            std::string name = entry->d_name;
+            if (name.rfind("wal-", 0) == 0) names.push_back(dir + "/" + name);
+        }
+        closedir(d);
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+static void remove_dir(const std::string& dir) {
+    for (const auto& path : wal_files(dir)) {
+        unlink(path.c_str());
+    }
+    unlink((dir + "/checkpoint").c_str());
+    rmdir(dir.c_str());
+}
+
+static WriteAheadLog::Options test_options(const std::string& dir) {
+    WriteAheadLog::Options options;
+    options.directory = dir;
+    options.group_commit_delay = std::chrono::microseconds(500);
+    return options;
+}
+
+static MetricBatch batch_of(const std::string& name, double value) {
+    MetricBatch batch;
+    batch.source_id = "client-a";
+    batch.add_metric(Metric(name, value, MetricType::GAUGE, {{"host", "web1"}}));
+    return batch;
+}
+
+// Sum of the first metric's value over every replayed batch
+static double replay_sum(const std::string& dir, WriteAheadLog::ReplayStats* stats = nullptr) {
+    WriteAheadLog wal(test_options(dir));
+    double sum = 0;
+    wal.open([&](const MetricBatch& batch) { sum += batch.metrics[0].value; }, stats);
+    return sum;
+}
+
+static void test_encode_roundtrip() {
+    MetricBatch batch = batch_of("cpu.usage", 42.5);
+    batch.add_metric(Metric("requests", 7, MetricType::COUNTER, {{"a", "1"}, {"b", "2"}}));
+
+    std::string payload;
+    metricstream::encode_wal_batch(payload, 17, batch);
+    uint64_t lsn = 0;
+    MetricBatch decoded;
+    CHECK(metricstream::decode_wal_batch(payload, lsn, decoded));
+    CHECK(lsn == 17);
+    CHECK(decoded.source_id == "client-a");
+    CHECK(decoded.received_at == batch.received_at);
+    CHECK(decoded.size() == 2);
+    CHECK(decoded.metrics[1].name() == "requests");
+    CHECK(decoded.metrics[1].type == MetricType::COUNTER);
+    CHECK(decoded.metrics[1].value == 7);
+    CHECK(*decoded.metrics[1].series().tag("b") == "2");
+    CHECK(decoded.metrics[1].series_id == batch.metrics[1].series_id);
+    CHECK(decoded.metrics[0].timestamp == batch.metrics[0].timestamp);
+
+    MetricBatch truncated;
+    CHECK(!metricstream::decode_wal_batch(std::string_view(payload).substr(0, payload.size() - 1),
+                                          lsn, truncated));
+}
+
+static void test_durable_and_replay() {
+    std::string dir = temp_dir("wal_replay");
+    remove_dir(dir);
+    {
+        WriteAheadLog wal(test_options(dir));
+        WriteAheadLog::ReplayStats stats;
+        CHECK(wal.open([](const MetricBatch&) {}, &stats));
+        CHECK(stats.batches == 0);
+
+        uint64_t first = wal.append(batch_of("cpu", 1));
+        uint64_t second = wal.append(batch_of("cpu", 2));
+        uint64_t refused = wal.append(batch_of("cpu", 100));
+        CHECK(first == 1 && second == 2 && refused == 3);
+        wal.cancel(refused);
+        CHECK(wal.wait_durable(second));
+        CHECK(wal.durable_lsn() >= second);
+        CHECK(wal.records_written() == 3);
+        CHECK(wal.group_commits() >= 1);
+        // Nothing applied yet: the watermark stays below the first batch
+        CHECK(wal.applied_through() == 0);
+    }
+    // No checkpoint: both accepted batches come back, the cancelled one not
+    WriteAheadLog::ReplayStats stats;
+    CHECK(replay_sum(dir, &stats) == 3);
+    CHECK(stats.batches == 2);
+    CHECK(stats.cancelled == 1);
+    CHECK(stats.corrupt_records == 0);
+    remove_dir(dir);
+}
+
+static void test_checkpoint() {
+    std::string dir = temp_dir("wal_checkpoint");
+    remove_dir(dir);
+    {
+        WriteAheadLog wal(test_options(dir));
+        CHECK(wal.open([](const MetricBatch&) {}));
+        uint64_t a = wal.append(batch_of("cpu", 1));
+        uint64_t b = wal.append(batch_of("cpu", 2));
+        uint64_t c = wal.append(batch_of("cpu", 4));
+        CHECK(wal.wait_durable(c));
+
+        // Applied out of order: the watermark waits for the gap
+        uint64_t later[] = {b};
+        wal.mark_applied(later, 1);
+        CHECK(wal.applied_through() == a - 1);
+        uint64_t earlier[] = {a};
+        wal.mark_applied(earlier, 1);
+        CHECK(wal.applied_through() == b);
+        CHECK(wal.checkpoint(wal.applied_through()));
+    }
+    CHECK(replay_sum(dir) == 4);   // Only the batch after the checkpoint
+
+    // Replay opened a new file each time; a checkpoint past everything
+    // deletes all but the newest
+    CHECK(wal_files(dir).size() >= 2);
+    {
+        WriteAheadLog wal(test_options(dir));
+        CHECK(wal.open([](const MetricBatch&) {}));
+        CHECK(wal.checkpoint(wal.applied_through()));
+    }
+    CHECK(wal_files(dir).size() == 1);
+    CHECK(replay_sum(dir) == 0);
+    remove_dir(dir);
+}
+
+static void test_torn_tail() {
+    std::string dir = temp_dir("wal_torn");
+    remove_dir(dir);
+    {
+        WriteAheadLog wal(test_options(dir));
+        CHECK(wal.open([](const MetricBatch&) {}));
+        wal.append(batch_of("cpu", 1));
+        CHECK(wal.wait_durable(wal.append(batch_of("cpu", 2))));
+    }
+    // Chop the last record in half, as a crash mid-write would
+    std::string path = wal_files(dir).back();
+    int fd = open(path.c_str(), O_RDWR);
+    off_t size = lseek(fd, 0, SEEK_END);
+    CHECK(ftruncate(fd, size - 10) == 0);
+    close(fd);
+
+    WriteAheadLog::ReplayStats stats;
+    CHECK(replay_sum(dir, &stats) == 1);
+    CHECK(stats.corrupt_records == 1);
+
+    // Later appends land in a new file, after the torn one
+    {
+        WriteAheadLog wal(test_options(dir));
+        CHECK(wal.open([](const MetricBatch&) {}));
+        CHECK(wal.wait_durable(wal.append(batch_of("cpu", 8))));
+    }
+    CHECK(replay_sum(dir) == 9);
+    remove_dir(dir);
+}
+
+static void test_group_commit() {
+    std::string dir = temp_dir("wal_group");
+    remove_dir(dir);
+    WriteAheadLog::Options options = test_options(dir);
+    options.group_commit_delay = std::chrono::microseconds(2000);
+    {
+        WriteAheadLog wal(options);
+        CHECK(wal.open([](const MetricBatch&) {}));
+
+        constexpr int THREADS = 8;
+        constexpr int PER_THREAD = 50;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < THREADS; ++t) {
+            threads.emplace_back([&] {
+                for (int i = 0; i < PER_THREAD; ++i) {
+                    CHECK(wal.wait_durable(wal.append(batch_of("cpu", 1))));
+                }
+            });
+        }
+        for (auto& thread : threads) thread.join();
+
+        CHECK(wal.records_written() == THREADS * PER_THREAD);
+        // Concurrent acks share fsyncs
+        CHECK(wal.group_commits() < wal.records_written());
+    }
+    CHECK(replay_sum(dir) == 400);
+    remove_dir(dir);
+}
+
+static void test_consumers_and_retention() {
+    std::string dir = temp_dir("wal_consumers");
+    remove_dir(dir);
+    WriteAheadLog::Options options = test_options(dir);
+    options.max_file_bytes = 1;   // A file per group commit
+    uint64_t a = 0;
+    uint64_t b = 0;
+    uint64_t c = 0;
+    {
+        WriteAheadLog wal(options);
+        size_t rollups = wal.add_consumer();
+        CHECK(rollups == 1);
+        CHECK(wal.open([](const MetricBatch&) {}));
+        a = wal.append(batch_of("cpu", 1));
+        CHECK(wal.wait_durable(a));
+        b = wal.append(batch_of("cpu", 2));
+        CHECK(wal.wait_durable(b));
+        c = wal.append(batch_of("cpu", 4));
+        CHECK(wal.wait_durable(c));
+
+        // Each consumer has its own watermark
+        uint64_t applied[] = {a, b, c};
+        wal.mark_applied(applied, 3);
+        wal.mark_applied(rollups, &b, 1);
+        CHECK(wal.applied_through() == c);
+        CHECK(wal.applied_through(rollups) == a - 1);
+        uint64_t last = 0;
+        std::vector<uint64_t> outstanding;
+        wal.consumer_snapshot(rollups, last, outstanding);
+        CHECK(last == c);
+        CHECK((outstanding == std::vector<uint64_t>{a, c}));
+        wal.cancel(c);
+        CHECK(wal.applied_through() == c);
+        wal.consumer_snapshot(rollups, last, outstanding);
+        CHECK((outstanding == std::vector<uint64_t>{a}));
+
+        // Storage is done with all of it, the other consumer is not
+        wal.retain_from(a);
+        CHECK(wal.checkpoint(c));
+        CHECK(wal.checkpoint_lsn() == c);
+    }
+    CHECK(wal_files(dir).size() >= 3);
+
+    // Plain replay starts after the checkpoint; replay from an earlier lsn
+    // visits the retained batches, each with its lsn
+    CHECK(replay_sum(dir) == 0);
+    std::vector<uint64_t> seen;
+    {
+        WriteAheadLog wal(options);
+        CHECK(wal.open([&](const MetricBatch& batch) { seen.push_back(batch.wal_lsn); }, a));
+        CHECK(wal.checkpoint_lsn() == c);
+        CHECK(wal.checkpoint(wal.applied_through()));   // Retention is per process: nothing held
+    }
+    CHECK((seen == std::vector<uint64_t>{a, b}));   // c was cancelled
+    CHECK(wal_files(dir).size() == 1);
+    remove_dir(dir);
+}
+
+int main() {
+    test_encode_roundtrip();
+    test_durable_and_replay();
+    test_checkpoint();
+    test_torn_tail();
+    test_group_commit();
+    test_consumers_and_retention();
+
+    return test_result("wal_test");
+}